@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+#
+# Compares the BENCH lines of two benchmark runs (serial monitor logs).
+#
+#   python compare_bench.py base.log new.log [--threshold 10]
+#
+# Metrics ending in _us or _ms are better when lower, per_s and the free
+# heap figures when higher. max_us is shown but never fails the comparison.
+# Exits with 1 if any metric got worse by more than the threshold (percent),
+# so CI can fail the build.
+
+from __future__ import print_function
+
+import argparse
+import json
+import sys
+
+LOWER_IS_BETTER = ('_us', '_ms', 'heap_used')
+HIGHER_IS_BETTER = ('per_s', 'free', 'min_free', 'largest_block', 'stack_hwm')
+IGNORED = ('bench', 'cards', 'n', 'bytes')
+NOISY = ('max_us',)  # Printed, but a single slow sample is not a regression
+
+
+def load(path):
+    results = {}
+    with open(path, errors='replace') as f:
+        for line in f:
+            start = line.find('BENCH {')
+            if start < 0:
+                continue
+            try:
+                entry = json.loads(line[start + len('BENCH '):])
+            except ValueError:
+                continue
+            if entry.get('bench') == 'meta':
+                continue
+            results[(entry['bench'], entry.get('cards', 0))] = entry
+    return results
+
+
+def direction(metric):
+    if metric.endswith(LOWER_IS_BETTER):
+        return -1
+    if metric.endswith(HIGHER_IS_BETTER):
+        return 1
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare the BENCH results of two benchmark logs')
+    parser.add_argument('base')
+    parser.add_argument('new')
+    parser.add_argument('--threshold', type=float, default=10.0, help='allowed regression in percent')
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+    regressions = 0
+
+    print('{:<18} {:>6} {:<14} {:>12} {:>12} {:>8}'.format('bench', 'cards', 'metric', 'base', 'new', 'change'))
+    for key in sorted(new):
+        if key not in base:
+            continue
+        for metric, value in sorted(new[key].items()):
+            old = base[key].get(metric)
+            sign = direction(metric)
+            if metric in IGNORED or sign == 0 or not isinstance(value, (int, float)) or not old:
+                continue
+            change = (value - old) * 100.0 / old
+            worse = -change * sign > args.threshold and metric not in NOISY
+            regressions += worse
+            print('{:<18} {:>6} {:<14} {:>12.3f} {:>12.3f} {:>7.1f}%{}'.format(
+                key[0], key[1], metric, old, value, change, '  <-- regression' if worse else ''))
+
+    missing = sorted(set(base) - set(new))
+    for key in missing:
+        print('missing in new run: {} cards={}'.format(*key))
+
+    if regressions or missing:
+        print('{} regression(s) above {}%, {} missing result(s)'.format(regressions, args.threshold, len(missing)))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
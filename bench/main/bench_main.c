@@ -0,0 +1,285 @@
+/* RFID Manager benchmarks
+ *
+ * Measures the card database and storage paths at a few card counts and
+ * prints one machine-readable line per result:
+ *
+ *   BENCH {"bench":"check_card_hit","cards":200,"n":2000,"p50_us":1.25,...}
+ *
+ * Short operations are timed with the CPU cycle counter, flash bound ones
+ * with esp_timer. compare_bench.py diffs the BENCH lines of two runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_heap_caps.h"
+#include "esp_app_desc.h"
+#include "esp_idf_version.h"
+#include "spi_ffs_storage.h"
+#include "rfid_manager.h"
+
+static const char *TAG = "RFID_BENCH";
+
+#define BENCH_LOOKUPS      2000       // check_card calls per percentile run
+#define BENCH_CARD_ID_BASE 0xBE000000 // Benchmark cards, away from the default cards
+#define BENCH_MISS_ID_BASE 0xDE000000 // Never added
+#define BENCH_NUM_LEVELS   3
+
+static uint32_t s_samples[BENCH_LOOKUPS];
+static uint32_t s_cycles_per_us;
+static uint32_t s_lcg_state;
+
+// Live bench cards are bench_card_id(s_first_live) .. bench_card_id(s_next_card - 1).
+// Removed ids stay indexed and can not be added again, so removals take the
+// oldest cards and additions always use new ids.
+static uint32_t s_first_live;
+static uint32_t s_next_card;
+
+/**
+ * @brief Deterministic pseudo random numbers, so every run does the same lookups
+ */
+static uint32_t bench_rand(void)
+{
+    s_lcg_state = s_lcg_state * 1664525u + 1013904223u;
+    return s_lcg_state;
+}
+
+static uint32_t bench_card_id(uint32_t i)
+{
+    return BENCH_CARD_ID_BASE + i * 7u + 1u;
+}
+
+static double bench_cycles_to_us(uint32_t cycles)
+{
+    return (double)cycles / s_cycles_per_us;
+}
+
+static double bench_elapsed_ms(int64_t start_us)
+{
+    return (double)(esp_timer_get_time() - start_us) / 1000.0;
+}
+
+static int bench_compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Sorts s_samples[0..n) and prints their percentiles
+ */
+static void bench_report_percentiles(const char *bench, uint16_t cards, uint32_t n)
+{
+    qsort(s_samples, n, sizeof(s_samples[0]), bench_compare_u32);
+    printf("BENCH {\"bench\":\"%s\",\"cards\":%u,\"n\":%" PRIu32 ",\"p50_us\":%.3f,\"p90_us\":%.3f,"
+           "\"p99_us\":%.3f,\"max_us\":%.3f}\n",
+           bench, cards, n,
+           bench_cycles_to_us(s_samples[n / 2]),
+           bench_cycles_to_us(s_samples[(n * 90) / 100]),
+           bench_cycles_to_us(s_samples[(n * 99) / 100]),
+           bench_cycles_to_us(s_samples[n - 1]));
+}
+
+/**
+ * @brief Adds n new bench cards
+ * @return true if all were added
+ */
+static bool bench_add_cards(uint32_t n)
+{
+    char name[RFID_CARD_NAME_LEN];
+    for (uint32_t i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "Bench %" PRIu32, s_next_card);
+        if (rfid_manager_add_card(bench_card_id(s_next_card), name) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to add bench card %" PRIu32, s_next_card);
+            return false;
+        }
+        s_next_card++;
+    }
+    return true;
+}
+
+/**
+ * @brief Removes the n oldest bench cards
+ */
+static void bench_remove_cards(uint32_t n)
+{
+    for (uint32_t i = 0; i < n && s_first_live < s_next_card; i++) {
+        rfid_manager_remove_card(bench_card_id(s_first_live++));
+    }
+}
+
+/**
+ * @brief Times rfid_manager_check_card() for cards that are, or are not, in the database
+ */
+static void bench_check_card(uint16_t cards)
+{
+    uint32_t live = s_next_card - s_first_live;
+    s_lcg_state = 12345;
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint32_t id = bench_card_id(s_first_live + bench_rand() % live);
+        uint32_t start = esp_cpu_get_cycle_count();
+        bool found = rfid_manager_check_card(id);
+        s_samples[i] = esp_cpu_get_cycle_count() - start;
+        if (!found) {
+            ESP_LOGE(TAG, "Card 0x%08" PRIx32 " missing", id);
+        }
+    }
+    bench_report_percentiles("check_card_hit", cards, BENCH_LOOKUPS);
+
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint32_t id = BENCH_MISS_ID_BASE + (bench_rand() & 0xFFFFF);
+        uint32_t start = esp_cpu_get_cycle_count();
+        rfid_manager_check_card(id);
+        s_samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    bench_report_percentiles("check_card_miss", cards, BENCH_LOOKUPS);
+
+    // The checks above staged access log records, write them outside the timed sections
+    rfid_access_log_flush();
+}
+
+/**
+ * @brief Times rfid_manager_get_card_list_json() over the whole database
+ */
+static void bench_json(uint16_t cards)
+{
+    size_t len = (size_t)cards * 96 + 64;
+    char *buffer = malloc(len);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "No memory for a %u byte JSON buffer", (unsigned)len);
+        return;
+    }
+
+    const uint32_t runs = 20;
+    for (uint32_t i = 0; i < runs; i++) {
+        uint32_t start = esp_cpu_get_cycle_count();
+        if (rfid_manager_get_card_list_json(buffer, len) != ESP_OK) {
+            ESP_LOGE(TAG, "Card list JSON does not fit in %u bytes", (unsigned)len);
+            free(buffer);
+            return;
+        }
+        s_samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    size_t out_len = strlen(buffer);
+    free(buffer);
+
+    qsort(s_samples, runs, sizeof(s_samples[0]), bench_compare_u32);
+    printf("BENCH {\"bench\":\"card_list_json\",\"cards\":%u,\"n\":%" PRIu32 ",\"p50_us\":%.3f,"
+           "\"max_us\":%.3f,\"bytes\":%u}\n",
+           cards, runs, bench_cycles_to_us(s_samples[runs / 2]), bench_cycles_to_us(s_samples[runs - 1]),
+           (unsigned)out_len);
+}
+
+/**
+ * @brief Fills the database up to target cards and runs every benchmark at that size
+ *
+ * @param target Total card count for this level
+ */
+static void bench_level(uint16_t target)
+{
+    uint16_t before = rfid_manager_get_card_count();
+    if (target <= before) {
+        return;
+    }
+    uint16_t to_add = target - before;
+
+    // Adds only touch RAM while the cache timer is far away
+    int64_t start = esp_timer_get_time();
+    if (!bench_add_cards(to_add)) {
+        return;
+    }
+    double add_ms = bench_elapsed_ms(start);
+    printf("BENCH {\"bench\":\"add_card\",\"cards\":%u,\"n\":%u,\"total_ms\":%.3f,\"per_s\":%.1f}\n",
+           target, to_add, add_ms, add_ms > 0 ? to_add * 1000.0 / add_ms : 0.0);
+
+    start = esp_timer_get_time();
+    rfid_manager_flush_cache();
+    printf("BENCH {\"bench\":\"save_batch\",\"cards\":%u,\"n\":%u,\"total_ms\":%.3f}\n",
+           target, to_add, bench_elapsed_ms(start));
+
+    // One card replaced, the common case once the database is set up
+    bench_remove_cards(1);
+    bench_add_cards(1);
+    start = esp_timer_get_time();
+    rfid_manager_flush_cache();
+    printf("BENCH {\"bench\":\"save_one\",\"cards\":%u,\"total_ms\":%.3f}\n", target, bench_elapsed_ms(start));
+
+    // Deinit writes nothing here (cache flushed), init reads the card file and journal
+    rfid_manager_deinit();
+    start = esp_timer_get_time();
+    esp_err_t ret = rfid_manager_init();
+    printf("BENCH {\"bench\":\"load\",\"cards\":%u,\"total_ms\":%.3f}\n", target, bench_elapsed_ms(start));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Reload failed: %s", esp_err_to_name(ret));
+        return;
+    }
+    rfid_manager_set_cache_timeout(60 * 1000);
+
+    bench_check_card(target);
+    bench_json(target);
+
+    // Replace half of the bench cards, restoring the level
+    uint32_t to_remove = (s_next_card - s_first_live) / 2;
+    start = esp_timer_get_time();
+    bench_remove_cards(to_remove);
+    double remove_ms = bench_elapsed_ms(start);
+    printf("BENCH {\"bench\":\"remove_card\",\"cards\":%u,\"n\":%" PRIu32 ",\"total_ms\":%.3f,\"per_s\":%.1f}\n",
+           target, to_remove, remove_ms, remove_ms > 0 ? to_remove * 1000.0 / remove_ms : 0.0);
+    bench_add_cards(to_remove);
+    rfid_manager_flush_cache();
+
+    printf("BENCH {\"bench\":\"heap\",\"cards\":%u,\"free\":%u,\"min_free\":%u,\"largest_block\":%u,"
+           "\"stack_hwm\":%u}\n",
+           target, (unsigned)heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT),
+           (unsigned)uxTaskGetStackHighWaterMark(NULL));
+
+    vTaskDelay(pdMS_TO_TICKS(10)); // Let the idle task run between levels
+}
+
+void app_main(void)
+{
+    s_cycles_per_us = esp_rom_get_cpu_ticks_per_us();
+    printf("BENCH {\"bench\":\"meta\",\"version\":\"%s\",\"idf\":\"%s\",\"cpu_mhz\":%" PRIu32 ",\"max_cards\":%u}\n",
+           esp_app_get_description()->version, esp_get_idf_version(), s_cycles_per_us, RFID_MAX_CARDS);
+
+    spiffs_storage_init();
+
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    int64_t start = esp_timer_get_time();
+    if (rfid_manager_init() != ESP_OK) {
+        ESP_LOGE(TAG, "rfid_manager_init() failed, aborting");
+        return;
+    }
+    printf("BENCH {\"bench\":\"init\",\"cards\":%u,\"total_ms\":%.3f,\"heap_used\":%d}\n",
+           rfid_manager_get_card_count(), bench_elapsed_ms(start),
+           (int)(heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT)));
+
+    start = esp_timer_get_time();
+    rfid_manager_format_database();
+    printf("BENCH {\"bench\":\"format\",\"cards\":%u,\"total_ms\":%.3f}\n",
+           rfid_manager_get_card_count(), bench_elapsed_ms(start));
+    rfid_manager_set_cache_timeout(60 * 1000);
+
+    const uint16_t levels[BENCH_NUM_LEVELS] = {
+        RFID_MAX_CARDS / 4, RFID_MAX_CARDS / 2, RFID_MAX_CARDS
+    };
+    for (int i = 0; i < BENCH_NUM_LEVELS; i++) {
+        bench_level(levels[i]);
+    }
+
+    // Leave the device with the default cards only
+    rfid_manager_format_database();
+    rfid_manager_set_cache_timeout(RFID_DEFAULT_CACHE_TIMEOUT_MS);
+    rfid_manager_deinit();
+    printf("BENCH_DONE\n");
+}
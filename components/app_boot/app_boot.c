@@ -0,0 +1,135 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_boot.h"
+
+static const char *TAG = "app_boot";
+
+static EventGroupHandle_t s_ready_group = NULL;
+static SemaphoreHandle_t s_stage_lock = NULL; // s_stages, s_num_stages, s_ready_ms
+static app_boot_stage_t s_stages[APP_BOOT_MAX_STAGES];
+static uint16_t s_num_stages = 0;
+static uint32_t s_ready_ms = 0;
+
+/**
+ * @brief Logs every recorded stage and the total boot time
+ */
+static void app_boot_log_report(void)
+{
+    app_boot_stage_t stages[APP_BOOT_MAX_STAGES];
+    uint16_t n = app_boot_get_stages(stages, APP_BOOT_MAX_STAGES);
+
+    ESP_LOGI(TAG, "Boot stages (ms since reset):");
+    for (uint16_t i = 0; i < n; i++) {
+        ESP_LOGI(TAG, "  %-14s start %6lu  took %6lu", stages[i].name,
+                 (unsigned long)stages[i].start_ms, (unsigned long)stages[i].duration_ms);
+    }
+    ESP_LOGI(TAG, "Ready after %lu ms", (unsigned long)app_boot_get_ready_ms());
+}
+
+esp_err_t app_boot_init(void)
+{
+    if (s_ready_group != NULL) {
+        return ESP_OK;
+    }
+
+    s_stage_lock = xSemaphoreCreateMutex();
+    s_ready_group = xEventGroupCreate();
+    if (s_stage_lock == NULL || s_ready_group == NULL) {
+        ESP_LOGE(TAG, "Failed to create boot event group");
+        if (s_stage_lock != NULL) {
+            vSemaphoreDelete(s_stage_lock);
+            s_stage_lock = NULL;
+        }
+        if (s_ready_group != NULL) {
+            vEventGroupDelete(s_ready_group);
+            s_ready_group = NULL;
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void app_boot_set_ready(uint32_t bits)
+{
+    if (s_ready_group == NULL) {
+        return;
+    }
+
+    EventBits_t before = xEventGroupGetBits(s_ready_group);
+    EventBits_t after = xEventGroupSetBits(s_ready_group, bits);
+    if ((before & APP_BOOT_ALL_READY) != APP_BOOT_ALL_READY &&
+        (after & APP_BOOT_ALL_READY) == APP_BOOT_ALL_READY) {
+        xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+        s_ready_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        xSemaphoreGive(s_stage_lock);
+        app_boot_log_report();
+    }
+}
+
+bool app_boot_wait_ready(uint32_t bits, uint32_t timeout_ms)
+{
+    if (s_ready_group == NULL) {
+        return false;
+    }
+
+    EventBits_t set = xEventGroupWaitBits(s_ready_group, bits,
+                                          pdFALSE, // Keep the bits, readiness is permanent
+                                          pdTRUE,  // Every requested bit
+                                          pdMS_TO_TICKS(timeout_ms));
+    return (set & bits) == bits;
+}
+
+int64_t app_boot_stage_begin(void)
+{
+    return esp_timer_get_time();
+}
+
+void app_boot_stage_end(const char *name, int64_t begin)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t duration_ms = (uint32_t)((now - begin) / 1000);
+
+    ESP_LOGI(TAG, "Stage %s took %lu ms", name, (unsigned long)duration_ms);
+    if (s_stage_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+    if (s_num_stages < APP_BOOT_MAX_STAGES) {
+        s_stages[s_num_stages++] = (app_boot_stage_t){
+            .name = name,
+            .start_ms = (uint32_t)(begin / 1000),
+            .duration_ms = duration_ms,
+        };
+    }
+    xSemaphoreGive(s_stage_lock);
+}
+
+uint16_t app_boot_get_stages(app_boot_stage_t *stages, uint16_t max_stages)
+{
+    if (stages == NULL || s_stage_lock == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+    uint16_t n = s_num_stages < max_stages ? s_num_stages : max_stages;
+    memcpy(stages, s_stages, n * sizeof(app_boot_stage_t));
+    xSemaphoreGive(s_stage_lock);
+    return n;
+}
+
+uint32_t app_boot_get_ready_ms(void)
+{
+    if (s_stage_lock == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+    uint32_t ready_ms = s_ready_ms;
+    xSemaphoreGive(s_stage_lock);
+    return ready_ms;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Startup runs in stages on more than one task: NVS first, then the SPIFFS
+ * mount and card database load on a storage task while WiFi associates and
+ * the HTTP server starts on the main task. Each part sets its readiness bit
+ * when it is done; code that depends on one waits for it instead of relying
+ * on the order of calls in app_main().
+ */
+#define APP_BOOT_STORAGE_READY (1u << 0) // SPIFFS mount and rfid_manager_init() finished
+#define APP_BOOT_NETWORK_READY (1u << 1) // WiFi, HTTP server, time sync and OTA client started
+#define APP_BOOT_ALL_READY     (APP_BOOT_STORAGE_READY | APP_BOOT_NETWORK_READY)
+
+#define APP_BOOT_MAX_STAGES 12
+
+// Timing of one boot stage, in milliseconds since reset
+typedef struct {
+    const char *name; // Stage name, a string literal
+    uint32_t start_ms;
+    uint32_t duration_ms;
+} app_boot_stage_t;
+
+/**
+ * @brief Create the readiness event group, call first in app_main()
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the event group could not be created
+ */
+esp_err_t app_boot_init(void);
+
+/**
+ * @brief Mark parts of the system as ready
+ *
+ * The stage report is logged once every APP_BOOT_ALL_READY bit is set.
+ *
+ * @param bits APP_BOOT_*_READY bits to set
+ */
+void app_boot_set_ready(uint32_t bits);
+
+/**
+ * @brief Wait until parts of the system are ready
+ * @param bits APP_BOOT_*_READY bits that must all be set
+ * @param timeout_ms Maximum time to wait, 0 to only check
+ * @return true if all bits are set, false on timeout or before app_boot_init()
+ */
+bool app_boot_wait_ready(uint32_t bits, uint32_t timeout_ms);
+
+/**
+ * @brief Start timing a boot stage
+ * @return Opaque start time to pass to app_boot_stage_end()
+ */
+int64_t app_boot_stage_begin(void);
+
+/**
+ * @brief Record the duration of a boot stage, safe to call from any task
+ * @param name Stage name, must be a string literal
+ * @param begin Value returned by app_boot_stage_begin()
+ */
+void app_boot_stage_end(const char *name, int64_t begin);
+
+/**
+ * @brief Copy the recorded boot stages
+ * @param stages Array receiving up to max_stages entries, in completion order
+ * @param max_stages Capacity of stages
+ * @return Number of entries copied
+ */
+uint16_t app_boot_get_stages(app_boot_stage_t *stages, uint16_t max_stages);
+
+/**
+ * @brief Milliseconds from reset until every APP_BOOT_ALL_READY bit was set
+ * @return Boot time in ms, 0 while booting
+ */
+uint32_t app_boot_get_ready_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
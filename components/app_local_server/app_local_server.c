@@ -4,15 +4,19 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <sys/param.h>
+#include "lwip/sockets.h"
 #include "esp_http_server.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_mac.h"
 #include "esp_timer.h"
 #include "esp_ota_ops.h"
+#include "esp_heap_caps.h"
 #include <cJSON.h>
 #include "time.h"
 #include "app_local_server.h"
@@ -26,45 +30,105 @@
 #include "rfid_manager.h"
 #include "../app_time_sync/include/app_time_sync.h"
 #include "freertos/timers.h"
+#include "freertos/semphr.h"
 #include "aws_iot.h"
+#include "aws_iot_telemetry.h"
+#include "app_boot.h"
+#include "app_metrics.h"
+#include "app_ota.h"
+#include "http_arena.h"
+#include "web_assets.h" // Generated at build time, see CMakeLists.txt
 
 // DEFINES
-#define HTTP_SERVER_MAX_URI_HANDLERS (20u)
-#define HTTP_SERVER_RECEIVE_WAIT_TIMEOUT (10u) // in seconds
-#define HTTP_SERVER_SEND_WAIT_TIMEOUT (10u)    // in seconds
 #define HTTP_SERVER_MONITOR_QUEUE_LEN (3u)
 
+// Server tuning, see "HTTP Server Configuration" in this component's Kconfig
+#ifndef CONFIG_HTTP_SERVER_MAX_OPEN_SOCKETS
+#define CONFIG_HTTP_SERVER_MAX_OPEN_SOCKETS 7
+#endif
+#ifndef CONFIG_HTTP_SERVER_BACKLOG
+#define CONFIG_HTTP_SERVER_BACKLOG 5
+#endif
+#ifndef CONFIG_HTTP_SERVER_TASK_PRIORITY
+#define CONFIG_HTTP_SERVER_TASK_PRIORITY 5
+#endif
+#ifndef CONFIG_HTTP_SERVER_TASK_CORE
+#define CONFIG_HTTP_SERVER_TASK_CORE -1
+#endif
+#ifndef CONFIG_HTTP_SERVER_STACK_SIZE
+#define CONFIG_HTTP_SERVER_STACK_SIZE 8192
+#endif
+#ifndef CONFIG_HTTP_SERVER_RECV_TIMEOUT
+#define CONFIG_HTTP_SERVER_RECV_TIMEOUT 5
+#endif
+#ifndef CONFIG_HTTP_SERVER_SEND_TIMEOUT
+#define CONFIG_HTTP_SERVER_SEND_TIMEOUT 5
+#endif
+#ifndef CONFIG_HTTP_SERVER_STORAGE_WAIT_MS
+#define CONFIG_HTTP_SERVER_STORAGE_WAIT_MS 3000
+#endif
+#ifndef CONFIG_HTTP_SERVER_UPLOAD_TIMEOUT
+#define CONFIG_HTTP_SERVER_UPLOAD_TIMEOUT 30
+#endif
+#ifndef CONFIG_HTTP_SERVER_OTA_BUFFER_SIZE
+#define CONFIG_HTTP_SERVER_OTA_BUFFER_SIZE 8192
+#endif
+
 #define OTA_UPDATE_PENDING (0)
 #define OTA_UPDATE_SUCCESSFUL (1)
 #define OTA_UPDATE_FAILED (-1)
 
-// Increased buffer size to handle more RFID cards in JSON format
-// Previous size (3*1024) was too small for systems with many cards
-#define HTTP_SERVER_BUFFER_SIZE (10 * 1024)
+// Largest /getData request and response, both in the request arena
+#define HTTP_SERVER_GET_DATA_REQ_SIZE (256u)
+#define HTTP_SERVER_GET_DATA_RSP_SIZE (4u * 1024u)
+
+// Cards fetched per batch while streaming the card list, and the longest JSON
+// object a single card can produce (name fully escaped)
+#define HTTP_SERVER_CARD_BATCH (8u)
+#define HTTP_SERVER_CARD_JSON_MAX (64u + RFID_CARD_NAME_LEN * 6u)
+
+// Binary card backup format used by /cards/Export and /cards/Import:
+// a 4 byte magic followed by fixed size little-endian records of
+// card_id (4), timestamp (4) and the NUL padded name (RFID_CARD_NAME_LEN).
+#define HTTP_SERVER_CARD_BIN_MAGIC "RFC1"
+#define HTTP_SERVER_CARD_BIN_MAGIC_LEN (4u)
+#define HTTP_SERVER_CARD_BIN_RECORD_LEN (8u + RFID_CARD_NAME_LEN)
+// Records received per httpd_req_recv() call of /cards/Import
+#define HTTP_SERVER_CARD_IMPORT_BATCH (32u)
+#define HTTP_SERVER_ACCESS_LOG_BATCH (16u)
+#define HTTP_SERVER_ACCESS_LOG_JSON_MAX (72u) // {"id":"0xFFFFFFFF","ts":4294967295,"ok":false,"rd":255}
+#define HTTP_SERVER_METRICS_CHUNK (1024u) // /api/metrics output is sent in chunks of up to this size
 
-static char http_server_buffer[HTTP_SERVER_BUFFER_SIZE] = {0};
 static const char *TAG = "app_local_server";
 // GLOBAL VARIABLES
-extern const char jquery_3_3_1_min_js_start[] asm("_binary_jquery_3_3_1_min_js_start");
-extern const char jquery_3_3_1_min_js_end[] asm("_binary_jquery_3_3_1_min_js_end");
-extern const char index_html_start[] asm("_binary_index_html_start");
-extern const char index_html_end[] asm("_binary_index_html_end");
-extern const char app_css_start[] asm("_binary_app_css_start");
-extern const char app_css_end[] asm("_binary_app_css_end");
-extern const char app_js_start[] asm("_binary_app_js_start");
-extern const char app_js_end[] asm("_binary_app_js_end");
-extern const char favicon_ico_start[] asm("_binary_favicon_ico_start");
-extern const char favicon_ico_end[] asm("_binary_favicon_ico_end");
-extern const char root_start[] asm("_binary_root_html_start");
-extern const char root_end[] asm("_binary_root_html_end");
-extern const char rfid_management_html_start[] asm("_binary_rfid_management_html_start");
-extern const char rfid_management_html_end[] asm("_binary_rfid_management_html_end");
-extern const char rfid_management_js_start[] asm("_binary_rfid_management_js_start");
-extern const char rfid_management_js_end[] asm("_binary_rfid_management_js_end");
+// Embedded web page, see web_assets.h
+#define WEB_ASSET_EXTERN(symbol, type, etag)                                    \
+    extern const char symbol##_gz_start[] asm("_binary_" #symbol "_gz_start"); \
+    extern const char symbol##_gz_end[] asm("_binary_" #symbol "_gz_end");
+WEB_ASSETS(WEB_ASSET_EXTERN)
+
+typedef struct
+{
+    const char *type;  // Content type of the uncompressed file
+    const char *start; // Bounds of the embedded .gz blob
+    const char *end;
+    const char *etag;  // Quoted strong ETag
+} http_server_asset_t;
+
+typedef struct
+{
+    const char *uri;
+    int8_t asset; // Index into http_server_assets, -1 for an empty slot
+} http_server_asset_route_t;
+
+#define WEB_ASSET_ENTRY(symbol, type, etag) {type, symbol##_gz_start, symbol##_gz_end, etag},
+static const http_server_asset_t http_server_assets[] = {WEB_ASSETS(WEB_ASSET_ENTRY)};
+static const http_server_asset_route_t http_server_asset_routes[WEB_ASSET_ROUTE_SLOTS] = WEB_ASSET_ROUTES;
 
 static httpd_handle_t http_server_handle = NULL;
 // Queue Handle used to manipulate the main queue of events
 static QueueHandle_t http_server_monitor_q_handle;
+static app_local_server_work_cb_t http_server_work_cb = NULL; // Told when a monitor message is queued
 // Firmware Update Status
 static int fw_update_status = OTA_UPDATE_PENDING;
 // Local Time Status
@@ -83,15 +147,11 @@ static http_server_wifi_connect_status_e g_wifi_connect_status = HTTP_WIFI_STATU
 
 // FUNCTION PROTOTYPES
 static BaseType_t http_server_monitor_send_msg(http_server_msg_e msg_id);
-static void http_server_monitor(void);
+static bool http_server_monitor(void);
 static void start_webserver(void);
 static void http_server_fw_update_reset_timer(void);
 
-static esp_err_t http_server_j_query_handler(httpd_req_t *req);
-static esp_err_t http_server_index_html_handler(httpd_req_t *req);
-static esp_err_t http_server_app_css_handler(httpd_req_t *req);
-static esp_err_t http_server_app_js_handler(httpd_req_t *req);
-static esp_err_t http_server_favicon_handler(httpd_req_t *req);
+static esp_err_t http_server_asset_handler(httpd_req_t *req);
 static esp_err_t http_server_ota_update_handler(httpd_req_t *req);
 static esp_err_t http_server_ota_status_handler(httpd_req_t *req);
 static esp_err_t http_server_ssid_handler(httpd_req_t *req);
@@ -103,10 +163,6 @@ static esp_err_t http_server_wifi_connect_info_handler(httpd_req_t *req);
 static esp_err_t http_server_wifi_disconnect_handler(httpd_req_t *req);
 static esp_err_t http_server_get_saved_station_ssid_handler(httpd_req_t *req);
 
-// RFID Management Webpage Handlers
-static esp_err_t http_server_rfid_management_html_handler(httpd_req_t *req);
-static esp_err_t http_server_rfid_management_js_handler(httpd_req_t *req);
-
 // RFID Management API Handlers
 static esp_err_t http_server_rfid_list_cards_handler(httpd_req_t *req);
 static esp_err_t http_server_rfid_add_card_handler(httpd_req_t *req);
@@ -114,10 +170,19 @@ static esp_err_t http_server_rfid_remove_card_handler(httpd_req_t *req);
 static esp_err_t http_server_rfid_get_card_count_handler(httpd_req_t *req);
 static esp_err_t http_server_rfid_check_card_handler(httpd_req_t *req);
 static esp_err_t http_server_rfid_reset_handler(httpd_req_t *req);
+static esp_err_t http_server_rfid_export_handler(httpd_req_t *req);
+static esp_err_t http_server_rfid_import_handler(httpd_req_t *req);
+static esp_err_t http_server_rfid_access_log_handler(httpd_req_t *req);
+static bool http_server_rfid_wait_ready(httpd_req_t *req);
 
 // AWS IoT API Handler
 static esp_err_t http_server_aws_iot_status_handler(httpd_req_t *req);
 
+// Metrics API Handlers
+static esp_err_t http_server_metrics_get_handler(httpd_req_t *req);
+static esp_err_t http_server_metrics_set_handler(httpd_req_t *req);
+static esp_err_t http_server_request_handler(httpd_req_t *req);
+
 static esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err);
 
 static esp_err_t http_server_get_data_handler(httpd_req_t *req);
@@ -128,26 +193,6 @@ void get_local_time_string(char *buffer, size_t len);
 void get_local_time_string_utc(char *buffer, size_t len);
 
 static const httpd_uri_t uri_handlers[] = {
-    {.uri = "/jquery-3.3.1.min.js",
-     .method = HTTP_GET,
-     .handler = http_server_j_query_handler,
-     .user_ctx = NULL},
-    {.uri = "/",
-     .method = HTTP_GET,
-     .handler = http_server_index_html_handler,
-     .user_ctx = NULL},
-    {.uri = "/app.css",
-     .method = HTTP_GET,
-     .handler = http_server_app_css_handler,
-     .user_ctx = NULL},
-    {.uri = "/app.js",
-     .method = HTTP_GET,
-     .handler = http_server_app_js_handler,
-     .user_ctx = NULL},
-    {.uri = "/favicon.ico",
-     .method = HTTP_GET,
-     .handler = http_server_favicon_handler,
-     .user_ctx = NULL},
     {.uri = "/OTAupdate",
      .method = HTTP_POST,
      .handler = http_server_ota_update_handler,
@@ -194,16 +239,6 @@ static const httpd_uri_t uri_handlers[] = {
         .method = HTTP_GET,
         .handler = http_server_get_saved_station_ssid_handler,
         .user_ctx = NULL},
-    // RFID Management Webpage
-    {
-        .uri = "/rfid_management.html",
-        .method = HTTP_GET,
-        .handler = http_server_rfid_management_html_handler,
-        .user_ctx = NULL},
-    {.uri = "/rfid_management.js",
-     .method = HTTP_GET,
-     .handler = http_server_rfid_management_js_handler,
-     .user_ctx = NULL},
     // RFID Endpoints
     {
         .uri = "/cards/Get",
@@ -230,17 +265,50 @@ static const httpd_uri_t uri_handlers[] = {
      .method = HTTP_POST,
      .handler = http_server_rfid_reset_handler,
      .user_ctx = NULL},
+    {.uri = "/cards/Export",
+     .method = HTTP_GET,
+     .handler = http_server_rfid_export_handler,
+     .user_ctx = NULL},
+    {.uri = "/cards/Import",
+     .method = HTTP_POST,
+     .handler = http_server_rfid_import_handler,
+     .user_ctx = NULL},
+    {.uri = "/cards/AccessLog",
+     .method = HTTP_GET,
+     .handler = http_server_rfid_access_log_handler,
+     .user_ctx = NULL},
      
     // AWS IoT Status Endpoint
     {.uri = "/awsIoTStatus",
      .method = HTTP_GET,
      .handler = http_server_aws_iot_status_handler,
+     .user_ctx = NULL},
+
+    // Metrics Endpoints
+    {.uri = "/api/metrics",
+     .method = HTTP_GET,
+     .handler = http_server_metrics_get_handler,
+     .user_ctx = NULL},
+    {.uri = "/api/metrics",
+     .method = HTTP_POST,
+     .handler = http_server_metrics_set_handler,
+     .user_ctx = NULL},
+
+    // Web page files, must stay last: httpd uses the first matching handler
+    {.uri = "/*",
+     .method = HTTP_GET,
+     .handler = http_server_asset_handler,
      .user_ctx = NULL}
 };
 
 // Calculate the number of URI handlers
 #define URI_HANDLERS_COUNT (sizeof(uri_handlers) / sizeof(uri_handlers[0]))
 
+#ifdef CONFIG_APP_METRICS_ENABLE
+// Request latency of each uri_handlers entry, registered in start_webserver()
+static app_metrics_histogram_t *http_server_uri_metrics[URI_HANDLERS_COUNT];
+#endif
+
 // FUNCTIONS
 bool app_local_server_init(void)
 {
@@ -261,9 +329,17 @@ bool app_local_server_start(void)
 bool app_local_server_process(void)
 {
     // Process the HTTP Server Monitor Task
-    http_server_monitor();
+    return http_server_monitor();
+}
 
-    return true;
+void app_local_server_set_work_callback(app_local_server_work_cb_t callback)
+{
+    http_server_work_cb = callback;
+}
+
+bool app_local_server_post_msg(http_server_msg_e msg_id)
+{
+    return http_server_monitor_send_msg(msg_id) == pdTRUE;
 }
 
 /*
@@ -285,20 +361,27 @@ static BaseType_t http_server_monitor_send_msg(http_server_msg_e msg_id)
 {
     http_server_q_msg_t msg;
     msg.msg_id = msg_id;
-    return xQueueSend(http_server_monitor_q_handle, &msg, portMAX_DELAY);
+    BaseType_t sent = xQueueSend(http_server_monitor_q_handle, &msg, portMAX_DELAY);
+    if (sent == pdTRUE && http_server_work_cb != NULL)
+    {
+        http_server_work_cb();
+    }
+    return sent;
 }
 
 /*
- * HTTP Server Monitor Task used to track events of the HTTP Server.
- * @param pvParameter parameters which can be passed to the task
- * @return http server instance handle if successful, NULL otherwise
+ * HTTP Server Monitor used to track events of the HTTP Server. Handles every
+ * queued message without waiting for new ones.
+ * @return true if at least one message was handled
  */
-static void http_server_monitor(void)
+static bool http_server_monitor(void)
 {
     http_server_q_msg_t msg;
+    bool handled = false;
 
-    if (xQueueReceive(http_server_monitor_q_handle, &msg, portMAX_DELAY))
+    while (xQueueReceive(http_server_monitor_q_handle, &msg, 0))
     {
+        handled = true;
         switch (msg.msg_id)
         {
         case HTTP_MSG_WIFI_CONNECT_INIT:
@@ -334,20 +417,46 @@ static void http_server_monitor(void)
             break;
         }
     }
+    return handled;
 }
 
 static void start_webserver(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.max_uri_handlers = URI_HANDLERS_COUNT;
-    config.max_open_sockets = 7;
+    config.uri_match_fn = httpd_uri_match_wildcard; // For the "/*" web page handler
+
+    // httpd keeps three sockets for itself
+    config.max_open_sockets = MIN(CONFIG_HTTP_SERVER_MAX_OPEN_SOCKETS, CONFIG_LWIP_MAX_SOCKETS - 3);
+    if (config.max_open_sockets < CONFIG_HTTP_SERVER_MAX_OPEN_SOCKETS)
+    {
+        ESP_LOGW(TAG, "Limiting open sockets to %u, raise LWIP_MAX_SOCKETS for more", config.max_open_sockets);
+    }
+    config.backlog_conn = CONFIG_HTTP_SERVER_BACKLOG;
+#ifdef CONFIG_HTTP_SERVER_LRU_PURGE
     config.lru_purge_enable = true;
-    
-    // Increase buffer size for handling larger files
-    config.recv_wait_timeout = 15;  // Increase timeout for receiving data
-    config.send_wait_timeout = 15;  // Increase timeout for sending data
-    config.stack_size = 8192;       // Increase stack size for the HTTP server task
-    
+#else
+    config.lru_purge_enable = false;
+#endif
+
+    config.task_priority = CONFIG_HTTP_SERVER_TASK_PRIORITY;
+    config.core_id = CONFIG_HTTP_SERVER_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_HTTP_SERVER_TASK_CORE;
+    config.stack_size = CONFIG_HTTP_SERVER_STACK_SIZE;
+
+    // Short timeouts for regular requests; upload endpoints raise theirs, see http_server_set_upload_timeout()
+    config.recv_wait_timeout = CONFIG_HTTP_SERVER_RECV_TIMEOUT;
+    config.send_wait_timeout = CONFIG_HTTP_SERVER_SEND_TIMEOUT;
+
+#ifdef CONFIG_HTTP_SERVER_KEEP_ALIVE
+    // Release the sockets of stations that left without closing the connection
+    config.keep_alive_enable = true;
+    config.keep_alive_idle = CONFIG_HTTP_SERVER_KEEP_ALIVE_IDLE;
+    config.keep_alive_interval = CONFIG_HTTP_SERVER_KEEP_ALIVE_INTERVAL;
+    config.keep_alive_count = CONFIG_HTTP_SERVER_KEEP_ALIVE_COUNT;
+#endif
+
+    http_arena_init();
+
     ESP_LOGI(TAG, "Starting on port: '%d'", config.server_port);
     if (httpd_start(&http_server_handle, &config) == ESP_OK)
     {
@@ -356,7 +465,15 @@ static void start_webserver(void)
         // Register all handlers from the global array
         for (int i = 0; i < URI_HANDLERS_COUNT; i++)
         {
-            if (httpd_register_uri_handler(http_server_handle, &uri_handlers[i]) != ESP_OK)
+            // Every request goes through http_server_request_handler(), which
+            // runs the table entry inside a request arena and times it
+            httpd_uri_t uri = uri_handlers[i];
+            uri.handler = http_server_request_handler;
+            uri.user_ctx = (void *)&uri_handlers[i];
+#ifdef CONFIG_APP_METRICS_ENABLE
+            http_server_uri_metrics[i] = app_metrics_histogram("http_request_us", "uri", uri_handlers[i].uri);
+#endif
+            if (httpd_register_uri_handler(http_server_handle, &uri) != ESP_OK)
             {
                 ESP_LOGE(TAG, "Failed to register handler for %s", uri_handlers[i].uri);
             }
@@ -389,303 +506,384 @@ static void http_server_fw_update_reset_timer(void)
 }
 
 /*
- * jQuery get handler requested when accessing the web page.
- * @param req HTTP request for which the uri needs to be handled
- * @return ESP_OK
+ * Looks up the embedded web page file served at a URI.
+ * @param uri Request URI, any query string is ignored
+ * @return the asset, or NULL if there is none for this URI
  */
-static esp_err_t http_server_j_query_handler(httpd_req_t *req)
+static const http_server_asset_t *http_server_find_asset(const char *uri)
 {
-    esp_err_t error;
-    ESP_LOGI(TAG, "JQuery Requested");
-    
-    // Set content type
-    httpd_resp_set_type(req, "application/javascript");
-    
-    // Disable caching for development
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "0");
-    
-    // Send the file with chunked encoding for large files
-    httpd_resp_set_hdr(req, "Transfer-Encoding", "chunked");
-    
-    // Calculate file size
-    size_t file_size = jquery_3_3_1_min_js_end - jquery_3_3_1_min_js_start;
-    const char* file_data = jquery_3_3_1_min_js_start;
-    
-    // Send in chunks of 4KB
-    const size_t chunk_size = 4096;
-    size_t bytes_sent = 0;
-    
-    while (bytes_sent < file_size) {
-        size_t current_chunk_size = (file_size - bytes_sent > chunk_size) ? 
-                                    chunk_size : (file_size - bytes_sent);
-        
-        error = httpd_resp_send_chunk(req, file_data + bytes_sent, current_chunk_size);
-        if (error != ESP_OK) {
-            ESP_LOGE(TAG, "http_server_j_query_handler: Error %d while sending chunk", error);
-            httpd_resp_sendstr_chunk(req, NULL); // End chunked response on error
-            return error;
-        }
-        
-        bytes_sent += current_chunk_size;
-        // Small delay to prevent overwhelming the socket buffer
-        vTaskDelay(5 / portTICK_PERIOD_MS);
+    // FNV-1a, must match the hash used by tools/compress_webpage.py
+    uint32_t hash = 0x811C9DC5u;
+    size_t uri_len = 0;
+    for (; uri[uri_len] != '\0' && uri[uri_len] != '?'; ++uri_len)
+    {
+        hash = (hash ^ (uint8_t)uri[uri_len]) * 0x01000193u;
     }
-    
-    // End chunked response
-    error = httpd_resp_sendstr_chunk(req, NULL);
-    if (error != ESP_OK) {
-        ESP_LOGE(TAG, "http_server_j_query_handler: Error %d ending chunked response", error);
-    } else {
-        ESP_LOGI(TAG, "http_server_j_query_handler: Response Sent Successfully");
+
+    for (uint32_t slot = hash & (WEB_ASSET_ROUTE_SLOTS - 1);
+         http_server_asset_routes[slot].uri != NULL;
+         slot = (slot + 1) & (WEB_ASSET_ROUTE_SLOTS - 1))
+    {
+        const http_server_asset_route_t *route = &http_server_asset_routes[slot];
+        if (strncmp(route->uri, uri, uri_len) == 0 && route->uri[uri_len] == '\0')
+        {
+            return &http_server_assets[route->asset];
+        }
     }
-    
-    return error;
+    return NULL;
 }
 
 /*
- * Send the index HTML page
+ * Serves the embedded, gzip compressed web page files for every GET request
+ * without a dedicated handler; anything else gets the captive portal redirect.
+ * Answers 304 Not Modified when the client already holds the current version,
+ * so a returning browser costs one short round trip instead of the whole file.
  * @param req HTTP request for which the uri needs to be handled
- * @return ESP_OK
+ * @return ESP_OK, or the error of the send
  */
-static esp_err_t http_server_index_html_handler(httpd_req_t *req)
+static esp_err_t http_server_asset_handler(httpd_req_t *req)
 {
     esp_err_t error;
-    ESP_LOGI(TAG, "Index HTML Requested");
-    
-    // Set content type
-    httpd_resp_set_type(req, "text/html");
-    
-    // Disable caching for development
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "0");
-    
-    // For small files like HTML, we can send directly without chunking
-    error = httpd_resp_send(req, (const char *)index_html_start, index_html_end - index_html_start);
-    if (error != ESP_OK)
+    char if_none_match[64];
+
+    const http_server_asset_t *asset = http_server_find_asset(req->uri);
+    if (asset == NULL)
     {
-        ESP_LOGE(TAG, "http_server_index_html_handler: Error %d while sending Response", error);
+        return http_404_error_handler(req, HTTPD_404_NOT_FOUND);
     }
-    else
+    ESP_LOGI(TAG, "%s Requested", req->uri);
+
+    // Cached copies must be revalidated, so a firmware update shows up on the next load
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+        strstr(if_none_match, asset->etag) != NULL)
+    {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    // Every browser accepts gzip, there is no uncompressed copy in flash
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    error = httpd_resp_send(req, asset->start, asset->end - asset->start);
+    if (error != ESP_OK)
     {
-        ESP_LOGI(TAG, "http_server_index_html_handler: Response Sent Successfully");
+        ESP_LOGE(TAG, "%s: Error %d while sending Response", req->uri, error);
     }
     return error;
 }
 
 /*
- * app.css get handler is requested when accessing the web page
- * @param req HTTP request for which the uri needs to be handled
- * @return ESP_OK
+ * Gives a request with a large body the longer upload receive timeout.
+ * httpd applies recv_wait_timeout to every socket, which is kept short so
+ * stalled clients do not hold sockets for long. The socket stays open for
+ * the next requests, so the handler puts the old timeout back with
+ * http_server_restore_timeout() before it returns.
+ * @param req HTTP request whose socket gets the timeout
+ * @param saved Receives the timeout to restore
  */
-static esp_err_t http_server_app_css_handler(httpd_req_t *req)
+static void http_server_set_upload_timeout(httpd_req_t *req, struct timeval *saved)
 {
-    esp_err_t error;
-    ESP_LOGI(TAG, "APP CSS Requested");
-    
-    // Set content type
-    httpd_resp_set_type(req, "text/css");
-    
-    // Disable caching for development
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "0");
-    
-    // Send the file
-    error = httpd_resp_send(req, (const char *)app_css_start, app_css_end - app_css_start);
-    if (error != ESP_OK)
+    struct timeval timeout = {.tv_sec = CONFIG_HTTP_SERVER_UPLOAD_TIMEOUT, .tv_usec = 0};
+    socklen_t saved_len = sizeof(*saved);
+    int sockfd = httpd_req_to_sockfd(req);
+    saved->tv_sec = CONFIG_HTTP_SERVER_RECV_TIMEOUT;
+    saved->tv_usec = 0;
+    if (sockfd < 0 || getsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, saved, &saved_len) != 0 ||
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0)
     {
-        ESP_LOGE(TAG, "http_server_app_css_handler: Error %d while sending Response", error);
+        ESP_LOGW(TAG, "Could not set the upload timeout on socket %d", sockfd);
     }
-    else
+}
+
+/*
+ * Puts back the receive timeout replaced by http_server_set_upload_timeout().
+ * @param req HTTP request of the upload
+ * @param saved Timeout returned by http_server_set_upload_timeout()
+ */
+static void http_server_restore_timeout(httpd_req_t *req, const struct timeval *saved)
+{
+    int sockfd = httpd_req_to_sockfd(req);
+    if (sockfd < 0 || setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, saved, sizeof(*saved)) != 0)
     {
-        ESP_LOGI(TAG, "http_server_app_css_handler: Response Sent Successfully");
+        ESP_LOGW(TAG, "Could not restore the receive timeout on socket %d", sockfd);
     }
-    return error;
 }
 
+// One buffer passed between the receiver and the OTA writer task, len 0 ends the upload.
+// The queues are the only way the two tasks hand each other state.
+typedef struct
+{
+    uint8_t *buffer; // Start of the buffer, returned to the receiver once written
+    const uint8_t *data;
+    size_t len;
+    // Filled: ESP_OK, or on the end marker (len 0) ESP_FAIL to abort the image.
+    // Free: the first write error so far, so the receiver can stop early.
+    esp_err_t result;
+} http_server_ota_chunk_t;
+
+typedef struct
+{
+    esp_ota_handle_t ota_handle;
+    QueueHandle_t filled_q;     // Receiver -> writer
+    QueueHandle_t free_q;       // Writer -> receiver
+    SemaphoreHandle_t done;     // Given by the writer when it has finished
+    esp_err_t write_result;     // Writer only: first write error, or the result of esp_ota_end.
+                                // The receiver reads it once it has taken done.
+} http_server_ota_ctx_t;
+
 /*
- * app.js get handler requested when accessing the web page.
- * @param req HTTP request for which the uri needs to be handled
- * @return ESP_OK
+ * Flashes the upload buffers queued by http_server_ota_update_handler() while
+ * the handler keeps receiving into the other buffer.
+ * @param pvParameters http_server_ota_ctx_t of the upload
  */
-static esp_err_t http_server_app_js_handler(httpd_req_t *req)
+static void http_server_ota_writer_task(void *pvParameters)
 {
-    esp_err_t error;
-    ESP_LOGI(TAG, "APP JS Requested");
-    
-    // Set content type
-    httpd_resp_set_type(req, "application/javascript");
-    
-    // Disable caching for development
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "0");
-    
-    // Send the file
-    error = httpd_resp_send(req, (const char *)app_js_start, app_js_end - app_js_start);
-    if (error != ESP_OK)
+    http_server_ota_ctx_t *ctx = (http_server_ota_ctx_t *)pvParameters;
+    http_server_ota_chunk_t chunk;
+
+    while (xQueueReceive(ctx->filled_q, &chunk, portMAX_DELAY) == pdTRUE && chunk.len > 0)
+    {
+        // After an error keep draining, so the receiver never blocks on a full queue
+        if (ctx->write_result == ESP_OK)
+        {
+            ctx->write_result = esp_ota_write(ctx->ota_handle, chunk.data, chunk.len);
+        }
+        chunk.result = ctx->write_result;
+        xQueueSend(ctx->free_q, &chunk, portMAX_DELAY);
+    }
+
+    // The end marker says whether the receiver got the whole image
+    if (ctx->write_result == ESP_OK)
     {
-        ESP_LOGE(TAG, "http_server_app_js_handler: Error %d while sending Response", error);
+        ctx->write_result = chunk.result;
+    }
+
+    /*
+     * After calling esp_ota_end, the handle is no longer valid and memory associated
+     * with it is freed (regardless of the results). It also validates the new image.
+     */
+    if (ctx->write_result == ESP_OK)
+    {
+        ctx->write_result = esp_ota_end(ctx->ota_handle);
     }
     else
     {
-        ESP_LOGI(TAG, "http_server_app_js_handler: Response Sent Successfully");
+        esp_ota_abort(ctx->ota_handle);
     }
-    return error;
+    xSemaphoreGive(ctx->done);
+    vTaskDelete(NULL);
 }
 
 /*
- * Sends the .ico file when accessing the web page
- * @param req HTTP request for which the uri needs to be handled
- * @return ESP_OK
+ * Finds needle in the first haystack_len bytes of haystack.
+ * @return offset of the first match, or -1
  */
-static esp_err_t http_server_favicon_handler(httpd_req_t *req)
+static int http_server_find_bytes(const uint8_t *haystack, size_t haystack_len, const char *needle)
 {
-    esp_err_t error;
-    ESP_LOGI(TAG, "Favicon.ico Requested");
-    
-    // Set content type
-    httpd_resp_set_type(req, "image/x-icon");
-    
-    // Disable caching for development
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "0");
-    
-    // Send the file
-    error = httpd_resp_send(req, (const char *)favicon_ico_start, favicon_ico_end - favicon_ico_start);
-    if (error != ESP_OK)
+    size_t needle_len = strlen(needle);
+    for (size_t i = 0; i + needle_len <= haystack_len; ++i)
     {
-        ESP_LOGE(TAG, "http_server_favicon_handler: Error %d while sending Response", error);
+        if (memcmp(haystack + i, needle, needle_len) == 0)
+        {
+            return (int)i;
+        }
     }
-    else
+    return -1;
+}
+
+/*
+ * Receives exactly len bytes of the request body, retrying on socket timeouts.
+ * @return len, or the httpd_req_recv error / 0 if the connection closed
+ */
+static int http_server_recv_full(httpd_req_t *req, uint8_t *buffer, size_t len)
+{
+    size_t received = 0;
+    while (received < len)
     {
-        ESP_LOGI(TAG, "http_server_favicon_handler: Response Sent Successfully");
+        int recv_len = httpd_req_recv(req, (char *)buffer + received, len - received);
+        if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            ESP_LOGI(TAG, "http_server_ota_update_handler: Socket Timeout");
+            continue; // Retry Receiving if Timeout Occurred
+        }
+        if (recv_len <= 0)
+        {
+            return recv_len;
+        }
+        received += recv_len;
     }
-    return error;
+    return (int)received;
 }
 
 /**
  * @brief Receives the *.bin file via the web page and handles the firmware update
+ *
+ * The body is either the raw image (Content-Type application/octet-stream, as
+ * sent by the web page) or a multipart/form-data upload with a single file.
+ * Two CONFIG_HTTP_SERVER_OTA_BUFFER_SIZE buffers are used in turn: while one
+ * is filled from the socket, http_server_ota_writer_task() writes the other
+ * to flash, erasing each sector just before it is written.
+ * Answers 409 while an OTA download (app_ota_start()) writes the partition.
  * @param req HTTP request for which the uri needs to be handled
  * @return ESP_OK, other ESP_FAIL if timeout occurs and the update canot be started
  */
 static esp_err_t http_server_ota_update_handler(httpd_req_t *req)
 {
-    esp_err_t error;
-    esp_ota_handle_t ota_handle;
-    char ota_buffer[1024];
-    int content_len = req->content_len; // total content length
-    int content_received = 0;
-    int recv_len = 0;
-    bool is_req_body_started = false;
+    const size_t buffer_size = CONFIG_HTTP_SERVER_OTA_BUFFER_SIZE;
+    http_server_ota_ctx_t ctx = {.write_result = ESP_OK};
+    http_server_ota_chunk_t chunk;
+    uint8_t *buffers[2] = {NULL, NULL};
+    char content_type[128] = {0};
+    size_t remaining = req->content_len; // Body bytes not received yet
+    size_t image_len = req->content_len; // Firmware bytes within the body
+    size_t trailer_len = 0;              // Closing multipart boundary
+    size_t image_received = 0;
     bool flash_successful = false;
+    esp_err_t error = ESP_FAIL;
+    struct timeval saved_timeout;
+
+    if (app_ota_begin_upload() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "http_server_ota_update_handler: OTA download in progress, rejecting upload");
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "An OTA download is in progress");
+        return ESP_OK;
+    }
+
+    http_server_set_upload_timeout(req, &saved_timeout);
 
     // get the next OTA app partition which should be written with a new firmware
     const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
 
-    // our ota_buffer is not sufficient to receive all data in a one go
-    // hence we will read the data in chunks and write in chunks, read the below
-    // mentioned comments for more information
-    do
-    {
-        // The following is the API to read content of data from the HTTP request
-        /* This API will read HTTP content data from the HTTP request into the
-         * provided buffer. Use content_len provided in the httpd_req_t structure to
-         *  know the length of the data to be fetched.
-         *  If the content_len is to large for the buffer then the user may have to
-         *  make multiple calls to this functions (as done here), each time fetching
-         *  buf_len num of bytes (which is ota_buffer length here), while the pointer
-         *  to content data is incremented internally by the same number
-         *  This function returns
-         *  Bytes: Number of bytes read into the buffer successfully
-         *  0: Buffer length parameter is zero/connection closed by peer.
-         *  HTTPD_SOCK_ERR_INVALID: Invalid Arguments
-         *  HTTPD_SOCK_ERR_TIMEOUT: Timeout/Interrupted while calling socket recv()
-         *  HTTPD_SOCK_ERR_FAIL: Unrecoverable error while calling socket recv()
-         *  Parameters to this function are:
-         *  req: The request being responded to
-         *  ota_buffer: Pointer to a buffer that the data will be read into
-         *  length: length of the buffer which ever is minimum (as we don't want to
-         *          read more data which buffer can't handle)
-         */
-        recv_len = httpd_req_recv(req, ota_buffer, MIN(content_len, sizeof(ota_buffer)));
-        // if recv_len is less than zero, it means some problem (but if timeout error, then try again)
-        if (recv_len < 0)
+    buffers[0] = malloc(buffer_size);
+    buffers[1] = malloc(buffer_size);
+    ctx.filled_q = xQueueCreate(2, sizeof(http_server_ota_chunk_t));
+    ctx.free_q = xQueueCreate(2, sizeof(http_server_ota_chunk_t));
+    ctx.done = xSemaphoreCreateBinary();
+    if (update_partition == NULL || buffers[0] == NULL || buffers[1] == NULL ||
+        ctx.filled_q == NULL || ctx.free_q == NULL || ctx.done == NULL)
+    {
+        ESP_LOGE(TAG, "http_server_ota_update_handler: Out of memory or no OTA partition");
+        goto cleanup;
+    }
+
+    // The first buffer also carries the multipart headers, if any
+    size_t first_len = MIN(remaining, buffer_size);
+    if (http_server_recv_full(req, buffers[0], first_len) != (int)first_len)
+    {
+        ESP_LOGE(TAG, "http_server_ota_update_handler: Receive failed");
+        goto cleanup;
+    }
+    remaining -= first_len;
+
+    size_t body_start = 0;
+    httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type));
+    if (strncmp(content_type, "multipart/form-data", strlen("multipart/form-data")) == 0)
+    {
+        // The file content starts after the part headers, i.e. after \r\n\r\n
+        int headers_end = http_server_find_bytes(buffers[0], first_len, "\r\n\r\n");
+        if (headers_end < 0)
         {
-            // Check if timeout occur, then we will retry again
-            if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
-            {
-                ESP_LOGI(TAG, "http_server_ota_update_handler: Socket Timeout");
-                continue; // Retry Receiving if Timeout Occurred
-            }
-            // If there is some other error apart from Timeout, then exit with fail
-            ESP_LOGI(TAG, "http_server_ota_update_handler: OTA Other Error, %d", recv_len);
-            return ESP_FAIL;
+            ESP_LOGE(TAG, "http_server_ota_update_handler: No multipart header end in the first %u bytes", (unsigned)first_len);
+            goto cleanup;
         }
-        ESP_LOGI(TAG, "http_server_ota_update_handler: OTA RX: %d of %d", content_received, content_len);
+        body_start = headers_end + 4u;
 
-        // We are here which means that "recv_len" is positive, now we have to check
-        // if this is the first data we are receiving or not, If so, it will have
-        // the information in the header that we need
-        if (!is_req_body_started)
+        // The part is followed by "\r\n--<boundary>--\r\n", which must not reach the flash
+        const char *boundary = strstr(content_type, "boundary=");
+        if (boundary != NULL)
         {
-            is_req_body_started = true;
-            // Now we have to identify from where the binary file content is starting
-            // this can be done by actually checking the escape characters i.e. \r\n\r\n
-            // Get the location of the *.bin file content (remove the web form data)
-            // the strstr will return the pointer to the \r\n\r\n in the ota_buffer
-            // and then by adding 4 we reach to the start of the binary content/start
-            char *body_start_p = strstr(ota_buffer, "\r\n\r\n") + 4u;
-            int body_part_len = recv_len - (body_start_p - ota_buffer);
-            ESP_LOGI(TAG, "http_server_ota_update_handler: OTA File Size: %d", content_len);
-            /*
-             * esp_ota_begin function commence an OTA update writing to the specified
-             * partition. The specified partition is erased to the specified image
-             * size. If the image size is not yet known, OTA_SIZE_UNKNOWN is passed
-             * which will cause the entire partition to be erased.
-             * On Success this function allocates memory that remains in use until
-             * esp_ota_end is called with the return handle.
-             */
-            error = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &ota_handle);
-            if (error != ESP_OK)
-            {
-                ESP_LOGI(TAG, "http_server_ota_update_handler: Error with OTA Begin, Canceling OTA");
-                return ESP_FAIL;
-            }
-            else
-            {
-                ESP_LOGI(TAG, "http_server_ota_update_handler: Writing to partition subtype %d at offset 0x%lx", update_partition->subtype, update_partition->address);
-            }
-            /*
-             * esp_ota_write function, writes the OTA update to the partition.
-             * This function can be called multiple times as data is received during
-             * the OTA operation. Data is written sequentially to the partition.
-             * Here we are writing the body start for the first time.
-             */
-            esp_ota_write(ota_handle, body_start_p, body_part_len);
-            content_received += body_part_len;
+            trailer_len = strlen("\r\n--") + strlen(boundary + strlen("boundary=")) + strlen("--\r\n");
         }
-        else
+        if (req->content_len < body_start + trailer_len)
         {
-            /* Continue to receive data above using httpd_req_recv function, and write
-             * using esp_ota_write (below), until all the content is received. */
-            esp_ota_write(ota_handle, ota_buffer, recv_len);
-            content_received += recv_len;
+            goto cleanup;
         }
+        image_len = req->content_len - body_start - trailer_len;
+    }
+    ESP_LOGI(TAG, "http_server_ota_update_handler: OTA File Size: %u", (unsigned)image_len);
 
-    } while ((recv_len > 0) && (content_received < content_len));
-    // till complete data is received and written or some error is there we will
-    // remain in the above mentioned do-while loop
-
-    /* Finish the OTA update and validate newly written app image.
-     * After calling esp_ota_end, the handle is no longer valid and memory associated
-     * with it is freed (regardless of the results).
+    /*
+     * esp_ota_begin function commence an OTA update writing to the specified
+     * partition. With OTA_WITH_SEQUENTIAL_WRITES each sector is erased right
+     * before it is first written, in the writer task, instead of erasing the
+     * whole partition up front while the client waits.
+     * On Success this function allocates memory that remains in use until
+     * esp_ota_end is called with the return handle.
      */
-    if (esp_ota_end(ota_handle) == ESP_OK)
+    error = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &ctx.ota_handle);
+    if (error != ESP_OK)
+    {
+        ESP_LOGI(TAG, "http_server_ota_update_handler: Error with OTA Begin, Canceling OTA");
+        goto cleanup;
+    }
+    ESP_LOGI(TAG, "http_server_ota_update_handler: Writing to partition subtype %d at offset 0x%lx", update_partition->subtype, update_partition->address);
+
+    if (xTaskCreate(http_server_ota_writer_task, "ota_writer", 4096, &ctx, CONFIG_HTTP_SERVER_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        esp_ota_abort(ctx.ota_handle);
+        error = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    // The second buffer starts out free
+    chunk = (http_server_ota_chunk_t){.buffer = buffers[1]};
+    xQueueSend(ctx.free_q, &chunk, 0);
+
+    chunk.buffer = buffers[0];
+    chunk.data = buffers[0] + body_start;
+    chunk.len = MIN(first_len - body_start, image_len);
+    chunk.result = ESP_OK;
+    bool recv_failed = false;
+    while (true)
+    {
+        image_received += chunk.len;
+        if (chunk.len > 0)
+        {
+            xQueueSend(ctx.filled_q, &chunk, portMAX_DELAY);
+        }
+        if (image_received >= image_len)
+        {
+            break;
+        }
+
+        // Fill the next free buffer while the writer flashes the previous one
+        xQueueReceive(ctx.free_q, &chunk, portMAX_DELAY);
+        if (chunk.result != ESP_OK)
+        {
+            break; // The writer failed, the rest of the image is not needed
+        }
+        size_t len = MIN(MIN(remaining, buffer_size), image_len - image_received);
+        int recv_len = http_server_recv_full(req, chunk.buffer, len);
+        if (recv_len != (int)len)
+        {
+            ESP_LOGI(TAG, "http_server_ota_update_handler: OTA Other Error, %d", recv_len);
+            recv_failed = true;
+            break;
+        }
+        remaining -= len;
+        chunk.data = chunk.buffer;
+        chunk.len = len;
+
+        if ((image_received * 10) / image_len != ((image_received + len) * 10) / image_len)
+        {
+            ESP_LOGI(TAG, "http_server_ota_update_handler: OTA RX: %u of %u", (unsigned)(image_received + len), (unsigned)image_len);
+        }
+    }
+
+    // End of image, wait for the writer to flush and validate it, or to abort it
+    chunk.len = 0;
+    chunk.result = recv_failed ? ESP_FAIL : ESP_OK;
+    xQueueSend(ctx.filled_q, &chunk, portMAX_DELAY);
+    xSemaphoreTake(ctx.done, portMAX_DELAY);
+    error = ctx.write_result;
+
+    if (error == ESP_OK)
     {
         // let's update the partition i.e. configure OTA data for new boot partition
         if (esp_ota_set_boot_partition(update_partition) == ESP_OK)
@@ -701,8 +899,30 @@ static esp_err_t http_server_ota_update_handler(httpd_req_t *req)
     }
     else
     {
-        ESP_LOGI(TAG, "http_server_ota_update_handler: esp_ota_end Error");
+        ESP_LOGI(TAG, "http_server_ota_update_handler: OTA write/end Error %s", esp_err_to_name(error));
+    }
+
+cleanup:
+    free(buffers[0]);
+    free(buffers[1]);
+    if (ctx.filled_q != NULL)
+    {
+        vQueueDelete(ctx.filled_q);
+    }
+    if (ctx.free_q != NULL)
+    {
+        vQueueDelete(ctx.free_q);
+    }
+    if (ctx.done != NULL)
+    {
+        vSemaphoreDelete(ctx.done);
     }
+    if (!flash_successful)
+    {
+        // A flashed image keeps the partition claimed until the reboot into it
+        app_ota_end_upload();
+    }
+    http_server_restore_timeout(req, &saved_timeout);
 
     // We won't update the global variables throughout the file, so send the message about the status
     if (flash_successful)
@@ -816,12 +1036,10 @@ static esp_err_t http_server_sensor_handler(httpd_req_t *req)
 
     ESP_LOGI(TAG, "Simulated Temperature: %.2f°C, Humidity: %.2f%%", temp, humidity);
 
-    // Publish to AWS IoT
-    esp_err_t aws_result = aws_iot_publish_sensor_data(temp, humidity);
-    if (aws_result == ESP_OK) {
-        ESP_LOGI(TAG, "Successfully published sensor data to AWS IoT");
-    } else {
-        ESP_LOGW(TAG, "Failed to publish sensor data to AWS IoT: %s", esp_err_to_name(aws_result));
+    // Queue for the next AWS IoT telemetry batch
+    esp_err_t aws_result = aws_iot_telemetry_add_sensor(temp, humidity);
+    if (aws_result != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to queue sensor data for AWS IoT: %s", esp_err_to_name(aws_result));
     }
 
     // Format as JSON response
@@ -851,14 +1069,20 @@ static esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err)
 static esp_err_t http_server_get_data_handler(httpd_req_t *req)
 {
     bool isComma = false;
-    int32_t length = 0;
-    uint16_t rsp_len = 0;
     char temp_buff[256] = {0};
     ESP_LOGI(TAG, "Parameters Request Received");
 
+    // Request and response live in the request arena
+    char *buf = http_arena_alloc(HTTP_SERVER_GET_DATA_REQ_SIZE);
+    http_json_writer_t w;
+    if (buf == NULL || http_json_writer_init(&w, HTTP_SERVER_GET_DATA_RSP_SIZE) != ESP_OK)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
     // Read request content
-    char buf[256];
-    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
+    int ret = httpd_req_recv(req, buf, HTTP_SERVER_GET_DATA_REQ_SIZE - 1);
     if (ret <= 0)
     {
         ESP_LOGE(TAG, "Failed to receive request data");
@@ -885,41 +1109,27 @@ static esp_err_t http_server_get_data_handler(httpd_req_t *req)
     cJSON *key_obj = cJSON_GetObjectItemCaseSensitive(json, "key");
     if (cJSON_IsString(key_obj) && (key_obj->valuestring != NULL))
     {
-        // ESP_LOGI(TAG, "Key value: %s", key_obj->valuestring);
-        // I am sending comma separated values in key_obj->valuestring like "SSID,Temp,Humidity"
-        // extract them based on the comma token, give me code to extract them
-        // ',' ASCII value of comma
-        // "," const string
+        // Comma separated keys like "SSID,Temp,Humidity" are answered with
         // {"SSID":"NetworkA", "Temp":"25", "Humidity":"60"}
         char *token;
 
         token = strtok(key_obj->valuestring, ",");
 
-        memset(http_server_buffer, 0, HTTP_SERVER_BUFFER_SIZE);
-
-        length = snprintf(http_server_buffer,
-                          HTTP_SERVER_BUFFER_SIZE,
-                          "{");
+        http_json_append(&w, "{");
 
         while (token != NULL)
         {
             ESP_LOGI(TAG, "Key value: %s", token);
             memset(temp_buff, 0, sizeof(temp_buff));
             get_data_rsp_string(token, temp_buff, sizeof(temp_buff));
-            length += snprintf(http_server_buffer + length,
-                               HTTP_SERVER_BUFFER_SIZE - length,
-                               "%s%s",
-                               isComma ? "," : "",
-                               temp_buff);
+            http_json_append(&w, "%s%s", isComma ? "," : "", temp_buff);
             token = strtok(NULL, ",");
             isComma = true;
         }
 
-        length += snprintf(http_server_buffer + length,
-                           HTTP_SERVER_BUFFER_SIZE - length,
-                           "}");
+        http_json_append(&w, "}");
 
-        ESP_LOGI(TAG, "%s [%ld]: %s", key_obj->valuestring, length, http_server_buffer);
+        ESP_LOGI(TAG, "%s [%u]: %s", key_obj->valuestring, (unsigned)w.len, w.buf);
     }
     else
     {
@@ -934,11 +1144,12 @@ static esp_err_t http_server_get_data_handler(httpd_req_t *req)
 
     // Send success response
     const char *response = NULL;
+    size_t rsp_len = 0;
 
-    if (length > 0)
+    if (!w.overflow && w.len > 0)
     {
-        response = http_server_buffer;
-        rsp_len = length;
+        response = w.buf;
+        rsp_len = w.len;
     }
     else
     {
@@ -1215,15 +1426,6 @@ static esp_err_t http_server_get_saved_station_ssid_handler(httpd_req_t *req)
     char station_ssid[64] = {0};
     char station_password[64] = {0};
 
-    // Create JSON response
-    cJSON *root = cJSON_CreateObject();
-    if (root == NULL)
-    {
-        ESP_LOGE(TAG, "Failed to create JSON object");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
-    }
-
     // Try to get saved SSID from NVS
     bool success = nvs_storage_get_wifi_credentials(station_ssid, sizeof(station_ssid),
                                                     station_password, sizeof(station_password));
@@ -1231,31 +1433,33 @@ static esp_err_t http_server_get_saved_station_ssid_handler(httpd_req_t *req)
     if (success && station_ssid[0] != '\0')
     {
         ESP_LOGI(TAG, "Found saved SSID: %s", station_ssid);
-        cJSON_AddStringToObject(root, "station_ssid", station_ssid);
     }
     else
     {
         ESP_LOGW(TAG, "No saved station SSID found in NVS");
-        cJSON_AddStringToObject(root, "station_ssid", "");
+        station_ssid[0] = '\0';
     }
 
-    // Generate JSON string
-    const char *json_str = cJSON_PrintUnformatted(root);
-    if (json_str == NULL)
+    // Create JSON response in the request arena, room for a fully escaped SSID
+    http_json_writer_t w;
+    if (http_json_writer_init(&w, 32 + sizeof(station_ssid) * 6) != ESP_OK)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    http_json_append(&w, "{\"station_ssid\":");
+    http_json_append_string(&w, station_ssid);
+    http_json_append(&w, "}");
+    if (w.overflow)
     {
         ESP_LOGE(TAG, "Failed to generate JSON string");
-        cJSON_Delete(root);
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
     // Send response
     httpd_resp_set_type(req, "application/json");
-    esp_err_t send_err = httpd_resp_send(req, json_str, strlen(json_str));
-
-    // Cleanup
-    cJSON_Delete(root);
-    free((void *)json_str);
+    esp_err_t send_err = httpd_resp_send(req, w.buf, w.len);
 
     if (send_err != ESP_OK)
     {
@@ -1266,110 +1470,550 @@ static esp_err_t http_server_get_saved_station_ssid_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-// --- RFID Management Webpage Handlers ---
+// --- RFID Management API Handlers ---
 
 /*
- * Sends the rfid_management.html page
- * @param req HTTP request for which the uri needs to be handled
- * @return ESP_OK
+ * Appends src to dst as the body of a JSON string, escaping quotes, backslashes and control characters.
+ * @return number of characters written, excluding the terminator
  */
-static esp_err_t http_server_rfid_management_html_handler(httpd_req_t *req)
+static size_t http_server_json_escape(char *dst, size_t dst_len, const char *src)
 {
-    esp_err_t error;
-    ESP_LOGI(TAG, "RFID Management HTML Requested");
-    
-    // Set content type
-    httpd_resp_set_type(req, "text/html");
-    
-    // Strong cache control headers to prevent any caching of dynamic content
-    httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate, max-age=0, post-check=0, pre-check=0");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "-1");
-    // Add a Vary header to ensure proxy servers don't cache
-    httpd_resp_set_hdr(req, "Vary", "*");
-    
-    // For small files like HTML, we can send directly without chunking
-    error = httpd_resp_send(req, (const char *)rfid_management_html_start, rfid_management_html_end - rfid_management_html_start);
-    if (error != ESP_OK)
-    {
-        ESP_LOGE(TAG, "http_server_rfid_management_html_handler: Error %d while sending Response", error);
-    }
-    else
+    size_t length = 0;
+    for (; *src != '\0' && length + 7 < dst_len; ++src)
     {
-        ESP_LOGI(TAG, "http_server_rfid_management_html_handler: Response Sent Successfully");
+        unsigned char c = (unsigned char)*src;
+        if (c == '"' || c == '\\')
+        {
+            dst[length++] = '\\';
+            dst[length++] = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            length += snprintf(dst + length, dst_len - length, "\\u%04x", c);
+        }
+        else
+        {
+            dst[length++] = (char)c;
+        }
     }
-    return error;
+    dst[length] = '\0';
+    return length;
 }
 
 /*
- * rfid_management.js get handler requested when accessing the rfid management page.
- * @param req HTTP request for which the uri needs to be handled
- * @return ESP_OK
+ * Decodes a URL query value in place ('+' and %XX escapes).
  */
-static esp_err_t http_server_rfid_management_js_handler(httpd_req_t *req)
+static void http_server_url_decode(char *value)
 {
-    esp_err_t error;
-    ESP_LOGI(TAG, "RFID Management JS Requested");
-    
-    // Set content type
-    httpd_resp_set_type(req, "application/javascript");
-    
-    // Strong cache control headers to prevent any caching of dynamic content
-    httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate, max-age=0, post-check=0, pre-check=0");
-    httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_set_hdr(req, "Expires", "-1");
-    // Add a Vary header to ensure proxy servers don't cache
-    httpd_resp_set_hdr(req, "Vary", "*");
-    
-    
-    // Send the file
-    error = httpd_resp_send(req, (const char *)rfid_management_js_start, rfid_management_js_end - rfid_management_js_start);
-    if (error != ESP_OK)
+    char *out = value;
+    for (char *in = value; *in != '\0'; ++in)
     {
-        ESP_LOGE(TAG, "http_server_rfid_management_js_handler: Error %d while sending Response", error);
-    }
-    else
+        if (*in == '+')
+        {
+            *out++ = ' ';
+        }
+        else if (*in == '%' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2]))
+        {
+            char hex[3] = {in[1], in[2], '\0'};
+            *out++ = (char)strtoul(hex, NULL, 16);
+            in += 2;
+        }
+        else
+        {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+/*
+ * Waits for the card database, which is loaded in the background at boot.
+ * Answers 503 with Retry-After if it is still not loaded after
+ * CONFIG_HTTP_SERVER_STORAGE_WAIT_MS.
+ * @return true if the handler can go on
+ */
+static bool http_server_rfid_wait_ready(httpd_req_t *req)
+{
+    if (app_boot_wait_ready(APP_BOOT_STORAGE_READY, CONFIG_HTTP_SERVER_STORAGE_WAIT_MS))
     {
-        ESP_LOGI(TAG, "http_server_rfid_management_js_handler: Response Sent Successfully");
+        return true;
     }
-    return error;
+
+    ESP_LOGW(TAG, "%s: card database not loaded yet", req->uri);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\":\"Starting\"}", HTTPD_RESP_USE_STRLEN);
+    return false;
 }
 
-// --- RFID Management API Handlers ---
+/*
+ * Reads the paging/filter parameters of /cards/Get from the query string.
+ * Missing parameters keep their defaults: offset 0, no limit, no filter.
+ */
+static void http_server_rfid_parse_list_query(httpd_req_t *req, uint32_t *offset, uint32_t *limit, rfid_card_filter_t *filter)
+{
+    char query[160];
+    char value[RFID_CARD_NAME_LEN * 3];
+
+    *offset = 0;
+    *limit = UINT32_MAX;
+    memset(filter, 0, sizeof(*filter));
+
+    size_t query_len = httpd_req_get_url_query_len(req);
+    if (query_len == 0 || query_len >= sizeof(query) ||
+        httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
+    {
+        return;
+    }
+
+    if (httpd_query_key_value(query, "offset", value, sizeof(value)) == ESP_OK)
+    {
+        *offset = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK && strtoul(value, NULL, 10) > 0)
+    {
+        *limit = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "since_ts", value, sizeof(value)) == ESP_OK)
+    {
+        filter->since_ts = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "name_prefix", value, sizeof(value)) == ESP_OK)
+    {
+        http_server_url_decode(value);
+        strncpy(filter->name_prefix, value, sizeof(filter->name_prefix) - 1);
+    }
+}
 
-// GET /api/rfid/cards - List all cards
+// GET /cards/Get?offset=&limit=&name_prefix=&since_ts= - List cards
+// Returns the page of matching cards plus the total number of matches. The list is
+// streamed with chunked encoding a few cards at a time, so the memory used does not
+// grow with the number of cards.
 static esp_err_t http_server_rfid_list_cards_handler(httpd_req_t *req)
 {
-    char *resp_str = "{\"status\":\"Failed\"}";
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
+    rfid_card_t cards[HTTP_SERVER_CARD_BATCH];
+    char chunk[HTTP_SERVER_CARD_BATCH * HTTP_SERVER_CARD_JSON_MAX + 64];
+    char name[RFID_CARD_NAME_LEN * 6];
+    rfid_card_filter_t filter;
+    rfid_card_iter_t iter;
+    uint32_t offset, limit, total = 0;
+    uint16_t num_cards = 0;
+    bool isComma = false;
+    esp_err_t ret;
+
+    http_server_rfid_parse_list_query(req, &offset, &limit, &filter);
+    ESP_LOGI(TAG, "/cards/Get (GET) requested: offset=%lu limit=%lu prefix='%s' since=%lu",
+             (unsigned long)offset, (unsigned long)limit, filter.name_prefix, (unsigned long)filter.since_ts);
 
     httpd_resp_set_type(req, "application/json");
+    rfid_manager_card_iter_init_filtered(&iter, &filter);
 
-    ESP_LOGI(TAG, "/api/rfid/cards (GET) requested - SIMPLIFIED HANDLER");
+    // Position the cursor and fetch the first batch before sending anything, so a
+    // failure can still be reported with a status code
+    if (rfid_manager_count_cards(&filter, &total) != ESP_OK ||
+        rfid_manager_card_iter_skip(&iter, offset, NULL) != ESP_OK ||
+        rfid_manager_card_iter_next(&iter, cards, MIN(HTTP_SERVER_CARD_BATCH, limit), &num_cards) != ESP_OK)
+    {
+        httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_send(req, "{\"status\":\"Failed\"}", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
 
-    if (rfid_manager_get_card_list_json(http_server_buffer, HTTP_SERVER_BUFFER_SIZE) != ESP_FAIL)
+    size_t length = snprintf(chunk, sizeof(chunk), "{\"total\":%lu,\"offset\":%lu,\"cards\":[",
+                             (unsigned long)total, (unsigned long)offset);
+    while (true)
     {
-        resp_str = http_server_buffer; // Assigning the address of buffer to pointer
+        for (uint16_t i = 0; i < num_cards; ++i)
+        {
+            http_server_json_escape(name, sizeof(name), cards[i].name);
+            length += snprintf(chunk + length, sizeof(chunk) - length,
+                               "%s{\"id\":\"0x%lX\",\"nm\":\"%s\",\"ts\":%lu}",
+                               isComma ? "," : "", (unsigned long)cards[i].card_id, name, (unsigned long)cards[i].timestamp);
+            isComma = true;
+        }
+        limit -= num_cards;
+
+        if (iter.done || limit == 0)
+        {
+            break;
+        }
+
+        if ((ret = httpd_resp_send_chunk(req, chunk, length)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to send card list chunk: %s", esp_err_to_name(ret));
+            return ret; // Client is gone, httpd closes the socket
+        }
+        length = 0;
 
-        httpd_resp_set_status(req, HTTPD_200);
+        if (rfid_manager_card_iter_next(&iter, cards, MIN(HTTP_SERVER_CARD_BATCH, limit), &num_cards) != ESP_OK)
+        {
+            // Headers are already out; end the body so the client sees a truncated, invalid document
+            ESP_LOGE(TAG, "Failed to read next batch of cards, aborting list");
+            httpd_resp_send_chunk(req, NULL, 0);
+            return ESP_FAIL;
+        }
     }
-    else
+
+    length += snprintf(chunk + length, sizeof(chunk) - length, "]}");
+    if ((ret = httpd_resp_send_chunk(req, chunk, length)) != ESP_OK)
     {
-        httpd_resp_set_status(req, HTTPD_400);
+        ESP_LOGE(TAG, "Failed to send card list chunk: %s", esp_err_to_name(ret));
+        return ret;
     }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void http_server_put_le32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    dst[2] = (uint8_t)(value >> 16);
+    dst[3] = (uint8_t)(value >> 24);
+}
 
-    esp_err_t ret = httpd_resp_send(req, resp_str, strlen(resp_str));
+static uint32_t http_server_get_le32(const uint8_t *src)
+{
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
 
-    if (ret != ESP_OK)
+// GET /cards/Export - Download all active cards in the binary backup format
+static esp_err_t http_server_rfid_export_handler(httpd_req_t *req)
+{
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
+    rfid_card_t cards[HTTP_SERVER_CARD_BATCH];
+    uint8_t chunk[HTTP_SERVER_CARD_BATCH * HTTP_SERVER_CARD_BIN_RECORD_LEN];
+    rfid_card_iter_t iter;
+    uint16_t num_cards = 0;
+    uint32_t exported = 0;
+    esp_err_t ret;
+
+    ESP_LOGI(TAG, "/cards/Export (GET) requested");
+
+    rfid_manager_card_iter_init(&iter);
+    if (rfid_manager_card_iter_next(&iter, cards, HTTP_SERVER_CARD_BATCH, &num_cards) != ESP_OK)
+    {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"rfid_cards.bin\"");
+    if ((ret = httpd_resp_send_chunk(req, HTTP_SERVER_CARD_BIN_MAGIC, HTTP_SERVER_CARD_BIN_MAGIC_LEN)) != ESP_OK)
+    {
+        return ret;
+    }
+
+    while (num_cards > 0)
+    {
+        for (uint16_t i = 0; i < num_cards; ++i)
+        {
+            uint8_t *record = &chunk[i * HTTP_SERVER_CARD_BIN_RECORD_LEN];
+            http_server_put_le32(record, cards[i].card_id);
+            http_server_put_le32(record + 4, cards[i].timestamp);
+            strncpy((char *)record + 8, cards[i].name, RFID_CARD_NAME_LEN); // NUL pads the rest
+            record[8 + RFID_CARD_NAME_LEN - 1] = '\0';
+        }
+        if ((ret = httpd_resp_send_chunk(req, (const char *)chunk, num_cards * HTTP_SERVER_CARD_BIN_RECORD_LEN)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to send card export chunk: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        exported += num_cards;
+
+        if (rfid_manager_card_iter_next(&iter, cards, HTTP_SERVER_CARD_BATCH, &num_cards) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to read next batch of cards, aborting export");
+            httpd_resp_send_chunk(req, NULL, 0);
+            return ESP_FAIL;
+        }
+    }
+
+    ESP_LOGI(TAG, "Exported %lu cards", (unsigned long)exported);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Receives and applies the body of /cards/Import, see http_server_rfid_import_handler()
+static esp_err_t http_server_rfid_import_cards(httpd_req_t *req)
+{
+    char resp_json[128];
+    uint8_t magic[HTTP_SERVER_CARD_BIN_MAGIC_LEN];
+    size_t remaining = req->content_len;
+    size_t filled = 0;
+    uint32_t total = 0, staged = 0;
+    uint16_t added = 0;
+    esp_err_t ret = ESP_OK;
+
+    ESP_LOGI(TAG, "/cards/Import (POST) requested, %u bytes", (unsigned)req->content_len);
+
+    if (remaining < HTTP_SERVER_CARD_BIN_MAGIC_LEN ||
+        (remaining - HTTP_SERVER_CARD_BIN_MAGIC_LEN) % HTTP_SERVER_CARD_BIN_RECORD_LEN != 0)
     {
-        ESP_LOGE(TAG, "Simplified handler failed to send response: %s", esp_err_to_name(ret));
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body is not a card backup file");
+        return ESP_FAIL;
     }
 
+    // Magic first, then the records
+    while (filled < HTTP_SERVER_CARD_BIN_MAGIC_LEN)
+    {
+        int recv_len = httpd_req_recv(req, (char *)magic + filled, HTTP_SERVER_CARD_BIN_MAGIC_LEN - filled);
+        if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            continue; // Retry Receiving if Timeout Occurred
+        }
+        if (recv_len <= 0)
+        {
+            return ESP_FAIL;
+        }
+        filled += recv_len;
+    }
+    remaining -= filled;
+    if (memcmp(magic, HTTP_SERVER_CARD_BIN_MAGIC, HTTP_SERVER_CARD_BIN_MAGIC_LEN) != 0)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body is not a card backup file");
+        return ESP_FAIL;
+    }
+    total = remaining / HTTP_SERVER_CARD_BIN_RECORD_LEN;
+
+    // The whole file is staged and added in one call, so a failed import leaves
+    // the database as it was. Small files fit in the request arena, larger ones
+    // go to PSRAM when there is some.
+    uint8_t *records = http_arena_alloc(HTTP_SERVER_CARD_IMPORT_BATCH * HTTP_SERVER_CARD_BIN_RECORD_LEN);
+    rfid_card_t *cards = NULL;
+    rfid_card_t *cards_heap = NULL;
+    bool staging_ok = records != NULL;
+    if (total > RFID_MAX_CARDS)
+    {
+        ESP_LOGW(TAG, "Card import of %lu cards exceeds the %d card database", (unsigned long)total, RFID_MAX_CARDS);
+        ret = ESP_ERR_NO_MEM;
+        remaining = 0;
+    }
+    else if (total > 0 && staging_ok)
+    {
+        cards = http_arena_alloc(total * sizeof(rfid_card_t));
+        if (cards == NULL)
+        {
+            cards_heap = heap_caps_calloc_prefer(total, sizeof(rfid_card_t), 2,
+                                                 MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_8BIT);
+            cards = cards_heap;
+        }
+        staging_ok = cards != NULL;
+    }
+    if (!staging_ok)
+    {
+        ESP_LOGE(TAG, "No memory to stage a card import of %lu cards", (unsigned long)total);
+        heap_caps_free(cards_heap);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Not enough memory for the import");
+        return ESP_FAIL;
+    }
+
+    filled = 0;
+    while (remaining > 0)
+    {
+        size_t chunk_size = HTTP_SERVER_CARD_IMPORT_BATCH * HTTP_SERVER_CARD_BIN_RECORD_LEN;
+        int recv_len = httpd_req_recv(req, (char *)records + filled, MIN(remaining, chunk_size - filled));
+        if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            continue;
+        }
+        if (recv_len <= 0)
+        {
+            ESP_LOGE(TAG, "Card import aborted after %lu of %lu cards, recv error %d, nothing added",
+                     (unsigned long)staged, (unsigned long)total, recv_len);
+            heap_caps_free(cards_heap);
+            return ESP_FAIL;
+        }
+        filled += recv_len;
+        remaining -= recv_len;
+
+        // Decode the complete records, a partial one stays at the front of the buffer
+        uint32_t count = filled / HTTP_SERVER_CARD_BIN_RECORD_LEN;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const uint8_t *record = &records[i * HTTP_SERVER_CARD_BIN_RECORD_LEN];
+            rfid_card_t *card = &cards[staged++];
+            card->card_id = http_server_get_le32(record);
+            card->timestamp = http_server_get_le32(record + 4);
+            card->active = 1;
+            memcpy(card->name, record + 8, RFID_CARD_NAME_LEN);
+            card->name[RFID_CARD_NAME_LEN - 1] = '\0';
+        }
+        filled -= count * HTTP_SERVER_CARD_BIN_RECORD_LEN;
+        memmove(records, records + count * HTTP_SERVER_CARD_BIN_RECORD_LEN, filled);
+    }
+
+    if (ret == ESP_OK && staged > 0)
+    {
+        ret = rfid_manager_add_cards_batch(cards, (uint16_t)staged, &added);
+    }
+    heap_caps_free(cards_heap);
+
+    httpd_resp_set_type(req, "application/json");
+    if (ret == ESP_ERR_NO_MEM)
+    {
+        httpd_resp_set_status(req, "507 Insufficient Storage");
+    }
+    else if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Card import failed: %s", esp_err_to_name(ret));
+        httpd_resp_set_status(req, HTTPD_500);
+    }
+    // On an error nothing was added, every card of the file counts as skipped
+    snprintf(resp_json, sizeof(resp_json), "{\"status\":\"%s\",\"added\":%u,\"skipped\":%lu}",
+             ret == ESP_OK ? "success" : "error", added, (unsigned long)(total - added));
+    httpd_resp_send(req, resp_json, HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
+// POST /cards/Import - Add the cards of a binary backup (see /cards/Export)
+// The body is received in chunks and staged, then added in one call: either every
+// new card is added or none is. Cards already present are skipped.
+static esp_err_t http_server_rfid_import_handler(httpd_req_t *req)
+{
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
+    struct timeval saved_timeout;
+    http_server_set_upload_timeout(req, &saved_timeout);
+    esp_err_t ret = http_server_rfid_import_cards(req);
+    http_server_restore_timeout(req, &saved_timeout);
+    return ret;
+}
+
+/*
+ * Reads the paging/filter parameters of /cards/AccessLog from the query string.
+ * Missing parameters keep their defaults: offset 0, no limit, no filter.
+ */
+static void http_server_rfid_parse_access_log_query(httpd_req_t *req, uint32_t *offset, uint32_t *limit, rfid_access_filter_t *filter)
+{
+    char query[128];
+    char value[16];
+
+    *offset = 0;
+    *limit = UINT32_MAX;
+    memset(filter, 0, sizeof(*filter));
+
+    size_t query_len = httpd_req_get_url_query_len(req);
+    if (query_len == 0 || query_len >= sizeof(query) ||
+        httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
+    {
+        return;
+    }
+
+    if (httpd_query_key_value(query, "offset", value, sizeof(value)) == ESP_OK)
+    {
+        *offset = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK && strtoul(value, NULL, 10) > 0)
+    {
+        *limit = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK)
+    {
+        filter->from_ts = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK)
+    {
+        filter->to_ts = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "card_id", value, sizeof(value)) == ESP_OK)
+    {
+        filter->card_id = strtoul(value, NULL, 0);
+    }
+}
+
+// GET /cards/AccessLog?from=&to=&card_id=&offset=&limit= - List card checks, oldest first
+// Streamed like /cards/Get: {"total":N,"offset":O,"records":[{"id":"0x..","ts":..,"ok":true,"rd":0},...]}
+static esp_err_t http_server_rfid_access_log_handler(httpd_req_t *req)
+{
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
+    rfid_access_record_t records[HTTP_SERVER_ACCESS_LOG_BATCH];
+    char chunk[HTTP_SERVER_ACCESS_LOG_BATCH * HTTP_SERVER_ACCESS_LOG_JSON_MAX + 64];
+    rfid_access_filter_t filter;
+    rfid_access_iter_t iter;
+    uint32_t offset, limit, total = 0;
+    uint16_t num_records = 0;
+    bool isComma = false;
+    esp_err_t ret;
+
+    http_server_rfid_parse_access_log_query(req, &offset, &limit, &filter);
+    ESP_LOGI(TAG, "/cards/AccessLog (GET) requested: offset=%lu limit=%lu from=%lu to=%lu card=0x%lX",
+             (unsigned long)offset, (unsigned long)limit, (unsigned long)filter.from_ts,
+             (unsigned long)filter.to_ts, (unsigned long)filter.card_id);
+
+    httpd_resp_set_type(req, "application/json");
+    rfid_access_log_iter_init(&iter, &filter);
+
+    if (rfid_access_log_count(&filter, &total) != ESP_OK ||
+        rfid_access_log_iter_skip(&iter, offset) != ESP_OK ||
+        rfid_access_log_iter_next(&iter, records, MIN(HTTP_SERVER_ACCESS_LOG_BATCH, limit), &num_records) != ESP_OK)
+    {
+        httpd_resp_set_status(req, HTTPD_500);
+        httpd_resp_send(req, "{\"status\":\"Failed\"}", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    size_t length = snprintf(chunk, sizeof(chunk), "{\"total\":%lu,\"offset\":%lu,\"records\":[",
+                             (unsigned long)total, (unsigned long)offset);
+    while (true)
+    {
+        for (uint16_t i = 0; i < num_records; ++i)
+        {
+            length += snprintf(chunk + length, sizeof(chunk) - length,
+                               "%s{\"id\":\"0x%lX\",\"ts\":%lu,\"ok\":%s,\"rd\":%u}",
+                               isComma ? "," : "", (unsigned long)records[i].card_id, (unsigned long)records[i].timestamp,
+                               records[i].granted ? "true" : "false", records[i].reader_id);
+            isComma = true;
+        }
+        limit -= num_records;
+
+        if (iter.done || limit == 0)
+        {
+            break;
+        }
+
+        if ((ret = httpd_resp_send_chunk(req, chunk, length)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to send access log chunk: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        length = 0;
+
+        if (rfid_access_log_iter_next(&iter, records, MIN(HTTP_SERVER_ACCESS_LOG_BATCH, limit), &num_records) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to read next batch of access records, aborting list");
+            httpd_resp_send_chunk(req, NULL, 0);
+            return ESP_FAIL;
+        }
+    }
+
+    length += snprintf(chunk + length, sizeof(chunk) - length, "]}");
+    if ((ret = httpd_resp_send_chunk(req, chunk, length)) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to send access log chunk: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 // POST /api/rfid/cards - Add new card
 static esp_err_t http_server_rfid_add_card_handler(httpd_req_t *req)
 {
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
     ESP_LOGI(TAG, "/api/rfid/cards (POST) requested");
     char content[256];
     int recv_len = httpd_req_recv(req, content, sizeof(content) - 1);
@@ -1450,6 +2094,10 @@ static esp_err_t http_server_rfid_add_card_handler(httpd_req_t *req)
 // DEL /api/rfid/cards/{id} - Remove card
 static esp_err_t http_server_rfid_remove_card_handler(httpd_req_t *req)
 {
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
     char urlBuffer[256];
     uint16_t lengthOfURI = 0;
     char idStrBuffer[48];
@@ -1506,6 +2154,10 @@ static esp_err_t http_server_rfid_remove_card_handler(httpd_req_t *req)
 // GET /api/rfid/cards/count - Get card count
 static esp_err_t http_server_rfid_get_card_count_handler(httpd_req_t *req)
 {
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
     ESP_LOGI(TAG, "/api/rfid/cards/count (GET) requested");
     uint16_t count = rfid_manager_get_card_count();
     char resp_json[64];
@@ -1518,6 +2170,10 @@ static esp_err_t http_server_rfid_get_card_count_handler(httpd_req_t *req)
 // POST /api/rfid/cards/check - Check if card exists
 static esp_err_t http_server_rfid_check_card_handler(httpd_req_t *req)
 {
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
     ESP_LOGI(TAG, "/api/rfid/cards/check (POST) requested");
     char content[128]; // Increased size for card_id string
     int recv_len = httpd_req_recv(req, content, sizeof(content) - 1);
@@ -1560,6 +2216,7 @@ static esp_err_t http_server_rfid_check_card_handler(httpd_req_t *req)
     cJSON_Delete(json);
 
     bool exists = rfid_manager_check_card(card_id);
+    aws_iot_telemetry_add_card_access(card_id, exists);
     char resp_json[64];
     sprintf(resp_json, "{\"exists\":%s, \"card_id\":\"%lu\"}", exists ? "true" : "false", (unsigned long)card_id);
     httpd_resp_set_type(req, "application/json");
@@ -1570,6 +2227,10 @@ static esp_err_t http_server_rfid_check_card_handler(httpd_req_t *req)
 // POST /api/rfid/reset - Reset to default cards
 static esp_err_t http_server_rfid_reset_handler(httpd_req_t *req)
 {
+    if (!http_server_rfid_wait_ready(req))
+    {
+        return ESP_OK;
+    }
     ESP_LOGI(TAG, "/api/rfid/reset (POST) requested");
     esp_err_t ret = rfid_manager_format_database();
     if (ret == ESP_OK)
@@ -1610,3 +2271,140 @@ static esp_err_t http_server_aws_iot_status_handler(httpd_req_t *req)
     
     return ESP_OK;
 }
+
+/*
+ * Registered in place of every uri_handlers entry, which it gets as user_ctx.
+ * Runs the entry's handler with a fresh request arena (see http_arena.h) and
+ * records the request latency under its URI.
+ */
+static esp_err_t http_server_request_handler(httpd_req_t *req)
+{
+    const httpd_uri_t *uri = req->user_ctx;
+#ifdef CONFIG_APP_METRICS_ENABLE
+    int64_t begin = app_metrics_begin();
+#endif
+    http_arena_begin();
+    esp_err_t ret = uri->handler(req);
+    http_arena_end();
+#ifdef CONFIG_APP_METRICS_ENABLE
+    app_metrics_end(http_server_uri_metrics[uri - uri_handlers], begin);
+#endif
+    return ret;
+}
+
+typedef struct
+{
+    httpd_req_t *req;
+    size_t length;
+    char chunk[HTTP_SERVER_METRICS_CHUNK];
+} http_server_metrics_stream_t;
+
+/*
+ * app_metrics_write() callback, collects the output into chunks
+ */
+static bool http_server_metrics_stream_write(const char *data, size_t len, void *ctx)
+{
+    http_server_metrics_stream_t *stream = ctx;
+
+    if (stream->length + len > sizeof(stream->chunk))
+    {
+        if (httpd_resp_send_chunk(stream->req, stream->chunk, stream->length) != ESP_OK)
+        {
+            return false;
+        }
+        stream->length = 0;
+    }
+    if (len > sizeof(stream->chunk))
+    {
+        return httpd_resp_send_chunk(stream->req, data, len) == ESP_OK;
+    }
+    memcpy(stream->chunk + stream->length, data, len);
+    stream->length += len;
+    return true;
+}
+
+// GET /api/metrics?format=prometheus - Request latencies, lock contention, DNS, MQTT and flash metrics
+// JSON by default, Prometheus text exposition format with format=prometheus
+static esp_err_t http_server_metrics_get_handler(httpd_req_t *req)
+{
+#ifndef CONFIG_APP_METRICS_ENABLE
+    httpd_resp_set_status(req, "501 Not Implemented");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\":\"Disabled\"}", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+#else
+    app_metrics_format_t format = APP_METRICS_FORMAT_JSON;
+    char query[32];
+    char value[16];
+
+    size_t query_len = httpd_req_get_url_query_len(req);
+    if (query_len > 0 && query_len < sizeof(query) &&
+        httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK &&
+        strcmp(value, "prometheus") == 0)
+    {
+        format = APP_METRICS_FORMAT_PROMETHEUS;
+    }
+
+    http_server_metrics_stream_t stream = {.req = req, .length = 0};
+
+    httpd_resp_set_type(req, format == APP_METRICS_FORMAT_PROMETHEUS ? "text/plain; version=0.0.4" : "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    esp_err_t ret = app_metrics_write(format, http_server_metrics_stream_write, &stream);
+    if (ret == ESP_OK && stream.length > 0)
+    {
+        ret = httpd_resp_send_chunk(req, stream.chunk, stream.length);
+    }
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to send metrics: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+#endif
+}
+
+// POST /api/metrics - {"sampling":true|false,"reset":true}, both optional. Responds with the sampling state.
+static esp_err_t http_server_metrics_set_handler(httpd_req_t *req)
+{
+#ifndef CONFIG_APP_METRICS_ENABLE
+    return http_server_metrics_get_handler(req); // 501 as well
+#else
+    char content[64];
+    int recv_len = httpd_req_recv(req, content, sizeof(content) - 1);
+    if (recv_len <= 0)
+    {
+        if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    content[recv_len] = '\0';
+
+    cJSON *json = cJSON_Parse(content);
+    if (json == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON format");
+        return ESP_FAIL;
+    }
+
+    cJSON *sampling_json = cJSON_GetObjectItem(json, "sampling");
+    cJSON *reset_json = cJSON_GetObjectItem(json, "reset");
+    if (cJSON_IsTrue(reset_json))
+    {
+        app_metrics_reset();
+    }
+    if (cJSON_IsBool(sampling_json))
+    {
+        app_metrics_set_sampling(cJSON_IsTrue(sampling_json));
+    }
+    cJSON_Delete(json);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, app_metrics_sampling_enabled ? "{\"sampling\":true}" : "{\"sampling\":false}", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+#endif
+}
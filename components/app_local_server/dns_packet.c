@@ -0,0 +1,306 @@
+/* Captive Portal Example
+
+    This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+    Unless required by applicable law or agreed to in writing, this
+    software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+    CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "dns_packet.h"
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <arpa/inet.h>
+// Compile time byte swaps for the templates below, lwip/def.h has them on the chip.
+// Hosts running the Linux target are little endian (x86-64, arm64)
+#define PP_HTONS(x) ((uint16_t)((((x) & 0xff) << 8) | (((x) & 0xff00) >> 8)))
+#define PP_HTONL(x) ((((x) & 0xffUL) << 24) | (((x) & 0xff00UL) << 8) | (((x) & 0xff0000UL) >> 8) | (((x) & 0xff000000UL) >> 24))
+#else
+#include "lwip/sockets.h"
+#endif
+
+#define DNS_MAX_QUESTIONS (4)       // Queries with more questions are dropped (real clients send one)
+
+#define DNS_FLAG_QR (0x8000)
+#define DNS_FLAG_RD (0x0100)
+#define DNS_OPCODE(flags) (((flags) >> 11) & 0xF)
+#define QD_TYPE_A (0x0001)
+#define QD_TYPE_SOA (0x0006)
+#define QD_CLASS_IN (0x0001)
+#define ANS_TTL_SEC (300)
+#define NEG_TTL_SEC (300)           // How long clients may cache "no such record" (AAAA, HTTPS, ...)
+
+#define DNS_CACHE_ENTRIES (8)       // Recently answered questions kept with their prebuilt reply
+#define DNS_CACHE_QUESTION_MAX (96) // Longest question section that is cached
+#define DNS_CACHE_TAIL_MAX (40)     // Longest prebuilt part after the question (A answer or SOA)
+
+static const char *TAG = "example_dns_redirect_server";
+
+// DNS Header Packet
+typedef struct __attribute__((__packed__))
+{
+    uint16_t id;
+    uint16_t flags;
+    uint16_t qd_count;
+    uint16_t an_count;
+    uint16_t ns_count;
+    uint16_t ar_count;
+} dns_header_t;
+
+// DNS Question Packet
+typedef struct __attribute__((__packed__))
+{
+    uint16_t type;
+    uint16_t class;
+} dns_question_t;
+
+// DNS Answer Packet
+typedef struct __attribute__((__packed__))
+{
+    uint16_t ptr_offset;
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t addr_len;
+    uint32_t ip_addr;
+} dns_answer_t;
+
+// SOA record sent in the authority section of empty answers, so clients
+// cache the negative answer (RFC 2308) instead of retrying
+typedef struct __attribute__((__packed__))
+{
+    uint16_t ptr_offset;
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t data_len;
+    uint8_t mname;          // Root name
+    uint8_t rname;          // Root name
+    uint32_t serial;
+    uint32_t refresh;
+    uint32_t retry;
+    uint32_t expire;
+    uint32_t minimum;       // Negative caching TTL
+} dns_soa_t;
+
+// Reply to a question, built once and replayed while the question repeats
+typedef struct
+{
+    uint32_t last_used;     // Cache clock value of the last hit, 0 for a free entry
+    uint32_t generation;    // s_ap_ip_generation the reply was built with
+    uint16_t question_len;
+    uint16_t an_count;
+    uint16_t ns_count;
+    uint16_t tail_len;
+    uint8_t question[DNS_CACHE_QUESTION_MAX];
+    uint8_t tail[DNS_CACHE_TAIL_MAX];
+} dns_cache_entry_t;
+
+// softAP address in network order, refreshed on Wi-Fi/IP events instead of per query
+static volatile uint32_t s_ap_ip_addr = 0;
+// Bumped whenever the address changes, so cached replies are rebuilt
+static volatile uint32_t s_ap_ip_generation = 1;
+
+// Only used by the DNS task
+static dns_cache_entry_t s_cache[DNS_CACHE_ENTRIES];
+static uint32_t s_cache_clock = 0;
+
+// Every A answer is this template plus the name pointer and the current AP address
+static const dns_answer_t s_answer_template = {
+    .type = PP_HTONS(QD_TYPE_A),
+    .class = PP_HTONS(QD_CLASS_IN),
+    .ttl = PP_HTONL(ANS_TTL_SEC),
+    .addr_len = PP_HTONS(sizeof(uint32_t)),
+};
+
+static const dns_soa_t s_soa_template = {
+    .type = PP_HTONS(QD_TYPE_SOA),
+    .class = PP_HTONS(QD_CLASS_IN),
+    .ttl = PP_HTONL(NEG_TTL_SEC),
+    .data_len = PP_HTONS(sizeof(dns_soa_t) - offsetof(dns_soa_t, mname)),
+    .serial = PP_HTONL(1),
+    .refresh = PP_HTONL(3600),
+    .retry = PP_HTONL(600),
+    .expire = PP_HTONL(86400),
+    .minimum = PP_HTONL(NEG_TTL_SEC),
+};
+
+void dns_set_answer_ip(uint32_t addr)
+{
+    if (addr != s_ap_ip_addr) {
+        s_ap_ip_addr = addr;
+        s_ap_ip_generation++;
+    }
+}
+
+uint32_t dns_get_answer_ip(void)
+{
+    return s_ap_ip_addr;
+}
+
+/*
+    Skips the name of a question in the packet without copying it
+    returns the offset of the first byte after the name, or -1 if the name is malformed
+*/
+static int skip_dns_name(const uint8_t *packet, int len, int offset)
+{
+    while (offset < len) {
+        uint8_t label_len = packet[offset];
+        if (label_len == 0) {
+            return offset + 1;
+        }
+        // Compression pointers are not used in questions of a query
+        if (label_len & 0xC0) {
+            return -1;
+        }
+        offset += label_len + 1;
+    }
+    return -1;
+}
+
+/*
+    Replays a cached reply if the request repeats a recently answered question.
+    Returns the reply length, or 0 on a cache miss
+*/
+static int dns_cache_reply(uint8_t *buf, int len, size_t buf_size)
+{
+    int question_len = len - (int)sizeof(dns_header_t);
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        dns_cache_entry_t *entry = &s_cache[i];
+        // A longer request may carry an EDNS record after the question, which the reply drops
+        if (entry->last_used == 0 || entry->generation != s_ap_ip_generation ||
+            entry->question_len > question_len ||
+            memcmp(buf + sizeof(dns_header_t), entry->question, entry->question_len) != 0) {
+            continue;
+        }
+
+        int reply_len = sizeof(dns_header_t) + entry->question_len + entry->tail_len;
+        if (reply_len > (int)buf_size) {
+            return 0;
+        }
+        dns_header_t *header = (dns_header_t *)buf;
+        header->flags = htons(DNS_FLAG_QR | (ntohs(header->flags) & DNS_FLAG_RD));
+        header->an_count = htons(entry->an_count);
+        header->ns_count = htons(entry->ns_count);
+        header->ar_count = 0;
+        memcpy(buf + sizeof(dns_header_t) + entry->question_len, entry->tail, entry->tail_len);
+        entry->last_used = ++s_cache_clock;
+        return reply_len;
+    }
+    return 0;
+}
+
+// Remembers the reply just built in buf for its (single) question
+static void dns_cache_store(const uint8_t *buf, int question_end, int reply_len)
+{
+    const dns_header_t *header = (const dns_header_t *)buf;
+    int question_len = question_end - (int)sizeof(dns_header_t);
+    int tail_len = reply_len - question_end;
+    if (question_len > DNS_CACHE_QUESTION_MAX || tail_len > DNS_CACHE_TAIL_MAX) {
+        return;
+    }
+
+    // Replace a free, stale or else the least recently used entry
+    dns_cache_entry_t *victim = &s_cache[0];
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        if (s_cache[i].last_used == 0 || s_cache[i].generation != s_ap_ip_generation) {
+            victim = &s_cache[i];
+            break;
+        }
+        if (s_cache[i].last_used < victim->last_used) {
+            victim = &s_cache[i];
+        }
+    }
+
+    victim->generation = s_ap_ip_generation;
+    victim->question_len = question_len;
+    victim->an_count = ntohs(header->an_count);
+    victim->ns_count = ntohs(header->ns_count);
+    victim->tail_len = tail_len;
+    memcpy(victim->question, buf + sizeof(dns_header_t), question_len);
+    memcpy(victim->tail, buf + question_end, tail_len);
+    victim->last_used = ++s_cache_clock;
+}
+
+int dns_build_reply(uint8_t *buf, int len, size_t buf_size)
+{
+    if (len < (int)sizeof(dns_header_t)) {
+        return -1;
+    }
+
+    // Endianess of NW packet different from chip
+    dns_header_t *header = (dns_header_t *)buf;
+    uint16_t flags = ntohs(header->flags);
+    uint16_t qd_count = ntohs(header->qd_count);
+    ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d", ntohs(header->id), flags, qd_count);
+
+    // Not a standard query
+    if ((flags & DNS_FLAG_QR) || DNS_OPCODE(flags) != 0 || qd_count == 0 || qd_count > DNS_MAX_QUESTIONS) {
+        return -1;
+    }
+
+    if (qd_count == 1) {
+        int reply_len = dns_cache_reply(buf, len, buf_size);
+        if (reply_len > 0) {
+            return reply_len;
+        }
+    }
+
+    // Find the questions that get an answer and the end of the question section
+    uint16_t a_name_offsets[DNS_MAX_QUESTIONS];
+    int an_count = 0;
+    int offset = sizeof(dns_header_t);
+    for (int i = 0; i < qd_count; i++) {
+        int name_offset = offset;
+        offset = skip_dns_name(buf, len, offset);
+        if (offset < 0 || offset + (int)sizeof(dns_question_t) > len) {
+            return -1;
+        }
+
+        dns_question_t question;
+        memcpy(&question, buf + offset, sizeof(question));
+        offset += sizeof(question);
+
+        if (ntohs(question.type) == QD_TYPE_A && ntohs(question.class) == QD_CLASS_IN) {
+            a_name_offsets[an_count++] = name_offset;
+        }
+    }
+    int question_end = offset;
+
+    int reply_len = offset + (an_count > 0 ? an_count * sizeof(dns_answer_t) : sizeof(dns_soa_t));
+    if (reply_len > (int)buf_size) {
+        return -1;
+    }
+
+    // Set question response flag, keep the id and the recursion desired bit
+    header->flags = htons(DNS_FLAG_QR | (flags & DNS_FLAG_RD));
+    header->an_count = htons(an_count);
+    header->ns_count = htons(an_count > 0 ? 0 : 1);
+    header->ar_count = 0;
+
+    if (an_count > 0) {
+        dns_answer_t answer = s_answer_template;
+        answer.ip_addr = s_ap_ip_addr;
+        for (int i = 0; i < an_count; i++) {
+            answer.ptr_offset = htons(0xC000 | a_name_offsets[i]);
+            memcpy(buf + offset, &answer, sizeof(answer));
+            offset += sizeof(answer);
+        }
+    } else {
+        // No data for this type: NOERROR with the negative caching TTL in the SOA
+        dns_soa_t soa = s_soa_template;
+        soa.ptr_offset = htons(0xC000 | sizeof(dns_header_t));
+        memcpy(buf + offset, &soa, sizeof(soa));
+    }
+
+    if (qd_count == 1) {
+        dns_cache_store(buf, question_end, reply_len);
+    }
+    return reply_len;
+}
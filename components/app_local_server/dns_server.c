@@ -9,10 +9,20 @@
 
 #include <sys/param.h>
 #include <inttypes.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "app_metrics.h"
+#include "dns_packet.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -20,143 +30,87 @@
 #include "lwip/netdb.h"
 
 #define DNS_PORT (53)
-#define DNS_MAX_LEN (256)
+#define DNS_MAX_LEN (512)           // Largest DNS message over plain UDP
+#define DNS_BATCH_MAX (8)           // Queries drained per wakeup before going back to select()
 
-#define OPCODE_MASK (0x7800)
-#define QR_FLAG (1 << 7)
-#define QD_TYPE_A (0x0001)
-#define ANS_TTL_SEC (300)
+#define DNS_RATE_CLIENTS (16)       // Source addresses tracked by the rate limiter
+#define DNS_RATE_QPS (20)           // Sustained queries per second per client
+#define DNS_RATE_BURST (40)         // Queries a client may send at once after being quiet
 
 static const char *TAG = "example_dns_redirect_server";
 
-// DNS Header Packet
-typedef struct __attribute__((__packed__))
-{
-    uint16_t id;
-    uint16_t flags;
-    uint16_t qd_count;
-    uint16_t an_count;
-    uint16_t ns_count;
-    uint16_t ar_count;
-} dns_header_t;
-
-// DNS Question Packet
-typedef struct {
-    uint16_t type;
-    uint16_t class;
-} dns_question_t;
-
-// DNS Answer Packet
-typedef struct __attribute__((__packed__))
-{
-    uint16_t ptr_offset;
-    uint16_t type;
-    uint16_t class;
-    uint32_t ttl;
-    uint16_t addr_len;
-    uint32_t ip_addr;
-} dns_answer_t;
+// Registered in start_dns_server(), per second rates are in the metrics output
+static app_metrics_counter_t *s_metric_queries = NULL;
+static app_metrics_counter_t *s_metric_rate_limited = NULL;
 
-/*
-    Parse the name from the packet from the DNS name format to a regular .-seperated name
-    returns the pointer to the next part of the packet
-*/
-static char *parse_dns_name(char *raw_name, char *parsed_name, size_t parsed_name_max_len)
+// Token bucket of one client, in thousandths of a query
+typedef struct
 {
+    uint32_t addr;
+    int64_t last_ms;
+    int32_t tokens;
+    bool limited;
+} dns_rate_bucket_t;
 
-    char *label = raw_name;
-    char *name_itr = parsed_name;
-    int name_len = 0;
-
-    do {
-        int sub_name_len = *label;
-        // (len + 1) since we are adding  a '.'
-        name_len += (sub_name_len + 1);
-        if (name_len > parsed_name_max_len) {
-            return NULL;
-        }
-
-        // Copy the sub name that follows the the label
-        memcpy(name_itr, label + 1, sub_name_len);
-        name_itr[sub_name_len] = '.';
-        name_itr += (sub_name_len + 1);
-        label += sub_name_len + 1;
-    } while (*label != 0);
-
-    // Terminate the final string, replacing the last '.'
-    parsed_name[name_len - 1] = '\0';
-    // Return pointer to first char after the name
-    return label + 1;
-}
+// Only used by the DNS task
+static dns_rate_bucket_t s_rate_buckets[DNS_RATE_CLIENTS];
 
-// Parses the DNS request and prepares a DNS response with the IP of the softAP
-static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t dns_reply_max_len)
+static void dns_refresh_ap_ip(void)
 {
-    if (req_len > dns_reply_max_len) {
-        return -1;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    if (netif != NULL && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
+        dns_set_answer_ip(ip_info.ip.addr);
+        ESP_LOGD(TAG, "Answering with AP IP 0x%" PRIX32, ip_info.ip.addr);
     }
+}
 
-    // Prepare the reply
-    memset(dns_reply, 0, dns_reply_max_len);
-    memcpy(dns_reply, req, req_len);
+static void dns_ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    dns_refresh_ap_ip();
+}
 
-    // Endianess of NW packet different from chip
-    dns_header_t *header = (dns_header_t *)dns_reply;
-    ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d",
-             ntohs(header->id), ntohs(header->flags), ntohs(header->qd_count));
+/*
+    Token bucket per source address. Returns false if the client is over its
+    rate and the query should be dropped
+*/
+static bool dns_rate_allow(uint32_t addr)
+{
+    int64_t now_ms = esp_timer_get_time() / 1000;
 
-    // Not a standard query
-    if ((header->flags & OPCODE_MASK) != 0) {
-        return 0;
+    // Find the client's bucket, or take over the one idle the longest
+    dns_rate_bucket_t *bucket = &s_rate_buckets[0];
+    for (int i = 0; i < DNS_RATE_CLIENTS; i++) {
+        if (s_rate_buckets[i].addr == addr) {
+            bucket = &s_rate_buckets[i];
+            break;
+        }
+        if (s_rate_buckets[i].last_ms < bucket->last_ms) {
+            bucket = &s_rate_buckets[i];
+        }
     }
-
-    // Set question response flag
-    header->flags |= QR_FLAG;
-
-    uint16_t qd_count = ntohs(header->qd_count);
-    header->an_count = htons(qd_count);
-
-    int reply_len = qd_count * sizeof(dns_answer_t) + req_len;
-    if (reply_len > dns_reply_max_len) {
-        return -1;
+    if (bucket->addr != addr) {
+        bucket->addr = addr;
+        bucket->tokens = DNS_RATE_BURST * 1000;
+        bucket->limited = false;
+    } else {
+        int64_t refill = (now_ms - bucket->last_ms) * DNS_RATE_QPS;
+        bucket->tokens = (int32_t)MIN((int64_t)bucket->tokens + refill, (int64_t)DNS_RATE_BURST * 1000);
     }
-
-    // Pointer to current answer and question
-    char *cur_ans_ptr = dns_reply + req_len;
-    char *cur_qd_ptr = dns_reply + sizeof(dns_header_t);
-    char name[128];
-
-    // Respond to all questions with the ESP32's IP address
-    for (int i = 0; i < qd_count; i++) {
-        char *name_end_ptr = parse_dns_name(cur_qd_ptr, name, sizeof(name));
-        if (name_end_ptr == NULL) {
-            ESP_LOGE(TAG, "Failed to parse DNS question: %s", cur_qd_ptr);
-            return -1;
-        }
-
-        dns_question_t *question = (dns_question_t *)(name_end_ptr);
-        uint16_t qd_type = ntohs(question->type);
-        uint16_t qd_class = ntohs(question->class);
-
-        ESP_LOGD(TAG, "Received type: %d | Class: %d | Question for: %s", qd_type, qd_class, name);
-
-        if (qd_type == QD_TYPE_A) {
-            dns_answer_t *answer = (dns_answer_t *)cur_ans_ptr;
-
-            answer->ptr_offset = htons(0xC000 | (cur_qd_ptr - dns_reply));
-            answer->type = htons(qd_type);
-            answer->class = htons(qd_class);
-            answer->ttl = htonl(ANS_TTL_SEC);
-
-            esp_netif_ip_info_t ip_info;
-            esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_AP_DEF"), &ip_info);
-            ESP_LOGD(TAG, "Answer with PTR offset: 0x%" PRIX16 " and IP 0x%" PRIX32, ntohs(answer->ptr_offset), ip_info.ip.addr);
-
-            answer->addr_len = htons(sizeof(ip_info.ip.addr));
-            answer->ip_addr = ip_info.ip.addr;
+    bucket->last_ms = now_ms;
+
+    if (bucket->tokens < 1000) {
+        if (!bucket->limited) {
+            char addr_str[16];
+            inet_ntoa_r(addr, addr_str, sizeof(addr_str));
+            ESP_LOGW(TAG, "Rate limiting DNS queries from %s", addr_str);
+            bucket->limited = true;
         }
+        return false;
     }
-    return reply_len;
+    bucket->tokens -= 1000;
+    bucket->limited = false;
+    return true;
 }
 
 /*
@@ -165,10 +119,9 @@ static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t
 */
 void dns_server_task(void *pvParameters)
 {
-    char rx_buffer[128];
-    char addr_str[128];
-    int addr_family;
-    int ip_protocol;
+    // One buffer holds the query and then the reply built over it
+    uint8_t packet[DNS_MAX_LEN];
+    char addr_str[16];
 
     while (1) {
 
@@ -176,11 +129,8 @@ void dns_server_task(void *pvParameters)
         dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
         dest_addr.sin_family = AF_INET;
         dest_addr.sin_port = htons(DNS_PORT);
-        addr_family = AF_INET;
-        ip_protocol = IPPROTO_IP;
-        inet_ntoa_r(dest_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
 
-        int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
+        int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
         if (sock < 0) {
             ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
             break;
@@ -191,44 +141,53 @@ void dns_server_task(void *pvParameters)
         if (err < 0) {
             ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
         }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
         ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
 
+        if (dns_get_answer_ip() == 0) {
+            dns_refresh_ap_ip();
+        }
+
         while (1) {
-            ESP_LOGI(TAG, "Waiting for data");
-            struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-            socklen_t socklen = sizeof(source_addr);
-            int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
-
-            // Error occurred during receiving
-            if (len < 0) {
-                ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-                close(sock);
+            fd_set read_fds;
+            FD_ZERO(&read_fds);
+            FD_SET(sock, &read_fds);
+            if (select(sock + 1, &read_fds, NULL, NULL, NULL) < 0) {
+                ESP_LOGE(TAG, "select failed: errno %d", errno);
                 break;
             }
-            // Data received
-            else {
-                // Get the sender's ip address as string
-                if (source_addr.sin6_family == PF_INET) {
-                    inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                } else if (source_addr.sin6_family == PF_INET6) {
-                    inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-                }
 
-                // Null-terminate whatever we received and treat like a string...
-                rx_buffer[len] = 0;
+            // Drain what queued up while we were asleep, a burst of phones joining
+            // gets answered in one wakeup
+            for (int i = 0; i < DNS_BATCH_MAX; i++) {
+                struct sockaddr_in source_addr;
+                socklen_t socklen = sizeof(source_addr);
+                int len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&source_addr, &socklen);
+                if (len < 0) {
+                    if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                        ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+                    }
+                    break;
+                }
 
-                char reply[DNS_MAX_LEN];
-                int reply_len = parse_dns_request(rx_buffer, len, reply, DNS_MAX_LEN);
+                app_metrics_count(s_metric_queries, 1);
+                if (!dns_rate_allow(source_addr.sin_addr.s_addr)) {
+                    app_metrics_count(s_metric_rate_limited, 1);
+                    continue;
+                }
 
-                ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
+                int reply_len = dns_build_reply(packet, len, sizeof(packet));
+                if (esp_log_level_get(TAG) >= ESP_LOG_DEBUG) {
+                    inet_ntoa_r(source_addr.sin_addr, addr_str, sizeof(addr_str));
+                    ESP_LOGD(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
+                }
                 if (reply_len <= 0) {
-                    ESP_LOGE(TAG, "Failed to prepare a DNS reply");
-                } else {
-                    int err = sendto(sock, reply, reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                    if (err < 0) {
-                        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                        break;
-                    }
+                    continue; // Malformed or not a query, nothing to answer
+                }
+
+                // A full send buffer only loses this reply, the client retries
+                if (sendto(sock, packet, reply_len, 0, (struct sockaddr *)&source_addr, socklen) < 0) {
+                    ESP_LOGW(TAG, "Error occurred during sending: errno %d", errno);
                 }
             }
         }
@@ -244,5 +203,12 @@ void dns_server_task(void *pvParameters)
 
 void start_dns_server(void)
 {
+    // The AP address only changes when the AP (re)starts or its netif is reconfigured
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_START, &dns_ip_event_handler, NULL);
+    esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, &dns_ip_event_handler, NULL);
+    dns_refresh_ap_ip();
+
+    s_metric_queries = app_metrics_counter("dns_queries_total", NULL, NULL);
+    s_metric_rate_limited = app_metrics_counter("dns_rate_limited_total", NULL, NULL);
     xTaskCreate(dns_server_task, "dns_server", 4096, NULL, 5, NULL);
 }
@@ -0,0 +1,157 @@
+/**
+ * @file http_arena.c
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cJSON.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "app_metrics.h"
+#include "http_arena.h"
+
+#ifndef CONFIG_HTTP_SERVER_ARENA_SIZE
+#define CONFIG_HTTP_SERVER_ARENA_SIZE 12288
+#endif
+
+#define HTTP_ARENA_ALIGN (sizeof(void *) > 4 ? sizeof(void *) : 4)
+
+static const char *TAG = "http_arena";
+
+static uint8_t http_arena[CONFIG_HTTP_SERVER_ARENA_SIZE] __attribute__((aligned(8)));
+static size_t http_arena_used = 0;
+static size_t http_arena_peak = 0;
+static TaskHandle_t http_arena_owner = NULL; // Task of the current request, NULL in between
+static app_metrics_counter_t *http_arena_metric_fallback = NULL;
+
+/**
+ * @brief cJSON allocator: the arena for the request task, the heap for everyone else
+ */
+static void *http_arena_cjson_malloc(size_t size)
+{
+    if (http_arena_owner != NULL && xTaskGetCurrentTaskHandle() == http_arena_owner)
+    {
+        void *ptr = http_arena_alloc(size);
+        if (ptr != NULL)
+        {
+            return ptr;
+        }
+        app_metrics_count(http_arena_metric_fallback, 1);
+    }
+    return malloc(size);
+}
+
+/**
+ * @brief cJSON free: arena memory is only released by http_arena_end()
+ */
+static void http_arena_cjson_free(void *ptr)
+{
+    if ((uint8_t *)ptr >= http_arena && (uint8_t *)ptr < http_arena + sizeof(http_arena))
+    {
+        return;
+    }
+    free(ptr);
+}
+
+void http_arena_init(void)
+{
+    http_arena_metric_fallback = app_metrics_counter("http_arena_fallback_total", NULL, NULL);
+
+    cJSON_Hooks hooks = {
+        .malloc_fn = http_arena_cjson_malloc,
+        .free_fn = http_arena_cjson_free,
+    };
+    cJSON_InitHooks(&hooks);
+}
+
+void http_arena_begin(void)
+{
+    http_arena_used = 0;
+    http_arena_owner = xTaskGetCurrentTaskHandle();
+}
+
+void http_arena_end(void)
+{
+    if (http_arena_used > http_arena_peak)
+    {
+        http_arena_peak = http_arena_used;
+        ESP_LOGD(TAG, "New peak: %u of %u bytes", (unsigned)http_arena_peak, (unsigned)sizeof(http_arena));
+    }
+    http_arena_owner = NULL;
+    http_arena_used = 0;
+}
+
+void *http_arena_alloc(size_t size)
+{
+    size_t aligned = (size + HTTP_ARENA_ALIGN - 1) & ~(HTTP_ARENA_ALIGN - 1);
+    if (http_arena_owner == NULL || aligned < size || aligned > sizeof(http_arena) - http_arena_used)
+    {
+        return NULL;
+    }
+    void *ptr = &http_arena[http_arena_used];
+    http_arena_used += aligned;
+    return ptr;
+}
+
+esp_err_t http_json_writer_init(http_json_writer_t *w, size_t size)
+{
+    *w = (http_json_writer_t){0};
+    w->buf = http_arena_alloc(size);
+    if (w->buf == NULL)
+    {
+        ESP_LOGE(TAG, "No room for a %u byte response", (unsigned)size);
+        return ESP_ERR_NO_MEM;
+    }
+    w->size = size;
+    w->buf[0] = '\0';
+    return ESP_OK;
+}
+
+void http_json_append(http_json_writer_t *w, const char *fmt, ...)
+{
+    if (w->overflow)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(w->buf + w->len, w->size - w->len, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= w->size - w->len)
+    {
+        w->overflow = true;
+        w->buf[w->len] = '\0';
+        return;
+    }
+    w->len += n;
+}
+
+void http_json_append_string(http_json_writer_t *w, const char *str)
+{
+    size_t start = w->len;
+    http_json_append(w, "\"");
+    for (const char *c = str; *c != '\0' && !w->overflow; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            http_json_append(w, "\\%c", *c);
+        }
+        else if ((unsigned char)*c < 0x20)
+        {
+            http_json_append(w, "\\u%04x", (unsigned char)*c);
+        }
+        else
+        {
+            http_json_append(w, "%c", *c);
+        }
+    }
+    http_json_append(w, "\"");
+    if (w->overflow)
+    {
+        w->len = start; // Never leave half a string behind
+        w->buf[start] = '\0';
+    }
+}
@@ -48,8 +48,31 @@ typedef struct http_server_q_msg
 
 void http_server_fw_update_reset_cb(void *arg);
 
+/*
+ * Callback telling the application that app_local_server_process() has
+ * messages to handle. Called from the task that queued the message.
+ */
+typedef void (*app_local_server_work_cb_t)(void);
+
 bool app_local_server_init(void);
 bool app_local_server_start(void);
+
+/*
+ * Handles the queued monitor messages, returns without waiting if there are none.
+ * @return true if at least one message was handled
+ */
 bool app_local_server_process(void);
 
+/*
+ * Registers the callback used to request an app_local_server_process() call,
+ * NULL to go back to polling.
+ */
+void app_local_server_set_work_callback(app_local_server_work_cb_t callback);
+
+/*
+ * Queues a message for the HTTP Monitor, e.g. HTTP_MSG_TIME_SERVICE_INITIALIZED.
+ * @return true if the message was queued
+ */
+bool app_local_server_post_msg(http_server_msg_e msg_id);
+
 #endif // APP_LOCAL_SERVER_H
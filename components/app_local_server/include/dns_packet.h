@@ -0,0 +1,54 @@
+/* Captive Portal Example
+
+    This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+    Unless required by applicable law or agreed to in writing, this
+    software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+    CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Sets the address every A question is answered with
+ *
+ * Replies cached for an earlier address are not replayed any more.
+ *
+ * @param addr IPv4 address in network order
+ */
+void dns_set_answer_ip(uint32_t addr);
+
+/**
+ * @brief The address set with dns_set_answer_ip(), 0 before the first call
+ */
+uint32_t dns_get_answer_ip(void);
+
+/**
+ * @brief Turns the DNS request in buf into the reply, in place
+ *
+ * The question section is kept, everything after it is replaced by one
+ * answer per A question with the address of dns_set_answer_ip(). Questions
+ * for other types (AAAA, HTTPS, ...) get an empty answer with an SOA record,
+ * so clients cache it and stop asking. Replies to single questions are
+ * cached and replayed. Not thread safe, only the DNS task calls it.
+ *
+ * Works on the received bytes only, without sockets, so it also builds for
+ * the ESP-IDF Linux target (see host_test/).
+ *
+ * @param buf Request, overwritten with the reply
+ * @param len Length of the request
+ * @param buf_size Size of buf
+ * @return int Length of the reply, or -1 to drop the packet
+ */
+int dns_build_reply(uint8_t *buf, int len, size_t buf_size);
+
+#ifdef __cplusplus
+}
+#endif
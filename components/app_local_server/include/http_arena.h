@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Per-request memory for the HTTP handlers.
+ *
+ * One static arena of CONFIG_HTTP_SERVER_ARENA_SIZE bytes backs every
+ * request: http_arena_begin() hands it to the calling task, allocations bump
+ * a pointer and http_arena_end() drops everything at once. Since the server
+ * runs one request at a time on its own task, the heap never sees the short
+ * lived request buffers and cJSON trees, so it does not fragment over long
+ * uptimes.
+ *
+ * cJSON is hooked with cJSON_InitHooks(): nodes and strings allocated by the
+ * arena owner come from the arena, other tasks (AWS IoT) keep using the heap.
+ * An allocation that does not fit falls back to the heap and is counted in
+ * http_arena_fallback_total.
+ */
+
+/**
+ * @brief Install the cJSON hooks, called once before the server starts
+ */
+void http_arena_init(void);
+
+/**
+ * @brief Start a request: the calling task owns the empty arena until http_arena_end()
+ */
+void http_arena_begin(void);
+
+/**
+ * @brief End the request, everything allocated from the arena is released
+ */
+void http_arena_end(void);
+
+/**
+ * @brief Allocate from the arena of the current request
+ * @param size Bytes needed, the result is aligned for any type
+ * @return The memory, or NULL outside a request or when the arena is exhausted
+ */
+void *http_arena_alloc(size_t size);
+
+/**
+ * @brief Fixed-size JSON writer for responses, see http_json_writer_init()
+ *
+ * Appends that do not fit set overflow and leave the text as it was, so a
+ * response is either complete or reported as too large.
+ */
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} http_json_writer_t;
+
+/**
+ * @brief Set up a writer with a buffer of size bytes from the arena
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the arena has no room
+ */
+esp_err_t http_json_writer_init(http_json_writer_t *w, size_t size);
+
+/**
+ * @brief Append formatted text as is
+ */
+void http_json_append(http_json_writer_t *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Append str as a quoted and escaped JSON string
+ */
+void http_json_append_string(http_json_writer_t *w, const char *str);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+#
+# Gzips the web page assets for embedding and writes web_assets.h, the asset
+# table served by the static asset handler of app_local_server.c.
+#
+# Usage: compress_webpage.py <out_dir> <header> <asset> [<asset> ...]
+#
+# Every asset is served at "/<file name>", index.html also at "/". The header
+# provides:
+#   WEB_ASSETS(X)        X(symbol, mime_type, etag) for every asset, where the
+#                        embedded blob is _binary_<symbol>_gz_start/_end and
+#                        etag is a strong ETag derived from the content hash
+#   WEB_ASSET_ROUTES     open addressed hash table of { uri, asset index },
+#                        slot = fnv1a(uri) & (WEB_ASSET_ROUTE_SLOTS - 1),
+#                        linear probing, empty slots are { NULL, -1 }
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+MIME_TYPES = {
+    '.html': 'text/html',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+    '.json': 'application/json',
+    '.ico': 'image/x-icon',
+    '.png': 'image/png',
+    '.svg': 'image/svg+xml',
+}
+
+
+def fnv1a(data: bytes) -> int:
+    h = 0x811C9DC5
+    for b in data:
+        h = ((h ^ b) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def main() -> int:
+    if len(sys.argv) < 4:
+        print('usage: compress_webpage.py <out_dir> <header> <asset> [<asset> ...]', file=sys.stderr)
+        return 1
+
+    out_dir, header_path, assets = sys.argv[1], sys.argv[2], sys.argv[3:]
+    os.makedirs(out_dir, exist_ok=True)
+
+    entries = []
+    routes = []
+    for index, asset in enumerate(assets):
+        with open(asset, 'rb') as f:
+            raw = f.read()
+
+        # mtime=0 keeps the output, and so the firmware image, reproducible
+        compressed = gzip.compress(raw, compresslevel=9, mtime=0)
+        name = os.path.basename(asset)
+        with open(os.path.join(out_dir, name + '.gz'), 'wb') as f:
+            f.write(compressed)
+
+        symbol = re.sub(r'[^A-Za-z0-9]', '_', name)
+        mime = MIME_TYPES.get(os.path.splitext(name)[1].lower(), 'application/octet-stream')
+        etag = hashlib.sha256(raw).hexdigest()[:16]
+        entries.append('    X(%s, "%s", "\\"%s\\"")' % (symbol, mime, etag))
+
+        routes.append(('/' + name, index))
+        if name == 'index.html':
+            routes.append(('/', index))
+
+    # Keep the table at most half full so probes stay short
+    slots = 1
+    while slots < 2 * len(routes):
+        slots *= 2
+    table = [None] * slots
+    for uri, index in routes:
+        slot = fnv1a(uri.encode()) & (slots - 1)
+        while table[slot] is not None:
+            slot = (slot + 1) & (slots - 1)
+        table[slot] = (uri, index)
+
+    lines = ['// Generated by compress_webpage.py, do not edit', '#pragma once', '']
+    lines.append('#define WEB_ASSETS(X) \\')
+    lines.append(' \\\n'.join(entries))
+    lines.append('')
+    lines.append('#define WEB_ASSET_ROUTE_SLOTS %d' % slots)
+    lines.append('#define WEB_ASSET_ROUTES { \\')
+    for route in table:
+        if route is None:
+            lines.append('    { NULL, -1 }, \\')
+        else:
+            lines.append('    { "%s", %d }, \\' % route)
+    lines.append('}')
+    lines.append('')
+
+    with open(header_path, 'w') as f:
+        f.write('\n'.join(lines))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
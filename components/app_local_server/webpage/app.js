@@ -76,14 +76,11 @@ function getFileInfo()
  */
 function updateFirmware() 
 {
-  // Form Data
-  var formData = new FormData();
   var fileSelect = document.getElementById("selected_file");
   
   if (fileSelect.files && fileSelect.files.length == 1) 
   {
     var file = fileSelect.files[0];
-    formData.set("file", file, file.name);
     document.getElementById("ota_update_status").innerHTML = "Uploading " + file.name + ", Firmware Update in Progress...";
 
     // Http Request
@@ -92,7 +89,9 @@ function updateFirmware()
     request.upload.addEventListener("progress", updateProgress);
     request.open('POST', "/OTAupdate");
     request.responseType = "blob";
-    request.send(formData);
+    // Send the raw image, so the server can write it without parsing a multipart body
+    request.setRequestHeader("Content-Type", "application/octet-stream");
+    request.send(file);
   }
   else 
   {
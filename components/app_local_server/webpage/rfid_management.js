@@ -5,6 +5,10 @@
 
 // Global variables
 var cardList = [];
+var CARD_PAGE_SIZE = 50;    // Cards requested per page from /cards/Get
+var cardPageOffset = 0;     // Offset of the first card on the current page
+var cardListTotal = 0;      // Number of cards matching the current search
+var cardNameFilter = "";    // Name prefix the list is filtered by
 
 /**
  * Initialize functions when the document is ready
@@ -20,11 +24,34 @@ $(document).ready(function() {
     addCard();
   });
 
+  $("#cardSearchForm").on("submit", function(e) {
+    e.preventDefault();
+    cardNameFilter = $("#cardSearch").val().trim();
+    cardPageOffset = 0;
+    loadCardList();
+  });
+
+  $("#prevPageBtn").on("click", function() {
+    cardPageOffset = Math.max(0, cardPageOffset - CARD_PAGE_SIZE);
+    loadCardList();
+  });
+
+  $("#nextPageBtn").on("click", function() {
+    if (cardPageOffset + CARD_PAGE_SIZE < cardListTotal) {
+      cardPageOffset += CARD_PAGE_SIZE;
+      loadCardList();
+    }
+  });
+
   $("#checkCardForm").on("submit", function(e) {
     e.preventDefault();
     checkCard();
   });
 
+  $("#importCardsBtn").on("click", function() {
+    importCards();
+  });
+
   $("#resetDatabaseBtn").on("click", function() {
     showResetConfirmation();
   });
@@ -60,13 +87,26 @@ function getCardCount() {
 }
 
 /**
- * Loads the list of RFID cards from the server
+ * Loads the current page of RFID cards from the server
  */
 function loadCardList() {
-  $.getJSON('/cards/Get', function(data) {
+  var query = { offset: cardPageOffset, limit: CARD_PAGE_SIZE };
+  if (cardNameFilter !== "") {
+    query.name_prefix = cardNameFilter;
+  }
+
+  $.getJSON('/cards/Get', query, function(data) {
     if (data && data.cards) {
       cardList = data.cards;
+      cardListTotal = data.total;
+      // Step back if the page emptied, e.g. after deleting its last card
+      if (cardList.length === 0 && cardPageOffset > 0 && cardListTotal > 0) {
+        cardPageOffset = Math.max(0, cardPageOffset - CARD_PAGE_SIZE);
+        loadCardList();
+        return;
+      }
       renderCardTable();
+      renderPageControls();
     } else {
       console.error("Unexpected response format from /cards/Get");
       $("#cardTableBody").html("<tr><td colspan='3'>Error loading card data</td></tr>");
@@ -115,6 +155,17 @@ function renderCardTable() {
   });
 }
 
+/**
+ * Updates the page label and enables the previous/next buttons
+ */
+function renderPageControls() {
+  var first = cardListTotal === 0 ? 0 : cardPageOffset + 1;
+  var last = cardPageOffset + cardList.length;
+  $("#pageInfo").text(first + "-" + last + " of " + cardListTotal);
+  $("#prevPageBtn").prop("disabled", cardPageOffset === 0);
+  $("#nextPageBtn").prop("disabled", last >= cardListTotal);
+}
+
 /**
  * Adds a new RFID card to the database
  */
@@ -263,6 +314,40 @@ function resetDatabase() {
   });
 }
 
+/**
+ * Uploads a backup file from /cards/Export to /cards/Import
+ */
+function importCards() {
+  var file = $("#importFile")[0].files[0];
+  if (!file) {
+    alert("Please choose a backup file first");
+    return;
+  }
+
+  $.ajax({
+    url: '/cards/Import',
+    type: 'POST',
+    data: file,
+    processData: false,
+    contentType: 'application/octet-stream',
+    dataType: 'json',
+    complete: function(xhr) {
+      var result = xhr.responseJSON;
+      if (result && result.added !== undefined) {
+        if (xhr.status === 507) {
+          alert("Not enough free slots for the " + result.skipped + " cards of the backup, nothing imported");
+        } else {
+          alert("Imported " + result.added + " cards, skipped " + result.skipped);
+        }
+      } else {
+        alert("Failed to import cards: " + xhr.statusText);
+      }
+      getCardCount();
+      loadCardList();
+    }
+  });
+}
+
 /**
  * Shows the reset confirmation modal
  */
@@ -0,0 +1,463 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "app_metrics.h"
+
+// Without CONFIG_APP_METRICS_ENABLE, app_metrics.h provides empty inline stubs
+#ifdef CONFIG_APP_METRICS_ENABLE
+
+#include "esp_timer.h"
+
+static const char *TAG = "app_metrics";
+
+#ifndef CONFIG_APP_METRICS_MAX_HISTOGRAMS
+#define CONFIG_APP_METRICS_MAX_HISTOGRAMS 40
+#endif
+#ifndef CONFIG_APP_METRICS_MAX_COUNTERS
+#define CONFIG_APP_METRICS_MAX_COUNTERS 16
+#endif
+
+#define METRICS_RATE_PERIOD_US (1000 * 1000)
+#define METRICS_PIECE_MAX      192 // Longest formatted piece: one bucket list or one Prometheus line
+
+struct app_metrics_histogram {
+    const char *name;
+    const char *label_key;
+    const char *label_value;
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[APP_METRICS_NUM_BUCKETS];
+};
+
+struct app_metrics_counter {
+    const char *name;
+    const char *label_key;
+    const char *label_value;
+    uint64_t value;
+    uint64_t last_value; // value at the previous rate tick
+    uint32_t per_s;      // Increase over the last second
+};
+
+// Upper bucket bounds in us, the last bucket has none (+Inf)
+static const uint32_t s_bounds_us[APP_METRICS_NUM_BUCKETS - 1] = {
+    16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304,
+};
+
+#ifdef CONFIG_APP_METRICS_SAMPLE_ON_BOOT
+volatile bool app_metrics_sampling_enabled = true;
+#else
+volatile bool app_metrics_sampling_enabled = false;
+#endif
+
+// Every field below, and the values of every registered series
+static portMUX_TYPE s_metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct app_metrics_histogram s_histograms[CONFIG_APP_METRICS_MAX_HISTOGRAMS];
+static struct app_metrics_counter s_counters[CONFIG_APP_METRICS_MAX_COUNTERS];
+static uint16_t s_num_histograms = 0;
+static uint16_t s_num_counters = 0;
+static esp_timer_handle_t s_rate_timer = NULL;
+
+typedef struct {
+    app_metrics_write_cb_t write;
+    void *ctx;
+    bool failed;
+} metrics_writer_t;
+
+/**
+ * @brief Bucket of a sample: the first bound >= us, computed from its bit length
+ */
+static uint32_t metrics_bucket(uint32_t us)
+{
+    if (us <= s_bounds_us[0]) {
+        return 0;
+    }
+    uint32_t bits = 32 - __builtin_clz(us - 1); // Bits needed for us - 1, bound k is 2^(4 + 2k)
+    uint32_t bucket = (bits - 3) / 2;
+    return bucket < APP_METRICS_NUM_BUCKETS - 1 ? bucket : APP_METRICS_NUM_BUCKETS - 1;
+}
+
+static bool metrics_same_series(const char *name, const char *label_key, const char *label_value,
+                                const char *other_name, const char *other_key, const char *other_value)
+{
+    if (strcmp(name, other_name) != 0 || (label_key == NULL) != (other_key == NULL)) {
+        return false;
+    }
+    return label_key == NULL || (strcmp(label_key, other_key) == 0 && strcmp(label_value, other_value) == 0);
+}
+
+/**
+ * @brief Latches the per second increase of every counter
+ */
+static void metrics_rate_timer_cb(void *arg)
+{
+    portENTER_CRITICAL(&s_metrics_lock);
+    for (uint16_t i = 0; i < s_num_counters; i++) {
+        s_counters[i].per_s = (uint32_t)(s_counters[i].value - s_counters[i].last_value);
+        s_counters[i].last_value = s_counters[i].value;
+    }
+    portEXIT_CRITICAL(&s_metrics_lock);
+}
+
+esp_err_t app_metrics_init(void)
+{
+    if (s_rate_timer != NULL) {
+        return ESP_OK;
+    }
+
+    const esp_timer_create_args_t args = {
+        .callback = metrics_rate_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "metrics_rate",
+    };
+    if (esp_timer_create(&args, &s_rate_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create rate timer");
+        s_rate_timer = NULL;
+        return ESP_FAIL;
+    }
+    if (app_metrics_sampling_enabled) {
+        esp_timer_start_periodic(s_rate_timer, METRICS_RATE_PERIOD_US);
+    }
+    ESP_LOGI(TAG, "Metrics ready, sampling %s", app_metrics_sampling_enabled ? "on" : "off");
+    return ESP_OK;
+}
+
+app_metrics_histogram_t *app_metrics_histogram(const char *name, const char *label_key, const char *label_value)
+{
+    if (name == NULL || (label_key != NULL && label_value == NULL)) {
+        return NULL;
+    }
+
+    app_metrics_histogram_t *histogram = NULL;
+    portENTER_CRITICAL(&s_metrics_lock);
+    for (uint16_t i = 0; i < s_num_histograms && histogram == NULL; i++) {
+        if (metrics_same_series(name, label_key, label_value,
+                                s_histograms[i].name, s_histograms[i].label_key, s_histograms[i].label_value)) {
+            histogram = &s_histograms[i];
+        }
+    }
+    if (histogram == NULL && s_num_histograms < CONFIG_APP_METRICS_MAX_HISTOGRAMS) {
+        histogram = &s_histograms[s_num_histograms++];
+        histogram->name = name;
+        histogram->label_key = label_key;
+        histogram->label_value = label_value;
+    }
+    portEXIT_CRITICAL(&s_metrics_lock);
+
+    if (histogram == NULL) {
+        ESP_LOGW(TAG, "No room for histogram %s, raise APP_METRICS_MAX_HISTOGRAMS", name);
+    }
+    return histogram;
+}
+
+app_metrics_counter_t *app_metrics_counter(const char *name, const char *label_key, const char *label_value)
+{
+    if (name == NULL || (label_key != NULL && label_value == NULL)) {
+        return NULL;
+    }
+
+    app_metrics_counter_t *counter = NULL;
+    portENTER_CRITICAL(&s_metrics_lock);
+    for (uint16_t i = 0; i < s_num_counters && counter == NULL; i++) {
+        if (metrics_same_series(name, label_key, label_value,
+                                s_counters[i].name, s_counters[i].label_key, s_counters[i].label_value)) {
+            counter = &s_counters[i];
+        }
+    }
+    if (counter == NULL && s_num_counters < CONFIG_APP_METRICS_MAX_COUNTERS) {
+        counter = &s_counters[s_num_counters++];
+        counter->name = name;
+        counter->label_key = label_key;
+        counter->label_value = label_value;
+    }
+    portEXIT_CRITICAL(&s_metrics_lock);
+
+    if (counter == NULL) {
+        ESP_LOGW(TAG, "No room for counter %s, raise APP_METRICS_MAX_COUNTERS", name);
+    }
+    return counter;
+}
+
+void app_metrics_observe(app_metrics_histogram_t *histogram, uint32_t us)
+{
+    if (histogram == NULL || !app_metrics_sampling_enabled) {
+        return;
+    }
+
+    uint32_t bucket = metrics_bucket(us);
+    portENTER_CRITICAL(&s_metrics_lock);
+    histogram->count++;
+    histogram->sum_us += us;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+    histogram->buckets[bucket]++;
+    portEXIT_CRITICAL(&s_metrics_lock);
+}
+
+void app_metrics_count(app_metrics_counter_t *counter, uint32_t n)
+{
+    if (counter == NULL || !app_metrics_sampling_enabled) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_metrics_lock);
+    counter->value += n;
+    portEXIT_CRITICAL(&s_metrics_lock);
+}
+
+void app_metrics_set_sampling(bool enabled)
+{
+    if (enabled == app_metrics_sampling_enabled) {
+        return;
+    }
+
+    app_metrics_sampling_enabled = enabled;
+    if (s_rate_timer != NULL) {
+        if (enabled) {
+            esp_timer_start_periodic(s_rate_timer, METRICS_RATE_PERIOD_US);
+        } else {
+            esp_timer_stop(s_rate_timer);
+        }
+    }
+    ESP_LOGI(TAG, "Sampling %s", enabled ? "on" : "off");
+}
+
+void app_metrics_reset(void)
+{
+    portENTER_CRITICAL(&s_metrics_lock);
+    for (uint16_t i = 0; i < s_num_histograms; i++) {
+        s_histograms[i].count = 0;
+        s_histograms[i].max_us = 0;
+        s_histograms[i].sum_us = 0;
+        memset(s_histograms[i].buckets, 0, sizeof(s_histograms[i].buckets));
+    }
+    for (uint16_t i = 0; i < s_num_counters; i++) {
+        s_counters[i].value = 0;
+        s_counters[i].last_value = 0;
+        s_counters[i].per_s = 0;
+    }
+    portEXIT_CRITICAL(&s_metrics_lock);
+}
+
+// --- Output ---
+
+/**
+ * @brief Formats one piece of output and hands it to the writer; does nothing once a write failed
+ */
+static void metrics_emit(metrics_writer_t *w, const char *fmt, ...)
+{
+    if (w->failed) {
+        return;
+    }
+
+    char piece[METRICS_PIECE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(piece, sizeof(piece), fmt, args);
+    va_end(args);
+
+    if (n < 0) {
+        w->failed = true;
+        return;
+    }
+    if ((size_t)n >= sizeof(piece)) {
+        n = sizeof(piece) - 1; // Only an absurdly long label gets here
+    }
+    if (!w->write(piece, (size_t)n, w->ctx)) {
+        w->failed = true;
+    }
+}
+
+static void metrics_snapshot_histogram(uint16_t i, struct app_metrics_histogram *out)
+{
+    portENTER_CRITICAL(&s_metrics_lock);
+    *out = s_histograms[i];
+    portEXIT_CRITICAL(&s_metrics_lock);
+}
+
+static void metrics_snapshot_counter(uint16_t i, struct app_metrics_counter *out)
+{
+    portENTER_CRITICAL(&s_metrics_lock);
+    *out = s_counters[i];
+    portEXIT_CRITICAL(&s_metrics_lock);
+}
+
+static void metrics_write_json(metrics_writer_t *w, bool summary, uint16_t num_histograms, uint16_t num_counters)
+{
+    struct app_metrics_histogram h;
+    struct app_metrics_counter c;
+
+    metrics_emit(w, "{\"uptime_ms\":%" PRIu32 ",\"sampling\":%s", (uint32_t)(esp_timer_get_time() / 1000),
+                 app_metrics_sampling_enabled ? "true" : "false");
+    if (!summary) {
+        metrics_emit(w, ",\"bounds_us\":[");
+        for (uint32_t b = 0; b < APP_METRICS_NUM_BUCKETS - 1; b++) {
+            metrics_emit(w, "%s%" PRIu32, b > 0 ? "," : "", s_bounds_us[b]);
+        }
+        metrics_emit(w, "]");
+    }
+
+    metrics_emit(w, ",\"histograms\":[");
+    bool comma = false;
+    for (uint16_t i = 0; i < num_histograms; i++) {
+        metrics_snapshot_histogram(i, &h);
+        if (summary && h.count == 0) {
+            continue;
+        }
+        metrics_emit(w, "%s{\"name\":\"%s\"", comma ? "," : "", h.name);
+        if (h.label_key != NULL) {
+            metrics_emit(w, ",\"%s\":\"%s\"", h.label_key, h.label_value);
+        }
+        metrics_emit(w, ",\"count\":%" PRIu32 ",\"sum_us\":%" PRIu64 ",\"max_us\":%" PRIu32,
+                     h.count, h.sum_us, h.max_us);
+        if (!summary) {
+            metrics_emit(w, ",\"buckets\":[");
+            for (uint32_t b = 0; b < APP_METRICS_NUM_BUCKETS; b++) {
+                metrics_emit(w, "%s%" PRIu32, b > 0 ? "," : "", h.buckets[b]);
+            }
+            metrics_emit(w, "]");
+        }
+        metrics_emit(w, "}");
+        comma = true;
+    }
+
+    metrics_emit(w, "],\"counters\":[");
+    comma = false;
+    for (uint16_t i = 0; i < num_counters; i++) {
+        metrics_snapshot_counter(i, &c);
+        if (summary && c.value == 0) {
+            continue;
+        }
+        metrics_emit(w, "%s{\"name\":\"%s\"", comma ? "," : "", c.name);
+        if (c.label_key != NULL) {
+            metrics_emit(w, ",\"%s\":\"%s\"", c.label_key, c.label_value);
+        }
+        metrics_emit(w, ",\"value\":%" PRIu64 ",\"per_s\":%" PRIu32 "}", c.value, c.per_s);
+        comma = true;
+    }
+    metrics_emit(w, "]}");
+}
+
+/**
+ * @brief Writes the Prometheus label set of a series, with an optional extra "le" label
+ */
+static void metrics_emit_labels(metrics_writer_t *w, const char *key, const char *value, const char *le)
+{
+    if (key != NULL && le != NULL) {
+        metrics_emit(w, "{%s=\"%s\",le=\"%s\"}", key, value, le);
+    } else if (key != NULL) {
+        metrics_emit(w, "{%s=\"%s\"}", key, value);
+    } else if (le != NULL) {
+        metrics_emit(w, "{le=\"%s\"}", le);
+    }
+}
+
+/**
+ * @brief Writes one histogram family: every series registered under the name of series first
+ *
+ * Prometheus wants all series of a family together, registration order may interleave them.
+ */
+static void metrics_write_prometheus_histograms(metrics_writer_t *w, uint16_t first, uint16_t num_histograms)
+{
+    struct app_metrics_histogram h;
+    char le[12];
+    const char *name = s_histograms[first].name; // Registered entries never change
+
+    metrics_emit(w, "# TYPE %s histogram\n", name);
+    for (uint16_t i = first; i < num_histograms; i++) {
+        if (strcmp(s_histograms[i].name, name) != 0) {
+            continue;
+        }
+        metrics_snapshot_histogram(i, &h);
+        uint32_t cumulative = 0;
+        for (uint32_t b = 0; b < APP_METRICS_NUM_BUCKETS; b++) {
+            cumulative += h.buckets[b];
+            if (b < APP_METRICS_NUM_BUCKETS - 1) {
+                snprintf(le, sizeof(le), "%" PRIu32, s_bounds_us[b]);
+            } else {
+                strcpy(le, "+Inf");
+            }
+            metrics_emit(w, "%s_bucket", name);
+            metrics_emit_labels(w, h.label_key, h.label_value, le);
+            metrics_emit(w, " %" PRIu32 "\n", cumulative);
+        }
+        metrics_emit(w, "%s_sum", name);
+        metrics_emit_labels(w, h.label_key, h.label_value, NULL);
+        metrics_emit(w, " %" PRIu64 "\n%s_count", h.sum_us, name);
+        metrics_emit_labels(w, h.label_key, h.label_value, NULL);
+        metrics_emit(w, " %" PRIu32 "\n", h.count);
+    }
+
+    metrics_emit(w, "# TYPE %s_max gauge\n", name);
+    for (uint16_t i = first; i < num_histograms; i++) {
+        if (strcmp(s_histograms[i].name, name) == 0) {
+            metrics_snapshot_histogram(i, &h);
+            metrics_emit(w, "%s_max", name);
+            metrics_emit_labels(w, h.label_key, h.label_value, NULL);
+            metrics_emit(w, " %" PRIu32 "\n", h.max_us);
+        }
+    }
+}
+
+static void metrics_write_prometheus(metrics_writer_t *w, uint16_t num_histograms, uint16_t num_counters)
+{
+    metrics_emit(w, "# TYPE uptime_ms gauge\nuptime_ms %" PRIu32 "\n", (uint32_t)(esp_timer_get_time() / 1000));
+
+    for (uint16_t i = 0; i < num_histograms; i++) {
+        bool seen = false;
+        for (uint16_t j = 0; j < i && !seen; j++) {
+            seen = strcmp(s_histograms[j].name, s_histograms[i].name) == 0;
+        }
+        if (!seen) {
+            metrics_write_prometheus_histograms(w, i, num_histograms);
+        }
+    }
+
+    struct app_metrics_counter c;
+    for (uint16_t i = 0; i < num_counters; i++) {
+        bool seen = false;
+        for (uint16_t j = 0; j < i && !seen; j++) {
+            seen = strcmp(s_counters[j].name, s_counters[i].name) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+        metrics_emit(w, "# TYPE %s counter\n", s_counters[i].name);
+        for (uint16_t j = i; j < num_counters; j++) {
+            if (strcmp(s_counters[j].name, s_counters[i].name) == 0) {
+                metrics_snapshot_counter(j, &c);
+                metrics_emit(w, "%s", c.name);
+                metrics_emit_labels(w, c.label_key, c.label_value, NULL);
+                metrics_emit(w, " %" PRIu64 "\n", c.value);
+            }
+        }
+    }
+}
+
+esp_err_t app_metrics_write(app_metrics_format_t format, app_metrics_write_cb_t write, void *ctx)
+{
+    if (write == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Series registered while writing are left for the next call
+    portENTER_CRITICAL(&s_metrics_lock);
+    uint16_t num_histograms = s_num_histograms;
+    uint16_t num_counters = s_num_counters;
+    portEXIT_CRITICAL(&s_metrics_lock);
+
+    metrics_writer_t w = {.write = write, .ctx = ctx, .failed = false};
+    if (format == APP_METRICS_FORMAT_PROMETHEUS) {
+        metrics_write_prometheus(&w, num_histograms, num_counters);
+    } else {
+        metrics_write_json(&w, format == APP_METRICS_FORMAT_JSON_SUMMARY, num_histograms, num_counters);
+    }
+    return w.failed ? ESP_FAIL : ESP_OK;
+}
+
+#endif // CONFIG_APP_METRICS_ENABLE
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#ifdef CONFIG_APP_METRICS_ENABLE
+#include "esp_timer.h" // For app_metrics_begin() / app_metrics_end()
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hot path metrics: latency histograms and event counters kept in a fixed
+ * table. Components register their series once (usually in their init
+ * function) and record into the returned handle from any task. A series is
+ * a name plus at most one label, e.g. http_request_us{uri="/cards/Get"}.
+ *
+ * Recording costs a branch on the sampling flag when sampling is off, and
+ * nothing at all when CONFIG_APP_METRICS_ENABLE is not set: every function
+ * below then compiles to an empty inline stub and handles are NULL.
+ *
+ * Histograms count microseconds into APP_METRICS_NUM_BUCKETS buckets with
+ * upper bounds 16, 64, 256 ... 4194304 us (each 4x the previous) and +Inf.
+ */
+#define APP_METRICS_NUM_BUCKETS 11
+
+typedef struct app_metrics_histogram app_metrics_histogram_t;
+typedef struct app_metrics_counter app_metrics_counter_t;
+
+typedef enum {
+    APP_METRICS_FORMAT_JSON,         // Every series with its buckets
+    APP_METRICS_FORMAT_JSON_SUMMARY, // Count, sum and max of the series with samples, for MQTT pushes
+    APP_METRICS_FORMAT_PROMETHEUS,   // Prometheus text exposition format 0.0.4
+} app_metrics_format_t;
+
+/**
+ * @brief Receives the output of app_metrics_write() piece by piece
+ * @return false to stop writing
+ */
+typedef bool (*app_metrics_write_cb_t)(const char *data, size_t len, void *ctx);
+
+#ifdef CONFIG_APP_METRICS_ENABLE
+
+extern volatile bool app_metrics_sampling_enabled; // Use app_metrics_set_sampling() to change
+
+/**
+ * @brief Start the once per second rate sampling of the counters, call early in app_main()
+ *
+ * Series can be registered and recorded before this call.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if the rate timer could not be created
+ */
+esp_err_t app_metrics_init(void);
+
+/**
+ * @brief Find or register a latency histogram
+ *
+ * Registering a series that already exists returns the existing handle, so
+ * components that are initialized again keep their samples.
+ *
+ * @param name Metric name, a string literal such as "http_request_us"
+ * @param label_key Label name, or NULL for a series without a label
+ * @param label_value Label value; a string that outlives the metrics and needs no JSON escaping
+ * @return Handle to record into, NULL once CONFIG_APP_METRICS_MAX_HISTOGRAMS are registered
+ */
+app_metrics_histogram_t *app_metrics_histogram(const char *name, const char *label_key, const char *label_value);
+
+/**
+ * @brief Find or register a counter, see app_metrics_histogram()
+ * @return Handle to count into, NULL once CONFIG_APP_METRICS_MAX_COUNTERS are registered
+ */
+app_metrics_counter_t *app_metrics_counter(const char *name, const char *label_key, const char *label_value);
+
+/**
+ * @brief Add one sample to a histogram
+ * @param histogram Handle from app_metrics_histogram(), NULL is ignored
+ * @param us Sample in microseconds
+ */
+void app_metrics_observe(app_metrics_histogram_t *histogram, uint32_t us);
+
+/**
+ * @brief Add to a counter while sampling is on
+ * @param counter Handle from app_metrics_counter(), NULL is ignored
+ * @param n Amount to add
+ */
+void app_metrics_count(app_metrics_counter_t *counter, uint32_t n);
+
+/**
+ * @brief Start timing an operation
+ * @return Start time for app_metrics_end(), 0 while sampling is off
+ */
+static inline int64_t app_metrics_begin(void)
+{
+    return app_metrics_sampling_enabled ? esp_timer_get_time() : 0;
+}
+
+/**
+ * @brief Record the time since app_metrics_begin() into a histogram
+ * @param histogram Handle from app_metrics_histogram(), NULL is ignored
+ * @param begin Value returned by app_metrics_begin(); 0 records nothing
+ */
+static inline void app_metrics_end(app_metrics_histogram_t *histogram, int64_t begin)
+{
+    if (begin != 0) {
+        app_metrics_observe(histogram, (uint32_t)(esp_timer_get_time() - begin));
+    }
+}
+
+/**
+ * @brief Turn sampling on or off at run time, the recorded values are kept
+ */
+void app_metrics_set_sampling(bool enabled);
+
+/**
+ * @brief Clear every histogram and counter, the registrations are kept
+ */
+void app_metrics_reset(void);
+
+/**
+ * @brief Format every registered series
+ *
+ * Each series is copied under the metrics lock and formatted outside of it,
+ * so a slow writer never blocks the recording tasks.
+ *
+ * @param format Output format
+ * @param write Called with each piece of output, in order
+ * @param ctx Passed to write
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if write is NULL,
+ *         ESP_FAIL if write returned false
+ */
+esp_err_t app_metrics_write(app_metrics_format_t format, app_metrics_write_cb_t write, void *ctx);
+
+#else // CONFIG_APP_METRICS_ENABLE
+
+static inline esp_err_t app_metrics_init(void) { return ESP_OK; }
+static inline app_metrics_histogram_t *app_metrics_histogram(const char *name, const char *label_key, const char *label_value)
+{
+    return NULL;
+}
+static inline app_metrics_counter_t *app_metrics_counter(const char *name, const char *label_key, const char *label_value)
+{
+    return NULL;
+}
+static inline void app_metrics_observe(app_metrics_histogram_t *histogram, uint32_t us) {}
+static inline void app_metrics_count(app_metrics_counter_t *counter, uint32_t n) {}
+static inline int64_t app_metrics_begin(void) { return 0; }
+static inline void app_metrics_end(app_metrics_histogram_t *histogram, int64_t begin) {}
+static inline void app_metrics_set_sampling(bool enabled) {}
+static inline void app_metrics_reset(void) {}
+static inline esp_err_t app_metrics_write(app_metrics_format_t format, app_metrics_write_cb_t write, void *ctx)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif // CONFIG_APP_METRICS_ENABLE
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_app_format.h"
+#include "nvs.h"
+#include "nvs_storage.h"
+#include "app_ota.h"
+
+static const char *TAG = "app_ota";
+
+#ifndef CONFIG_APP_OTA_BUFFER_SIZE
+#define CONFIG_APP_OTA_BUFFER_SIZE 4096
+#endif
+
+#ifndef CONFIG_APP_OTA_HTTP_TIMEOUT_MS
+#define CONFIG_APP_OTA_HTTP_TIMEOUT_MS 10000
+#endif
+
+#ifndef CONFIG_APP_OTA_CHECKPOINT_KB
+#define CONFIG_APP_OTA_CHECKPOINT_KB 64
+#endif
+
+#ifndef CONFIG_APP_OTA_MAX_RETRIES
+#define CONFIG_APP_OTA_MAX_RETRIES 10
+#endif
+
+#ifndef CONFIG_APP_OTA_RETRY_DELAY_MS
+#define CONFIG_APP_OTA_RETRY_DELAY_MS 5000
+#endif
+
+#ifndef CONFIG_APP_OTA_TASK_STACK_SIZE
+#define CONFIG_APP_OTA_TASK_STACK_SIZE 8192
+#endif
+
+#ifndef CONFIG_APP_OTA_TASK_PRIORITY
+#define CONFIG_APP_OTA_TASK_PRIORITY 5
+#endif
+
+#define APP_OTA_PROGRESS_KEY     "ota_progress"
+#define APP_OTA_PROGRESS_VERSION 1
+#define APP_OTA_URL_LEN          256
+#define APP_OTA_ETAG_LEN         64
+#define APP_OTA_ONLINE_BIT       BIT0  // The station has an IP address
+
+// Download progress as persisted in NVS. Only whole erase sectors below
+// 'checkpoint' are trusted after a reset; the sector at the checkpoint is
+// erased and written again when the download resumes.
+typedef struct {
+    uint32_t version;
+    uint32_t partition_address;   // Target partition, the record is dropped if it changes
+    uint32_t image_size;          // Total image size, 0 until the first response
+    uint32_t checkpoint;          // Sector aligned number of bytes known to be on flash
+    char etag[APP_OTA_ETAG_LEN];  // Strong ETag of the image, sent as If-Range
+    char url[APP_OTA_URL_LEN];
+} app_ota_progress_t;
+
+// State of the running download, owned by the download task
+typedef struct {
+    app_ota_progress_t progress;
+    const esp_partition_t *partition;
+    uint32_t written;             // Bytes written to the partition
+    uint32_t erased_to;           // Partition offset up to which flash is erased
+    uint32_t last_percent;
+    // Filled from the response headers of the current connection
+    char response_etag[APP_OTA_ETAG_LEN];
+    bool has_content_range;
+    uint32_t range_start;
+    uint32_t range_total;
+} app_ota_ctx_t;
+
+static app_ota_ctx_t s_ctx;
+static TaskHandle_t s_ota_task_handle = NULL;
+static EventGroupHandle_t s_net_events = NULL;
+
+// Both the download task and a browser upload write the next update
+// partition, at most one of them may run
+static portMUX_TYPE s_writer_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_download_running;
+static bool s_upload_running;
+
+/**
+ * @brief Claims the update partition for the download task or an upload
+ * @return true if nothing else was writing it
+ */
+static bool app_ota_claim(bool upload)
+{
+    bool claimed = false;
+    portENTER_CRITICAL(&s_writer_lock);
+    if (!s_download_running && !s_upload_running) {
+        if (upload) {
+            s_upload_running = true;
+        } else {
+            s_download_running = true;
+        }
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&s_writer_lock);
+    return claimed;
+}
+
+static void app_ota_release_download(void)
+{
+    portENTER_CRITICAL(&s_writer_lock);
+    s_download_running = false;
+    portEXIT_CRITICAL(&s_writer_lock);
+}
+
+/**
+ * @brief Tracks whether the station is online, so the download waits for it
+ */
+static void app_ota_net_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        xEventGroupSetBits(s_net_events, APP_OTA_ONLINE_BIT);
+    } else {
+        // IP_EVENT_STA_LOST_IP only comes after a timeout, a disconnect is offline already
+        xEventGroupClearBits(s_net_events, APP_OTA_ONLINE_BIT);
+    }
+}
+
+/**
+ * @brief Starts tracking the station connection, once
+ */
+static esp_err_t app_ota_watch_network(void)
+{
+    if (s_net_events != NULL) {
+        return ESP_OK;
+    }
+    s_net_events = xEventGroupCreate();
+    if (s_net_events == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &app_ota_net_event_handler, NULL);
+    if (err == ESP_OK) {
+        err = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_LOST_IP, &app_ota_net_event_handler, NULL);
+    }
+    if (err == ESP_OK) {
+        err = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &app_ota_net_event_handler, NULL);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register network events: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    // The station may have connected before the handlers were registered
+    esp_netif_t *sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    esp_netif_ip_info_t ip_info;
+    if (sta != NULL && esp_netif_get_ip_info(sta, &ip_info) == ESP_OK && ip_info.ip.addr != 0) {
+        xEventGroupSetBits(s_net_events, APP_OTA_ONLINE_BIT);
+    }
+    return ESP_OK;
+}
+
+static bool app_ota_online(void)
+{
+    return (xEventGroupGetBits(s_net_events) & APP_OTA_ONLINE_BIT) != 0;
+}
+
+/**
+ * @brief Saves the download progress, rounded down to a whole erase sector
+ */
+static void app_ota_save_checkpoint(void)
+{
+    uint32_t sector = s_ctx.partition->erase_size;
+    uint32_t checkpoint = s_ctx.written - (s_ctx.written % sector);
+    if (checkpoint == s_ctx.progress.checkpoint) {
+        return;
+    }
+
+    s_ctx.progress.checkpoint = checkpoint;
+    if (nvs_storage_set_blob(APP_OTA_PROGRESS_KEY, &s_ctx.progress, sizeof(s_ctx.progress)) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save OTA progress, a reset will restart further back");
+    }
+}
+
+/**
+ * @brief Forgets everything written so far, for a new or changed image
+ */
+static void app_ota_restart_image(uint32_t image_size, const char *etag)
+{
+    s_ctx.written = 0;
+    s_ctx.erased_to = 0;
+    s_ctx.last_percent = 0;
+    s_ctx.progress.image_size = image_size;
+    s_ctx.progress.checkpoint = 0;
+    // Weak ETags can not be used for If-Range, resume without validation then
+    if (etag != NULL && strncmp(etag, "W/", 2) != 0) {
+        strlcpy(s_ctx.progress.etag, etag, sizeof(s_ctx.progress.etag));
+    } else {
+        s_ctx.progress.etag[0] = '\0';
+    }
+    nvs_storage_set_blob(APP_OTA_PROGRESS_KEY, &s_ctx.progress, sizeof(s_ctx.progress));
+}
+
+/**
+ * @brief Writes the next piece of the image, erasing flash just ahead of it
+ *
+ * Erasing lazily keeps the flash below the resume point intact, unlike
+ * esp_ota_begin() which always starts over at offset 0.
+ */
+static esp_err_t app_ota_write(const uint8_t *data, size_t len)
+{
+    if (s_ctx.written == 0 && data[0] != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "Download is not a firmware image (magic 0x%02x)", data[0]);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+
+    while (s_ctx.erased_to < s_ctx.written + len) {
+        esp_err_t err = esp_partition_erase_range(s_ctx.partition, s_ctx.erased_to, s_ctx.partition->erase_size);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Erase at 0x%" PRIx32 " failed: %s", s_ctx.erased_to, esp_err_to_name(err));
+            return err;
+        }
+        s_ctx.erased_to += s_ctx.partition->erase_size;
+    }
+
+    esp_err_t err = esp_partition_write(s_ctx.partition, s_ctx.written, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Write at 0x%" PRIx32 " failed: %s", s_ctx.written, esp_err_to_name(err));
+        return err;
+    }
+    s_ctx.written += len;
+    return ESP_OK;
+}
+
+/**
+ * @brief Collects the response headers needed to validate a resumed download
+ */
+static esp_err_t app_ota_http_event_handler(esp_http_client_event_t *evt)
+{
+    if (evt->event_id != HTTP_EVENT_ON_HEADER) {
+        return ESP_OK;
+    }
+
+    if (strcasecmp(evt->header_key, "ETag") == 0) {
+        strlcpy(s_ctx.response_etag, evt->header_value, sizeof(s_ctx.response_etag));
+    } else if (strcasecmp(evt->header_key, "Content-Range") == 0) {
+        // bytes <first>-<last>/<total>
+        s_ctx.has_content_range = sscanf(evt->header_value, "bytes %" SCNu32 "-%*" SCNu32 "/%" SCNu32,
+                                         &s_ctx.range_start, &s_ctx.range_total) == 2;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Runs one HTTP request, continuing the image from s_ctx.written
+ *
+ * @param buffer Receive buffer of CONFIG_APP_OTA_BUFFER_SIZE bytes
+ * @param retry Set to true if the error is worth retrying (network, server hiccup)
+ * @return ESP_OK once the whole image is on flash, error code otherwise
+ */
+static esp_err_t app_ota_fetch(uint8_t *buffer, bool *retry)
+{
+    esp_http_client_config_t config = {
+        .url = s_ctx.progress.url,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = CONFIG_APP_OTA_HTTP_TIMEOUT_MS,
+        .event_handler = app_ota_http_event_handler,
+        .keep_alive_enable = true,
+    };
+
+    *retry = true;
+    if (s_ctx.progress.image_size > 0 && s_ctx.written == s_ctx.progress.image_size) {
+        return ESP_OK;
+    }
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_ctx.response_etag[0] = '\0';
+    s_ctx.has_content_range = false;
+    if (s_ctx.written > 0) {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%" PRIu32 "-", s_ctx.written);
+        esp_http_client_set_header(client, "Range", range);
+        // Makes the server send the whole new image instead if it changed meanwhile
+        if (s_ctx.progress.etag[0] != '\0') {
+            esp_http_client_set_header(client, "If-Range", s_ctx.progress.etag);
+        }
+    }
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to connect: %s", esp_err_to_name(err));
+        esp_http_client_cleanup(client);
+        return err;
+    }
+
+    int64_t content_length = esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+
+    if (status == 206 && s_ctx.has_content_range &&
+        s_ctx.range_start == s_ctx.written && s_ctx.range_total == s_ctx.progress.image_size) {
+        ESP_LOGI(TAG, "Resuming at %" PRIu32 " of %" PRIu32 " bytes", s_ctx.written, s_ctx.progress.image_size);
+    } else if (status == 200) {
+        if (content_length <= 0) {
+            ESP_LOGE(TAG, "Server did not send a Content-Length, can not download resumably");
+            *retry = false;
+            err = ESP_ERR_NOT_SUPPORTED;
+            goto cleanup;
+        }
+        if (content_length > s_ctx.partition->size) {
+            ESP_LOGE(TAG, "Image of %lld bytes does not fit partition of %" PRIu32 " bytes",
+                     (long long)content_length, s_ctx.partition->size);
+            *retry = false;
+            err = ESP_ERR_INVALID_SIZE;
+            goto cleanup;
+        }
+        if (s_ctx.written > 0) {
+            ESP_LOGW(TAG, "Server sent the whole image, restarting the download");
+        }
+        app_ota_restart_image((uint32_t)content_length, s_ctx.response_etag);
+        ESP_LOGI(TAG, "Downloading %" PRIu32 " bytes", s_ctx.progress.image_size);
+    } else if (status == 206 || status == 416) {
+        // Range does not line up with what we have, start over on the next attempt
+        ESP_LOGW(TAG, "Unexpected range response (%d), restarting the download", status);
+        app_ota_restart_image(0, NULL);
+        err = ESP_FAIL;
+        goto cleanup;
+    } else {
+        ESP_LOGE(TAG, "HTTP status %d", status);
+        *retry = status >= 500;
+        err = ESP_FAIL;
+        goto cleanup;
+    }
+
+    err = ESP_OK;
+    while (s_ctx.written < s_ctx.progress.image_size) {
+        uint32_t remaining = s_ctx.progress.image_size - s_ctx.written;
+        int len = esp_http_client_read(client, (char *)buffer,
+                                       remaining < CONFIG_APP_OTA_BUFFER_SIZE ? remaining : CONFIG_APP_OTA_BUFFER_SIZE);
+        if (len <= 0) {
+            ESP_LOGW(TAG, "Connection lost at %" PRIu32 " of %" PRIu32 " bytes", s_ctx.written, s_ctx.progress.image_size);
+            err = ESP_FAIL;
+            break;
+        }
+
+        err = app_ota_write(buffer, len);
+        if (err != ESP_OK) {
+            *retry = false;
+            break;
+        }
+
+        if (s_ctx.written - s_ctx.progress.checkpoint >= CONFIG_APP_OTA_CHECKPOINT_KB * 1024) {
+            app_ota_save_checkpoint();
+        }
+
+        uint32_t percent = (uint32_t)((uint64_t)s_ctx.written * 100 / s_ctx.progress.image_size);
+        if (percent >= s_ctx.last_percent + 10) {
+            s_ctx.last_percent = percent - (percent % 10);
+            ESP_LOGI(TAG, "OTA download: %" PRIu32 "%%", s_ctx.last_percent);
+        }
+    }
+
+cleanup:
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+/**
+ * @brief Fetches the image, reconnecting until it is complete or retries run out
+ */
+static esp_err_t app_ota_download(void)
+{
+    uint8_t *buffer = malloc(CONFIG_APP_OTA_BUFFER_SIZE);
+    if (buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Nothing above the checkpoint is trusted after a reset
+    s_ctx.written = s_ctx.progress.checkpoint;
+    s_ctx.erased_to = s_ctx.written;
+    s_ctx.last_percent = 0;
+
+    esp_err_t err = ESP_FAIL;
+    int failures = 0;
+    while (failures < CONFIG_APP_OTA_MAX_RETRIES) {
+        uint32_t written_before = s_ctx.written;
+        bool retry;
+
+        if (!app_ota_online()) {
+            ESP_LOGI(TAG, "Waiting for the network to download %s", s_ctx.progress.url);
+            xEventGroupWaitBits(s_net_events, APP_OTA_ONLINE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+        }
+
+        err = app_ota_fetch(buffer, &retry);
+        if (err == ESP_OK || !retry) {
+            break;
+        }
+
+        app_ota_save_checkpoint();
+        if (!app_ota_online()) {
+            // Not the server's fault, wait for the link without using up a retry
+            ESP_LOGW(TAG, "Download interrupted (%s), network lost", esp_err_to_name(err));
+            continue;
+        }
+        // Only count attempts that made no progress, a flaky link that keeps
+        // delivering data is allowed to take as many reconnects as it needs
+        failures = (s_ctx.written > written_before) ? 1 : failures + 1;
+        ESP_LOGW(TAG, "Download interrupted (%s), retry %d of %d in %d ms", esp_err_to_name(err),
+                 failures, CONFIG_APP_OTA_MAX_RETRIES, CONFIG_APP_OTA_RETRY_DELAY_MS);
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_APP_OTA_RETRY_DELAY_MS));
+    }
+
+    free(buffer);
+    return err;
+}
+
+/**
+ * @brief Background task downloading, verifying and booting the new image
+ */
+static void app_ota_task(void *pvParameters)
+{
+    esp_err_t err = app_ota_download();
+    if (err == ESP_OK) {
+        // Verifies the image (header, segments, hash and signature if enabled)
+        err = esp_ota_set_boot_partition(s_ctx.partition);
+        nvs_storage_erase_key(APP_OTA_PROGRESS_KEY);
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "OTA complete, rebooting into partition at 0x%" PRIx32, s_ctx.partition->address);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            esp_restart();
+        }
+        ESP_LOGE(TAG, "Downloaded image is invalid: %s", esp_err_to_name(err));
+    } else if (err == ESP_ERR_OTA_VALIDATE_FAILED || err == ESP_ERR_INVALID_SIZE) {
+        nvs_storage_erase_key(APP_OTA_PROGRESS_KEY);
+        ESP_LOGE(TAG, "OTA failed: %s", esp_err_to_name(err));
+    } else {
+        // Keep the progress, the next app_ota_start() or reset resumes from it
+        ESP_LOGE(TAG, "OTA stopped at %" PRIu32 " bytes: %s", s_ctx.written, esp_err_to_name(err));
+    }
+
+    s_ota_task_handle = NULL;
+    app_ota_release_download();
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Starts the download task for the progress record in s_ctx
+ *
+ * The caller has claimed the partition with app_ota_claim(false).
+ */
+static esp_err_t app_ota_start_task(void)
+{
+    esp_err_t err = app_ota_watch_network();
+    if (err != ESP_OK) {
+        app_ota_release_download();
+        return err;
+    }
+    if (xTaskCreate(app_ota_task, "app_ota", CONFIG_APP_OTA_TASK_STACK_SIZE, NULL,
+                    CONFIG_APP_OTA_TASK_PRIORITY, &s_ota_task_handle) != pdPASS) {
+        s_ota_task_handle = NULL;
+        app_ota_release_download();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_ota_init(void)
+{
+    app_ota_progress_t progress;
+    size_t length = sizeof(progress);
+
+    esp_err_t err = nvs_storage_get_blob(APP_OTA_PROGRESS_KEY, &progress, &length);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK || length != sizeof(progress) || progress.version != APP_OTA_PROGRESS_VERSION) {
+        ESP_LOGW(TAG, "Discarding unreadable OTA progress record");
+        return nvs_storage_erase_key(APP_OTA_PROGRESS_KEY);
+    }
+
+    // The update partition flips after every successful OTA, a record for
+    // the partition we are running from is stale
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL || partition->address != progress.partition_address) {
+        ESP_LOGW(TAG, "Discarding OTA progress for another partition");
+        return nvs_storage_erase_key(APP_OTA_PROGRESS_KEY);
+    }
+
+    if (!app_ota_claim(false)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    progress.url[sizeof(progress.url) - 1] = '\0';
+    progress.etag[sizeof(progress.etag) - 1] = '\0';
+    memset(&s_ctx, 0, sizeof(s_ctx));
+    s_ctx.progress = progress;
+    s_ctx.partition = partition;
+
+    ESP_LOGI(TAG, "Resuming interrupted OTA of %s at %" PRIu32 " bytes", progress.url, progress.checkpoint);
+    return app_ota_start_task();
+}
+
+esp_err_t app_ota_start(const char *url)
+{
+    if (url == NULL || strncmp(url, "https://", 8) != 0 || strlen(url) >= APP_OTA_URL_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (!app_ota_claim(false)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Keep the progress of an earlier attempt at the same image
+    bool resume = s_ctx.partition == partition && strcmp(s_ctx.progress.url, url) == 0;
+    if (!resume) {
+        memset(&s_ctx, 0, sizeof(s_ctx));
+        s_ctx.progress.version = APP_OTA_PROGRESS_VERSION;
+        s_ctx.progress.partition_address = partition->address;
+        strlcpy(s_ctx.progress.url, url, sizeof(s_ctx.progress.url));
+        s_ctx.partition = partition;
+        nvs_storage_set_blob(APP_OTA_PROGRESS_KEY, &s_ctx.progress, sizeof(s_ctx.progress));
+    }
+
+    ESP_LOGI(TAG, "%s OTA from %s", resume ? "Resuming" : "Starting", url);
+    return app_ota_start_task();
+}
+
+bool app_ota_is_running(void)
+{
+    return s_download_running;
+}
+
+esp_err_t app_ota_begin_upload(void)
+{
+    if (!app_ota_claim(true)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The upload overwrites what an interrupted download left on the partition
+    if (s_ctx.progress.checkpoint > 0 || s_ctx.written > 0) {
+        ESP_LOGW(TAG, "Browser upload replaces the interrupted OTA of %s", s_ctx.progress.url);
+    }
+    memset(&s_ctx, 0, sizeof(s_ctx));
+    nvs_storage_erase_key(APP_OTA_PROGRESS_KEY);
+    return ESP_OK;
+}
+
+void app_ota_end_upload(void)
+{
+    portENTER_CRITICAL(&s_writer_lock);
+    s_upload_running = false;
+    portEXIT_CRITICAL(&s_writer_lock);
+}
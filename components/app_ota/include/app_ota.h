@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Initialize the pull based HTTPS OTA client
+ *
+ * Must be called after nvs_storage_init() and the WiFi init (the default
+ * event loop). If a download was interrupted by a reset, its progress is read
+ * back from NVS and the download is resumed in the background once the
+ * station has an IP address.
+ *
+ * @return esp_err_t ESP_OK on success, error code otherwise
+ */
+esp_err_t app_ota_init(void);
+
+/**
+ * @brief Start downloading and installing a firmware image
+ *
+ * The image is fetched by a background task, so the caller (the MQTT task
+ * for AWS IoT commands) is not blocked. Dropped connections are resumed with
+ * HTTP Range requests, and progress is saved in NVS so a reset does not
+ * restart the download from the beginning. The device reboots into the new
+ * image once it is complete and verified. While the station is offline the
+ * download waits for it, and those attempts do not count against
+ * CONFIG_APP_OTA_MAX_RETRIES.
+ *
+ * @param url HTTPS URL of the firmware image, checked against the certificate bundle
+ * @return esp_err_t ESP_OK if the download was started,
+ *         ESP_ERR_INVALID_ARG if the URL is not HTTPS or too long,
+ *         ESP_ERR_INVALID_STATE if a download or a browser upload is running,
+ *         ESP_ERR_NOT_FOUND if there is no OTA partition to update
+ */
+esp_err_t app_ota_start(const char *url);
+
+/**
+ * @brief Check if a firmware download is in progress
+ * @return true while the download task is running, false otherwise
+ */
+bool app_ota_is_running(void);
+
+/**
+ * @brief Claim the update partition for a firmware upload through the local server
+ *
+ * Keeps app_ota_start() from writing the same partition while the upload
+ * runs. The progress of an interrupted download is dropped, the upload
+ * overwrites its data.
+ *
+ * @return esp_err_t ESP_OK if the upload may write the partition,
+ *         ESP_ERR_INVALID_STATE if a download or another upload is running
+ */
+esp_err_t app_ota_begin_upload(void);
+
+/**
+ * @brief Release the partition claimed by app_ota_begin_upload()
+ */
+void app_ota_end_upload(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -18,13 +18,26 @@ static EventGroupHandle_t time_sync_event_group;
 // Task handle for the time sync task
 static TaskHandle_t time_sync_task_handle = NULL;
 
+// Told when a synchronization attempt completes
+static app_time_sync_cb_t time_sync_cb = NULL;
+
+/**
+ * @brief Sets TIME_SYNC_COMPLETED_BIT and tells the registered callback
+ */
+static void time_sync_signal_completed(void) {
+    if (time_sync_event_group != NULL) {
+        xEventGroupSetBits(time_sync_event_group, TIME_SYNC_COMPLETED_BIT);
+    }
+    if (time_sync_cb != NULL) {
+        time_sync_cb();
+    }
+}
+
 static void time_sync_notification_cb(struct timeval *tv) {
     ESP_LOGI(TAG, "Notification of a time synchronization event");
     
     // Set the event bit to indicate time sync is complete
-    if (time_sync_event_group != NULL) {
-        xEventGroupSetBits(time_sync_event_group, TIME_SYNC_COMPLETED_BIT);
-    }
+    time_sync_signal_completed();
         // Initialize AWS IoT connectivity
         esp_err_t aws_init_ret = aws_iot_start();
         if (aws_init_ret != ESP_OK)
@@ -70,7 +83,7 @@ static void time_sync_task(void *pvParameters) {
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize SNTP: %s", esp_err_to_name(err));
         // Set the event bit even on failure so the application continues
-        xEventGroupSetBits(time_sync_event_group, TIME_SYNC_COMPLETED_BIT);
+        time_sync_signal_completed();
         vTaskDelete(NULL);
         return;
     }
@@ -106,7 +119,7 @@ static void time_sync_task(void *pvParameters) {
     ESP_LOGI(TAG, "The current local time is: %s", strftime_buf);
 
     // Set the event bit to indicate time sync attempt is complete
-    xEventGroupSetBits(time_sync_event_group, TIME_SYNC_COMPLETED_BIT);
+    time_sync_signal_completed();
     
     // Task completed, delete itself
     time_sync_task_handle = NULL;
@@ -160,7 +173,7 @@ void app_time_sync_init(void) {
         ESP_LOGI(TAG, "The current local time is: %s", strftime_buf);
 
         // Set the event bit since time is already set
-        xEventGroupSetBits(time_sync_event_group, TIME_SYNC_COMPLETED_BIT);
+        time_sync_signal_completed();
     }
 }
 
@@ -200,3 +213,7 @@ bool app_time_sync_is_completed(void) {
     EventBits_t bits = xEventGroupGetBits(time_sync_event_group);
     return (bits & TIME_SYNC_COMPLETED_BIT) != 0;
 }
+
+void app_time_sync_set_callback(app_time_sync_cb_t callback) {
+    time_sync_cb = callback;
+}
@@ -3,6 +3,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/**
+ * @brief Callback for completed time synchronization attempts
+ *
+ * Called from the SNTP or time sync task, must not block.
+ */
+typedef void (*app_time_sync_cb_t)(void);
+
 /**
  * @brief Initialize time synchronization
  * 
@@ -25,3 +32,13 @@ bool app_time_sync_wait(uint32_t timeout_ms);
  * @return true if time sync completed, false otherwise
  */
 bool app_time_sync_is_completed(void);
+
+/**
+ * @brief Register a callback for completed synchronization attempts
+ *
+ * Register it before app_time_sync_init() to also hear about a clock that
+ * was already set.
+ *
+ * @param callback Callback to register, or NULL
+ */
+void app_time_sync_set_callback(app_time_sync_cb_t callback);
@@ -1,4 +1,7 @@
 #include "aws_iot.h"
+#include "aws_iot_telemetry.h"
+#include "aws_iot_card_sync.h"
+#include "aws_iot_commands.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
@@ -8,7 +11,7 @@
 #include "esp_event.h"
 #include "esp_tls.h"
 #include "mqtt_client.h"
-#include "cJSON.h"
+#include "app_metrics.h"
 #include <string.h>
 
 static const char *TAG = "AWS_IOT";
@@ -19,13 +22,40 @@ static esp_mqtt_client_handle_t mqtt_client = NULL;
 // Connection status flag
 static bool is_connected = false;
 
-// Message callback function
-static aws_iot_message_callback_t message_callback = NULL;
-
 // Event group to signal connection status
 static EventGroupHandle_t aws_iot_event_group;
 #define AWS_IOT_CONNECTED_BIT BIT0
 
+// Publish metrics. QoS 1 publishes wait here for their PUBACK, indexed by
+// msg_id; a slot reused before its PUBACK arrived just loses that sample.
+#define AWS_IOT_METRICS_INFLIGHT 8
+typedef struct {
+    int msg_id;
+    int64_t sent;  // app_metrics_begin() before the publish call
+} aws_iot_publish_time_t;
+static aws_iot_publish_time_t s_publish_times[AWS_IOT_METRICS_INFLIGHT];
+static portMUX_TYPE s_publish_times_lock = portMUX_INITIALIZER_UNLOCKED;
+static app_metrics_histogram_t *s_metric_publish_call = NULL;
+static app_metrics_histogram_t *s_metric_publish_ack = NULL;
+static app_metrics_counter_t *s_metric_publish_failed = NULL;
+
+/**
+ * @brief Records the publish to PUBACK latency of msg_id, if its publish was timed
+ */
+static void aws_iot_metrics_published(int msg_id)
+{
+    aws_iot_publish_time_t *slot = &s_publish_times[(unsigned)msg_id % AWS_IOT_METRICS_INFLIGHT];
+    int64_t sent = 0;
+
+    portENTER_CRITICAL(&s_publish_times_lock);
+    if (slot->msg_id == msg_id) {
+        sent = slot->sent;
+        slot->msg_id = 0;
+    }
+    portEXIT_CRITICAL(&s_publish_times_lock);
+    app_metrics_end(s_metric_publish_ack, sent);
+}
+
 /**
  * @brief MQTT event handler
  */
@@ -48,6 +78,12 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             } else {
                 ESP_LOGI(TAG, "Subscription sent, msg_id=%d", msg_id);
             }
+
+            // Catch up on card changes missed while offline
+            aws_iot_card_sync_on_connected();
+
+            // Start draining the offline backlog right away
+            aws_iot_telemetry_flush();
             break;
             
         case MQTT_EVENT_DISCONNECTED:
@@ -66,17 +102,25 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             
         case MQTT_EVENT_PUBLISHED:
             ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            aws_iot_telemetry_on_published(event->msg_id);
+            aws_iot_metrics_published(event->msg_id);
             break;
             
         case MQTT_EVENT_DATA:
             ESP_LOGI(TAG, "MQTT_EVENT_DATA");
             ESP_LOGI(TAG, "Topic: %.*s", event->topic_len, event->topic);
             ESP_LOGI(TAG, "Data: %.*s", event->data_len, event->data);
-            
-            // Call user callback if registered
-            if (message_callback != NULL) {
-                message_callback(event->topic, event->topic_len, event->data, event->data_len);
+
+            // Card deltas are reassembled here, everything goes on to the command worker
+            if (aws_iot_card_sync_on_data(event->topic, event->topic_len, event->data, event->data_len,
+                                          event->current_data_offset, event->total_data_len)) {
+                break;
             }
+            if (event->data_len != event->total_data_len) {
+                ESP_LOGW(TAG, "Dropping fragmented %d byte message", event->total_data_len);
+                break;
+            }
+            aws_iot_commands_post(event->topic, event->topic_len, event->data, event->data_len);
             break;
             
         case MQTT_EVENT_ERROR:
@@ -100,6 +144,10 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 esp_err_t aws_iot_start(void)
 {
     ESP_LOGI(TAG, "Initializing AWS IoT");
+
+    s_metric_publish_call = app_metrics_histogram("mqtt_publish_us", "stage", "call");
+    s_metric_publish_ack = app_metrics_histogram("mqtt_publish_us", "stage", "puback");
+    s_metric_publish_failed = app_metrics_counter("mqtt_publish_failed_total", NULL, NULL);
     
     // Create event group for AWS IoT connection status
     aws_iot_event_group = xEventGroupCreate();
@@ -151,8 +199,30 @@ esp_err_t aws_iot_start(void)
     // Register MQTT event handler
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     
+    // The handler subscribes on MQTT_EVENT_CONNECTED, which can come right after
+    // the start, so everything it uses is set up first.
+    // Commands run on their own worker, never on the MQTT task
+    esp_err_t err = aws_iot_commands_start();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start command worker, commands are dropped: %s", esp_err_to_name(err));
+    }
+
+    // Telemetry is batched by its own flush task
+    err = aws_iot_telemetry_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Telemetry batching unavailable: %s", esp_err_to_name(err));
+    }
+
+    err = aws_iot_card_sync_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Card sync restarts from version 0: %s", esp_err_to_name(err));
+    }
+
     // Start MQTT client
-    esp_err_t err = esp_mqtt_client_start(mqtt_client);
+    err = esp_mqtt_client_start(mqtt_client);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
@@ -162,54 +232,53 @@ esp_err_t aws_iot_start(void)
         aws_iot_event_group = NULL;
         return err;
     }
-
-    // No automatic publishing task - publishing will be triggered from HTTP handler
     
     return ESP_OK;
 }
 
-esp_err_t aws_iot_publish_sensor_data(float temperature, float humidity)
+esp_err_t aws_iot_publish(const char *topic, const char *payload, int len, int qos, int *msg_id_out)
 {
     if (!is_connected || mqtt_client == NULL) {
         ESP_LOGE(TAG, "Cannot publish - not connected to AWS IoT");
         return ESP_FAIL;
     }
-    
-    // Create JSON payload
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "temperature", temperature);
-    cJSON_AddNumberToObject(root, "humidity", humidity);
-    cJSON_AddStringToObject(root, "device_id", CONFIG_AWS_EXAMPLE_CLIENT_ID);
-    
-    // Get timestamp if available
-    time_t now;
-    time(&now);
-    if (now > 1600000000) {  // Sanity check for valid time (after 2020-09-13)
-        cJSON_AddNumberToObject(root, "timestamp", now);
-    }
-    
-    char *payload = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    
-    if (payload == NULL) {
-        ESP_LOGE(TAG, "Failed to create JSON payload");
-        return ESP_FAIL;
+
+    if (topic == NULL || payload == NULL) {
+        return ESP_ERR_INVALID_ARG;
     }
-    
-    ESP_LOGI(TAG, "Publishing to topic %s: %s", AWS_IOT_SENSOR_TOPIC, payload);
-    
-    int msg_id = esp_mqtt_client_publish(mqtt_client, AWS_IOT_SENSOR_TOPIC, payload, 0, 1, 0);
-    free(payload);
-    
+
+    int64_t begin = app_metrics_begin();
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, payload, len, qos, 0);
     if (msg_id < 0) {
         ESP_LOGE(TAG, "Failed to publish message");
+        app_metrics_count(s_metric_publish_failed, 1);
         return ESP_FAIL;
     }
-    
-    ESP_LOGI(TAG, "Successfully published message, msg_id=%d", msg_id);
+    app_metrics_end(s_metric_publish_call, begin);
+
+    if (begin != 0 && msg_id > 0) {
+        // The PUBACK may beat us here, then the sample is lost
+        portENTER_CRITICAL(&s_publish_times_lock);
+        s_publish_times[(unsigned)msg_id % AWS_IOT_METRICS_INFLIGHT] = (aws_iot_publish_time_t){
+            .msg_id = msg_id,
+            .sent = begin,
+        };
+        portEXIT_CRITICAL(&s_publish_times_lock);
+    }
+
+    ESP_LOGD(TAG, "Published %d bytes to %s, msg_id=%d", len, topic, msg_id);
+    if (msg_id_out != NULL) {
+        *msg_id_out = msg_id;
+    }
     return ESP_OK;
 }
 
+esp_err_t aws_iot_publish_sensor_data(float temperature, float humidity)
+{
+    // Batched with the other telemetry, see aws_iot_telemetry.h
+    return aws_iot_telemetry_add_sensor(temperature, humidity);
+}
+
 bool aws_iot_is_connected(void)
 {
     return is_connected;
@@ -222,7 +291,7 @@ esp_err_t aws_iot_set_message_callback(aws_iot_message_callback_t callback)
         return ESP_ERR_INVALID_ARG;
     }
     
-    message_callback = callback;
+    aws_iot_commands_set_fallback(callback);
     ESP_LOGI(TAG, "Message callback registered");
     return ESP_OK;
 }
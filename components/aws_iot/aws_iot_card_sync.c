@@ -0,0 +1,277 @@
+#include "aws_iot_card_sync.h"
+#include "aws_iot.h"
+#include "aws_iot_commands.h"
+#include "rfid_manager.h"
+#include "nvs.h"
+#include "nvs_storage.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+
+static const char *TAG = "AWS_IOT_CARD_SYNC";
+
+#ifndef CONFIG_AWS_IOT_CARD_SYNC_MAX_BYTES
+#define CONFIG_AWS_IOT_CARD_SYNC_MAX_BYTES 8192
+#endif
+
+#ifndef CONFIG_AWS_IOT_CARD_SYNC_MAX_CHANGES
+#define CONFIG_AWS_IOT_CARD_SYNC_MAX_CHANGES 256
+#endif
+
+#define CARD_SYNC_VERSION_KEY "card_sync_ver"
+
+// A delta message, reassembled on the MQTT task and applied on the command worker
+typedef struct {
+    int len;
+    char data[];
+} card_sync_message_t;
+
+static bool s_initialized;
+static volatile uint32_t s_version;  // Written by the command worker only
+static char s_delta_topic[128];
+static char s_ack_topic[128];
+
+// Reassembly of a fragmented delta message, MQTT task only
+static card_sync_message_t *s_message; // NULL while no delta message is in progress
+static bool s_message_skipped;         // The rest of an oversized message is dropped
+
+/**
+ * @brief Publishes the current version and the outcome of the last batch
+ */
+static void card_sync_report(const char *status)
+{
+    char payload[128];
+    int len = snprintf(payload, sizeof(payload), "{\"device_id\":\"%s\",\"version\":%" PRIu32 ",\"status\":\"%s\"}",
+                       CONFIG_AWS_EXAMPLE_CLIENT_ID, s_version, status);
+    if (aws_iot_publish(s_ack_topic, payload, len, 1, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to report card version %" PRIu32, s_version);
+    }
+}
+
+/**
+ * @brief Reads a card id given as "0x..." hex string, decimal string or number
+ *
+ * Leading zeros are decimal, not octal, and anything but digits (a sign,
+ * spaces, trailing characters) makes the id invalid.
+ *
+ * @return The card id, 0 if item is not a valid id
+ */
+static uint32_t card_sync_card_id(const cJSON *item)
+{
+    if (cJSON_IsString(item)) {
+        const char *text = item->valuestring;
+        int base = 10;
+        if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+            text += 2;
+            base = 16;
+        }
+        if (!isxdigit((unsigned char)text[0]) || (base == 10 && !isdigit((unsigned char)text[0]))) {
+            return 0;
+        }
+        char *end = NULL;
+        errno = 0;
+        unsigned long long value = strtoull(text, &end, base);
+        if (*end != '\0' || errno == ERANGE || value > UINT32_MAX) {
+            return 0;
+        }
+        return (uint32_t)value;
+    }
+    if (cJSON_IsNumber(item) && item->valuedouble >= 0 && item->valuedouble <= UINT32_MAX &&
+        item->valuedouble == (double)(uint32_t)item->valuedouble) {
+        return (uint32_t)item->valuedouble;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fills changes from the "remove" and "add" arrays of a delta
+ * @return Number of changes, -1 if the delta is malformed or too large
+ */
+static int card_sync_parse_changes(const cJSON *json, rfid_card_change_t *changes)
+{
+    const cJSON *add = cJSON_GetObjectItem(json, "add");
+    const cJSON *remove = cJSON_GetObjectItem(json, "remove");
+    if ((add != NULL && !cJSON_IsArray(add)) || (remove != NULL && !cJSON_IsArray(remove)) ||
+        cJSON_GetArraySize(add) + cJSON_GetArraySize(remove) > CONFIG_AWS_IOT_CARD_SYNC_MAX_CHANGES) {
+        return -1;
+    }
+
+    int count = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, remove) {
+        changes[count] = (rfid_card_change_t){ .card_id = card_sync_card_id(item), .remove = true };
+        if (changes[count++].card_id == 0) {
+            return -1;
+        }
+    }
+    cJSON_ArrayForEach(item, add) {
+        const cJSON *name = cJSON_GetObjectItem(item, "name");
+        changes[count] = (rfid_card_change_t){ .card_id = card_sync_card_id(cJSON_GetObjectItem(item, "card_id")) };
+        if (changes[count].card_id == 0 || !cJSON_IsString(name)) {
+            return -1;
+        }
+        strncpy(changes[count].name, name->valuestring, RFID_CARD_NAME_LEN - 1);
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Applies one complete delta message and reports the result
+ */
+static void card_sync_apply(const char *message, int len)
+{
+    cJSON *json = cJSON_ParseWithLength(message, len);
+    const cJSON *from = cJSON_GetObjectItem(json, "from");
+    const cJSON *version = cJSON_GetObjectItem(json, "version");
+    if (!cJSON_IsNumber(from) || !cJSON_IsNumber(version) || from->valuedouble < 0 ||
+        version->valuedouble <= from->valuedouble || version->valuedouble > UINT32_MAX) {
+        ESP_LOGW(TAG, "Ignoring malformed card delta");
+        cJSON_Delete(json);
+        card_sync_report("rejected");
+        return;
+    }
+    uint32_t from_version = (uint32_t)from->valuedouble;
+    uint32_t to_version = (uint32_t)version->valuedouble;
+
+    if (to_version <= s_version) {
+        ESP_LOGI(TAG, "Card delta %" PRIu32 " already applied", to_version);
+        cJSON_Delete(json);
+        card_sync_report("applied");
+        return;
+    }
+    if (from_version > s_version) {
+        ESP_LOGW(TAG, "Card delta from %" PRIu32 ", device is at %" PRIu32, from_version, s_version);
+        cJSON_Delete(json);
+        card_sync_report("gap");
+        return;
+    }
+
+    rfid_card_change_t *changes = calloc(CONFIG_AWS_IOT_CARD_SYNC_MAX_CHANGES, sizeof(rfid_card_change_t));
+    int count = (changes != NULL) ? card_sync_parse_changes(json, changes) : -1;
+    cJSON_Delete(json);
+
+    esp_err_t err = (count < 0) ? ESP_ERR_INVALID_ARG : rfid_manager_apply_changes(changes, (uint16_t)count);
+    free(changes);
+    if (err == ESP_OK) {
+        // The cards must be on flash before the version says so
+        err = rfid_manager_flush_cache();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to apply card delta %" PRIu32 ": %s", to_version, esp_err_to_name(err));
+        card_sync_report("rejected");
+        return;
+    }
+
+    s_version = to_version;
+    err = nvs_storage_set_blob(CARD_SYNC_VERSION_KEY, &to_version, sizeof(to_version));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store card version: %s", esp_err_to_name(err));
+    }
+    ESP_LOGI(TAG, "Card database at version %" PRIu32 " (%d changes)", to_version, count);
+    card_sync_report("applied");
+}
+
+/**
+ * @brief Command worker side: applies a message handed over by aws_iot_card_sync_on_data()
+ */
+static void card_sync_work(void *arg)
+{
+    card_sync_message_t *message = arg;
+    card_sync_apply(message->data, message->len);
+    free(message);
+}
+
+esp_err_t aws_iot_card_sync_init(void)
+{
+    if (s_initialized) {
+        return ESP_OK;
+    }
+    snprintf(s_delta_topic, sizeof(s_delta_topic), "esp32/%s/cards/delta", CONFIG_AWS_EXAMPLE_CLIENT_ID);
+    snprintf(s_ack_topic, sizeof(s_ack_topic), "esp32/%s/cards/ack", CONFIG_AWS_EXAMPLE_CLIENT_ID);
+    s_initialized = true;
+
+    uint32_t version = 0;
+    size_t length = sizeof(version);
+    esp_err_t err = nvs_storage_get_blob(CARD_SYNC_VERSION_KEY, &version, &length);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK || length != sizeof(version)) {
+        ESP_LOGW(TAG, "Unreadable card version, syncing from 0");
+        return (err != ESP_OK) ? err : ESP_ERR_INVALID_SIZE;
+    }
+    s_version = version;
+    ESP_LOGI(TAG, "Card database at version %" PRIu32, version);
+    return ESP_OK;
+}
+
+void aws_iot_card_sync_on_connected(void)
+{
+    if (!s_initialized) {
+        return;
+    }
+    if (aws_iot_subscribe(s_delta_topic, 1) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to subscribe to %s", s_delta_topic);
+        return;
+    }
+    card_sync_report("applied"); // Asks for the changes since our version
+}
+
+bool aws_iot_card_sync_on_data(const char *topic, int topic_len, const char *data, int data_len,
+                               int offset, int total_len)
+{
+    if (!s_initialized) {
+        return false;
+    }
+    if (offset == 0) {
+        free(s_message);
+        s_message = NULL;
+        s_message_skipped = false;
+        if (topic_len != (int)strlen(s_delta_topic) || strncmp(topic, s_delta_topic, topic_len) != 0) {
+            return false;
+        }
+        if (total_len > CONFIG_AWS_IOT_CARD_SYNC_MAX_BYTES ||
+            (s_message = malloc(sizeof(card_sync_message_t) + total_len)) == NULL) {
+            ESP_LOGE(TAG, "Dropping %d byte card delta", total_len);
+            s_message_skipped = true;
+        } else {
+            s_message->len = 0;
+        }
+    } else if (s_message == NULL && !s_message_skipped) {
+        return false; // Rest of some other message
+    }
+
+    if (s_message != NULL && offset == s_message->len && offset + data_len <= total_len) {
+        memcpy(s_message->data + offset, data, data_len);
+        s_message->len += data_len;
+    }
+    if (offset + data_len >= total_len) {
+        // Parsing, the table update and the flash write run on the command worker,
+        // so keep-alives and the next messages are not held up behind them
+        if (s_message_skipped) {
+            card_sync_report("rejected");
+        } else if (s_message != NULL && s_message->len == total_len) {
+            if (aws_iot_commands_post_work(card_sync_work, s_message)) {
+                s_message = NULL; // Freed by card_sync_work()
+            } else {
+                ESP_LOGE(TAG, "Dropping card delta, command queue full");
+                card_sync_report("rejected");
+            }
+        }
+        free(s_message);
+        s_message = NULL;
+        s_message_skipped = false;
+    }
+    return true;
+}
+
+uint32_t aws_iot_card_sync_get_version(void)
+{
+    return s_version;
+}
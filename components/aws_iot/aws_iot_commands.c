@@ -0,0 +1,215 @@
+#include "aws_iot_commands.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+#include <stdint.h>
+#include <string.h>
+
+static const char *TAG = "AWS_IOT_COMMANDS";
+
+#ifndef CONFIG_AWS_IOT_COMMAND_QUEUE_BYTES
+#define CONFIG_AWS_IOT_COMMAND_QUEUE_BYTES 4096
+#endif
+
+#ifndef CONFIG_AWS_IOT_COMMAND_MAX
+#define CONFIG_AWS_IOT_COMMAND_MAX 16
+#endif
+
+#ifndef CONFIG_AWS_IOT_COMMAND_TASK_STACK_SIZE
+#define CONFIG_AWS_IOT_COMMAND_TASK_STACK_SIZE 6144
+#endif
+
+#ifndef CONFIG_AWS_IOT_COMMAND_TASK_PRIORITY
+#define CONFIG_AWS_IOT_COMMAND_TASK_PRIORITY 4
+#endif
+
+// Open addressing table at most half full, a power of two so the probe is a mask
+#define COMMAND_SLOTS_MIN (2 * CONFIG_AWS_IOT_COMMAND_MAX)
+#define COMMAND_SLOTS (COMMAND_SLOTS_MIN <= 8 ? 8 : COMMAND_SLOTS_MIN <= 16 ? 16 : COMMAND_SLOTS_MIN <= 32 ? 32 : \
+                       COMMAND_SLOTS_MIN <= 64 ? 64 : 128)
+
+typedef struct {
+    const char *name;  // NULL for a free slot
+    uint32_t hash;
+    aws_iot_command_handler_t handler;
+    void *arg;
+} command_entry_t;
+
+// Ring item: this header, the topic, then the data and a terminator. Work
+// posted with aws_iot_commands_post_work() is the header alone.
+typedef struct {
+    uint16_t topic_len;
+    uint16_t data_len;
+    aws_iot_work_t work;  // NULL for a received message
+    void *arg;
+} command_item_t;
+
+static command_entry_t s_commands[COMMAND_SLOTS];
+static uint32_t s_num_commands;
+static RingbufHandle_t s_ring;
+static TaskHandle_t s_task;
+static volatile aws_iot_message_callback_t s_fallback;
+
+/**
+ * @brief FNV-1a hash of a command name
+ */
+static uint32_t commands_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Finds the entry of name, or the free slot it would go to
+ */
+static command_entry_t *commands_find(const char *name, uint32_t hash)
+{
+    uint32_t i = hash & (COMMAND_SLOTS - 1);
+    while (s_commands[i].name != NULL &&
+           (s_commands[i].hash != hash || strcmp(s_commands[i].name, name) != 0)) {
+        i = (i + 1) & (COMMAND_SLOTS - 1);
+    }
+    return &s_commands[i];
+}
+
+/**
+ * @brief Parses one queued message and hands it to its handler
+ */
+static void commands_dispatch(const command_item_t *item)
+{
+    if (item->work != NULL) {
+        item->work(item->arg);
+        return;
+    }
+
+    aws_iot_command_t command = {
+        .topic = (const char *)(item + 1),
+        .topic_len = item->topic_len,
+        .data = (const char *)(item + 1) + item->topic_len,
+        .data_len = item->data_len,
+    };
+
+    cJSON *json = cJSON_ParseWithLength(command.data, command.data_len);
+    const cJSON *name = cJSON_GetObjectItemCaseSensitive(json, "command");
+    if (cJSON_IsString(name)) {
+        const command_entry_t *entry = commands_find(name->valuestring, commands_hash(name->valuestring));
+        if (entry->name != NULL) {
+            ESP_LOGI(TAG, "Command: %s", entry->name);
+            command.json = json;
+            entry->handler(&command, entry->arg);
+            cJSON_Delete(json);
+            return;
+        }
+        ESP_LOGW(TAG, "Unknown command: %s", name->valuestring);
+    }
+    cJSON_Delete(json);
+
+    aws_iot_message_callback_t fallback = s_fallback;
+    if (fallback != NULL) {
+        fallback(command.topic, command.topic_len, command.data, command.data_len);
+    }
+}
+
+/**
+ * @brief Worker task: runs the handlers, one message at a time
+ */
+static void commands_task(void *arg)
+{
+    while (1) {
+        size_t size;
+        command_item_t *item = xRingbufferReceive(s_ring, &size, portMAX_DELAY);
+        if (item != NULL) {
+            commands_dispatch(item);
+            vRingbufferReturnItem(s_ring, item);
+        }
+    }
+}
+
+esp_err_t aws_iot_commands_register(const char *name, aws_iot_command_handler_t handler, void *arg)
+{
+    if (name == NULL || handler == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t hash = commands_hash(name);
+    command_entry_t *entry = commands_find(name, hash);
+    if (entry->name != NULL) {
+        ESP_LOGE(TAG, "Command %s registered twice", name);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_num_commands >= CONFIG_AWS_IOT_COMMAND_MAX) {
+        ESP_LOGE(TAG, "No room for command %s, see CONFIG_AWS_IOT_COMMAND_MAX", name);
+        return ESP_ERR_NO_MEM;
+    }
+    *entry = (command_entry_t){ .name = name, .hash = hash, .handler = handler, .arg = arg };
+    s_num_commands++;
+    return ESP_OK;
+}
+
+esp_err_t aws_iot_commands_start(void)
+{
+    if (s_task != NULL) {
+        return ESP_OK;
+    }
+    if (s_ring == NULL) {
+        s_ring = xRingbufferCreate(CONFIG_AWS_IOT_COMMAND_QUEUE_BYTES, RINGBUF_TYPE_NOSPLIT);
+        if (s_ring == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (xTaskCreate(commands_task, "aws_iot_cmd", CONFIG_AWS_IOT_COMMAND_TASK_STACK_SIZE, NULL,
+                    CONFIG_AWS_IOT_COMMAND_TASK_PRIORITY, &s_task) != pdPASS) {
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Command worker started, %u commands", (unsigned)s_num_commands);
+    return ESP_OK;
+}
+
+void aws_iot_commands_set_fallback(aws_iot_message_callback_t callback)
+{
+    s_fallback = callback;
+}
+
+bool aws_iot_commands_post(const char *topic, int topic_len, const char *data, int data_len)
+{
+    if (s_ring == NULL || topic_len < 0 || data_len < 0 || topic_len > UINT16_MAX || data_len > UINT16_MAX) {
+        return false;
+    }
+
+    // The one copy: the MQTT buffer is reused as soon as the event handler returns
+    size_t size = sizeof(command_item_t) + topic_len + data_len + 1;
+    void *slot = NULL;
+    if (size > xRingbufferGetMaxItemSize(s_ring) || xRingbufferSendAcquire(s_ring, &slot, size, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Dropping %d byte message, command queue full", data_len);
+        return false;
+    }
+    command_item_t *item = slot;
+    *item = (command_item_t){ .topic_len = (uint16_t)topic_len, .data_len = (uint16_t)data_len };
+    char *bytes = (char *)(item + 1);
+    memcpy(bytes, topic, topic_len);
+    memcpy(bytes + topic_len, data, data_len);
+    bytes[topic_len + data_len] = '\0';
+    xRingbufferSendComplete(s_ring, slot);
+    return true;
+}
+
+bool aws_iot_commands_post_work(aws_iot_work_t work, void *arg)
+{
+    if (s_ring == NULL || work == NULL) {
+        return false;
+    }
+    void *slot = NULL;
+    if (xRingbufferSendAcquire(s_ring, &slot, sizeof(command_item_t), 0) != pdTRUE) {
+        return false;
+    }
+    *(command_item_t *)slot = (command_item_t){ .work = work, .arg = arg };
+    xRingbufferSendComplete(s_ring, slot);
+    return true;
+}
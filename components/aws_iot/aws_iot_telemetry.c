@@ -0,0 +1,595 @@
+#include "aws_iot_telemetry.h"
+#include "aws_iot.h"
+#include "spiffs_ring.h"
+#include "app_metrics.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+static const char *TAG = "AWS_IOT_TELEMETRY";
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN
+#define CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN 64
+#endif
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_FLUSH_EVENTS
+#define CONFIG_AWS_IOT_TELEMETRY_FLUSH_EVENTS 16
+#endif
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_FLUSH_INTERVAL_MS
+#define CONFIG_AWS_IOT_TELEMETRY_FLUSH_INTERVAL_MS 30000
+#endif
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_BUFFER_SIZE
+#define CONFIG_AWS_IOT_TELEMETRY_BUFFER_SIZE 2048
+#endif
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_QOS
+#define CONFIG_AWS_IOT_TELEMETRY_QOS 1
+#endif
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_BACKLOG_EVENTS
+#define CONFIG_AWS_IOT_TELEMETRY_BACKLOG_EVENTS 2048
+#endif
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_DRAIN_INTERVAL_MS
+#define CONFIG_AWS_IOT_TELEMETRY_DRAIN_INTERVAL_MS 1000
+#endif
+
+#ifndef CONFIG_AWS_IOT_TELEMETRY_ACK_TIMEOUT_MS
+#define CONFIG_AWS_IOT_TELEMETRY_ACK_TIMEOUT_MS 10000
+#endif
+
+#ifndef CONFIG_APP_METRICS_PUSH_INTERVAL_S
+#define CONFIG_APP_METRICS_PUSH_INTERVAL_S 0
+#endif
+
+#define TELEMETRY_BACKLOG_PATH "/spiffs/telemetry.q"
+#define TELEMETRY_BATCH_EVENTS 32  // Events moved to or sent from the backlog at a time
+
+// Room kept free at the end of the buffer for closing the event list
+#define TELEMETRY_TAIL_RESERVE 4
+#define TELEMETRY_EARLY_ACKS 4     // PUBACKs remembered while the drain has no msg_id yet
+
+typedef enum {
+    TELEMETRY_EVENT_SENSOR,
+    TELEMETRY_EVENT_ACCESS,
+} telemetry_event_type_t;
+
+typedef struct {
+    uint8_t type;        // telemetry_event_type_t
+    bool granted;        // TELEMETRY_EVENT_ACCESS only
+    uint32_t timestamp;  // 0 if the clock was not synchronized
+    union {
+        struct {
+            float temperature;
+            float humidity;
+        } sensor;
+        uint32_t card_id;
+    };
+} telemetry_event_t;
+
+// Events wait in a ring until they are published. Every event has a sequence
+// number (head_seq + position), so the flush task can remove exactly the
+// events it published even if a full ring dropped some of them meanwhile.
+static telemetry_event_t s_events[CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN];
+static uint32_t s_head;
+static uint32_t s_count;
+static uint32_t s_head_seq;
+static uint32_t s_dropped;
+static SemaphoreHandle_t s_lock;
+static TaskHandle_t s_flush_task_handle;
+
+// Only touched by the flush task
+static char s_payload[CONFIG_AWS_IOT_TELEMETRY_BUFFER_SIZE];
+static telemetry_event_t s_batch[TELEMETRY_BATCH_EVENTS];
+
+// Offline backlog on SPIFFS, owned by the flush task. One backlog message
+// is in flight at a time; it is removed from the file once its PUBACK
+// arrives, or sent again after CONFIG_AWS_IOT_TELEMETRY_ACK_TIMEOUT_MS.
+static spiffs_ring_t s_backlog;
+static uint32_t s_backlog_base_seq;  // Sequence number of the oldest backlog event, counts overwritten ones
+static uint32_t s_inflight_seq;      // s_backlog_base_seq when the in-flight message was read
+static uint32_t s_inflight_count;
+static TickType_t s_inflight_sent;
+
+// Shared with the MQTT task, under s_ack_lock. A PUBACK is matched against the
+// in-flight message when it arrives, so other PUBACKs can not hide it. One that
+// arrives before the drain has stored its msg_id is kept in s_early_acks.
+static portMUX_TYPE s_ack_lock = portMUX_INITIALIZER_UNLOCKED;
+static int s_inflight_msg_id = -1;
+static bool s_inflight_acked;
+static int s_early_acks[TELEMETRY_EARLY_ACKS] = { -1, -1, -1, -1 };
+static uint32_t s_early_ack_next;
+
+static app_metrics_histogram_t *s_metric_flash_write;
+static app_metrics_counter_t *s_metric_flash_bytes;
+static TickType_t s_metrics_pushed;  // Tick of the last metrics push
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} telemetry_writer_t;
+
+/**
+ * @brief Appends formatted text, or nothing at all if it does not fit
+ * @return true if the text was appended
+ */
+static bool telemetry_append(telemetry_writer_t *w, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(w->buf + w->len, w->size - w->len, fmt, args);
+    va_end(args);
+
+    if (n < 0 || (size_t)n >= w->size - w->len) {
+        w->buf[w->len] = '\0';
+        return false;
+    }
+    w->len += n;
+    return true;
+}
+
+/**
+ * @brief Appends one event as a JSON object
+ */
+static bool telemetry_append_event(telemetry_writer_t *w, const telemetry_event_t *event, bool first)
+{
+    size_t start = w->len;
+    // Leave room for "]}" so the message can always be closed
+    size_t size = w->size;
+    w->size -= TELEMETRY_TAIL_RESERVE;
+
+    bool ok = telemetry_append(w, first ? "{\"type\":" : ",{\"type\":");
+    if (ok && event->type == TELEMETRY_EVENT_SENSOR) {
+        ok = telemetry_append(w, "\"sensor\"");
+    } else if (ok) {
+        ok = telemetry_append(w, "\"access\"");
+    }
+    if (ok && event->timestamp != 0) {
+        ok = telemetry_append(w, ",\"ts\":%" PRIu32, event->timestamp);
+    }
+    if (ok && event->type == TELEMETRY_EVENT_SENSOR) {
+        ok = telemetry_append(w, ",\"temperature\":%.2f,\"humidity\":%.2f}",
+                              event->sensor.temperature, event->sensor.humidity);
+    } else if (ok) {
+        ok = telemetry_append(w, ",\"card_id\":\"0x%08" PRIX32 "\",\"granted\":%s}",
+                              event->card_id, event->granted ? "true" : "false");
+    }
+
+    w->size = size;
+    if (!ok) {
+        w->len = start;
+        w->buf[start] = '\0';
+    }
+    return ok;
+}
+
+/**
+ * @brief Adds an event to the ring, dropping the oldest one if it is full
+ */
+static esp_err_t telemetry_push(const telemetry_event_t *event)
+{
+    if (s_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_count == CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN) {
+        s_head = (s_head + 1) % CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN;
+        s_head_seq++;
+        s_count--;
+        s_dropped++;
+    }
+    s_events[(s_head + s_count) % CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN] = *event;
+    s_count++;
+    bool flush = s_count >= CONFIG_AWS_IOT_TELEMETRY_FLUSH_EVENTS;
+    xSemaphoreGive(s_lock);
+
+    if (flush) {
+        xTaskNotifyGive(s_flush_task_handle);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Current time for an event, or 0 if the clock is not set yet
+ */
+static uint32_t telemetry_timestamp(void)
+{
+    time_t now;
+    time(&now);
+    return now > 1600000000 ? (uint32_t)now : 0;  // Sanity check for valid time (after 2020-09-13)
+}
+
+static void telemetry_begin(telemetry_writer_t *w, uint32_t dropped)
+{
+    w->buf = s_payload;
+    w->size = sizeof(s_payload);
+    w->len = 0;
+    telemetry_append(w, "{\"device_id\":\"%s\",\"dropped\":%" PRIu32 ",\"events\":[",
+                     CONFIG_AWS_EXAMPLE_CLIENT_ID, dropped);
+}
+
+static void telemetry_end(telemetry_writer_t *w)
+{
+    telemetry_append(w, "]}");
+}
+
+/**
+ * @brief Removes the ring events with a sequence number below end_seq
+ *
+ * Events the ring dropped meanwhile are already gone. Called with s_lock held.
+ */
+static void telemetry_discard_locked(uint32_t end_seq)
+{
+    while (s_count > 0 && (int32_t)(end_seq - s_head_seq) > 0) {
+        s_head = (s_head + 1) % CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN;
+        s_head_seq++;
+        s_count--;
+    }
+}
+
+/**
+ * @brief Serializes as many queued events as fit into s_payload
+ *
+ * @param end_seq Filled with the sequence number following the last serialized event
+ * @param dropped Filled with the drop count reported in the message
+ * @return Number of events serialized
+ */
+static uint32_t telemetry_serialize(uint32_t *end_seq, uint32_t *dropped)
+{
+    telemetry_writer_t w;
+    uint32_t n = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *dropped = s_dropped;
+    telemetry_begin(&w, *dropped);
+    while (n < s_count) {
+        const telemetry_event_t *event = &s_events[(s_head + n) % CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN];
+        if (!telemetry_append_event(&w, event, n == 0)) {
+            break;
+        }
+        n++;
+    }
+    *end_seq = s_head_seq + n;
+    xSemaphoreGive(s_lock);
+
+    telemetry_end(&w);
+    return n;
+}
+
+/**
+ * @brief Publishes everything in the ring, one message per full buffer
+ */
+static void telemetry_publish_pending(void)
+{
+    while (aws_iot_is_connected()) {
+        uint32_t end_seq;
+        uint32_t dropped;
+        uint32_t n = telemetry_serialize(&end_seq, &dropped);
+        if (n == 0) {
+            return;
+        }
+
+        esp_err_t err = aws_iot_publish(AWS_IOT_SENSOR_TOPIC, s_payload, strlen(s_payload), CONFIG_AWS_IOT_TELEMETRY_QOS, NULL);
+        if (err != ESP_OK) {
+            // Keep the events, the next flush tries again
+            ESP_LOGW(TAG, "Failed to publish %" PRIu32 " events", n);
+            return;
+        }
+        ESP_LOGI(TAG, "Published %" PRIu32 " events in %u bytes", n, (unsigned)strlen(s_payload));
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        telemetry_discard_locked(end_seq);
+        s_dropped -= dropped;
+        bool more = s_count > 0;
+        xSemaphoreGive(s_lock);
+
+        if (!more) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Opens the backlog file on first use, SPIFFS may be mounted after us
+ * @return true if the backlog can be used
+ */
+static bool telemetry_backlog_ready(void)
+{
+    if (CONFIG_AWS_IOT_TELEMETRY_BACKLOG_EVENTS == 0) {
+        return false;
+    }
+    if (s_backlog.file != NULL) {
+        return true;
+    }
+    return spiffs_ring_open(&s_backlog, TELEMETRY_BACKLOG_PATH, sizeof(telemetry_event_t),
+                            CONFIG_AWS_IOT_TELEMETRY_BACKLOG_EVENTS) == ESP_OK;
+}
+
+static uint32_t telemetry_backlog_count(void)
+{
+    return spiffs_ring_count(&s_backlog);
+}
+
+static uint32_t telemetry_ram_count(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t count = s_count;
+    xSemaphoreGive(s_lock);
+    return count;
+}
+
+/**
+ * @brief Moves the events waiting in RAM to the end of the backlog file
+ */
+static void telemetry_spill(void)
+{
+    if (!telemetry_backlog_ready()) {
+        return;
+    }
+
+    while (1) {
+        uint32_t n = 0;
+        uint32_t end_seq;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        while (n < s_count && n < TELEMETRY_BATCH_EVENTS) {
+            s_batch[n] = s_events[(s_head + n) % CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN];
+            n++;
+        }
+        end_seq = s_head_seq + n;
+        xSemaphoreGive(s_lock);
+
+        if (n == 0) {
+            return;
+        }
+
+        uint32_t overwritten = 0;
+        int64_t begin = app_metrics_begin();
+        if (spiffs_ring_push(&s_backlog, s_batch, n, &overwritten) != ESP_OK) {
+            // Leave the events in RAM, where the ring still bounds them
+            return;
+        }
+        app_metrics_end(s_metric_flash_write, begin);
+        app_metrics_count(s_metric_flash_bytes, n * sizeof(telemetry_event_t));
+
+        s_backlog_base_seq += overwritten;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        telemetry_discard_locked(end_seq);
+        s_dropped += overwritten;
+        xSemaphoreGive(s_lock);
+    }
+}
+
+/**
+ * @brief Sends the next backlog message once the previous one is acknowledged
+ *
+ * Called once per drain interval, which bounds the reconnect burst to one
+ * message of at most CONFIG_AWS_IOT_TELEMETRY_BUFFER_SIZE bytes per interval.
+ */
+static void telemetry_drain_backlog(void)
+{
+    portENTER_CRITICAL(&s_ack_lock);
+    int inflight_msg_id = s_inflight_msg_id;
+    bool acked = s_inflight_acked;
+    portEXIT_CRITICAL(&s_ack_lock);
+
+    if (inflight_msg_id >= 0) {
+        if (acked) {
+            // A full backlog may have overwritten some of the sent events since,
+            // only the ones still there are removed
+            uint32_t gone = s_backlog_base_seq - s_inflight_seq;
+            if (gone < s_inflight_count && spiffs_ring_pop(&s_backlog, s_inflight_count - gone) == ESP_OK) {
+                s_backlog_base_seq += s_inflight_count - gone;
+            }
+        } else if (xTaskGetTickCount() - s_inflight_sent < pdMS_TO_TICKS(CONFIG_AWS_IOT_TELEMETRY_ACK_TIMEOUT_MS)) {
+            return;
+        } else {
+            // Delivery is at least once, a late PUBACK just means a duplicate
+            ESP_LOGW(TAG, "No PUBACK for backlog msg_id=%d, sending it again", inflight_msg_id);
+        }
+        portENTER_CRITICAL(&s_ack_lock);
+        s_inflight_msg_id = -1;
+        s_inflight_acked = false;
+        portEXIT_CRITICAL(&s_ack_lock);
+    }
+    if (xTaskGetTickCount() - s_inflight_sent < pdMS_TO_TICKS(CONFIG_AWS_IOT_TELEMETRY_DRAIN_INTERVAL_MS)) {
+        return;
+    }
+
+    uint32_t n = 0;
+    if (spiffs_ring_read(&s_backlog, 0, s_batch, TELEMETRY_BATCH_EVENTS, &n) != ESP_OK || n == 0) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t dropped = s_dropped;
+    xSemaphoreGive(s_lock);
+
+    telemetry_writer_t w;
+    uint32_t sent = 0;
+    telemetry_begin(&w, dropped);
+    while (sent < n && telemetry_append_event(&w, &s_batch[sent], sent == 0)) {
+        sent++;
+    }
+    telemetry_end(&w);
+
+    // Only PUBACKs from here on can belong to this message
+    portENTER_CRITICAL(&s_ack_lock);
+    for (int i = 0; i < TELEMETRY_EARLY_ACKS; i++) {
+        s_early_acks[i] = -1;
+    }
+    portEXIT_CRITICAL(&s_ack_lock);
+
+    int msg_id = -1;
+    if (aws_iot_publish(AWS_IOT_SENSOR_TOPIC, s_payload, w.len, 1, &msg_id) != ESP_OK) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_dropped -= dropped;
+    xSemaphoreGive(s_lock);
+
+    portENTER_CRITICAL(&s_ack_lock);
+    s_inflight_msg_id = msg_id;
+    s_inflight_acked = false;
+    for (int i = 0; i < TELEMETRY_EARLY_ACKS; i++) {
+        if (s_early_acks[i] == msg_id) {
+            s_inflight_acked = true;
+            s_early_acks[i] = -1;
+        }
+    }
+    portEXIT_CRITICAL(&s_ack_lock);
+    s_inflight_seq = s_backlog_base_seq;
+    s_inflight_count = sent;
+    s_inflight_sent = xTaskGetTickCount();
+    ESP_LOGI(TAG, "Sent %" PRIu32 " backlog events, %" PRIu32 " left, msg_id=%d",
+             sent, telemetry_backlog_count() - sent, msg_id);
+}
+
+/**
+ * @brief app_metrics_write() callback, appends to a telemetry_writer_t
+ */
+static bool telemetry_metrics_write(const char *data, size_t len, void *ctx)
+{
+    telemetry_writer_t *w = ctx;
+    if (len >= w->size - w->len) {
+        return false;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    w->buf[w->len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Publishes the metrics summary every CONFIG_APP_METRICS_PUSH_INTERVAL_S
+ *
+ * Checked on every flush task wakeup, so pushes happen at least
+ * CONFIG_AWS_IOT_TELEMETRY_FLUSH_INTERVAL_MS apart.
+ */
+static void telemetry_push_metrics(void)
+{
+    if (CONFIG_APP_METRICS_PUSH_INTERVAL_S == 0 ||
+        xTaskGetTickCount() - s_metrics_pushed < pdMS_TO_TICKS(CONFIG_APP_METRICS_PUSH_INTERVAL_S * 1000)) {
+        return;
+    }
+    s_metrics_pushed = xTaskGetTickCount();
+
+    telemetry_writer_t w = { .buf = s_payload, .size = sizeof(s_payload), .len = 0 };
+    if (app_metrics_write(APP_METRICS_FORMAT_JSON_SUMMARY, telemetry_metrics_write, &w) != ESP_OK) {
+        ESP_LOGW(TAG, "Metrics summary does not fit in %u bytes, not pushed", (unsigned)sizeof(s_payload));
+        return;
+    }
+    if (aws_iot_publish(AWS_IOT_METRICS_TOPIC, s_payload, w.len, 0, NULL) == ESP_OK) {
+        ESP_LOGD(TAG, "Pushed %u bytes of metrics", (unsigned)w.len);
+    }
+}
+
+/**
+ * @brief Flushes on the interval, or earlier when notified
+ *
+ * While offline, new events go to the backlog file. While an older backlog
+ * is being drained they wait in RAM, which is newer than the whole file so
+ * the order is kept, and are moved to the file only if RAM fills up.
+ */
+static void telemetry_flush_task(void *pvParameters)
+{
+    while (1) {
+        bool draining = aws_iot_is_connected() && telemetry_backlog_count() > 0;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(draining ? CONFIG_AWS_IOT_TELEMETRY_DRAIN_INTERVAL_MS
+                                                         : CONFIG_AWS_IOT_TELEMETRY_FLUSH_INTERVAL_MS));
+
+        if (!aws_iot_is_connected() ||
+            (telemetry_backlog_count() > 0 && telemetry_ram_count() >= CONFIG_AWS_IOT_TELEMETRY_QUEUE_LEN / 2)) {
+            telemetry_spill();
+        }
+        if (!aws_iot_is_connected()) {
+            continue;
+        }
+        if (telemetry_backlog_count() > 0) {
+            telemetry_drain_backlog();
+        } else {
+            telemetry_publish_pending();
+        }
+        telemetry_push_metrics();
+    }
+}
+
+esp_err_t aws_iot_telemetry_init(void)
+{
+    if (s_lock != NULL) {
+        return ESP_OK;
+    }
+
+    s_metric_flash_write = app_metrics_histogram("flash_write_us", "file", "telemetry");
+    s_metric_flash_bytes = app_metrics_counter("flash_write_bytes_total", "file", "telemetry");
+
+    SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    if (lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create telemetry lock");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(telemetry_flush_task, "aws_telemetry", 4096, NULL, 4, &s_flush_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create telemetry task");
+        vSemaphoreDelete(lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Publishing the lock enables the add functions, the task exists by now
+    s_lock = lock;
+    return ESP_OK;
+}
+
+esp_err_t aws_iot_telemetry_add_sensor(float temperature, float humidity)
+{
+    telemetry_event_t event = {
+        .type = TELEMETRY_EVENT_SENSOR,
+        .timestamp = telemetry_timestamp(),
+        .sensor = { .temperature = temperature, .humidity = humidity },
+    };
+    return telemetry_push(&event);
+}
+
+esp_err_t aws_iot_telemetry_add_card_access(uint32_t card_id, bool granted)
+{
+    telemetry_event_t event = {
+        .type = TELEMETRY_EVENT_ACCESS,
+        .granted = granted,
+        .timestamp = telemetry_timestamp(),
+        .card_id = card_id,
+    };
+    return telemetry_push(&event);
+}
+
+esp_err_t aws_iot_telemetry_flush(void)
+{
+    if (s_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xTaskNotifyGive(s_flush_task_handle);
+    return ESP_OK;
+}
+
+void aws_iot_telemetry_on_published(int msg_id)
+{
+    portENTER_CRITICAL(&s_ack_lock);
+    if (s_inflight_msg_id >= 0 && msg_id == s_inflight_msg_id) {
+        s_inflight_acked = true;
+    } else {
+        s_early_acks[s_early_ack_next] = msg_id;
+        s_early_ack_next = (s_early_ack_next + 1) % TELEMETRY_EARLY_ACKS;
+    }
+    portEXIT_CRITICAL(&s_ack_lock);
+}
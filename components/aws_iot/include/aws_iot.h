@@ -26,13 +26,28 @@
 esp_err_t aws_iot_start(void);
 
 /**
- * @brief Publish sensor data to AWS IoT
+ * @brief Queue sensor data for the next telemetry batch
+ *
+ * Same as aws_iot_telemetry_add_sensor(), the sample is published together
+ * with the other queued telemetry on AWS_IOT_SENSOR_TOPIC.
+ *
  * @param temperature Temperature value in Celsius
  * @param humidity Humidity value in percentage
- * @return esp_err_t ESP_OK on success, error code otherwise
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE before aws_iot_start()
  */
 esp_err_t aws_iot_publish_sensor_data(float temperature, float humidity);
 
+/**
+ * @brief Publish a message to AWS IoT
+ * @param topic The topic to publish on
+ * @param payload The message data, not copied after the call returns
+ * @param len Length of payload, 0 to use strlen(payload)
+ * @param qos Quality of Service level (0, 1, or 2)
+ * @param msg_id_out Optional, filled with the message id reported again by MQTT_EVENT_PUBLISHED
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if not connected or the publish failed
+ */
+esp_err_t aws_iot_publish(const char *topic, const char *payload, int len, int qos, int *msg_id_out);
+
 /**
  * @brief Check if AWS IoT connection is established
  * @return true if connected, false otherwise
@@ -41,6 +56,10 @@ bool aws_iot_is_connected(void);
 
 /**
  * @brief Callback function type for received MQTT messages
+ *
+ * Called on the command worker task for messages that are not a command
+ * registered with aws_iot_commands_register().
+ *
  * @param topic The topic on which the message was received
  * @param topic_len Length of the topic string
  * @param data The message data
@@ -75,4 +94,9 @@ esp_err_t aws_iot_unsubscribe(const char *topic);
  */
 #define AWS_IOT_COMMAND_TOPIC "esp32/command"
 
+/**
+ * @brief Topic the metrics summary is pushed to, see CONFIG_APP_METRICS_PUSH_INTERVAL_S
+ */
+#define AWS_IOT_METRICS_TOPIC "esp32/metrics"
+
 #endif /* COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_H_ */
@@ -0,0 +1,76 @@
+#ifndef COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_CARD_SYNC_H_
+#define COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_CARD_SYNC_H_
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Card database sync from the cloud. Each device subscribes to
+ * esp32/<client id>/cards/delta and receives versioned batches of changes:
+ *
+ *   {"from":41,"version":42,
+ *    "add":[{"card_id":"0x1234ABCD","name":"Alice"}],
+ *    "remove":["0x0BADCAFE"]}
+ *
+ * Card ids are strings as in the telemetry ("0x..." hex or plain decimal, leading
+ * zeros are decimal) or whole numbers. One invalid id rejects the whole delta.
+ * A batch carries the final state of every card changed between "from" and
+ * "version", so it can be applied to any database at a version in
+ * [from, version): it goes to rfid_manager_apply_changes() as one
+ * transaction, is flushed to flash and only then is the new version stored
+ * in NVS. A reset in between just applies the same batch again.
+ *
+ * After every batch and on every connect the device reports its version on
+ * esp32/<client id>/cards/ack, QoS 1:
+ *
+ *   {"device_id":"...","version":42,"status":"applied"}
+ *
+ * "status" is "applied" if the database is at the version of the batch
+ * (also for a batch received twice), "gap" if "from" is ahead of the device
+ * and "rejected" if a batch could not be applied, e.g. because the database
+ * is full or the message exceeds CONFIG_AWS_IOT_CARD_SYNC_MAX_BYTES or
+ * CONFIG_AWS_IOT_CARD_SYNC_MAX_CHANGES. The cloud answers every report
+ * with the changes since the reported version, so an offline device catches
+ * up after a reconnect.
+ */
+
+/**
+ * @brief Load the synced version from NVS
+ *
+ * Called by aws_iot_start(), calling it again is a no-op.
+ *
+ * @return esp_err_t ESP_OK on success, or the NVS error (the device then starts from version 0)
+ */
+esp_err_t aws_iot_card_sync_init(void);
+
+/**
+ * @brief Subscribe to the delta topic and report the current version, called by aws_iot.c on connect
+ */
+void aws_iot_card_sync_on_connected(void);
+
+/**
+ * @brief Offer received MQTT data to the card sync, called by aws_iot.c for MQTT_EVENT_DATA
+ *
+ * Large messages arrive in several fragments, only the first one carries the
+ * topic. Runs on the MQTT task and only reassembles the message; a complete
+ * batch is handed to the command worker (aws_iot_commands_post_work()) and
+ * applied there.
+ *
+ * @param topic Topic of the message, only set for the first fragment
+ * @param topic_len Length of topic
+ * @param data Fragment data
+ * @param data_len Length of this fragment
+ * @param offset Offset of this fragment in the message
+ * @param total_len Length of the whole message
+ * @return true if the fragment belonged to a delta message and was consumed
+ */
+bool aws_iot_card_sync_on_data(const char *topic, int topic_len, const char *data, int data_len,
+                               int offset, int total_len);
+
+/**
+ * @brief Version of the card database last synced from the cloud, 0 if never
+ */
+uint32_t aws_iot_card_sync_get_version(void);
+
+#endif /* COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_CARD_SYNC_H_ */
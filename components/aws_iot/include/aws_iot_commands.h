@@ -0,0 +1,94 @@
+#ifndef COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_COMMANDS_H_
+#define COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_COMMANDS_H_
+
+#include "esp_err.h"
+#include "aws_iot.h"
+#include "cJSON.h"
+#include <stdbool.h>
+
+/**
+ * Commands received over AWS IoT, e.g. {"command":"ota","url":"https://..."}.
+ *
+ * The MQTT task only copies each message into a ring buffer and goes back to
+ * the network. A worker task parses the message in place in the ring, looks
+ * the "command" string up in a hash table built at registration and calls
+ * the handler with pointers into the ring, so a slow handler never holds up
+ * incoming messages or keep-alives. Messages without a registered "command"
+ * go to the callback set with aws_iot_set_message_callback(), on the worker
+ * task as well.
+ *
+ * Messages larger than the ring can hold (CONFIG_AWS_IOT_COMMAND_QUEUE_BYTES)
+ * and messages arriving while the ring is full are dropped.
+ */
+
+/**
+ * @brief A received command, valid only during the handler call
+ */
+typedef struct {
+    const char *topic;  // Not null-terminated
+    int topic_len;
+    const char *data;   // Raw message, null-terminated
+    int data_len;
+    const cJSON *json;  // Parsed message
+} aws_iot_command_t;
+
+/**
+ * @brief Command handler, runs on the command worker task
+ * @param command The command and the message it came with
+ * @param arg Argument given to aws_iot_commands_register()
+ */
+typedef void (*aws_iot_command_handler_t)(const aws_iot_command_t *command, void *arg);
+
+/**
+ * @brief Function run on the command worker task, see aws_iot_commands_post_work()
+ */
+typedef void (*aws_iot_work_t)(void *arg);
+
+/**
+ * @brief Register the handler of a command
+ *
+ * Must be called before aws_iot_start(); the table is not locked.
+ *
+ * @param name Command name, must stay valid (normally a string literal)
+ * @param handler Handler to call
+ * @param arg Passed to the handler
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on NULL arguments,
+ *         ESP_ERR_INVALID_STATE if the name is taken or the worker already runs,
+ *         ESP_ERR_NO_MEM if CONFIG_AWS_IOT_COMMAND_MAX handlers are registered
+ */
+esp_err_t aws_iot_commands_register(const char *name, aws_iot_command_handler_t handler, void *arg);
+
+/**
+ * @brief Create the ring buffer and start the worker task
+ *
+ * Called by aws_iot_start(), calling it again is a no-op.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the ring or task could not be created
+ */
+esp_err_t aws_iot_commands_start(void);
+
+/**
+ * @brief Set the callback for messages that are no registered command, called by aws_iot_set_message_callback()
+ * @param callback Callback, or NULL to drop such messages
+ */
+void aws_iot_commands_set_fallback(aws_iot_message_callback_t callback);
+
+/**
+ * @brief Queue a received message for the worker, called by aws_iot.c on the MQTT task
+ * @return true if the message was queued
+ */
+bool aws_iot_commands_post(const char *topic, int topic_len, const char *data, int data_len);
+
+/**
+ * @brief Queue a function call for the worker, for slow work arriving on the MQTT task
+ *
+ * Runs after the messages queued before it. Only the pointers are queued, arg
+ * must stay valid until work runs.
+ *
+ * @param work Function to call on the worker task
+ * @param arg Passed to work
+ * @return true if queued; false if the worker is not started or the ring is full
+ */
+bool aws_iot_commands_post_work(aws_iot_work_t work, void *arg);
+
+#endif /* COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_COMMANDS_H_ */
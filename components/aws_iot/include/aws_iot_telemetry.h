@@ -0,0 +1,65 @@
+#ifndef COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_TELEMETRY_H_
+#define COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_TELEMETRY_H_
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Telemetry is buffered in a fixed size ring and published in batches, one
+ * MQTT message per flush instead of one per sample:
+ *
+ *   {"device_id":"...","dropped":0,"events":[
+ *     {"type":"sensor","ts":1718000000,"temperature":24.50,"humidity":51.20},
+ *     {"type":"access","ts":1718000003,"card_id":"0x1234ABCD","granted":true}]}
+ *
+ * "ts" is left out while the clock is not synchronized, "dropped" counts the
+ * events lost to a full ring since the previous message. A flush happens
+ * every CONFIG_AWS_IOT_TELEMETRY_FLUSH_INTERVAL_MS, or as soon as
+ * CONFIG_AWS_IOT_TELEMETRY_FLUSH_EVENTS events are waiting.
+ *
+ * While AWS IoT is disconnected the events are moved to a bounded backlog
+ * file on SPIFFS (/spiffs/telemetry.q), so they survive outages and resets;
+ * once it is full the oldest are dropped. After a reconnect the backlog is
+ * drained with QoS 1, one message per CONFIG_AWS_IOT_TELEMETRY_DRAIN_INTERVAL_MS,
+ * each removed from the file only when its PUBACK arrives.
+ */
+
+/**
+ * @brief Initialize the telemetry ring and start the flush task
+ *
+ * Called by aws_iot_start(), calling it again is a no-op.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the task or lock could not be created
+ */
+esp_err_t aws_iot_telemetry_init(void);
+
+/**
+ * @brief Queue a sensor sample for the next batch
+ * @param temperature Temperature value in Celsius
+ * @param humidity Humidity value in percentage
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE before aws_iot_telemetry_init()
+ */
+esp_err_t aws_iot_telemetry_add_sensor(float temperature, float humidity);
+
+/**
+ * @brief Queue a card access event for the next batch
+ * @param card_id The card that was presented
+ * @param granted true if the card was accepted
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE before aws_iot_telemetry_init()
+ */
+esp_err_t aws_iot_telemetry_add_card_access(uint32_t card_id, bool granted);
+
+/**
+ * @brief Ask the flush task to publish the queued events now
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE before aws_iot_telemetry_init()
+ */
+esp_err_t aws_iot_telemetry_flush(void);
+
+/**
+ * @brief Reports a PUBACK to the backlog drain, called by aws_iot.c
+ * @param msg_id Message id from MQTT_EVENT_PUBLISHED
+ */
+void aws_iot_telemetry_on_published(int msg_id);
+
+#endif /* COMPONENTS_AWS_IOT_INCLUDE_AWS_IOT_TELEMETRY_H_ */
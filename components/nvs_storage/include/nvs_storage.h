@@ -33,6 +33,42 @@ bool nvs_storage_set_wifi_credentials(const char *ssid, const char *password);
 bool wifi_credentials_test(void);
 bool nvs_storage_get_wifi_credentials(char *ssid, size_t ssid_size, char *password, size_t password_size);
 
+/**
+ * @brief Store a binary record in the application namespace and commit it
+ *
+ * @param key NVS key, at most 15 characters
+ * @param data Record to store
+ * @param length Size of the record in bytes
+ * @return esp_err_t
+ *     - ESP_OK if the record was written and committed
+ *     - ESP_ERR_INVALID_ARG on NULL arguments
+ *     - Other error codes from the underlying NVS APIs
+ */
+esp_err_t nvs_storage_set_blob(const char *key, const void *data, size_t length);
+
+/**
+ * @brief Read a binary record from the application namespace
+ *
+ * @param key NVS key, at most 15 characters
+ * @param data Buffer receiving the record
+ * @param length In: size of data. Out: size of the stored record
+ * @return esp_err_t
+ *     - ESP_OK if the record was read
+ *     - ESP_ERR_NVS_NOT_FOUND if there is no record for key
+ *     - ESP_ERR_NVS_INVALID_LENGTH if data is too small for the record
+ *     - Other error codes from the underlying NVS APIs
+ */
+esp_err_t nvs_storage_get_blob(const char *key, void *data, size_t *length);
+
+/**
+ * @brief Remove a key from the application namespace and commit
+ *
+ * @param key NVS key
+ * @return esp_err_t ESP_OK if the key was removed or did not exist,
+ *         other error codes from the underlying NVS APIs
+ */
+esp_err_t nvs_storage_erase_key(const char *key);
+
 #ifdef __cplusplus
 }
 #endif
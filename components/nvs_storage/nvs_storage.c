@@ -156,6 +156,57 @@ bool nvs_storage_set_wifi_credentials(const char *ssid, const char *password)
     return true;
 }
 
+esp_err_t nvs_storage_set_blob(const char *key, const void *data, size_t length)
+{
+    if (key == NULL || data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = nvs_set_blob(nvs_storage_handle, key, data, length);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error writing '%s' to NVS: %s", key, esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_commit(nvs_storage_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing '%s' to NVS: %s", key, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t nvs_storage_get_blob(const char *key, void *data, size_t *length)
+{
+    if (key == NULL || data == NULL || length == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Not found is an expected answer, leave the logging to the caller
+    return nvs_get_blob(nvs_storage_handle, key, data, length);
+}
+
+esp_err_t nvs_storage_erase_key(const char *key)
+{
+    if (key == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = nvs_erase_key(nvs_storage_handle, key);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error erasing '%s' from NVS: %s", key, esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_commit(nvs_storage_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing erase of '%s': %s", key, esp_err_to_name(err));
+    }
+    return err;
+}
+
 bool wifi_credentials_test(void)
 {
     // Test values to validate storage and retrieval
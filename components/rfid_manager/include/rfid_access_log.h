@@ -0,0 +1,139 @@
+#ifndef RFID_ACCESS_LOG_H
+#define RFID_ACCESS_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define RFID_READER_ID_API 0 // Checks made through rfid_manager_check_card() / the web API
+
+// One card check. Stored as is in the log file, 12 bytes per record.
+typedef struct {
+    uint32_t card_id;   // Card that was presented
+    uint32_t timestamp; // time() of the check
+    uint8_t granted;    // 1 if the card was active, 0 if unknown or removed
+    uint8_t reader_id;  // Reader the card was presented to
+    uint16_t reserved;  // Always 0
+} rfid_access_record_t;
+
+// Selects records for rfid_access_log_count() and the iterator
+typedef struct {
+    uint32_t from_ts; // Only records with timestamp >= from_ts, 0 for no lower bound
+    uint32_t to_ts;   // Only records with timestamp <= to_ts, 0 for no upper bound
+    uint32_t card_id; // Only records of this card, 0 for every card
+} rfid_access_filter_t;
+
+// Cursor for walking the log in batches, oldest record first
+typedef struct {
+    rfid_access_filter_t filter;
+    uint32_t next_seq; // Sequence number of the next record to examine
+    bool done;         // Set once the newest record has been examined
+} rfid_access_iter_t;
+
+/**
+ * @brief Opens the access log file, called by rfid_manager_init().
+ *
+ * The log is a preallocated ring of CONFIG_RFID_ACCESS_LOG_RECORDS records in
+ * /spiffs/rfid_access.log; once it is full the oldest records are overwritten.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the locks could not be
+ *         created, ESP_FAIL if the file can not be opened.
+ */
+esp_err_t rfid_access_log_init(void);
+
+/**
+ * @brief Writes staged records and closes the log, called by rfid_manager_deinit().
+ *
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if the staged records could not be written.
+ */
+esp_err_t rfid_access_log_deinit(void);
+
+/**
+ * @brief Records a card check.
+ *
+ * The record is staged in RAM; staged records are written to flash in one
+ * batch by rfid_access_log_process(). Never writes flash or waits for a
+ * flush, so it is safe to call from any task, including the reader task.
+ * While the staging buffer is full records are dropped.
+ *
+ * @param card_id Card that was presented.
+ * @param granted Result of the check.
+ * @param reader_id Reader the card was presented to, RFID_READER_ID_API for API checks.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if the log is not initialized,
+ *         ESP_ERR_NO_MEM if the staging buffer is full and the record was dropped.
+ */
+esp_err_t rfid_access_log_record(uint32_t card_id, bool granted, uint8_t reader_id);
+
+/**
+ * @brief Writes the staged records once enough have accumulated or they are old enough.
+ *
+ * Called from rfid_manager_process().
+ *
+ * @return true if a batch was written, false otherwise.
+ */
+bool rfid_access_log_process(void);
+
+/**
+ * @brief Registers the callback used to request a rfid_access_log_process() call.
+ *
+ * Called once half of the staging buffer is used, when it is full and when the
+ * oldest staged record reaches CONFIG_RFID_ACCESS_LOG_FLUSH_MS. Set through
+ * rfid_manager_set_work_callback().
+ *
+ * @param callback Callback to register, or NULL.
+ */
+void rfid_access_log_set_work_callback(void (*callback)(void));
+
+/**
+ * @brief Writes all staged records to flash now.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if the log is not initialized,
+ *         ESP_FAIL on write errors or if the lock times out.
+ */
+esp_err_t rfid_access_log_flush(void);
+
+/**
+ * @brief Counts the records matching a filter.
+ *
+ * @param filter Filter to apply, NULL counts every record.
+ * @param count Filled with the number of matching records.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if count is NULL,
+ *         ESP_ERR_INVALID_STATE if the log is not initialized, ESP_FAIL on read errors.
+ */
+esp_err_t rfid_access_log_count(const rfid_access_filter_t *filter, uint32_t *count);
+
+/**
+ * @brief Resets an iterator to the oldest record matching a filter.
+ *
+ * @param iter Iterator to initialize.
+ * @param filter Filter to apply, copied into the iterator. NULL matches every record.
+ */
+void rfid_access_log_iter_init(rfid_access_iter_t *iter, const rfid_access_filter_t *filter);
+
+/**
+ * @brief Advances an iterator past the next count matching records.
+ *
+ * @param iter Iterator initialized with rfid_access_log_iter_init().
+ * @param count Number of matching records to skip.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if iter is NULL,
+ *         ESP_ERR_INVALID_STATE if the log is not initialized, ESP_FAIL on read errors.
+ */
+esp_err_t rfid_access_log_iter_skip(rfid_access_iter_t *iter, uint32_t count);
+
+/**
+ * @brief Copies the next batch of matching records, oldest first.
+ *
+ * Staged records are flushed first, so the newest checks are included.
+ * Records overwritten between batches are passed over, no record is
+ * returned twice.
+ *
+ * @param iter Iterator initialized with rfid_access_log_iter_init().
+ * @param records Array receiving up to max_records records.
+ * @param max_records Capacity of records.
+ * @param num_records Filled with the number of records copied; 0 once iter->done is set.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on NULL arguments,
+ *         ESP_ERR_INVALID_STATE if the log is not initialized, ESP_FAIL on read errors.
+ */
+esp_err_t rfid_access_log_iter_next(rfid_access_iter_t *iter, rfid_access_record_t *records, uint16_t max_records, uint16_t *num_records);
+
+#endif // RFID_ACCESS_LOG_H
@@ -3,9 +3,21 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "esp_err.h"
+#include "sdkconfig.h"
+#include "rfid_access_log.h" // For RFID_READER_ID_API
 
-#define RFID_MAX_CARDS 200
+#ifndef CONFIG_RFID_MAX_CARDS
+#define CONFIG_RFID_MAX_CARDS 200
+#endif
+
+#ifndef CONFIG_RFID_STORE_BLOCK_CARDS
+#define CONFIG_RFID_STORE_BLOCK_CARDS 16
+#endif
+
+#define RFID_MAX_CARDS CONFIG_RFID_MAX_CARDS
+#define RFID_STORE_BLOCK_CARDS CONFIG_RFID_STORE_BLOCK_CARDS // Slots per paged block of the card table
 #define RFID_CARD_NAME_LEN 32
 #define RFID_DEFAULT_CACHE_TIMEOUT_MS 5000  // Default 5 seconds cache timeout
 
@@ -26,9 +38,10 @@ int testable_mean(const int *values, int count);
  *
  * This function should be called once at startup. It will:
  * 1. Ensure the SPIFFS filesystem is mounted (usually handled by spi_ffs_storage component).
- * 2. Attempt to load RFID cards from the persistent storage file.
- * 3. If the file doesn't exist, is empty, or corrupted (checksum mismatch),
- *    it will initialize the database with default cards.
+ * 2. Load the newest of the two database copies whose CRC32 checks out,
+ *    the other copy if that one is damaged, and replay the journal on top.
+ * 3. If neither copy exists or is valid, initialize the database with
+ *    default cards.
  *
  * @return esp_err_t ESP_OK on success, or an error code on failure.
  */
@@ -50,6 +63,24 @@ esp_err_t rfid_manager_init(void);
  */
 esp_err_t rfid_manager_add_card(uint32_t card_id, const char* name);
 
+/**
+ * @brief Adds many RFID cards in one locked pass.
+ *
+ * Used for bulk imports. Cards whose card_id is 0 or already present in the
+ * database (active or not) are skipped, like rfid_manager_add_card() would
+ * reject them. The 'active' field of the input is ignored; a timestamp of 0
+ * is replaced by the current time. The batch is added as a whole or not at
+ * all, and persistence is scheduled once for it.
+ *
+ * @param cards Array of cards to add.
+ * @param count Number of elements in cards.
+ * @param num_cards_added Filled with the number of cards actually added.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the new cards do not all
+ *         fit or their blocks cannot be paged in (nothing is added then),
+ *         ESP_ERR_INVALID_ARG on NULL arguments, ESP_FAIL for other errors.
+ */
+esp_err_t rfid_manager_add_cards_batch(const rfid_card_t *cards, uint16_t count, uint16_t *num_cards_added);
+
 /**
  * @brief Removes an RFID card from the database.
  *
@@ -64,6 +95,31 @@ esp_err_t rfid_manager_add_card(uint32_t card_id, const char* name);
  */
 esp_err_t rfid_manager_remove_card(uint32_t card_id);
 
+// One entry of rfid_manager_apply_changes()
+typedef struct {
+    uint32_t card_id;
+    bool remove;                   // true: remove the card, false: add it or update its name
+    char name[RFID_CARD_NAME_LEN]; // Card holder name, ignored for removals
+} rfid_card_change_t;
+
+/**
+ * @brief Applies a batch of card additions and removals as one transaction.
+ *
+ * Used for remote sync. All removals are applied before the additions, under
+ * a single write lock, so checks see either none or all of the batch. Unlike
+ * rfid_manager_add_card(), adding a card that is already present updates its
+ * name, and adding a removed card activates it again. Removing a card that
+ * is not active is not an error. Persistence is scheduled once for the batch.
+ *
+ * @param changes Array of changes.
+ * @param count Number of elements in changes.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the additions would not
+ *         fit or the blocks of the changed slots cannot be paged in (nothing is
+ *         applied then), ESP_ERR_INVALID_ARG on NULL arguments or a card_id of 0,
+ *         ESP_FAIL for other errors.
+ */
+esp_err_t rfid_manager_apply_changes(const rfid_card_change_t *changes, uint16_t count);
+
 /**
  * @brief Checks if an RFID card is authorized.
  *
@@ -74,6 +130,18 @@ esp_err_t rfid_manager_remove_card(uint32_t card_id);
  */
 bool rfid_manager_check_card(uint32_t card_id);
 
+/**
+ * @brief Checks if an RFID card is authorized at a given reader.
+ *
+ * Same as rfid_manager_check_card(), and records the check together with the
+ * reader in the card access log (see rfid_access_log.h).
+ *
+ * @param card_id The 32-bit ID of the RFID card to check.
+ * @param reader_id Reader the card was presented to, RFID_READER_ID_API for API checks.
+ * @return true if the card is authorized and active, false otherwise.
+ */
+bool rfid_manager_check_card_at(uint32_t card_id, uint8_t reader_id);
+
 /**
  * @brief Gets the total number of active RFID cards in the database.
  *
@@ -94,6 +162,74 @@ uint16_t rfid_manager_get_card_count(void);
  */
 esp_err_t rfid_manager_list_cards(rfid_card_t *cards_buffer, uint16_t buffer_size, uint16_t *num_cards_copied);
 
+// Selects a subset of the active cards for iteration and counting
+typedef struct {
+    char name_prefix[RFID_CARD_NAME_LEN]; // Case-insensitive name prefix, empty matches every card
+    uint32_t since_ts;                    // Only cards with timestamp >= since_ts, 0 matches every card
+} rfid_card_filter_t;
+
+// Cursor for walking the active cards in batches, see rfid_manager_card_iter_next()
+typedef struct {
+    uint32_t next_card_id;     // Lowest card_id not returned yet
+    bool done;                 // Set once the last matching card has been returned
+    rfid_card_filter_t filter; // Cards not matching the filter are passed over
+} rfid_card_iter_t;
+
+/**
+ * @brief Resets an iterator to the start of the card list.
+ *
+ * @param iter Pointer to the iterator to initialize.
+ */
+void rfid_manager_card_iter_init(rfid_card_iter_t *iter);
+
+/**
+ * @brief Resets an iterator to the start of the cards matching a filter.
+ *
+ * @param iter Pointer to the iterator to initialize.
+ * @param filter Filter to apply, copied into the iterator. NULL matches every card.
+ */
+void rfid_manager_card_iter_init_filtered(rfid_card_iter_t *iter, const rfid_card_filter_t *filter);
+
+/**
+ * @brief Advances an iterator past the next count matching cards without copying them.
+ *
+ * Used to implement paging offsets.
+ *
+ * @param iter Iterator initialized with rfid_manager_card_iter_init() or _init_filtered().
+ * @param count Number of matching cards to skip.
+ * @param num_cards_skipped Optional, filled with the number of cards actually skipped.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if iter is NULL,
+ *         ESP_FAIL if the manager is not initialized or the lock times out.
+ */
+esp_err_t rfid_manager_card_iter_skip(rfid_card_iter_t *iter, uint32_t count, uint32_t *num_cards_skipped);
+
+/**
+ * @brief Counts the active cards matching a filter.
+ *
+ * @param filter Filter to apply, NULL counts every active card.
+ * @param count Filled with the number of matching cards.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if count is NULL,
+ *         ESP_FAIL if the manager is not initialized or the lock times out.
+ */
+esp_err_t rfid_manager_count_cards(const rfid_card_filter_t *filter, uint32_t *count);
+
+/**
+ * @brief Copies the next batch of matching active cards, in ascending card_id order.
+ *
+ * The database lock is held only while one batch is copied, so callers can
+ * stream a list of any size through a small buffer without blocking card
+ * checks. Cards added or removed between batches may or may not show up,
+ * but no card is returned twice.
+ *
+ * @param iter Iterator initialized with rfid_manager_card_iter_init().
+ * @param cards_buffer Array receiving up to buffer_size cards.
+ * @param buffer_size Capacity of cards_buffer.
+ * @param num_cards_copied Filled with the number of cards copied; 0 once iter->done is set.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on NULL arguments,
+ *         ESP_FAIL if the manager is not initialized or the lock times out.
+ */
+esp_err_t rfid_manager_card_iter_next(rfid_card_iter_t *iter, rfid_card_t *cards_buffer, uint16_t buffer_size, uint16_t *num_cards_copied);
+
 /**
  * @brief Formats the RFID database.
  *
@@ -105,7 +241,14 @@ esp_err_t rfid_manager_list_cards(rfid_card_t *cards_buffer, uint16_t buffer_siz
  */
 esp_err_t rfid_manager_format_database(void);
 
-
+/**
+ * @brief Writes the active cards as a JSON object {"cards":[{"id","nm","ts"},...]}.
+ *
+ * @param buffer Buffer for the NUL-terminated JSON string.
+ * @param bufferLength Size of buffer in bytes, about 80 bytes per card plus 13.
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if the arguments are invalid, the
+ *         lock could not be taken or the list does not fit in the buffer.
+ */
 esp_err_t rfid_manager_get_card_list_json(char* buffer, size_t bufferLength);
 
 /**
@@ -120,11 +263,26 @@ esp_err_t rfid_manager_get_card_list_json(char* buffer, size_t bufferLength);
  */
 esp_err_t rfid_manager_set_cache_timeout(uint32_t timeout_ms);
 
+/**
+ * @brief Set how often last-seen timestamps from card checks are written to flash.
+ *
+ * Checks only update the timestamp in RAM. The slots checked since the last
+ * write are appended to the journal as small timestamp records once per
+ * interval, at most CONFIG_RFID_LAST_SEEN_MAX_WRITES_PER_HOUR times an hour,
+ * and with every card save or rfid_manager_flush_cache().
+ *
+ * @param interval_ms Write interval in milliseconds. 0 keeps timestamps in RAM
+ *                    until the next card save.
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if the manager is not initialized.
+ */
+esp_err_t rfid_manager_set_last_seen_interval(uint32_t interval_ms);
+
 /**
  * @brief Force an immediate write of any cached changes to flash storage.
  *
  * This function can be used to ensure all changes are persisted immediately,
  * for example before system shutdown or when immediate persistence is required.
+ * Pending last-seen timestamps are written as well.
  *
  * @return esp_err_t ESP_OK on success, or an error code on failure.
  */
@@ -141,6 +299,24 @@ esp_err_t rfid_manager_flush_cache(void);
  */
 bool rfid_manager_process(void);
 
+/**
+ * @brief Callback telling the application that rfid_manager_process() has work.
+ *
+ * Called from the esp_timer task or from the task that checked a card, so it
+ * must not block; notifying the task that calls rfid_manager_process() is enough.
+ */
+typedef void (*rfid_manager_work_cb_t)(void);
+
+/**
+ * @brief Registers the callback used to request a rfid_manager_process() call.
+ *
+ * With a callback registered the application can sleep until told instead of
+ * polling rfid_manager_process(). Pass NULL to go back to polling.
+ *
+ * @param callback Callback to register, or NULL.
+ */
+void rfid_manager_set_work_callback(rfid_manager_work_cb_t callback);
+
 esp_err_t rfid_manager_deinit(void);
 
 // Custom error codes for RFID Manager
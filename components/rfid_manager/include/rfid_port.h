@@ -0,0 +1,92 @@
+#ifndef RFID_PORT_H
+#define RFID_PORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/*
+ * Storage and OS services of the card database that are not plain FreeRTOS
+ * or C stdio. On the chip they are SPIFFS, esp_timer and heap_caps; on the
+ * ESP-IDF Linux target (see host_test/) the card files live in a directory
+ * of the host file system and timers are FreeRTOS software timers, so
+ * rfid_manager runs unchanged on a development machine.
+ */
+
+#ifndef CONFIG_RFID_STORAGE_BASE_PATH
+#define CONFIG_RFID_STORAGE_BASE_PATH "/spiffs"
+#endif
+
+// Path of a card database file, e.g. RFID_PORT_PATH("rfid_cards.a")
+#define RFID_PORT_PATH(name) CONFIG_RFID_STORAGE_BASE_PATH "/" name
+
+// Checksum test of the card files. Fuzz builds (host_test/ with -DHOST_TEST_FUZZ=ON)
+// accept any checksum, following the libFuzzer convention, so random input reaches
+// the record parsers behind the CRCs.
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+#define RFID_PORT_CRC_OK(stored, computed) ((void)(stored), (void)(computed), true)
+#else
+#define RFID_PORT_CRC_OK(stored, computed) ((stored) == (computed))
+#endif
+
+typedef void (*rfid_port_timer_cb_t)(void *arg);
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+typedef struct rfid_port_timer *rfid_port_timer_t;
+#else
+#include "esp_timer.h"
+typedef esp_timer_handle_t rfid_port_timer_t;
+#endif
+
+/**
+ * @brief Creates a one-shot timer, the callback runs on a timer task
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the timer could not be created
+ */
+esp_err_t rfid_port_timer_create(rfid_port_timer_cb_t callback, void *arg, const char *name, rfid_port_timer_t *timer);
+
+/**
+ * @brief Arms the timer to fire once after timeout_us
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if it is already armed
+ */
+esp_err_t rfid_port_timer_start_once(rfid_port_timer_t timer, uint64_t timeout_us);
+
+/**
+ * @brief Disarms the timer, nothing happens if it is not armed
+ */
+void rfid_port_timer_stop(rfid_port_timer_t timer);
+
+/**
+ * @brief Deletes a stopped timer
+ */
+void rfid_port_timer_delete(rfid_port_timer_t timer);
+
+/**
+ * @brief Microseconds since boot (since start of the process on the host)
+ */
+int64_t rfid_port_time_us(void);
+
+/**
+ * @brief calloc() for the card table, from PSRAM if prefer_psram and there is some
+ */
+void *rfid_port_calloc(size_t n, size_t size, bool prefer_psram);
+
+/**
+ * @brief Frees memory of rfid_port_calloc()
+ */
+void rfid_port_free(void *ptr);
+
+/**
+ * @brief Size and usage of the file system holding CONFIG_RFID_STORAGE_BASE_PATH
+ * @return esp_err_t ESP_OK on success, an error if the file system is not mounted
+ */
+esp_err_t rfid_port_storage_info(size_t *total_bytes, size_t *used_bytes);
+
+/**
+ * @brief Renames a file, fails like SPIFFS if new_path exists
+ * @return true on success
+ */
+bool rfid_port_rename(const char *old_path, const char *new_path);
+
+#endif // RFID_PORT_H
@@ -0,0 +1,463 @@
+#include "rfid_access_log.h"
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "spiffs_ring.h"
+#include "rfid_port.h"
+#include "app_metrics.h"
+
+static const char *TAG = "RFID_ACCESS_LOG";
+
+#define RFID_ACCESS_LOG_FILE RFID_PORT_PATH("rfid_access.log")
+
+#ifndef CONFIG_RFID_ACCESS_LOG_RECORDS
+#define CONFIG_RFID_ACCESS_LOG_RECORDS 4096
+#endif
+
+#ifndef CONFIG_RFID_ACCESS_LOG_STAGING
+#define CONFIG_RFID_ACCESS_LOG_STAGING 32
+#endif
+
+#ifndef CONFIG_RFID_ACCESS_LOG_FLUSH_MS
+#define CONFIG_RFID_ACCESS_LOG_FLUSH_MS 10000
+#endif
+
+#define RFID_ACCESS_LOG_SCAN_BATCH 32 // Records read from flash per fread while filtering
+
+_Static_assert(sizeof(rfid_access_record_t) == 12, "rfid_access_record_t is stored on flash, keep it packed");
+
+// Lock order: s_log_lock before s_stage_lock. s_stage_lock is only held for
+// memcpy sized work so rfid_access_log_record() never waits for flash.
+static SemaphoreHandle_t s_log_lock = NULL;   // s_ring, s_base_seq, s_scan_buf
+static SemaphoreHandle_t s_stage_lock = NULL; // s_stage, s_stage_count, s_stage_since_us, s_stage_dropped
+
+static spiffs_ring_t s_ring;
+static uint32_t s_base_seq; // Sequence number of the oldest record in the ring, counts overwritten records
+static rfid_access_record_t s_scan_buf[RFID_ACCESS_LOG_SCAN_BATCH];
+
+static rfid_access_record_t s_stage[CONFIG_RFID_ACCESS_LOG_STAGING];
+static uint16_t s_stage_count;
+static int64_t s_stage_since_us; // rfid_port_time_us() of the oldest staged record
+static uint32_t s_stage_dropped;
+
+static rfid_port_timer_t s_flush_timer = NULL; // Armed by the first staged record, fires after CONFIG_RFID_ACCESS_LOG_FLUSH_MS
+static void (*s_work_cb)(void) = NULL;
+static app_metrics_histogram_t *s_metric_flash_write = NULL;
+static app_metrics_counter_t *s_metric_flash_bytes = NULL;
+
+/**
+ * @brief Moves the staged records to the ring file in one push.
+ *
+ * Caller holds s_log_lock.
+ */
+static esp_err_t rfid_access_log_flush_locked(void);
+
+/**
+ * @brief Flush timer callback, asks for a rfid_access_log_process() call.
+ */
+static void rfid_access_log_flush_timer_cb(void *arg);
+
+/**
+ * @brief Returns true if a record passes the filter.
+ */
+static bool rfid_access_log_matches(const rfid_access_filter_t *filter, const rfid_access_record_t *record);
+
+/**
+ * @brief Walks matching records from iter->next_seq, copying up to max of them.
+ *
+ * Caller holds s_log_lock. records may be NULL to only count/skip.
+ */
+static esp_err_t rfid_access_log_scan_locked(rfid_access_iter_t *iter, rfid_access_record_t *records, uint32_t max, uint32_t *num_matched);
+
+static esp_err_t rfid_access_log_flush_locked(void)
+{
+    static rfid_access_record_t batch[CONFIG_RFID_ACCESS_LOG_STAGING];
+    uint16_t n;
+    uint32_t dropped;
+    int64_t since_us;
+
+    xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+    n = s_stage_count;
+    since_us = s_stage_since_us;
+    memcpy(batch, s_stage, n * sizeof(rfid_access_record_t));
+    s_stage_count = 0;
+    dropped = s_stage_dropped;
+    s_stage_dropped = 0;
+    xSemaphoreGive(s_stage_lock);
+
+    if (dropped > 0)
+    {
+        ESP_LOGW(TAG, "%lu card checks were not logged, staging buffer was full", (unsigned long)dropped);
+    }
+    if (n == 0)
+    {
+        return ESP_OK;
+    }
+
+    uint32_t overwritten = 0;
+    int64_t begin = app_metrics_begin();
+    esp_err_t ret = spiffs_ring_push(&s_ring, batch, n, &overwritten);
+    if (ret != ESP_OK)
+    {
+        // Stage the batch again ahead of what was recorded meanwhile; what does
+        // not fit any more is counted as dropped, the newest records first
+        xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+        uint16_t kept_new = MIN(s_stage_count, (uint16_t)(CONFIG_RFID_ACCESS_LOG_STAGING - n));
+        s_stage_dropped += s_stage_count - kept_new;
+        memmove(&s_stage[n], s_stage, kept_new * sizeof(rfid_access_record_t));
+        memcpy(s_stage, batch, n * sizeof(rfid_access_record_t));
+        s_stage_count = n + kept_new;
+        s_stage_since_us = since_us;
+        xSemaphoreGive(s_stage_lock);
+
+        ESP_LOGE(TAG, "Failed to write %u access records, retrying", n);
+        if (s_flush_timer != NULL)
+        {
+            rfid_port_timer_stop(s_flush_timer);
+            rfid_port_timer_start_once(s_flush_timer, (uint64_t)CONFIG_RFID_ACCESS_LOG_FLUSH_MS * 1000);
+        }
+        return ESP_FAIL;
+    }
+    app_metrics_end(s_metric_flash_write, begin);
+    app_metrics_count(s_metric_flash_bytes, n * sizeof(rfid_access_record_t));
+    s_base_seq += overwritten;
+    ESP_LOGD(TAG, "Wrote %u access records, %lu stored", n, (unsigned long)spiffs_ring_count(&s_ring));
+    return ESP_OK;
+}
+
+static void rfid_access_log_flush_timer_cb(void *arg)
+{
+    if (s_work_cb != NULL)
+    {
+        s_work_cb();
+    }
+}
+
+static bool rfid_access_log_matches(const rfid_access_filter_t *filter, const rfid_access_record_t *record)
+{
+    if (filter->card_id != 0 && record->card_id != filter->card_id)
+    {
+        return false;
+    }
+    if (filter->from_ts != 0 && record->timestamp < filter->from_ts)
+    {
+        return false;
+    }
+    if (filter->to_ts != 0 && record->timestamp > filter->to_ts)
+    {
+        return false;
+    }
+    return true;
+}
+
+static esp_err_t rfid_access_log_scan_locked(rfid_access_iter_t *iter, rfid_access_record_t *records, uint32_t max, uint32_t *num_matched)
+{
+    *num_matched = 0;
+    if (iter->done)
+    {
+        return ESP_OK;
+    }
+
+    // Records older than s_base_seq were overwritten since the last batch
+    if ((int32_t)(iter->next_seq - s_base_seq) < 0)
+    {
+        iter->next_seq = s_base_seq;
+    }
+
+    uint32_t count = spiffs_ring_count(&s_ring);
+    uint32_t index = iter->next_seq - s_base_seq;
+    while (*num_matched < max && index < count)
+    {
+        uint32_t num_read = 0;
+        if (spiffs_ring_read(&s_ring, index, s_scan_buf, RFID_ACCESS_LOG_SCAN_BATCH, &num_read) != ESP_OK || num_read == 0)
+        {
+            return ESP_FAIL;
+        }
+
+        uint32_t i;
+        for (i = 0; i < num_read && *num_matched < max; i++)
+        {
+            if (rfid_access_log_matches(&iter->filter, &s_scan_buf[i]))
+            {
+                if (records != NULL)
+                {
+                    records[*num_matched] = s_scan_buf[i];
+                }
+                (*num_matched)++;
+            }
+        }
+        index += i;
+    }
+
+    iter->next_seq = s_base_seq + index;
+    iter->done = index >= count;
+    return ESP_OK;
+}
+
+esp_err_t rfid_access_log_init(void)
+{
+    s_metric_flash_write = app_metrics_histogram("flash_write_us", "file", "access_log");
+    s_metric_flash_bytes = app_metrics_counter("flash_write_bytes_total", "file", "access_log");
+
+    if (s_log_lock == NULL)
+    {
+        s_log_lock = xSemaphoreCreateMutex();
+        s_stage_lock = xSemaphoreCreateMutex();
+        if (s_log_lock == NULL || s_stage_lock == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create access log locks");
+            rfid_access_log_deinit();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (s_flush_timer == NULL)
+    {
+        if (rfid_port_timer_create(&rfid_access_log_flush_timer_cb, NULL, "rfid_log_flush", &s_flush_timer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create access log flush timer");
+            rfid_access_log_deinit();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    esp_err_t ret = ESP_OK;
+    if (s_ring.file == NULL)
+    {
+        s_base_seq = 0;
+        ret = spiffs_ring_open(&s_ring, RFID_ACCESS_LOG_FILE, sizeof(rfid_access_record_t), CONFIG_RFID_ACCESS_LOG_RECORDS);
+    }
+    xSemaphoreGive(s_log_lock);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open %s: %s", RFID_ACCESS_LOG_FILE, esp_err_to_name(ret));
+        rfid_access_log_deinit();
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t rfid_access_log_deinit(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (s_log_lock != NULL)
+    {
+        xSemaphoreTake(s_log_lock, portMAX_DELAY);
+        if (s_ring.file != NULL && s_stage_lock != NULL)
+        {
+            ret = rfid_access_log_flush_locked();
+        }
+        spiffs_ring_close(&s_ring);
+        xSemaphoreGive(s_log_lock);
+        vSemaphoreDelete(s_log_lock);
+        s_log_lock = NULL;
+    }
+    if (s_stage_lock != NULL)
+    {
+        vSemaphoreDelete(s_stage_lock);
+        s_stage_lock = NULL;
+    }
+    if (s_flush_timer != NULL)
+    {
+        rfid_port_timer_stop(s_flush_timer);
+        rfid_port_timer_delete(s_flush_timer);
+        s_flush_timer = NULL;
+    }
+    s_stage_count = 0;
+    s_stage_dropped = 0;
+    return ret;
+}
+
+esp_err_t rfid_access_log_record(uint32_t card_id, bool granted, uint8_t reader_id)
+{
+    if (s_stage_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    time_t now;
+    time(&now);
+
+    bool first = false;
+    bool due = false;
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+    if (s_stage_count < CONFIG_RFID_ACCESS_LOG_STAGING)
+    {
+        if (s_stage_count == 0)
+        {
+            s_stage_since_us = rfid_port_time_us();
+            first = true;
+        }
+        s_stage[s_stage_count++] = (rfid_access_record_t){
+            .card_id = card_id,
+            .timestamp = (uint32_t)now,
+            .granted = granted ? 1 : 0,
+            .reader_id = reader_id,
+        };
+        due = s_stage_count == CONFIG_RFID_ACCESS_LOG_STAGING / 2 || s_stage_count == CONFIG_RFID_ACCESS_LOG_STAGING;
+    }
+    else
+    {
+        // rfid_manager_process() is late or a flush is stuck behind a long query.
+        // The caller may be the reader task about to drive the relay, so it never
+        // writes flash or waits for s_log_lock here
+        s_stage_dropped++;
+        due = true;
+        ret = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(s_stage_lock);
+
+    if (first && s_flush_timer != NULL)
+    {
+        rfid_port_timer_stop(s_flush_timer);
+        rfid_port_timer_start_once(s_flush_timer, (uint64_t)CONFIG_RFID_ACCESS_LOG_FLUSH_MS * 1000);
+    }
+    if (due && s_work_cb != NULL)
+    {
+        s_work_cb();
+    }
+    return ret;
+}
+
+bool rfid_access_log_process(void)
+{
+    if (s_stage_lock == NULL)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(s_stage_lock, portMAX_DELAY);
+    bool due = s_stage_count >= CONFIG_RFID_ACCESS_LOG_STAGING / 2 ||
+               (s_stage_count > 0 && rfid_port_time_us() - s_stage_since_us >= (int64_t)CONFIG_RFID_ACCESS_LOG_FLUSH_MS * 1000);
+    xSemaphoreGive(s_stage_lock);
+
+    if (!due)
+    {
+        return false;
+    }
+    rfid_access_log_flush();
+    return true;
+}
+
+esp_err_t rfid_access_log_flush(void)
+{
+    if (s_log_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xSemaphoreTake(s_log_lock, pdMS_TO_TICKS(2000)) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Access log busy, staged records kept for the next flush");
+        return ESP_FAIL;
+    }
+    esp_err_t ret = s_ring.file != NULL ? rfid_access_log_flush_locked() : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(s_log_lock);
+    return ret;
+}
+
+void rfid_access_log_set_work_callback(void (*callback)(void))
+{
+    s_work_cb = callback;
+}
+
+esp_err_t rfid_access_log_count(const rfid_access_filter_t *filter, uint32_t *count)
+{
+    if (count == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    rfid_access_iter_t iter;
+    rfid_access_log_iter_init(&iter, filter);
+    *count = 0;
+
+    if (s_log_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xSemaphoreTake(s_log_lock, pdMS_TO_TICKS(2000)) != pdTRUE)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (s_ring.file != NULL)
+    {
+        rfid_access_log_flush_locked();
+        ret = rfid_access_log_scan_locked(&iter, NULL, UINT32_MAX, count);
+    }
+    xSemaphoreGive(s_log_lock);
+    return ret;
+}
+
+void rfid_access_log_iter_init(rfid_access_iter_t *iter, const rfid_access_filter_t *filter)
+{
+    if (iter == NULL)
+    {
+        return;
+    }
+    memset(iter, 0, sizeof(*iter));
+    if (filter != NULL)
+    {
+        iter->filter = *filter;
+    }
+    // next_seq 0 is clamped to the oldest stored record by the first scan
+}
+
+esp_err_t rfid_access_log_iter_skip(rfid_access_iter_t *iter, uint32_t count)
+{
+    if (iter == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_log_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xSemaphoreTake(s_log_lock, pdMS_TO_TICKS(2000)) != pdTRUE)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (s_ring.file != NULL)
+    {
+        uint32_t skipped;
+        rfid_access_log_flush_locked();
+        ret = rfid_access_log_scan_locked(iter, NULL, count, &skipped);
+    }
+    xSemaphoreGive(s_log_lock);
+    return ret;
+}
+
+esp_err_t rfid_access_log_iter_next(rfid_access_iter_t *iter, rfid_access_record_t *records, uint16_t max_records, uint16_t *num_records)
+{
+    if (iter == NULL || records == NULL || num_records == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *num_records = 0;
+    if (s_log_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xSemaphoreTake(s_log_lock, pdMS_TO_TICKS(2000)) != pdTRUE)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (s_ring.file != NULL)
+    {
+        uint32_t matched = 0;
+        rfid_access_log_flush_locked();
+        ret = rfid_access_log_scan_locked(iter, records, max_records, &matched);
+        *num_records = (uint16_t)matched;
+    }
+    xSemaphoreGive(s_log_lock);
+    return ret;
+}
@@ -1,28 +1,244 @@
 #include "rfid_manager.h"
 #include <string.h>
-#include "esp_spiffs.h"
+#include <strings.h>         // For strncasecmp()
+#include <stdlib.h>          // For qsort()
+#include <stddef.h>          // For offsetof()
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h" // For mutex
 #include <time.h>            // For time()
-#include "esp_timer.h"       // For caching timer
+#include "esp_rom_crc.h"     // For journal record checksums
+#include "rfid_access_log.h"
+#include "rfid_port.h"       // Timers, card table memory and file system
+#include "app_metrics.h"
 // #include <inttypes.h> // PRIX32 not used, using %lx with cast instead
 
 static const char *TAG = "RFID_MANAGER";
 
-#define RFID_DATABASE_FILE "/spiffs/rfid_cards.dat"
-
-// In-memory database for RFID cards
-static rfid_card_t rfid_database[RFID_MAX_CARDS];
-
-// Mutex for thread-safe access to the database and file operations
+#define RFID_DATABASE_FILE RFID_PORT_PATH("rfid_cards.dat") // Headerless card file of older firmware, migrated on load
+#define RFID_STORE_FILE_A  RFID_PORT_PATH("rfid_cards.a")
+#define RFID_STORE_FILE_B  RFID_PORT_PATH("rfid_cards.b")
+#define RFID_STORE_TEMP_FILE RFID_PORT_PATH("rfid_cards.tmp")
+#define RFID_STORE_MAGIC   0x42444652 // "RFDB"
+#define RFID_STORE_VERSION 2      // 1: raw rfid_card_t slots, 2: packed records of the active cards
+#define RFID_STORE_RECORD_HEAD 11 // card_id (4), slot (2), timestamp (4), name length (1)
+#define RFID_STORE_RECORD_MAX  (RFID_STORE_RECORD_HEAD + RFID_CARD_NAME_LEN - 1)
+#define RFID_STORE_RECORD_REMOVED 0x80 // Set in the name length of a removed card, kept so its ID stays taken
+#define RFID_JOURNAL_FILE  RFID_PORT_PATH("rfid_cards.jnl")
+#define RFID_JOURNAL_MAGIC 0x4A52 // "RJ"
+#define RFID_JOURNAL_SEEN_MAGIC 0x5452 // "RT"
+#define RFID_JOURNAL_BASE_MAGIC 0x4252 // "RB"
+#define RFID_WRITE_RETRY_MS 1000   // Delay before retrying a deferred or failed write
+
+#ifndef CONFIG_RFID_JOURNAL_COMPACT_RECORDS
+#define CONFIG_RFID_JOURNAL_COMPACT_RECORDS 128
+#endif
+
+#ifndef CONFIG_RFID_LAST_SEEN_FLUSH_S
+#define CONFIG_RFID_LAST_SEEN_FLUSH_S 600
+#endif
+
+#ifndef CONFIG_RFID_LAST_SEEN_MAX_WRITES_PER_HOUR
+#define CONFIG_RFID_LAST_SEEN_MAX_WRITES_PER_HOUR 12
+#endif
+
+#ifndef CONFIG_RFID_FILTER_COUNTERS_PER_CARD
+#define CONFIG_RFID_FILTER_COUNTERS_PER_CARD 12
+#endif
+
+#ifndef CONFIG_RFID_STORE_CACHE_BLOCKS
+#define CONFIG_RFID_STORE_CACHE_BLOCKS 16
+#endif
+
+#define RFID_STORE_BLOCKS ((RFID_MAX_CARDS + RFID_STORE_BLOCK_CARDS - 1) / RFID_STORE_BLOCK_CARDS)
+
+// Card table. What a card check needs stays in RAM for every slot: the sorted
+// index (see rfid_index), the active bits and the last-seen timestamps. Card IDs
+// and names are paged in blocks of RFID_STORE_BLOCK_CARDS slots from the image
+// the table was loaded from and the journal, through a cache of at most
+// CONFIG_RFID_STORE_CACHE_BLOCKS blocks, so RAM no longer grows with the names.
+static uint32_t rfid_active_slots[(RFID_MAX_CARDS + 31) / 32];
+static uint32_t *rfid_slot_timestamps = NULL; // Allocated in rfid_store_alloc(), PSRAM first when enabled
+
+// The card table is kept in two copies, RFID_STORE_FILE_A and RFID_STORE_FILE_B:
+// an rfid_store_header_t followed by one packed record per used slot, in slot
+// order and little endian: card_id, slot, timestamp, name length and the name
+// without its terminator. A removed card is a record without a name and with
+// RFID_STORE_RECORD_REMOVED in the length, so its ID still cannot be added again
+// (see rfid_manager_add_card()). Free slots take no space, so an image does not
+// depend on the layout of rfid_card_t, and the slot order lets a block of slots
+// be read back from its offset alone (see rfid_block_offsets). Version 1
+// images (every slot as a raw rfid_card_t) are still read and rewritten in the
+// current format on the next save. A save appends the changed slots to the
+// journal file, which starts with the sequence number of its image. Once the
+// journal would hold CONFIG_RFID_JOURNAL_COMPACT_RECORDS records it is folded
+// into a new image instead: written to RFID_STORE_TEMP_FILE and renamed over the
+// older copy, so the newest copy is never touched and a power loss at any point
+// leaves at least one valid image. Loading takes the valid copy with the highest
+// sequence number.
+typedef struct {
+    uint32_t magic;      // RFID_STORE_MAGIC
+    uint16_t version;    // RFID_STORE_VERSION
+    uint16_t card_size;  // Version 1: sizeof(rfid_card_t), version 2: 0
+    uint32_t count;      // Version 1: slots, version 2: records following the header
+    uint32_t sequence;   // Incremented with every image, the higher valid copy wins
+    uint32_t data_crc;   // CRC32 of everything after the header
+    uint32_t header_crc; // CRC32 of the preceding header fields
+} rfid_store_header_t;
+
+static uint32_t rfid_dirty_slots[(RFID_MAX_CARDS + 31) / 32];  // Changed since the last save
+static bool rfid_store_needs_rewrite = true; // No valid image of the current size: write one on the next save
+static uint32_t rfid_journal_records = 0;    // Records currently in the journal file
+static bool rfid_journal_has_base = false;   // The journal file starts with the rfid_journal_base_t of its image
+static uint32_t rfid_store_sequence = 0;     // Highest image sequence number seen on flash
+static const char *const rfid_store_files[2] = { RFID_STORE_FILE_A, RFID_STORE_FILE_B };
+static int8_t rfid_store_newest = -1;        // Copy the table was loaded from or last written to, -1 for none
+
+// One journal entry: the full contents of a slot after a change
+typedef struct {
+    uint16_t magic;   // RFID_JOURNAL_MAGIC
+    uint16_t slot;    // Slot index in the card table
+    rfid_card_t card; // New slot contents
+    uint32_t crc;     // CRC32 of all preceding bytes of the record
+} rfid_journal_record_t;
+
+// First entry of every journal: the image the records apply to. A journal older
+// than the loaded image was already folded into it (or erased by a format) and
+// is not replayed, which also covers a power loss between publishing an image
+// and deleting the journal.
+typedef struct {
+    uint16_t magic;     // RFID_JOURNAL_BASE_MAGIC
+    uint16_t reserved;  // 0
+    uint32_t sequence;  // rfid_store_header_t.sequence of the image
+    uint32_t crc;       // CRC32 of all preceding bytes of the record
+} rfid_journal_base_t;
+
+// Journal entry for a slot whose only change is the last-seen timestamp
+typedef struct {
+    uint16_t magic;     // RFID_JOURNAL_SEEN_MAGIC
+    uint16_t slot;      // Slot index in the card table
+    uint32_t timestamp; // New last-seen timestamp of the slot
+    uint32_t crc;       // CRC32 of all preceding bytes of the record
+} rfid_journal_seen_t;
+
+// Last-seen write-back: checks only set the slot's bit in rfid_seen_slots. The
+// seen slots go to the journal as rfid_journal_seen_t records with the next card
+// save, or when rfid_seen_timer fires (every rfid_seen_interval_ms, at most
+// CONFIG_RFID_LAST_SEEN_MAX_WRITES_PER_HOUR times an hour).
+static uint32_t rfid_seen_slots[(RFID_MAX_CARDS + 31) / 32];
+static bool rfid_seen_pending = false;      // Some bit in rfid_seen_slots is set
+static volatile bool is_seen_due = false;   // rfid_seen_timer fired, rfid_manager_process() writes
+static rfid_port_timer_t rfid_seen_timer = NULL;
+static uint32_t rfid_seen_interval_ms = CONFIG_RFID_LAST_SEEN_FLUSH_S * 1000;
+static int64_t rfid_seen_window_start = 0;  // Start of the current hour for the write cap
+static uint32_t rfid_seen_window_writes = 0;
+
+// Index entry: maps a card_id to the slot holding it in the card table
+typedef struct {
+    uint32_t card_id;
+    uint16_t slot;
+} rfid_index_entry_t;
+
+// Index over every used slot (card_id != 0, active or not), kept sorted by
+// card_id so lookups are a binary search and never touch the paged blocks.
+static rfid_index_entry_t *rfid_index = NULL;
+static uint16_t rfid_index_count = 0;
+
+// Paged part of a slot
+typedef struct {
+    uint32_t card_id; // 0 for a slot that was never used
+    char name[RFID_CARD_NAME_LEN];
+} rfid_page_slot_t;
+
+// One block of slots in the page cache
+typedef struct rfid_page {
+    struct rfid_page *newer; // LRU list, from rfid_page_newest to rfid_page_oldest
+    struct rfid_page *older;
+    uint16_t block;
+    bool pinned;             // Holds changes not saved yet, or is reserved by a writer: never evicted
+    rfid_page_slot_t slots[RFID_STORE_BLOCK_CARDS];
+} rfid_page_t;
+
+// Page cache. Pinned pages come on top of the CONFIG_RFID_STORE_CACHE_BLOCKS
+// budget and are released once their changes are saved, so a bulk import holds
+// its blocks in RAM until the next save. Readers share the database lock, so the
+// cache and rfid_page_scratch are guarded by rfid_page_mutex of their own.
+static rfid_page_t **rfid_block_pages = NULL;   // Cached page of each block or NULL, RFID_STORE_BLOCKS entries
+static rfid_page_t *rfid_page_newest = NULL;
+static rfid_page_t *rfid_page_oldest = NULL;
+static uint16_t rfid_pages_unpinned = 0;        // Cached pages that may be evicted
+static rfid_page_t rfid_page_scratch;           // Block read for a single use when no page can be cached
+static SemaphoreHandle_t rfid_page_mutex = NULL;
+
+// Where blocks that are not cached are read from
+typedef enum {
+    RFID_BACKING_NONE,    // Nothing on flash yet (format, defaults): never used slots
+    RFID_BACKING_SLOTS,   // Raw rfid_card_t slots of a version 1 image or the headerless file
+    RFID_BACKING_RECORDS, // Version 2 image, located through rfid_block_offsets
+} rfid_backing_kind_t;
+
+static struct {
+    rfid_backing_kind_t kind;
+    const char *path;
+    uint32_t base;  // RFID_BACKING_SLOTS: file offset of slot 0
+    uint32_t slots; // RFID_BACKING_SLOTS: slots in the file
+} rfid_store_backing;
+static uint32_t *rfid_block_offsets = NULL;      // File offset of each block's first record, RFID_STORE_BLOCKS + 1 entries
+static uint32_t *rfid_block_offsets_next = NULL; // Filled while an image is written, swapped in once it is published
+
+// Newest full record of every slot journaled since the image, sorted by slot,
+// so a block read from the image is brought up to date without replaying the
+// whole journal. Room for CONFIG_RFID_JOURNAL_COMPACT_RECORDS entries, as the
+// journal is compacted before it holds more records; emptied by every compaction.
+typedef struct {
+    uint16_t slot;
+    uint32_t offset; // Of the slot's rfid_journal_record_t in RFID_JOURNAL_FILE
+} rfid_overlay_entry_t;
+
+static rfid_overlay_entry_t *rfid_overlay = NULL;
+static uint32_t rfid_overlay_count = 0;
+static uint32_t rfid_journal_bytes = 0; // End of the last valid journal record
+
+// Counting Bloom filter over the active cards, so checks of unknown cards are
+// answered without taking the lock. Two 4-bit counters per byte; a counter that
+// reaches 15 stays there, so a removal can never clear a bit another card needs.
+// Writers (holding the write lock) bump rfid_filter_seq to an odd value while
+// they change counters; a reader only trusts a "not present" answer when the
+// sequence was even and unchanged around its probes, otherwise it takes the lock.
+#define RFID_FILTER_COUNTERS ((uint32_t)CONFIG_RFID_FILTER_COUNTERS_PER_CARD * RFID_MAX_CARDS)
+#define RFID_FILTER_HASHES   4
+#define RFID_FILTER_SATURATED 15
+static uint8_t *rfid_filter = NULL; // Kept across deinit, lock-free readers may still be probing it
+static uint32_t rfid_filter_seq = 0;
+
+// Reader/writer lock over the database and file operations. Writers (add, remove, format,
+// saves) hold rfid_mutex for the whole operation. Readers (check, get, count, list, JSON)
+// only pass through it to register in rfid_reader_count, so they run alongside each other,
+// and a writer waiting for the readers to drain keeps new readers out.
 static SemaphoreHandle_t rfid_mutex = NULL;
+static SemaphoreHandle_t rfid_readers_drained = NULL; // Given by the last reader out while a writer waits
+static portMUX_TYPE rfid_reader_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t rfid_reader_count = 0;
+static bool rfid_writer_waiting = false;
+
+// Lock and storage metrics, registered in rfid_manager_init(). Readers share the
+// lock, so only the exclusive hold time is measured.
+static app_metrics_histogram_t *rfid_metric_read_wait = NULL;
+static app_metrics_histogram_t *rfid_metric_write_wait = NULL;
+static app_metrics_histogram_t *rfid_metric_write_hold = NULL;
+static app_metrics_counter_t *rfid_metric_read_contended = NULL;
+static app_metrics_counter_t *rfid_metric_write_contended = NULL;
+static app_metrics_histogram_t *rfid_metric_flash_write = NULL;
+static app_metrics_counter_t *rfid_metric_flash_bytes = NULL;
+static app_metrics_counter_t *rfid_metric_filter_rejected = NULL;
+static int64_t rfid_write_locked_at = 0; // app_metrics_begin() of the current write lock holder
 
 // Caching mechanism variables
 static bool is_dirty = false;                       // Flag to indicate pending changes
 static bool is_ready_to_write = false;              // Flag to signal that a write to NVS is pending
-static esp_timer_handle_t rfid_write_timer = NULL;  // Timer for delayed NVS write
+static rfid_port_timer_t rfid_write_timer = NULL;  // Timer for delayed NVS write
 static uint32_t rfid_write_timeout_ms = RFID_DEFAULT_CACHE_TIMEOUT_MS; // Configurable timeout
+static rfid_manager_work_cb_t rfid_work_cb = NULL; // Told when rfid_manager_process() has work
 
 // Default RFID cards
 static const rfid_card_t default_cards[] = {
@@ -44,11 +260,21 @@ static const uint16_t num_default_cards = sizeof(default_cards) / sizeof(rfid_ca
  */
 static esp_err_t rfid_manager_load_defaults(void);
 
+/**
+ * @brief Stores the default cards in the first slots of an emptied card table.
+ *
+ * Must be called with the write lock held, after rfid_store_reset().
+ *
+ * @param count Set to the number of cards stored.
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if a block cannot be paged in.
+ */
+static esp_err_t rfid_store_put_defaults(uint16_t *count);
+
 /**
  * @brief Internal function to perform the actual write of cached RFID data to NVS.
  * 
  * This function is called by rfid_manager_process() or directly when caching is disabled.
- * It handles mutex acquisition and error logging for the NVS write operation.
+ * The caller must hold the write lock.
  * 
  * @return esp_err_t ESP_OK on success, or an error code on failure.
  */
@@ -67,13 +293,21 @@ static esp_err_t rfid_manager_save_to_file(void);
 /**
  * @brief Loads the RFID database from the SPIFFS file into memory.
  *
- * Reads the card data from persistent storage.
+ * Reads the newest valid A/B copy, falling back to the other copy and then to
+ * the headerless file of older firmware, and replays the journal on top.
  *
- * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the file doesn't exist,
- *         ESP_FAIL for other errors.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if no file exists,
+ *         another error if no copy is valid.
  */
 static esp_err_t rfid_manager_load_from_file(void);
 
+/**
+ * @brief Loads the headerless flat slot array written by older firmware.
+ *
+ * The next save writes the first A/B image and deletes the old file.
+ */
+static esp_err_t rfid_store_load_legacy(void);
+
 /**
  * @brief Timer callback function for delayed writing to flash.
  * 
@@ -84,70 +318,2009 @@ static esp_err_t rfid_manager_load_from_file(void);
  */
 static void rfid_cache_write_timeout_handler(void* arg);
 
-esp_err_t rfid_manager_get_card(uint32_t card_id, rfid_card_t *card)
+/**
+ * @brief Timer callback for the last-seen write-back, hands the write to rfid_manager_process().
+ */
+static void rfid_seen_timeout_handler(void* arg);
+
+/**
+ * @brief Finds the slot holding the given card_id using the sorted index.
+ *
+ * Must be called with the read or write lock held.
+ *
+ * @param card_id The card ID to look up.
+ * @return The slot holding the card, or -1 if the card_id is not present.
+ */
+static int32_t rfid_index_find(uint32_t card_id);
+
+/**
+ * @brief Inserts a card_id -> slot mapping into the sorted index.
+ *
+ * Must be called with the write lock held. The card_id must not already be indexed.
+ */
+static void rfid_index_insert(uint32_t card_id, uint16_t slot);
+
+/**
+ * @brief Removes a card_id from the sorted index, if present.
+ *
+ * Must be called with the write lock held.
+ */
+static void rfid_index_erase(uint32_t card_id);
+
+/**
+ * @brief Sorts the index entries collected while loading a card file.
+ *
+ * Duplicate IDs (only possible with a damaged file) keep their lowest slot.
+ * Must be called with the write lock held.
+ */
+static void rfid_index_sort(void);
+
+/**
+ * @brief Adds an active card to the negative lookup filter.
+ *
+ * Must be called with the write lock held.
+ */
+static void rfid_filter_add(uint32_t card_id);
+
+/**
+ * @brief Removes a card that is no longer active from the negative lookup filter.
+ *
+ * Must be called with the write lock held, once per earlier rfid_filter_add().
+ */
+static void rfid_filter_remove(uint32_t card_id);
+
+/**
+ * @brief Rebuilds the negative lookup filter from the active cards in the index.
+ *
+ * Must be called with the write lock held.
+ */
+static void rfid_filter_rebuild(void);
+
+/**
+ * @brief Tells whether card_id is certainly not an active card, without any lock.
+ *
+ * @return true if the card is not active; false if it may be, or if a writer was
+ *         changing the filter at the same time (the caller then looks it up).
+ */
+static bool rfid_filter_rejects(uint32_t card_id);
+
+/**
+ * @brief Allocates the index, timestamps, paging tables and filter (PSRAM first when enabled).
+ *
+ * Does nothing if they are already allocated. Pages are allocated as blocks
+ * are used.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the allocation fails.
+ */
+static esp_err_t rfid_store_alloc(void);
+
+/**
+ * @brief Frees what rfid_store_alloc() allocated and every cached page.
+ *
+ * The filter stays allocated and is emptied instead.
+ */
+static void rfid_store_free(void);
+
+/**
+ * @brief Frees every cached page, pinned or not.
+ *
+ * Must be called with the write lock held, or once the manager is shut down.
+ */
+static void rfid_store_drop_pages(void);
+
+/**
+ * @brief Empties the card table: no cards, no cached pages, nothing to read blocks from.
+ *
+ * Must be called with the write lock held.
+ */
+static void rfid_store_reset(void);
+
+/**
+ * @brief Copies a slot of the card table, paging its block in if needed.
+ *
+ * Safe to call with either the read or the write lock held.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if the block cannot be read.
+ */
+static esp_err_t rfid_store_get_slot(uint16_t slot, rfid_card_t *card);
+
+/**
+ * @brief Pins the block of a slot in the cache, so a change to it cannot fail later.
+ *
+ * Must be called with the write lock held.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the block cannot be paged in.
+ */
+static esp_err_t rfid_store_reserve_slot(uint16_t slot);
+
+/**
+ * @brief Returns the paged part of a slot for a change and marks the slot dirty.
+ *
+ * Pins the slot's block until the change is saved. Must be called with the
+ * write lock held.
+ *
+ * @return The slot in its cached page, or NULL if the block cannot be paged in.
+ */
+static rfid_page_slot_t *rfid_store_edit_slot(uint16_t slot);
+
+/**
+ * @brief Releases the pinned pages once every change in them is on flash.
+ *
+ * Trims the cache back to CONFIG_RFID_STORE_CACHE_BLOCKS pages. Must be called
+ * with the write lock held.
+ */
+static void rfid_store_pages_saved(void);
+
+/**
+ * @brief Tells whether a slot holds an active card.
+ *
+ * Safe to call with either the read or the write lock held.
+ */
+static bool rfid_store_slot_active(uint16_t slot);
+
+/**
+ * @brief Marks the given slot as changed since the last save.
+ *
+ * Safe to call with either the read or the write lock held.
+ */
+static void rfid_store_mark_dirty(uint16_t slot);
+
+/**
+ * @brief Records that a slot's timestamp changed, for the last-seen write-back.
+ *
+ * Arms rfid_seen_timer on the first call after a write. Safe to call with
+ * either the read or the write lock held.
+ */
+static void rfid_store_mark_seen(uint16_t slot);
+
+/**
+ * @brief Writes the last-seen timestamps once rfid_seen_timer fired, within the hourly cap.
+ *
+ * Must be called with the write lock held.
+ */
+static void rfid_seen_write_due(void);
+
+/**
+ * @brief Returns the first slot at or after 'from' that can take a new card.
+ *
+ * A slot is free if it holds no active card: never used, or its card was removed.
+ * Must be called with the write lock held.
+ *
+ * @return The slot number, or RFID_MAX_CARDS if the database is full.
+ */
+static uint16_t rfid_store_find_free_slot(uint16_t from);
+
+/**
+ * @brief Stores a new active card in a free slot and indexes it.
+ *
+ * Must be called with the write lock held, after checking that card_id is not indexed.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if the slot's block cannot be
+ *         paged in (nothing is changed then).
+ */
+static esp_err_t rfid_store_put_card(uint16_t slot, uint32_t card_id, const char *name, uint32_t timestamp);
+
+/**
+ * @brief Schedules persistence of the changes made under the current write lock.
+ *
+ * Restarts the cache timer, or writes immediately when caching is disabled.
+ * Must be called with the write lock held.
+ *
+ * @return esp_err_t ESP_OK on success, or the error of the immediate write.
+ */
+static esp_err_t rfid_schedule_write(void);
+
+/**
+ * @brief Re-arms the write timer after a deferred or failed write.
+ *
+ * is_ready_to_write stays set; the timer only brings rfid_manager_process()
+ * back through the work callback after RFID_WRITE_RETRY_MS.
+ */
+static void rfid_retry_write_later(void);
+
+/**
+ * @brief Writes the whole card table as a new image over the older of the two copies.
+ *
+ * Writes RFID_STORE_TEMP_FILE and renames it, the newest copy stays untouched.
+ * Must be called with the write lock held.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on a file error.
+ */
+static esp_err_t rfid_store_write_image(void);
+
+/**
+ * @brief Reads and checks one copy of the card table.
+ *
+ * With load set to false only the header is read and checked. Otherwise the
+ * copy is scanned into the resident part of the card table (unsorted index,
+ * active bits, timestamps), checked against the header CRC and becomes the
+ * file blocks are paged from; the caller resets the table if that fails.
+ * rewrite is set when the copy is valid but not in the current format or size.
+ *
+ * @return esp_err_t ESP_OK for a valid copy, ESP_ERR_NOT_FOUND if the file is missing,
+ *         ESP_ERR_INVALID_CRC or ESP_ERR_INVALID_SIZE for a damaged one.
+ */
+static esp_err_t rfid_store_read_image(const char *path, rfid_store_header_t *header, bool load, bool *rewrite);
+
+/** @brief Scans the raw slots of a version 1 image, see rfid_store_read_image(). */
+static esp_err_t rfid_store_read_slots_v1(FILE *f, const rfid_store_header_t *header, bool *rewrite);
+
+/**
+ * @brief Scans the packed records of a version 2 image, see rfid_store_read_image().
+ *
+ * Cards of slots beyond RFID_MAX_CARDS are not placed yet: their offset is
+ * returned in tail, 0 if there are none, for rfid_store_place_tail().
+ */
+static esp_err_t rfid_store_read_records(FILE *f, const rfid_store_header_t *header, uint32_t *tail, bool *rewrite);
+
+/**
+ * @brief Moves the cards of slots beyond RFID_MAX_CARDS into free slots.
+ *
+ * Reads the records from offset tail of an image that was written with a larger
+ * RFID_MAX_CARDS. Cards without a free slot are dropped. Must be called with the
+ * write lock held, after rfid_index_sort().
+ */
+static void rfid_store_place_tail(const char *path, uint32_t tail);
+
+/**
+ * @brief Packs the active and removed cards into image records.
+ *
+ * Passes over the table one block at a time, writing each block's records to f
+ * unless f is NULL, so a first pass with f set to NULL yields the record count
+ * and CRC for the header. Records the file offset of every block in offsets
+ * unless it is NULL.
+ *
+ * @return true on success, false if a write failed or a block could not be read
+ */
+static bool rfid_store_write_records(FILE *f, uint32_t *count, uint32_t *crc, uint32_t *bytes, uint32_t *offsets);
+
+/**
+ * @brief Persists all changed slots.
+ *
+ * Appends the dirty slots to the journal and compacts it when it is full, or
+ * rewrites the card file and drops the journal if a full rewrite is pending.
+ * Must be called with the write lock held.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on a file error.
+ */
+static esp_err_t rfid_store_save(void);
+
+/**
+ * @brief Applies the journal file on top of the freshly loaded card table.
+ *
+ * Updates the resident part of the table and records where each slot's newest
+ * record is (rfid_overlay). Stops at the first torn or corrupted record. A journal based on an older image
+ * than image_sequence is deleted instead. Must be called with the write lock held.
+ *
+ * @param image_sequence Sequence number of the image just loaded
+ * @return true if the journal ended cleanly, false if a bad record was found.
+ */
+static bool rfid_store_replay_journal(uint32_t image_sequence);
+
+/**
+ * @brief Takes the database lock for reading.
+ *
+ * Any number of readers may hold it at once. A reader must not modify the
+ * database, except for single aligned stores such as the card timestamp.
+ *
+ * @param timeout Maximum time to wait for a writer to finish.
+ * @return true if the read lock was taken, false on timeout.
+ */
+static bool rfid_read_lock(TickType_t timeout);
+
+/**
+ * @brief Releases a read lock taken with rfid_read_lock().
+ */
+static void rfid_read_unlock(void);
+
+/**
+ * @brief Takes the database lock exclusively.
+ *
+ * Waits for the current readers to finish while blocking new ones.
+ *
+ * @param timeout Maximum time to wait for other writers and readers.
+ * @return true if the write lock was taken, false on timeout.
+ */
+static bool rfid_write_lock(TickType_t timeout);
+
+/**
+ * @brief Releases the write lock taken with rfid_write_lock().
+ */
+static void rfid_write_unlock(void);
+
+esp_err_t rfid_manager_get_card(uint32_t card_id, rfid_card_t *card)
+{
+    if (card == NULL)
+    {
+        ESP_LOGE(TAG, "Output card pointer is NULL.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // Check if mutex is initialized first
+    if (rfid_mutex == NULL) {
+        ESP_LOGE(TAG, "RFID mutex not initialized in get_card");
+        return ESP_FAIL;
+    }
+    
+    if (rfid_read_lock(pdMS_TO_TICKS(2000)))
+    {
+        int32_t slot = rfid_index_find(card_id);
+        if (slot >= 0 && rfid_store_slot_active(slot))
+        {
+            esp_err_t ret = rfid_store_get_slot(slot, card); // Copy the card data
+            rfid_read_unlock();
+            if (ret != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Failed to read card 0x%08lx from slot %ld.", (unsigned long)card_id, (long)slot);
+                return ret;
+            }
+            ESP_LOGD(TAG, "Card 0x%08lx found at slot %ld.", (unsigned long)card_id, (long)slot);
+            return ESP_OK;
+        }
+        rfid_read_unlock();
+
+        if (slot >= 0)
+        {
+            // Card found but is inactive
+            ESP_LOGW(TAG, "Card 0x%08lx found at slot %ld but is inactive.", (unsigned long)card_id, (long)slot);
+        }
+        else
+        {
+            // Card ID not found in any slot
+            ESP_LOGW(TAG, "Card 0x%08lx not found in the database.", (unsigned long)card_id);
+        }
+        return ESP_ERR_NOT_FOUND; // Treat inactive as not found for "get active card" purposes
+    }
+    ESP_LOGE(TAG, "Failed to take RFID mutex in get_card");
+    return ESP_FAIL; // Mutex acquisition failed
+}
+
+
+int testable_mean(const int *values, int count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    int sum = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        sum += values[i];
+    }
+    return sum / count;
+}
+
+// --- Database Lock ---
+
+static bool rfid_read_lock(TickType_t timeout)
+{
+    int64_t begin = app_metrics_begin();
+
+    // Passing through rfid_mutex queues new readers behind any writer holding or waiting for it
+    if (xSemaphoreTake(rfid_mutex, 0) != pdTRUE)
+    {
+        app_metrics_count(rfid_metric_read_contended, 1);
+        if (xSemaphoreTake(rfid_mutex, timeout) != pdTRUE)
+        {
+            return false;
+        }
+    }
+    portENTER_CRITICAL(&rfid_reader_spinlock);
+    rfid_reader_count++;
+    portEXIT_CRITICAL(&rfid_reader_spinlock);
+    xSemaphoreGive(rfid_mutex);
+
+    app_metrics_end(rfid_metric_read_wait, begin);
+    return true;
+}
+
+static void rfid_read_unlock(void)
+{
+    bool wake_writer = false;
+    portENTER_CRITICAL(&rfid_reader_spinlock);
+    rfid_reader_count--;
+    if (rfid_reader_count == 0 && rfid_writer_waiting)
+    {
+        rfid_writer_waiting = false;
+        wake_writer = true;
+    }
+    portEXIT_CRITICAL(&rfid_reader_spinlock);
+
+    if (wake_writer)
+    {
+        xSemaphoreGive(rfid_readers_drained);
+    }
+}
+
+static bool rfid_write_lock(TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    int64_t begin = app_metrics_begin();
+    bool contended = false;
+
+    if (xSemaphoreTake(rfid_mutex, 0) != pdTRUE)
+    {
+        contended = true;
+        if (xSemaphoreTake(rfid_mutex, timeout) != pdTRUE)
+        {
+            app_metrics_count(rfid_metric_write_contended, 1);
+            return false;
+        }
+    }
+
+    portENTER_CRITICAL(&rfid_reader_spinlock);
+    bool must_wait = (rfid_reader_count > 0);
+    rfid_writer_waiting = must_wait;
+    portEXIT_CRITICAL(&rfid_reader_spinlock);
+
+    if (contended || must_wait)
+    {
+        app_metrics_count(rfid_metric_write_contended, 1);
+    }
+    if (must_wait)
+    {
+        TickType_t remaining = timeout;
+        if (timeout != portMAX_DELAY)
+        {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            remaining = (elapsed < timeout) ? (timeout - elapsed) : 0;
+        }
+        if (xSemaphoreTake(rfid_readers_drained, remaining) != pdTRUE)
+        {
+            portENTER_CRITICAL(&rfid_reader_spinlock);
+            bool still_waiting = rfid_writer_waiting;
+            rfid_writer_waiting = false;
+            portEXIT_CRITICAL(&rfid_reader_spinlock);
+            if (!still_waiting)
+            {
+                // The last reader left right after the timeout expired; consume its wake-up
+                // so the next writer doesn't see a stale one
+                xSemaphoreTake(rfid_readers_drained, 0);
+            }
+            xSemaphoreGive(rfid_mutex);
+            return false;
+        }
+    }
+
+    app_metrics_end(rfid_metric_write_wait, begin);
+    rfid_write_locked_at = app_metrics_begin();
+    return true;
+}
+
+static void rfid_write_unlock(void)
+{
+    app_metrics_end(rfid_metric_write_hold, rfid_write_locked_at);
+    rfid_write_locked_at = 0;
+    xSemaphoreGive(rfid_mutex);
+}
+
+// --- Card Index ---
+
+/**
+ * @brief Returns the position of the first index entry whose card_id is >= card_id.
+ */
+static uint16_t rfid_index_lower_bound(uint32_t card_id)
+{
+    uint16_t lo = 0;
+    uint16_t hi = rfid_index_count;
+    while (lo < hi)
+    {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (rfid_index[mid].card_id < card_id)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int32_t rfid_index_find(uint32_t card_id)
+{
+    if (card_id == 0) // 0 marks a never-used slot and is never indexed
+    {
+        return -1;
+    }
+    uint16_t pos = rfid_index_lower_bound(card_id);
+    if (pos < rfid_index_count && rfid_index[pos].card_id == card_id)
+    {
+        return rfid_index[pos].slot;
+    }
+    return -1;
+}
+
+static void rfid_index_insert(uint32_t card_id, uint16_t slot)
+{
+    if (card_id == 0 || rfid_index_count >= RFID_MAX_CARDS)
+    {
+        return;
+    }
+    uint16_t pos = rfid_index_lower_bound(card_id);
+    memmove(&rfid_index[pos + 1], &rfid_index[pos], (rfid_index_count - pos) * sizeof(rfid_index_entry_t));
+    rfid_index[pos].card_id = card_id;
+    rfid_index[pos].slot = slot;
+    rfid_index_count++;
+}
+
+static void rfid_index_erase(uint32_t card_id)
+{
+    uint16_t pos = rfid_index_lower_bound(card_id);
+    if (pos < rfid_index_count && rfid_index[pos].card_id == card_id)
+    {
+        memmove(&rfid_index[pos], &rfid_index[pos + 1], (rfid_index_count - pos - 1) * sizeof(rfid_index_entry_t));
+        rfid_index_count--;
+    }
+}
+
+static int rfid_index_entry_compare(const void *a, const void *b)
+{
+    uint32_t id_a = ((const rfid_index_entry_t *)a)->card_id;
+    uint32_t id_b = ((const rfid_index_entry_t *)b)->card_id;
+    if (id_a != id_b)
+    {
+        return (id_a < id_b) ? -1 : 1;
+    }
+    // Same card_id in two slots (only possible with a damaged file): lowest slot first
+    return (int)((const rfid_index_entry_t *)a)->slot - (int)((const rfid_index_entry_t *)b)->slot;
+}
+
+static void rfid_index_sort(void)
+{
+    uint16_t count = rfid_index_count;
+    qsort(rfid_index, count, sizeof(rfid_index_entry_t), rfid_index_entry_compare);
+
+    // Drop duplicate IDs, keeping the lowest slot, which is the one the old linear scan would have found
+    uint16_t unique = 0;
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        if (unique == 0 || rfid_index[unique - 1].card_id != rfid_index[i].card_id)
+        {
+            rfid_index[unique++] = rfid_index[i];
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Duplicate card 0x%08lx in slot %u ignored by index.",
+                     (unsigned long)rfid_index[i].card_id, rfid_index[i].slot);
+        }
+    }
+    rfid_index_count = unique;
+    ESP_LOGD(TAG, "Card index sorted with %u entries", rfid_index_count);
+}
+
+// --- Negative Lookup Filter ---
+
+/**
+ * @brief Murmur3 finalizer, spreads sequential card ids over the whole word.
+ */
+static uint32_t rfid_filter_mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+}
+
+/**
+ * @brief Computes the RFID_FILTER_HASHES counter positions of card_id (double hashing).
+ */
+static void rfid_filter_positions(uint32_t card_id, uint32_t *positions)
+{
+    uint32_t h1 = rfid_filter_mix(card_id);
+    uint32_t h2 = rfid_filter_mix(card_id ^ 0x9E3779B9) | 1;
+    for (uint32_t i = 0; i < RFID_FILTER_HASHES; ++i)
+    {
+        // Maps the hash onto [0, RFID_FILTER_COUNTERS) without a division
+        positions[i] = (uint32_t)(((uint64_t)(h1 + i * h2) * RFID_FILTER_COUNTERS) >> 32);
+    }
+}
+
+static uint8_t rfid_filter_counter(uint32_t pos)
+{
+    return (__atomic_load_n(&rfid_filter[pos / 2], __ATOMIC_RELAXED) >> ((pos & 1) * 4)) & 0x0F;
+}
+
+static void rfid_filter_set_counter(uint32_t pos, uint8_t value)
+{
+    uint8_t shift = (pos & 1) * 4;
+    uint8_t byte = rfid_filter[pos / 2];
+    byte = (byte & ~(0x0F << shift)) | (value << shift);
+    __atomic_store_n(&rfid_filter[pos / 2], byte, __ATOMIC_RELAXED);
+}
+
+static void rfid_filter_write_begin(void)
+{
+    __atomic_store_n(&rfid_filter_seq, rfid_filter_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void rfid_filter_write_end(void)
+{
+    __atomic_store_n(&rfid_filter_seq, rfid_filter_seq + 1, __ATOMIC_RELEASE);
+}
+
+static void rfid_filter_update(uint32_t card_id, int8_t delta)
+{
+    if (rfid_filter == NULL || card_id == 0)
+    {
+        return;
+    }
+    uint32_t positions[RFID_FILTER_HASHES];
+    rfid_filter_positions(card_id, positions);
+
+    rfid_filter_write_begin();
+    for (uint32_t i = 0; i < RFID_FILTER_HASHES; ++i)
+    {
+        uint8_t counter = rfid_filter_counter(positions[i]);
+        if (counter != RFID_FILTER_SATURATED && (delta > 0 || counter > 0))
+        {
+            rfid_filter_set_counter(positions[i], counter + delta);
+        }
+    }
+    rfid_filter_write_end();
+}
+
+static void rfid_filter_add(uint32_t card_id)
+{
+    rfid_filter_update(card_id, 1);
+}
+
+static void rfid_filter_remove(uint32_t card_id)
+{
+    rfid_filter_update(card_id, -1);
+}
+
+static void rfid_filter_rebuild(void)
+{
+    if (rfid_filter == NULL)
+    {
+        return;
+    }
+
+    rfid_filter_write_begin();
+    for (uint32_t i = 0; i < (RFID_FILTER_COUNTERS + 1) / 2; ++i)
+    {
+        __atomic_store_n(&rfid_filter[i], 0, __ATOMIC_RELAXED);
+    }
+    for (uint16_t i = 0; i < rfid_index_count; ++i)
+    {
+        if (!rfid_store_slot_active(rfid_index[i].slot))
+        {
+            continue;
+        }
+        uint32_t positions[RFID_FILTER_HASHES];
+        rfid_filter_positions(rfid_index[i].card_id, positions);
+        for (uint32_t j = 0; j < RFID_FILTER_HASHES; ++j)
+        {
+            uint8_t counter = rfid_filter_counter(positions[j]);
+            if (counter != RFID_FILTER_SATURATED)
+            {
+                rfid_filter_set_counter(positions[j], counter + 1);
+            }
+        }
+    }
+    rfid_filter_write_end();
+}
+
+static bool rfid_filter_rejects(uint32_t card_id)
+{
+    if (rfid_filter == NULL)
+    {
+        return false;
+    }
+    uint32_t seq = __atomic_load_n(&rfid_filter_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+    {
+        return false; // A writer is changing the filter
+    }
+
+    uint32_t positions[RFID_FILTER_HASHES];
+    rfid_filter_positions(card_id, positions);
+    bool rejected = false;
+    for (uint32_t i = 0; i < RFID_FILTER_HASHES && !rejected; ++i)
+    {
+        rejected = rfid_filter_counter(positions[i]) == 0;
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); // The probes above happen before the re-check below
+    return rejected && __atomic_load_n(&rfid_filter_seq, __ATOMIC_RELAXED) == seq;
+}
+
+// --- Card Store ---
+
+/**
+ * @brief calloc() variant that prefers PSRAM when CONFIG_RFID_STORE_USE_PSRAM is set.
+ */
+static void *rfid_store_calloc(size_t n, size_t size)
+{
+#if CONFIG_RFID_STORE_USE_PSRAM
+    return rfid_port_calloc(n, size, true);
+#else
+    return rfid_port_calloc(n, size, false);
+#endif
+}
+
+static esp_err_t rfid_store_alloc(void)
+{
+    if (rfid_slot_timestamps == NULL)
+    {
+        rfid_slot_timestamps = rfid_store_calloc(RFID_MAX_CARDS, sizeof(uint32_t));
+    }
+    if (rfid_index == NULL)
+    {
+        rfid_index = rfid_store_calloc(RFID_MAX_CARDS, sizeof(rfid_index_entry_t));
+    }
+    if (rfid_block_pages == NULL)
+    {
+        rfid_block_pages = rfid_store_calloc(RFID_STORE_BLOCKS, sizeof(rfid_page_t *));
+    }
+    if (rfid_block_offsets == NULL)
+    {
+        rfid_block_offsets = rfid_store_calloc(RFID_STORE_BLOCKS + 1, sizeof(uint32_t));
+    }
+    if (rfid_block_offsets_next == NULL)
+    {
+        rfid_block_offsets_next = rfid_store_calloc(RFID_STORE_BLOCKS + 1, sizeof(uint32_t));
+    }
+    if (rfid_overlay == NULL)
+    {
+        rfid_overlay = rfid_store_calloc(CONFIG_RFID_JOURNAL_COMPACT_RECORDS, sizeof(rfid_overlay_entry_t));
+    }
+    if (rfid_filter == NULL)
+    {
+        rfid_filter = rfid_store_calloc((RFID_FILTER_COUNTERS + 1) / 2, 1);
+    }
+    if (rfid_slot_timestamps == NULL || rfid_index == NULL || rfid_block_pages == NULL || rfid_block_offsets == NULL ||
+        rfid_block_offsets_next == NULL || rfid_overlay == NULL || rfid_filter == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate card store for %d cards", RFID_MAX_CARDS);
+        rfid_store_free();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void rfid_store_free(void)
+{
+    rfid_store_drop_pages();
+    rfid_port_free(rfid_block_pages);
+    rfid_block_pages = NULL;
+    rfid_port_free(rfid_slot_timestamps);
+    rfid_slot_timestamps = NULL;
+    rfid_port_free(rfid_block_offsets);
+    rfid_block_offsets = NULL;
+    rfid_port_free(rfid_block_offsets_next);
+    rfid_block_offsets_next = NULL;
+    rfid_port_free(rfid_overlay);
+    rfid_overlay = NULL;
+    rfid_overlay_count = 0;
+    rfid_store_backing.kind = RFID_BACKING_NONE;
+    rfid_port_free(rfid_index);
+    rfid_index = NULL;
+    rfid_index_count = 0;
+    memset(rfid_active_slots, 0, sizeof(rfid_active_slots));
+
+    if (rfid_filter != NULL)
+    {
+        rfid_filter_write_begin();
+        memset(rfid_filter, 0, (RFID_FILTER_COUNTERS + 1) / 2);
+        rfid_filter_write_end();
+    }
+}
+
+static void rfid_store_mark_dirty(uint16_t slot)
+{
+    // Atomic because check_card marks slots while only holding the read lock
+    __atomic_fetch_or(&rfid_dirty_slots[slot / 32], (uint32_t)(1UL << (slot % 32)), __ATOMIC_RELAXED);
+}
+
+static void rfid_store_mark_seen(uint16_t slot)
+{
+    __atomic_fetch_or(&rfid_seen_slots[slot / 32], (uint32_t)(1UL << (slot % 32)), __ATOMIC_RELAXED);
+    if (!__atomic_exchange_n(&rfid_seen_pending, true, __ATOMIC_RELAXED) &&
+        rfid_seen_interval_ms > 0 && rfid_seen_timer != NULL)
+    {
+        // Still running after an earlier save cleared the bits is fine, it picks these up too
+        rfid_port_timer_start_once(rfid_seen_timer, (uint64_t)rfid_seen_interval_ms * 1000);
+    }
+}
+
+static void rfid_seen_write_due(void)
+{
+    is_seen_due = false;
+    if (!rfid_seen_pending)
+    {
+        return; // A card save already wrote them
+    }
+
+    int64_t now = rfid_port_time_us();
+    const int64_t hour_us = 3600LL * 1000 * 1000;
+    if (rfid_seen_window_writes == 0 || now - rfid_seen_window_start >= hour_us)
+    {
+        rfid_seen_window_start = now;
+        rfid_seen_window_writes = 0;
+    }
+    if (rfid_seen_window_writes >= CONFIG_RFID_LAST_SEEN_MAX_WRITES_PER_HOUR)
+    {
+        ESP_LOGD(TAG, "Last-seen write cap reached, deferring until the next hour.");
+        rfid_port_timer_stop(rfid_seen_timer);
+        rfid_port_timer_start_once(rfid_seen_timer, rfid_seen_window_start + hour_us - now);
+        return;
+    }
+
+    if (rfid_store_save() != ESP_OK)
+    {
+        // A failed write does not use up the hourly budget
+        ESP_LOGE(TAG, "Failed to write last-seen timestamps, retrying.");
+        rfid_port_timer_stop(rfid_seen_timer);
+        rfid_port_timer_start_once(rfid_seen_timer, (uint64_t)RFID_WRITE_RETRY_MS * 1000);
+        return;
+    }
+    rfid_seen_window_writes++;
+}
+
+static uint32_t rfid_journal_crc(const rfid_journal_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(rfid_journal_record_t, crc));
+}
+
+// --- Card Pages ---
+
+static void rfid_store_put_le32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    dst[2] = (uint8_t)(value >> 16);
+    dst[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t rfid_store_get_le32(const uint8_t *src)
+{
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static bool rfid_store_slot_active(uint16_t slot)
+{
+    return (rfid_active_slots[slot / 32] >> (slot % 32)) & 1;
+}
+
+/**
+ * @brief Sets or clears the active bit of a slot. Must be called with the write lock held.
+ */
+static void rfid_store_set_active(uint16_t slot, bool active)
+{
+    uint32_t bit = (uint32_t)(1UL << (slot % 32));
+    if (active)
+    {
+        rfid_active_slots[slot / 32] |= bit;
+    }
+    else
+    {
+        rfid_active_slots[slot / 32] &= ~bit;
+    }
+}
+
+/**
+ * @brief Counts the slots holding an active card.
+ *
+ * Must be called with the read or write lock held.
+ */
+static uint16_t rfid_store_active_count(void)
+{
+    uint32_t count = 0;
+    for (uint32_t word = 0; word < (RFID_MAX_CARDS + 31) / 32; ++word)
+    {
+        count += (uint32_t)__builtin_popcount(rfid_active_slots[word]);
+    }
+    return (uint16_t)count;
+}
+
+/**
+ * @brief Returns the position of the first overlay entry whose slot is >= slot.
+ */
+static uint32_t rfid_overlay_lower_bound(uint16_t slot)
+{
+    uint32_t lo = 0;
+    uint32_t hi = rfid_overlay_count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (rfid_overlay[mid].slot < slot)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Records the journal offset of a slot's newest full record.
+ *
+ * Must be called with the write lock held.
+ *
+ * @return true on success, false if the overlay is full
+ */
+static bool rfid_overlay_set(uint16_t slot, uint32_t offset)
+{
+    uint32_t pos = rfid_overlay_lower_bound(slot);
+    if (pos < rfid_overlay_count && rfid_overlay[pos].slot == slot)
+    {
+        rfid_overlay[pos].offset = offset;
+        return true;
+    }
+    if (rfid_overlay_count >= CONFIG_RFID_JOURNAL_COMPACT_RECORDS)
+    {
+        return false;
+    }
+    memmove(&rfid_overlay[pos + 1], &rfid_overlay[pos], (rfid_overlay_count - pos) * sizeof(rfid_overlay_entry_t));
+    rfid_overlay[pos].slot = slot;
+    rfid_overlay[pos].offset = offset;
+    rfid_overlay_count++;
+    return true;
+}
+
+/**
+ * @brief Reads one block of slots from the backing file, then applies the journal overlay.
+ *
+ * Must be called with rfid_page_mutex held.
+ *
+ * @return true on success, false on a file error or a damaged record
+ */
+static bool rfid_store_read_block(uint16_t block, rfid_page_t *page)
+{
+    // Only used with rfid_page_mutex held
+    static uint8_t buffer[RFID_STORE_BLOCK_CARDS * RFID_STORE_RECORD_MAX];
+    uint32_t first = (uint32_t)block * RFID_STORE_BLOCK_CARDS;
+    uint32_t end = (first + RFID_STORE_BLOCK_CARDS < RFID_MAX_CARDS) ? first + RFID_STORE_BLOCK_CARDS : RFID_MAX_CARDS;
+    FILE *f = NULL;
+    bool ok = true;
+
+    memset(page->slots, 0, sizeof(page->slots));
+    page->block = block;
+    if (rfid_store_backing.kind == RFID_BACKING_SLOTS && first < rfid_store_backing.slots)
+    {
+        uint32_t count = ((end < rfid_store_backing.slots) ? end : rfid_store_backing.slots) - first;
+        f = fopen(rfid_store_backing.path, "rb");
+        ok = f != NULL && fseek(f, (long)(rfid_store_backing.base + first * sizeof(rfid_card_t)), SEEK_SET) == 0;
+        for (uint32_t i = 0; i < count && ok; ++i)
+        {
+            rfid_card_t card;
+            ok = fread(&card, sizeof(card), 1, f) == 1;
+            if (ok)
+            {
+                page->slots[i].card_id = card.card_id;
+                memcpy(page->slots[i].name, card.name, RFID_CARD_NAME_LEN - 1);
+            }
+        }
+    }
+    else if (rfid_store_backing.kind == RFID_BACKING_RECORDS)
+    {
+        uint32_t size = rfid_block_offsets[block + 1] - rfid_block_offsets[block];
+        if (size > 0)
+        {
+            f = fopen(rfid_store_backing.path, "rb");
+            ok = f != NULL && size <= sizeof(buffer) && fseek(f, (long)rfid_block_offsets[block], SEEK_SET) == 0 &&
+                 fread(buffer, 1, size, f) == size;
+        }
+        // The records were checked against the image CRC when it was loaded
+        for (uint32_t pos = 0; pos < size && ok;)
+        {
+            const uint8_t *record = &buffer[pos];
+            ok = size - pos >= RFID_STORE_RECORD_HEAD;
+            uint32_t slot = ok ? ((uint32_t)record[4] | ((uint32_t)record[5] << 8)) : 0;
+            uint8_t name_len = ok ? (record[10] & ~RFID_STORE_RECORD_REMOVED) : 0;
+            ok = ok && slot >= first && slot < end && name_len < RFID_CARD_NAME_LEN &&
+                 size - pos - RFID_STORE_RECORD_HEAD >= name_len;
+            if (ok)
+            {
+                rfid_page_slot_t *entry = &page->slots[slot - first];
+                entry->card_id = rfid_store_get_le32(record);
+                memcpy(entry->name, record + RFID_STORE_RECORD_HEAD, name_len);
+            }
+            pos += RFID_STORE_RECORD_HEAD + name_len;
+        }
+    }
+    if (f != NULL)
+    {
+        fclose(f);
+        f = NULL;
+    }
+
+    // Slots journaled since the image
+    uint32_t pos = rfid_overlay_lower_bound((uint16_t)first);
+    if (ok && pos < rfid_overlay_count && rfid_overlay[pos].slot < end)
+    {
+        f = fopen(RFID_JOURNAL_FILE, "rb");
+        ok = f != NULL;
+        for (; ok && pos < rfid_overlay_count && rfid_overlay[pos].slot < end; ++pos)
+        {
+            rfid_journal_record_t record;
+            ok = fseek(f, (long)rfid_overlay[pos].offset, SEEK_SET) == 0 && fread(&record, sizeof(record), 1, f) == 1 &&
+                 record.magic == RFID_JOURNAL_MAGIC && record.slot == rfid_overlay[pos].slot &&
+                 RFID_PORT_CRC_OK(record.crc, rfid_journal_crc(&record));
+            if (ok)
+            {
+                rfid_page_slot_t *entry = &page->slots[record.slot - first];
+                entry->card_id = record.card.card_id;
+                memcpy(entry->name, record.card.name, RFID_CARD_NAME_LEN - 1);
+                entry->name[RFID_CARD_NAME_LEN - 1] = '\0';
+            }
+        }
+        if (f != NULL)
+        {
+            fclose(f);
+        }
+    }
+
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to read card block %u.", block);
+    }
+    return ok;
+}
+
+static void rfid_page_unlink(rfid_page_t *page)
+{
+    if (page->newer != NULL)
+    {
+        page->newer->older = page->older;
+    }
+    else
+    {
+        rfid_page_newest = page->older;
+    }
+    if (page->older != NULL)
+    {
+        page->older->newer = page->newer;
+    }
+    else
+    {
+        rfid_page_oldest = page->newer;
+    }
+    page->newer = NULL;
+    page->older = NULL;
+}
+
+static void rfid_page_link_newest(rfid_page_t *page)
+{
+    page->newer = NULL;
+    page->older = rfid_page_newest;
+    if (rfid_page_newest != NULL)
+    {
+        rfid_page_newest->newer = page;
+    }
+    else
+    {
+        rfid_page_oldest = page;
+    }
+    rfid_page_newest = page;
+}
+
+/**
+ * @brief Takes the least recently used page out of the cache.
+ *
+ * Only unpinned pages are on the LRU list. Must be called with rfid_page_mutex held.
+ *
+ * @return The page, to be reused or freed, or NULL if every cached page is pinned.
+ */
+static rfid_page_t *rfid_page_evict(void)
+{
+    rfid_page_t *page = rfid_page_oldest;
+    if (page != NULL)
+    {
+        rfid_page_unlink(page);
+        rfid_block_pages[page->block] = NULL;
+        rfid_pages_unpinned--;
+    }
+    return page;
+}
+
+/**
+ * @brief Returns the cached page of a block, paging it in if needed.
+ *
+ * Once CONFIG_RFID_STORE_CACHE_BLOCKS pages may be evicted, or no new page can
+ * be allocated, the least recently used one is reused. Must be called with
+ * rfid_page_mutex held.
+ *
+ * @return The page, or NULL if the block is not cached and cannot be paged in.
+ */
+static rfid_page_t *rfid_page_get(uint16_t block)
+{
+    rfid_page_t *page = rfid_block_pages[block];
+    if (page != NULL)
+    {
+        if (!page->pinned)
+        {
+            rfid_page_unlink(page);
+            rfid_page_link_newest(page);
+        }
+        return page;
+    }
+
+    if (rfid_pages_unpinned >= CONFIG_RFID_STORE_CACHE_BLOCKS)
+    {
+        page = rfid_page_evict();
+    }
+    if (page == NULL)
+    {
+        page = rfid_store_calloc(1, sizeof(rfid_page_t));
+    }
+    if (page == NULL)
+    {
+        page = rfid_page_evict();
+    }
+    if (page == NULL)
+    {
+        return NULL;
+    }
+    if (!rfid_store_read_block(block, page))
+    {
+        rfid_port_free(page);
+        return NULL;
+    }
+    page->pinned = false;
+    rfid_block_pages[block] = page;
+    rfid_page_link_newest(page);
+    rfid_pages_unpinned++;
+    return page;
+}
+
+static esp_err_t rfid_store_get_slot(uint16_t slot, rfid_card_t *card)
+{
+    uint16_t block = slot / RFID_STORE_BLOCK_CARDS;
+    xSemaphoreTake(rfid_page_mutex, portMAX_DELAY);
+    const rfid_page_t *page = rfid_page_get(block);
+    if (page == NULL && rfid_store_read_block(block, &rfid_page_scratch))
+    {
+        page = &rfid_page_scratch; // Out of memory, read it for this call only
+    }
+    if (page != NULL)
+    {
+        const rfid_page_slot_t *entry = &page->slots[slot % RFID_STORE_BLOCK_CARDS];
+        card->card_id = entry->card_id;
+        memcpy(card->name, entry->name, RFID_CARD_NAME_LEN);
+    }
+    xSemaphoreGive(rfid_page_mutex);
+
+    card->active = rfid_store_slot_active(slot);
+    card->timestamp = __atomic_load_n(&rfid_slot_timestamps[slot], __ATOMIC_RELAXED); // See rfid_manager_check_card_at()
+    return page != NULL ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t rfid_store_reserve_slot(uint16_t slot)
+{
+    xSemaphoreTake(rfid_page_mutex, portMAX_DELAY);
+    rfid_page_t *page = rfid_page_get(slot / RFID_STORE_BLOCK_CARDS);
+    if (page != NULL && !page->pinned)
+    {
+        rfid_page_unlink(page);
+        rfid_pages_unpinned--;
+        page->pinned = true;
+    }
+    xSemaphoreGive(rfid_page_mutex);
+    return page != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static rfid_page_slot_t *rfid_store_edit_slot(uint16_t slot)
+{
+    if (rfid_store_reserve_slot(slot) != ESP_OK)
+    {
+        return NULL;
+    }
+    rfid_store_mark_dirty(slot);
+    // A pinned page stays in place, and only the writer holding the write lock changes it
+    return &rfid_block_pages[slot / RFID_STORE_BLOCK_CARDS]->slots[slot % RFID_STORE_BLOCK_CARDS];
+}
+
+static void rfid_store_pages_saved(void)
+{
+    xSemaphoreTake(rfid_page_mutex, portMAX_DELAY);
+    for (uint32_t block = 0; block < RFID_STORE_BLOCKS; ++block)
+    {
+        rfid_page_t *page = rfid_block_pages[block];
+        if (page != NULL && page->pinned)
+        {
+            page->pinned = false;
+            rfid_page_link_newest(page);
+            rfid_pages_unpinned++;
+        }
+    }
+    while (rfid_pages_unpinned > CONFIG_RFID_STORE_CACHE_BLOCKS)
+    {
+        rfid_port_free(rfid_page_evict());
+    }
+    xSemaphoreGive(rfid_page_mutex);
+}
+
+static void rfid_store_drop_pages(void)
+{
+    if (rfid_block_pages == NULL)
+    {
+        return;
+    }
+    for (uint32_t block = 0; block < RFID_STORE_BLOCKS; ++block)
+    {
+        rfid_port_free(rfid_block_pages[block]);
+        rfid_block_pages[block] = NULL;
+    }
+    rfid_page_newest = NULL;
+    rfid_page_oldest = NULL;
+    rfid_pages_unpinned = 0;
+}
+
+static void rfid_store_reset(void)
+{
+    rfid_store_drop_pages();
+    rfid_store_backing.kind = RFID_BACKING_NONE;
+    rfid_overlay_count = 0;
+    rfid_journal_bytes = 0;
+    rfid_index_count = 0;
+    memset(rfid_active_slots, 0, sizeof(rfid_active_slots));
+    memset(rfid_slot_timestamps, 0, RFID_MAX_CARDS * sizeof(uint32_t));
+    memset(rfid_dirty_slots, 0, sizeof(rfid_dirty_slots));
+    memset(rfid_seen_slots, 0, sizeof(rfid_seen_slots));
+    rfid_seen_pending = false;
+    rfid_filter_rebuild();
+}
+
+// --- Card Files ---
+
+/**
+ * @brief Appends every dirty or seen slot to the journal file and clears the slot bitmaps.
+ *
+ * Dirty slots are written in full, slots whose timestamp alone changed as
+ * rfid_journal_seen_t records. When a write fails the bitmaps are kept and
+ * rfid_store_needs_rewrite is set, so the next save compacts.
+ */
+static esp_err_t rfid_store_append_journal(void)
+{
+    FILE *f = NULL;
+    uint32_t appended = 0;
+    uint32_t bytes = 0;
+    uint32_t offset = rfid_journal_has_base ? rfid_journal_bytes : 0; // Of the next record in the file
+    rfid_journal_record_t record;
+    rfid_journal_seen_t seen;
+    memset(&record, 0, sizeof(record)); // Keep padding bytes deterministic for the CRC
+
+    for (uint32_t word = 0; word < (RFID_MAX_CARDS + 31) / 32; ++word)
+    {
+        uint32_t dirty = rfid_dirty_slots[word];
+        uint32_t bits = dirty | rfid_seen_slots[word];
+        while (bits != 0)
+        {
+            uint16_t slot = (uint16_t)(word * 32 + __builtin_ctz(bits));
+            bool full = (dirty & (bits & -bits)) != 0;
+            bits &= bits - 1;
+
+            if (f == NULL)
+            {
+                // A new journal replaces whatever is left of an older one
+                f = fopen(RFID_JOURNAL_FILE, rfid_journal_has_base ? "ab" : "wb");
+                if (f == NULL)
+                {
+                    ESP_LOGE(TAG, "Failed to open RFID journal file: %s", RFID_JOURNAL_FILE);
+                    return ESP_FAIL;
+                }
+                if (!rfid_journal_has_base)
+                {
+                    rfid_journal_base_t base = {
+                        .magic = RFID_JOURNAL_BASE_MAGIC,
+                        .sequence = rfid_store_sequence,
+                    };
+                    base.crc = esp_rom_crc32_le(0, (const uint8_t *)&base, offsetof(rfid_journal_base_t, crc));
+                    if (fwrite(&base, sizeof(base), 1, f) != 1)
+                    {
+                        ESP_LOGE(TAG, "Failed to start RFID journal.");
+                        fclose(f);
+                        rfid_store_needs_rewrite = true;
+                        return ESP_FAIL;
+                    }
+                    bytes += sizeof(base);
+                    offset += sizeof(base);
+                }
+            }
+
+            size_t written = 0;
+            if (full)
+            {
+                record.magic = RFID_JOURNAL_MAGIC;
+                record.slot = slot;
+                // Until the next compaction the slot's block is read back through this record
+                if (rfid_store_get_slot(slot, &record.card) == ESP_OK && rfid_overlay_set(slot, offset))
+                {
+                    record.crc = rfid_journal_crc(&record);
+                    written = fwrite(&record, sizeof(record), 1, f);
+                }
+                bytes += sizeof(record);
+                offset += sizeof(record);
+            }
+            else
+            {
+                seen.magic = RFID_JOURNAL_SEEN_MAGIC;
+                seen.slot = slot;
+                seen.timestamp = rfid_slot_timestamps[slot];
+                seen.crc = esp_rom_crc32_le(0, (const uint8_t *)&seen, offsetof(rfid_journal_seen_t, crc));
+                written = fwrite(&seen, sizeof(seen), 1, f);
+                bytes += sizeof(seen);
+                offset += sizeof(seen);
+            }
+            if (written != 1)
+            {
+                // A torn record would hide everything appended after it from the
+                // replay, so the next save writes a new image instead
+                ESP_LOGE(TAG, "Failed to append slot %u to RFID journal.", slot);
+                fclose(f);
+                rfid_store_needs_rewrite = true;
+                return ESP_FAIL;
+            }
+            appended++;
+        }
+    }
+
+    if (f == NULL)
+    {
+        return ESP_OK; // Nothing changed
+    }
+    if (fclose(f) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to close RFID journal file after appending.");
+        rfid_store_needs_rewrite = true; // Same as a failed write, the tail may be torn
+        return ESP_FAIL;
+    }
+
+    memset(rfid_dirty_slots, 0, sizeof(rfid_dirty_slots));
+    memset(rfid_seen_slots, 0, sizeof(rfid_seen_slots));
+    rfid_seen_pending = false;
+    rfid_journal_has_base = true;
+    rfid_journal_records += appended;
+    rfid_journal_bytes = offset;
+    rfid_store_pages_saved();
+    app_metrics_count(rfid_metric_flash_bytes, bytes);
+    ESP_LOGD(TAG, "Appended %lu records to RFID journal (%lu total)", (unsigned long)appended, (unsigned long)rfid_journal_records);
+    return ESP_OK;
+}
+
+/**
+ * @brief Folds the journal into a new image of the card table and deletes it.
+ *
+ * The journal's base record names the image before this one, so after a power
+ * loss between the two steps the next boot skips it instead of replaying it
+ * over the new image.
+ */
+static esp_err_t rfid_store_compact(void)
+{
+    esp_err_t ret = rfid_store_write_image();
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    if (remove(RFID_JOURNAL_FILE) != 0 && rfid_journal_records > 0)
+    {
+        ESP_LOGW(TAG, "Failed to remove RFID journal file after compaction.");
+    }
+    rfid_journal_has_base = false;
+    ESP_LOGI(TAG, "Compacted %lu journal records into %s", (unsigned long)rfid_journal_records, rfid_store_files[rfid_store_newest]);
+    rfid_journal_records = 0;
+    rfid_journal_bytes = 0;
+    rfid_overlay_count = 0;
+    rfid_store_pages_saved();
+    return ESP_OK;
+}
+
+static esp_err_t rfid_store_save(void)
+{
+    int64_t begin = app_metrics_begin();
+    esp_err_t ret;
+
+    uint32_t pending = 0;
+    for (uint32_t word = 0; word < (RFID_MAX_CARDS + 31) / 32; ++word)
+    {
+        pending += (uint32_t)__builtin_popcount(rfid_dirty_slots[word] | rfid_seen_slots[word]);
+    }
+
+    // A journal that would reach its limit is folded in right away, which keeps
+    // it (and rfid_overlay) bounded and turns a bulk change into one image write
+    if (!rfid_store_needs_rewrite && rfid_journal_records + pending < CONFIG_RFID_JOURNAL_COMPACT_RECORDS)
+    {
+        ret = rfid_store_append_journal();
+    }
+    else
+    {
+        // The card file gets every slot, so the journal and slot bitmaps are
+        // obsolete. The changed blocks stay pinned until the image is written.
+        memset(rfid_dirty_slots, 0, sizeof(rfid_dirty_slots));
+        memset(rfid_seen_slots, 0, sizeof(rfid_seen_slots));
+        rfid_seen_pending = false;
+        rfid_store_needs_rewrite = true;
+        ret = rfid_store_compact();
+    }
+
+    app_metrics_end(rfid_metric_flash_write, begin);
+    return ret;
+}
+
+/**
+ * @brief Applies one full journal record found at offset to the card table.
+ *
+ * The index and the resident fields are updated here, the paged part through
+ * rfid_overlay, or in the slot's cached page. Must be called with the write lock held.
+ *
+ * @return true on success, false if the slot's block cannot be read
+ */
+static bool rfid_store_replay_record(rfid_journal_record_t *record, uint32_t offset)
+{
+    rfid_card_t old;
+    if (rfid_store_get_slot(record->slot, &old) != ESP_OK)
+    {
+        return false;
+    }
+    record->card.name[RFID_CARD_NAME_LEN - 1] = '\0';
+    if (old.card_id != record->card.card_id)
+    {
+        if (rfid_index_find(old.card_id) == record->slot)
+        {
+            rfid_index_erase(old.card_id);
+        }
+        if (rfid_index_find(record->card.card_id) < 0)
+        {
+            rfid_index_insert(record->card.card_id, record->slot);
+        }
+    }
+    rfid_store_set_active(record->slot, record->card.active && record->card.card_id != 0);
+    rfid_slot_timestamps[record->slot] = record->card.timestamp;
+
+    rfid_page_t *page = rfid_block_pages[record->slot / RFID_STORE_BLOCK_CARDS];
+    if (!rfid_overlay_set(record->slot, offset))
+    {
+        // More records than the overlay holds (the limit was lowered): keep the
+        // block in RAM until the image written after the load
+        if (rfid_store_reserve_slot(record->slot) != ESP_OK)
+        {
+            return false;
+        }
+        page = rfid_block_pages[record->slot / RFID_STORE_BLOCK_CARDS];
+        rfid_store_needs_rewrite = true;
+    }
+    if (page != NULL)
+    {
+        rfid_page_slot_t *entry = &page->slots[record->slot % RFID_STORE_BLOCK_CARDS];
+        entry->card_id = record->card.card_id;
+        memcpy(entry->name, record->card.name, RFID_CARD_NAME_LEN);
+    }
+    return true;
+}
+
+static bool rfid_store_replay_journal(uint32_t image_sequence)
+{
+    rfid_journal_records = 0;
+    rfid_journal_has_base = false;
+    rfid_journal_bytes = 0;
+    rfid_overlay_count = 0;
+
+    FILE *f = fopen(RFID_JOURNAL_FILE, "rb");
+    if (f == NULL)
+    {
+        return true; // No journal, the card file is up to date
+    }
+
+    rfid_journal_base_t base;
+    size_t got = fread(&base, 1, sizeof(base), f);
+    if (got == 0)
+    {
+        fclose(f);
+        return true; // Empty, a new journal overwrites it
+    }
+    if (got != sizeof(base) || base.magic != RFID_JOURNAL_BASE_MAGIC ||
+        !RFID_PORT_CRC_OK(base.crc, esp_rom_crc32_le(0, (const uint8_t *)&base, offsetof(rfid_journal_base_t, crc))))
+    {
+        // Nothing in it can be trusted to belong to the loaded image
+        ESP_LOGW(TAG, "RFID journal has no valid base record, ignoring it.");
+        fclose(f);
+        return false;
+    }
+    if (base.sequence < image_sequence)
+    {
+        ESP_LOGW(TAG, "RFID journal of image %lu is older than image %lu, deleting it.",
+                 (unsigned long)base.sequence, (unsigned long)image_sequence);
+        fclose(f);
+        remove(RFID_JOURNAL_FILE);
+        return true;
+    }
+    if (base.sequence > rfid_store_sequence)
+    {
+        rfid_store_sequence = base.sequence; // The next image must outrank this journal too
+    }
+    rfid_journal_has_base = true;
+
+    bool clean = true;
+    uint32_t offset = sizeof(base); // Of the record being read
+    rfid_journal_record_t record;
+    rfid_journal_seen_t *seen = (rfid_journal_seen_t *)&record; // Both start with magic and slot
+    const size_t header = offsetof(rfid_journal_record_t, card);
+    while (true)
+    {
+        got = fread(&record, 1, header, f);
+        if (got == 0)
+        {
+            break;
+        }
+        size_t size = record.magic == RFID_JOURNAL_MAGIC ? sizeof(record)
+                    : record.magic == RFID_JOURNAL_SEEN_MAGIC ? sizeof(*seen) : 0;
+        if (got == header && size > 0)
+        {
+            got += fread((uint8_t *)&record + header, 1, size - header, f);
+        }
+        bool valid = size > 0 && got == size && record.slot < RFID_MAX_CARDS;
+        if (valid && record.magic == RFID_JOURNAL_MAGIC)
+        {
+            valid = RFID_PORT_CRC_OK(record.crc, rfid_journal_crc(&record));
+        }
+        else if (valid)
+        {
+            valid = RFID_PORT_CRC_OK(seen->crc, esp_rom_crc32_le(0, (const uint8_t *)seen, offsetof(rfid_journal_seen_t, crc)));
+        }
+        if (!valid)
+        {
+            ESP_LOGW(TAG, "RFID journal damaged after %lu records, ignoring the rest.", (unsigned long)rfid_journal_records);
+            clean = false;
+            break;
+        }
+
+        if (record.magic == RFID_JOURNAL_MAGIC && !rfid_store_replay_record(&record, offset))
+        {
+            ESP_LOGW(TAG, "RFID journal record %lu cannot be applied, ignoring the rest.", (unsigned long)rfid_journal_records);
+            clean = false;
+            break;
+        }
+        if (record.magic == RFID_JOURNAL_SEEN_MAGIC)
+        {
+            rfid_slot_timestamps[seen->slot] = seen->timestamp;
+        }
+        offset += size;
+        rfid_journal_records++;
+    }
+    fclose(f);
+    rfid_journal_bytes = offset;
+
+    if (rfid_journal_records > 0)
+    {
+        ESP_LOGI(TAG, "Replayed %lu records from RFID journal", (unsigned long)rfid_journal_records);
+    }
+    return clean;
+}
+
+static uint16_t rfid_store_find_free_slot(uint16_t from)
+{
+    for (uint16_t i = from; i < RFID_MAX_CARDS; ++i)
+    {
+        if (!rfid_store_slot_active(i))
+        {
+            return i;
+        }
+    }
+    return RFID_MAX_CARDS;
+}
+
+static esp_err_t rfid_store_put_card(uint16_t slot, uint32_t card_id, const char *name, uint32_t timestamp)
+{
+    rfid_page_slot_t *entry = rfid_store_edit_slot(slot);
+    if (entry == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to page in slot %u for card 0x%08lx.", slot, (unsigned long)card_id);
+        return ESP_FAIL;
+    }
+
+    // Reusing a removed card's slot drops that card's ID from the index
+    if (rfid_index_find(entry->card_id) == slot)
+    {
+        rfid_index_erase(entry->card_id);
+    }
+    rfid_index_insert(card_id, slot);
+
+    entry->card_id = card_id;
+    strncpy(entry->name, name, RFID_CARD_NAME_LEN - 1);
+    entry->name[RFID_CARD_NAME_LEN - 1] = '\0';
+    rfid_store_set_active(slot, true);
+    rfid_slot_timestamps[slot] = timestamp;
+    rfid_filter_add(card_id);
+    return ESP_OK;
+}
+
+static void rfid_retry_write_later(void)
+{
+    if (rfid_write_timer != NULL)
+    {
+        rfid_port_timer_stop(rfid_write_timer);
+        rfid_port_timer_start_once(rfid_write_timer, (uint64_t)RFID_WRITE_RETRY_MS * 1000);
+    }
+}
+
+static esp_err_t rfid_schedule_write(void)
+{
+    is_dirty = true;
+
+    // Reset the timer if it's running
+    if (rfid_write_timer != NULL)
+    {
+        rfid_port_timer_stop(rfid_write_timer);
+
+        // Only start the timer if caching is enabled (timeout > 0)
+        if (rfid_write_timeout_ms > 0)
+        {
+            rfid_port_timer_start_once(rfid_write_timer, rfid_write_timeout_ms * 1000);
+            ESP_LOGD(TAG, "Started RFID write timer for %lu ms", (unsigned long)rfid_write_timeout_ms);
+        }
+        else
+        {
+            // If caching is disabled, write immediately
+            return rfid_manager_write_into_memory();
+        }
+    }
+    return ESP_OK;
+}
+
+static uint32_t rfid_store_header_crc(const rfid_store_header_t *header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(rfid_store_header_t, header_crc));
+}
+
+static bool rfid_store_write_records(FILE *f, uint32_t *count, uint32_t *crc, uint32_t *bytes, uint32_t *offsets)
+{
+    // Only ever used by the single writer holding the write lock
+    static uint8_t chunk[RFID_STORE_BLOCK_CARDS * RFID_STORE_RECORD_MAX];
+
+    *count = 0;
+    *crc = 0;
+    *bytes = 0;
+    for (uint32_t block = 0; block < RFID_STORE_BLOCKS; ++block)
+    {
+        if (offsets != NULL)
+        {
+            offsets[block] = sizeof(rfid_store_header_t) + *bytes;
+        }
+
+        // Cached blocks are taken as they are, the others are read without
+        // displacing the cache
+        xSemaphoreTake(rfid_page_mutex, portMAX_DELAY);
+        const rfid_page_t *page = rfid_block_pages[block];
+        if (page == NULL && rfid_store_read_block((uint16_t)block, &rfid_page_scratch))
+        {
+            page = &rfid_page_scratch;
+        }
+        size_t used = 0;
+        uint32_t first = block * RFID_STORE_BLOCK_CARDS;
+        for (uint32_t i = 0; page != NULL && i < RFID_STORE_BLOCK_CARDS && first + i < RFID_MAX_CARDS; ++i)
+        {
+            uint16_t slot = (uint16_t)(first + i);
+            const rfid_page_slot_t *entry = &page->slots[i];
+            bool active = rfid_store_slot_active(slot);
+            if (!active && entry->card_id == 0)
+            {
+                continue;
+            }
+
+            size_t name_len = active ? strnlen(entry->name, RFID_CARD_NAME_LEN - 1) : 0;
+            uint8_t *record = &chunk[used];
+            rfid_store_put_le32(record, entry->card_id);
+            record[4] = (uint8_t)slot;
+            record[5] = (uint8_t)(slot >> 8);
+            rfid_store_put_le32(record + 6, rfid_slot_timestamps[slot]);
+            record[10] = active ? (uint8_t)name_len : RFID_STORE_RECORD_REMOVED;
+            memcpy(record + RFID_STORE_RECORD_HEAD, entry->name, name_len);
+            used += RFID_STORE_RECORD_HEAD + name_len;
+            ++*count;
+        }
+        xSemaphoreGive(rfid_page_mutex);
+
+        if (page == NULL || (f != NULL && used > 0 && fwrite(chunk, 1, used, f) != used))
+        {
+            return false;
+        }
+        *crc = esp_rom_crc32_le(*crc, chunk, used);
+        *bytes += used;
+    }
+    if (offsets != NULL)
+    {
+        offsets[RFID_STORE_BLOCKS] = sizeof(rfid_store_header_t) + *bytes;
+    }
+    return true;
+}
+
+static esp_err_t rfid_store_write_image(void)
+{
+    int8_t target_copy = (rfid_store_newest == 0) ? 1 : 0;
+    const char *target = rfid_store_files[target_copy];
+    rfid_store_header_t header = {
+        .magic = RFID_STORE_MAGIC,
+        .version = RFID_STORE_VERSION,
+        .sequence = rfid_store_sequence + 1,
+    };
+    uint32_t bytes;
+    if (!rfid_store_write_records(NULL, &header.count, &header.data_crc, &bytes, NULL))
+    {
+        ESP_LOGE(TAG, "Failed to read the card table for a new image.");
+        return ESP_FAIL;
+    }
+    header.header_crc = rfid_store_header_crc(&header);
+
+    FILE *f = fopen(RFID_STORE_TEMP_FILE, "wb");
+    if (f == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open RFID database file for writing: %s", RFID_STORE_TEMP_FILE);
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (ok)
+    {
+        uint32_t count, crc;
+        ok = rfid_store_write_records(f, &count, &crc, &bytes, rfid_block_offsets_next) &&
+             count == header.count && crc == header.data_crc;
+    }
+    if (fclose(f) != 0 || !ok)
+    {
+        ESP_LOGE(TAG, "Failed to write RFID database file %s.", RFID_STORE_TEMP_FILE);
+        remove(RFID_STORE_TEMP_FILE);
+        return ESP_FAIL;
+    }
+    app_metrics_count(rfid_metric_flash_bytes, sizeof(header) + bytes);
+
+    // SPIFFS cannot rename onto an existing file. Only the older copy goes away
+    // first, the newest one stays valid until the rename is done.
+    remove(target);
+    if (!rfid_port_rename(RFID_STORE_TEMP_FILE, target))
+    {
+        ESP_LOGE(TAG, "Failed to move new RFID database image to %s.", target);
+        return ESP_FAIL;
+    }
+    rfid_store_sequence = header.sequence;
+    rfid_store_newest = target_copy;
+    rfid_store_needs_rewrite = false;
+
+    // Blocks are paged from the new image from now on
+    uint32_t *offsets = rfid_block_offsets;
+    rfid_block_offsets = rfid_block_offsets_next;
+    rfid_block_offsets_next = offsets;
+    rfid_store_backing.kind = RFID_BACKING_RECORDS;
+    rfid_store_backing.path = target;
+
+    // The first image replaces the headerless card file of older firmware
+    remove(RFID_DATABASE_FILE);
+    ESP_LOGD(TAG, "Wrote RFID database image %lu with %lu cards (%lu bytes) to %s", (unsigned long)header.sequence,
+             (unsigned long)header.count, (unsigned long)(sizeof(header) + bytes), target);
+    return ESP_OK;
+}
+
+/**
+ * @brief Adds a slot read from a card file to the resident part of the table.
+ *
+ * The index is left unsorted, see rfid_index_sort().
+ */
+static void rfid_store_load_slot(uint16_t slot, uint32_t card_id, bool active, uint32_t timestamp)
+{
+    if (card_id == 0)
+    {
+        return; // Never used
+    }
+    rfid_index[rfid_index_count].card_id = card_id;
+    rfid_index[rfid_index_count].slot = slot;
+    rfid_index_count++;
+    rfid_store_set_active(slot, active);
+    rfid_slot_timestamps[slot] = timestamp;
+}
+
+static esp_err_t rfid_store_read_slots_v1(FILE *f, const rfid_store_header_t *header, bool *rewrite)
 {
-    if (card == NULL)
+    uint32_t crc = 0;
+    esp_err_t ret = ESP_OK;
+    for (uint32_t i = 0; i < header->count && ret == ESP_OK; ++i)
     {
-        ESP_LOGE(TAG, "Output card pointer is NULL.");
-        return ESP_ERR_INVALID_ARG;
+        rfid_card_t card;
+        if (fread(&card, sizeof(card), 1, f) != 1)
+        {
+            ret = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        crc = esp_rom_crc32_le(crc, (const uint8_t *)&card, sizeof(card));
+
+        // A copy written with a different RFID_MAX_CARDS is loaded as far as it fits
+        // and then rewritten at the current size
+        if (i < RFID_MAX_CARDS)
+        {
+            rfid_store_load_slot((uint16_t)i, card.card_id, card.active != 0, card.timestamp);
+        }
     }
-    
-    // Check if mutex is initialized first
-    if (rfid_mutex == NULL) {
-        ESP_LOGE(TAG, "RFID mutex not initialized in get_card");
-        return ESP_FAIL;
+    if (ret == ESP_OK && !RFID_PORT_CRC_OK(header->data_crc, crc))
+    {
+        ret = ESP_ERR_INVALID_CRC;
     }
-    
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE)
+    *rewrite = true; // Always migrated to the packed format
+    return ret;
+}
+
+static esp_err_t rfid_store_read_records(FILE *f, const rfid_store_header_t *header, uint32_t *tail, bool *rewrite)
+{
+    uint32_t crc = 0;
+    uint32_t offset = sizeof(rfid_store_header_t); // Of the record being read
+    int32_t last_slot = -1;
+    uint32_t block = 0; // First block whose offset is not known yet
+    *tail = 0;
+    *rewrite = false;
+    for (uint32_t i = 0; i < header->count; ++i)
     {
-        for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i)
+        uint8_t record[RFID_STORE_RECORD_MAX];
+        if (fread(record, RFID_STORE_RECORD_HEAD, 1, f) != 1)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        bool removed = (record[10] & RFID_STORE_RECORD_REMOVED) != 0;
+        uint8_t name_len = record[10] & ~RFID_STORE_RECORD_REMOVED;
+        if (name_len > RFID_CARD_NAME_LEN - 1 || (removed && name_len > 0) ||
+            (name_len > 0 && fread(record + RFID_STORE_RECORD_HEAD, name_len, 1, f) != 1))
         {
-            if (rfid_database[i].card_id == card_id)
+            return ESP_ERR_INVALID_SIZE;
+        }
+        crc = esp_rom_crc32_le(crc, record, RFID_STORE_RECORD_HEAD + name_len);
+
+        // Journal records refer to slots, so cards go back where they were. Records
+        // are in slot order: slots beyond a smaller RFID_MAX_CARDS come last and
+        // take the free slots left over once the whole image is checked.
+        uint32_t slot = (uint32_t)record[4] | ((uint32_t)record[5] << 8);
+        if (slot >= RFID_MAX_CARDS)
+        {
+            if (*tail == 0)
             {
-                if (rfid_database[i].active)
-                {
-                    *card = rfid_database[i]; // Copy the card data
-                    xSemaphoreGive(rfid_mutex);
-                    ESP_LOGI(TAG, "Card 0x%08lx found at slot %u.", (unsigned long)card_id, i);
-                    return ESP_OK;
-                }
-                else
-                {
-                    // Card found but is inactive
-                    ESP_LOGW(TAG, "Card 0x%08lx found at slot %u but is inactive.", (unsigned long)card_id, i);
-                    xSemaphoreGive(rfid_mutex);
-                    return ESP_ERR_NOT_FOUND; // Treat inactive as not found for "get active card" purposes
-                }
+                *tail = offset;
             }
+            *rewrite = true;
         }
-        // Card ID not found in any slot
-        ESP_LOGW(TAG, "Card 0x%08lx not found in the database.", (unsigned long)card_id);
-        xSemaphoreGive(rfid_mutex);
-        return ESP_ERR_NOT_FOUND;
+        else if (*tail != 0 || (int32_t)slot <= last_slot)
+        {
+            return ESP_ERR_INVALID_SIZE; // Out of slot order, or two records for one slot
+        }
+        else
+        {
+            while (block <= slot / RFID_STORE_BLOCK_CARDS)
+            {
+                rfid_block_offsets[block++] = offset;
+            }
+            rfid_store_load_slot((uint16_t)slot, rfid_store_get_le32(record), !removed, rfid_store_get_le32(record + 6));
+            last_slot = (int32_t)slot;
+        }
+        offset += RFID_STORE_RECORD_HEAD + name_len;
     }
-    ESP_LOGE(TAG, "Failed to take RFID mutex in get_card");
-    return ESP_FAIL; // Mutex acquisition failed
+
+    uint32_t end = (*tail != 0) ? *tail : offset;
+    while (block <= RFID_STORE_BLOCKS)
+    {
+        rfid_block_offsets[block++] = end;
+    }
+    return RFID_PORT_CRC_OK(header->data_crc, crc) ? ESP_OK : ESP_ERR_INVALID_CRC;
 }
 
+static void rfid_store_place_tail(const char *path, uint32_t tail)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL || fseek(f, (long)tail, SEEK_SET) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to reopen %s for the cards beyond slot %d.", path, RFID_MAX_CARDS);
+        if (f != NULL)
+        {
+            fclose(f);
+        }
+        return;
+    }
+
+    // The records were checked against the image CRC already and run to the end of the file
+    uint16_t next_free = 0;
+    uint8_t record[RFID_STORE_RECORD_MAX + 1];
+    while (fread(record, RFID_STORE_RECORD_HEAD, 1, f) == 1)
+    {
+        bool removed = (record[10] & RFID_STORE_RECORD_REMOVED) != 0;
+        uint8_t name_len = record[10] & ~RFID_STORE_RECORD_REMOVED;
+        if (name_len > RFID_CARD_NAME_LEN - 1 ||
+            (name_len > 0 && fread(record + RFID_STORE_RECORD_HEAD, name_len, 1, f) != 1))
+        {
+            break;
+        }
+        record[RFID_STORE_RECORD_HEAD + name_len] = '\0';
+        uint32_t card_id = rfid_store_get_le32(record);
+        uint32_t slot = (uint32_t)record[4] | ((uint32_t)record[5] << 8);
+        if (removed || card_id == 0 || rfid_index_find(card_id) >= 0)
+        {
+            continue; // A removed card is not worth a slot another card may need
+        }
 
-int testable_mean(const int *values, int count)
+        next_free = rfid_store_find_free_slot(next_free);
+        if (next_free == RFID_MAX_CARDS)
+        {
+            ESP_LOGW(TAG, "No free slot for card 0x%08lX from slot %lu, dropped.",
+                     (unsigned long)card_id, (unsigned long)slot);
+            continue;
+        }
+        if (rfid_store_put_card(next_free, card_id, (const char *)record + RFID_STORE_RECORD_HEAD,
+                                rfid_store_get_le32(record + 6)) != ESP_OK)
+        {
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static esp_err_t rfid_store_read_image(const char *path, rfid_store_header_t *header, bool load, bool *rewrite)
 {
-    if (count == 0)
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
     {
-        return 0;
+        return ESP_ERR_NOT_FOUND;
     }
-    int sum = 0;
-    for (int i = 0; i < count; ++i)
+
+    esp_err_t ret = ESP_OK;
+    uint32_t tail = 0;
+    if (fread(header, sizeof(*header), 1, f) != 1 || header->magic != RFID_STORE_MAGIC ||
+        !RFID_PORT_CRC_OK(header->header_crc, rfid_store_header_crc(header)))
     {
-        sum += values[i];
+        ret = ESP_ERR_INVALID_CRC;
     }
-    return sum / count;
+    else if (header->version == 1)
+    {
+        if (header->card_size != sizeof(rfid_card_t) || header->count == 0)
+        {
+            ret = ESP_ERR_INVALID_SIZE;
+        }
+        else if (load)
+        {
+            rfid_store_backing.kind = RFID_BACKING_SLOTS;
+            rfid_store_backing.path = path;
+            rfid_store_backing.base = sizeof(*header);
+            rfid_store_backing.slots = (header->count < RFID_MAX_CARDS) ? header->count : RFID_MAX_CARDS;
+            ret = rfid_store_read_slots_v1(f, header, rewrite);
+        }
+    }
+    else if (header->version != RFID_STORE_VERSION)
+    {
+        ret = ESP_ERR_INVALID_SIZE;
+    }
+    else if (load)
+    {
+        rfid_store_backing.kind = RFID_BACKING_RECORDS;
+        rfid_store_backing.path = path;
+        ret = rfid_store_read_records(f, header, &tail, rewrite);
+    }
+    fclose(f);
+
+    if (load && ret == ESP_OK)
+    {
+        rfid_index_sort();
+        if (tail != 0)
+        {
+            rfid_store_place_tail(path, tail);
+        }
+    }
+    return ret;
 }
 
 // --- Core API Functions ---
 
 esp_err_t rfid_manager_init(void)
 {
+    // Registration is idempotent, a reinit keeps the samples
+    rfid_metric_read_wait = app_metrics_histogram("rfid_lock_wait_us", "mode", "read");
+    rfid_metric_write_wait = app_metrics_histogram("rfid_lock_wait_us", "mode", "write");
+    rfid_metric_write_hold = app_metrics_histogram("rfid_lock_hold_us", "mode", "write");
+    rfid_metric_read_contended = app_metrics_counter("rfid_lock_contended_total", "mode", "read");
+    rfid_metric_write_contended = app_metrics_counter("rfid_lock_contended_total", "mode", "write");
+    rfid_metric_flash_write = app_metrics_histogram("flash_write_us", "file", "cards");
+    rfid_metric_flash_bytes = app_metrics_counter("flash_write_bytes_total", "file", "cards");
+    rfid_metric_filter_rejected = app_metrics_counter("rfid_filter_rejected_total", NULL, NULL);
+
     if (rfid_mutex == NULL)
     {
         rfid_mutex = xSemaphoreCreateMutex();
@@ -157,6 +2330,24 @@ esp_err_t rfid_manager_init(void)
             return ESP_FAIL;
         }
     }
+    if (rfid_readers_drained == NULL)
+    {
+        rfid_readers_drained = xSemaphoreCreateBinary();
+        if (rfid_readers_drained == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create RFID reader semaphore");
+            return ESP_FAIL;
+        }
+    }
+    if (rfid_page_mutex == NULL)
+    {
+        rfid_page_mutex = xSemaphoreCreateMutex();
+        if (rfid_page_mutex == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create RFID page cache mutex");
+            return ESP_FAIL;
+        }
+    }
     
     // Initialize the caching mechanism
     is_dirty = false;
@@ -164,35 +2355,54 @@ esp_err_t rfid_manager_init(void)
     // Create the timer if it doesn't exist
     if (rfid_write_timer == NULL)
     {
-        esp_timer_create_args_t timer_args = {
-            .callback = &rfid_cache_write_timeout_handler,
-            .name = "rfid_write_timer"
-        };
-        esp_err_t timer_ret = esp_timer_create(&timer_args, &rfid_write_timer);
+        esp_err_t timer_ret = rfid_port_timer_create(&rfid_cache_write_timeout_handler, NULL, "rfid_write_timer", &rfid_write_timer);
         if (timer_ret != ESP_OK)
         {
             ESP_LOGE(TAG, "Failed to create RFID write timer: %s", esp_err_to_name(timer_ret));
             return timer_ret;
         }
     }
+    if (rfid_seen_timer == NULL)
+    {
+        esp_err_t timer_ret = rfid_port_timer_create(&rfid_seen_timeout_handler, NULL, "rfid_seen_timer", &rfid_seen_timer);
+        if (timer_ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create RFID last-seen timer: %s", esp_err_to_name(timer_ret));
+            return timer_ret;
+        }
+    }
 
-    if (xSemaphoreTake(rfid_mutex, portMAX_DELAY) == pdTRUE)
+    if (rfid_write_lock(portMAX_DELAY))
     {
         esp_err_t ret; // Declared once at the beginning of the scope
 
         size_t total_bytes, used_bytes;
 
-        esp_err_t spiffs_ret = esp_spiffs_info(NULL, &total_bytes, &used_bytes); // Use default partition label (NULL)
+        esp_err_t spiffs_ret = rfid_port_storage_info(&total_bytes, &used_bytes);
 
         if (spiffs_ret != ESP_OK)
         {
             ESP_LOGE(TAG, "SPIFFS filesystem not found or not mounted. Please initialize SPIFFS first. Error: %s", esp_err_to_name(spiffs_ret));
-            xSemaphoreGive(rfid_mutex);
+            rfid_write_unlock();
             return ESP_ERR_INVALID_STATE; // Indicate that a required pre-condition (SPIFFS mounted) is not met.
         }
 
         ESP_LOGI(TAG, "SPIFFS filesystem found. Partition size: total: %zu, used: %zu", total_bytes, used_bytes);
 
+        ret = rfid_store_alloc();
+        if (ret != ESP_OK)
+        {
+            // Without a card table every API call would fail, so leave the manager uninitialized
+            rfid_write_unlock();
+            vSemaphoreDelete(rfid_mutex);
+            rfid_mutex = NULL;
+            vSemaphoreDelete(rfid_readers_drained);
+            rfid_readers_drained = NULL;
+            vSemaphoreDelete(rfid_page_mutex);
+            rfid_page_mutex = NULL;
+            return ret;
+        }
+
         // Attempt to load cards from file
         ret = rfid_manager_load_from_file(); // Assign to the already declared ret
 
@@ -215,7 +2425,14 @@ esp_err_t rfid_manager_init(void)
             }
         }
 
-        xSemaphoreGive(rfid_mutex);
+        rfid_write_unlock();
+
+        // The card table works without the access log, so a failure here is not fatal
+        esp_err_t log_ret = rfid_access_log_init();
+        if (log_ret != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Card access log unavailable: %s", esp_err_to_name(log_ret));
+        }
         return ret; // Return status of load_from_file or load_defaults
     }
     else
@@ -233,87 +2450,52 @@ esp_err_t rfid_manager_add_card(uint32_t card_id, const char *name)
         return ESP_FAIL;
     }
     
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE)
+    if (rfid_write_lock(pdMS_TO_TICKS(2000)))
     {
         if (name == NULL)
         {
             ESP_LOGE(TAG, "Cannot add card with NULL name.");
-            xSemaphoreGive(rfid_mutex);
+            rfid_write_unlock();
             return ESP_ERR_INVALID_ARG;
         }
 
-        // Check if card already exists by iterating through all possible slots
+        // Check if card already exists using the index.
         // A card_id is considered to exist if it's present in any slot and is not 0 (which might indicate an uninitialized slot).
         // This check prevents adding a card with an ID that is already in the system, regardless of its active status.
-        for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i)
+        int32_t existing_slot = rfid_index_find(card_id);
+        if (existing_slot >= 0)
         {
-            if (rfid_database[i].card_id == card_id && rfid_database[i].card_id != 0)
-            {
-                ESP_LOGW(TAG, "Attempt to add card 0x%08lx which already exists at slot %u (status: %s). Operation aborted.",
-                         (unsigned long)card_id, i, rfid_database[i].active ? "active" : "inactive");
-                xSemaphoreGive(rfid_mutex);
-                return ESP_ERR_INVALID_STATE; // Card ID already present in the database, operation invalid in this state
-            }
+            ESP_LOGW(TAG, "Attempt to add card 0x%08lx which already exists at slot %ld (status: %s). Operation aborted.",
+                     (unsigned long)card_id, (long)existing_slot, rfid_store_slot_active(existing_slot) ? "active" : "inactive");
+            rfid_write_unlock();
+            return ESP_ERR_INVALID_STATE; // Card ID already present in the database, operation invalid in this state
         }
 
-        // If card does not exist, try to add to the first inactive slot or at the end
-        uint16_t _index_of_first_inactive_slot = RFID_MAX_CARDS;
-
-        // First, look for an inactive slot to reuse
-        for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i)
-        {
-            // This logic assumes that card_id == 0 can mean an empty/never-used slot,
-            // if we compact the array on removal.
-            // The current design saves all RFID_MAX_CARDS slots.
-            // An inactive card would have card_id != 0 but active == 0.
-            // A truly empty slot might have card_id == 0.
-            // Let's find the first slot where card_id is 0 (never used) or active is 0 (previously removed)
-            if (rfid_database[i].card_id == 0 || rfid_database[i].active == 0)
-            {
-                _index_of_first_inactive_slot = i;
-                break;
-            }
-        }
+        // If card does not exist, try to add to the first inactive slot
+        uint16_t _index_of_first_inactive_slot = rfid_store_find_free_slot(0);
 
         if (_index_of_first_inactive_slot < RFID_MAX_CARDS)
         {
-            rfid_database[_index_of_first_inactive_slot].card_id = card_id;
-            strncpy(rfid_database[_index_of_first_inactive_slot].name, name, RFID_CARD_NAME_LEN - 1);
-            rfid_database[_index_of_first_inactive_slot].name[RFID_CARD_NAME_LEN - 1] = '\0';
-            rfid_database[_index_of_first_inactive_slot].active = 1;
             time_t now_add;
             time(&now_add);
-            rfid_database[_index_of_first_inactive_slot].timestamp = (uint32_t)now_add; // Set current timestamp
-
-            ESP_LOGI(TAG, "Added card %lu ('%s') at slot %u.", (unsigned long)card_id, name, _index_of_first_inactive_slot);         
-            
-            // Mark as dirty and start/reset the timer for delayed write
-            is_dirty = true;
-            
-            // Reset the timer if it's running
-            if (rfid_write_timer != NULL) {
-                esp_timer_stop(rfid_write_timer);
-                
-                // Only start the timer if caching is enabled (timeout > 0)
-                if (rfid_write_timeout_ms > 0) {
-                    esp_timer_start_once(rfid_write_timer, rfid_write_timeout_ms * 1000);
-                    ESP_LOGD(TAG, "Started RFID write timer for %lu ms", (unsigned long)rfid_write_timeout_ms);
-                } else {
-                    // If caching is disabled, write immediately
-                    esp_err_t save_ret = rfid_manager_write_into_memory(); // Call the new function
-                    xSemaphoreGive(rfid_mutex);
-                    return save_ret;
-                }
+            if (rfid_store_put_card(_index_of_first_inactive_slot, card_id, name, (uint32_t)now_add) != ESP_OK)
+            {
+                rfid_write_unlock();
+                return ESP_FAIL;
             }
 
-            xSemaphoreGive(rfid_mutex);
-            return ESP_OK;
+            ESP_LOGI(TAG, "Added card %lu ('%s') at slot %u.", (unsigned long)card_id, name, _index_of_first_inactive_slot);
+
+            // Mark as dirty and start/reset the timer for delayed write
+            esp_err_t save_ret = rfid_schedule_write();
+            rfid_write_unlock();
+            return save_ret;
         }
         else
         {
            // This case (_index_of_first_inactive_slot == RFID_MAX_CARDS) means all RFID_MAX_CARDS slots // have card_id != 0 AND active == 1. So, the database is truly full.
             ESP_LOGW(TAG, "RFID database is full (all %d slots active). Cannot add new card 0x%08lx.", RFID_MAX_CARDS, (unsigned long)card_id);
-            xSemaphoreGive(rfid_mutex);
+            rfid_write_unlock();
             return ESP_ERR_NO_MEM;
         }
     }
@@ -321,6 +2503,247 @@ esp_err_t rfid_manager_add_card(uint32_t card_id, const char *name)
     return ESP_FAIL;
 }
 
+esp_err_t rfid_manager_add_cards_batch(const rfid_card_t *cards, uint16_t count, uint16_t *num_cards_added)
+{
+    if (cards == NULL || num_cards_added == NULL)
+    {
+        ESP_LOGE(TAG, "add_cards_batch: Invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+    *num_cards_added = 0;
+
+    if (rfid_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "RFID mutex not initialized in add_cards_batch");
+        return ESP_FAIL;
+    }
+
+    if (!rfid_write_lock(pdMS_TO_TICKS(2000)))
+    {
+        ESP_LOGE(TAG, "Failed to take RFID mutex in add_cards_batch");
+        return ESP_FAIL;
+    }
+
+    // All or nothing, like apply_changes: every new card needs a free slot. An ID
+    // repeated within the batch is counted each time, so this only errs on the
+    // side of refusing.
+    uint32_t available = RFID_MAX_CARDS - rfid_store_active_count();
+    uint32_t needed = 0;
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        needed += cards[i].card_id != 0 && rfid_index_find(cards[i].card_id) < 0;
+    }
+    if (needed > available)
+    {
+        ESP_LOGW(TAG, "Batch of %u cards needs %lu free slots, %lu available. Nothing added.",
+                 count, (unsigned long)needed, (unsigned long)available);
+        rfid_write_unlock();
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Pin the blocks of the slots the batch fills before changing anything, so
+    // running out of memory for them cannot leave half a batch behind
+    esp_err_t ret = ESP_OK;
+    uint16_t free_slot = 0;
+    for (uint32_t i = 0; i < needed && ret == ESP_OK; ++i, ++free_slot)
+    {
+        free_slot = rfid_store_find_free_slot(free_slot);
+        if (free_slot >= RFID_MAX_CARDS)
+        {
+            break;
+        }
+        ret = rfid_store_reserve_slot(free_slot);
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Not enough memory to page in the slots for a batch of %u cards. Nothing added.", count);
+        rfid_write_unlock();
+        return ESP_ERR_NO_MEM;
+    }
+
+    time_t now_add;
+    time(&now_add);
+
+    // Slots below free_slot are known to be taken, so the whole batch costs a
+    // single pass over the table
+    free_slot = 0;
+    uint16_t skipped = 0;
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        if (cards[i].card_id == 0 || rfid_index_find(cards[i].card_id) >= 0)
+        {
+            skipped++; // Same rule as add_card: an ID already present is never re-added
+            continue;
+        }
+
+        free_slot = rfid_store_find_free_slot(free_slot);
+        if (free_slot >= RFID_MAX_CARDS)
+        {
+            break; // Not reached, the slots were counted above
+        }
+
+        ret = rfid_store_put_card(free_slot, cards[i].card_id, cards[i].name,
+                                  cards[i].timestamp != 0 ? cards[i].timestamp : (uint32_t)now_add);
+        if (ret != ESP_OK)
+        {
+            break; // Not reached, the slots were paged in above
+        }
+        (*num_cards_added)++;
+    }
+
+    ESP_LOGI(TAG, "Batch add: %u added, %u skipped as duplicates or invalid.", *num_cards_added, skipped);
+
+    if (*num_cards_added > 0)
+    {
+        esp_err_t write_ret = rfid_schedule_write();
+        ret = (ret == ESP_OK) ? write_ret : ret;
+    }
+
+    rfid_write_unlock();
+    return ret;
+}
+
+esp_err_t rfid_manager_apply_changes(const rfid_card_change_t *changes, uint16_t count)
+{
+    if (changes == NULL && count > 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        if (changes[i].card_id == 0)
+        {
+            ESP_LOGE(TAG, "apply_changes: card_id 0 in change %u", i);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (rfid_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "RFID mutex not initialized in apply_changes");
+        return ESP_FAIL;
+    }
+    if (!rfid_write_lock(pdMS_TO_TICKS(2000)))
+    {
+        ESP_LOGE(TAG, "Failed to take RFID mutex in apply_changes");
+        return ESP_FAIL;
+    }
+
+    // All or nothing: count the slots the additions take against the free ones
+    // first. Removals free their slot; an addition of a card that is inactive by
+    // then reuses its own slot, any other new card takes a free one.
+    uint32_t available = RFID_MAX_CARDS - rfid_store_active_count();
+    uint32_t needed = 0;
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        int32_t slot = rfid_index_find(changes[i].card_id);
+        bool active = slot >= 0 && rfid_store_slot_active(slot);
+        if (changes[i].remove)
+        {
+            available += active;
+            continue;
+        }
+        bool removed_here = false;
+        for (uint16_t j = 0; j < count && active && !removed_here; ++j)
+        {
+            removed_here = changes[j].remove && changes[j].card_id == changes[i].card_id;
+        }
+        needed += !active || removed_here;
+    }
+    if (needed > available)
+    {
+        ESP_LOGW(TAG, "Card changes need %lu free slots, %lu available. Nothing applied.",
+                 (unsigned long)needed, (unsigned long)available);
+        rfid_write_unlock();
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Pin every block the changes may write before making any: the slots of the
+    // listed cards, and the free slots new cards take (a removed card's slot may
+    // be taken instead, it is pinned already)
+    esp_err_t ret = ESP_OK;
+    for (uint16_t i = 0; i < count && ret == ESP_OK; ++i)
+    {
+        int32_t slot = rfid_index_find(changes[i].card_id);
+        if (slot >= 0)
+        {
+            ret = rfid_store_reserve_slot(slot);
+        }
+    }
+    uint16_t free_slot = 0;
+    for (uint32_t i = 0; i < needed && ret == ESP_OK; ++i, ++free_slot)
+    {
+        free_slot = rfid_store_find_free_slot(free_slot);
+        if (free_slot >= RFID_MAX_CARDS)
+        {
+            break;
+        }
+        ret = rfid_store_reserve_slot(free_slot);
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Not enough memory to page in the slots of %u card changes. Nothing applied.", count);
+        rfid_write_unlock();
+        return ESP_ERR_NO_MEM;
+    }
+
+    time_t now_add;
+    time(&now_add);
+    uint16_t removed = 0, added = 0, updated = 0;
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        int32_t slot = rfid_index_find(changes[i].card_id);
+        if (changes[i].remove && slot >= 0 && rfid_store_slot_active(slot))
+        {
+            rfid_store_set_active(slot, false); // Stays indexed, like rfid_manager_remove_card()
+            rfid_store_mark_dirty(slot);
+            rfid_filter_remove(changes[i].card_id);
+            removed++;
+        }
+    }
+    free_slot = 0;
+    for (uint16_t i = 0; i < count && ret == ESP_OK; ++i)
+    {
+        if (changes[i].remove)
+        {
+            continue;
+        }
+        int32_t slot = rfid_index_find(changes[i].card_id);
+        if (slot >= 0 && rfid_store_slot_active(slot))
+        {
+            rfid_card_t current;
+            ret = rfid_store_get_slot(slot, &current);
+            if (ret == ESP_OK && strncmp(current.name, changes[i].name, RFID_CARD_NAME_LEN - 1) != 0)
+            {
+                rfid_page_slot_t *entry = rfid_store_edit_slot(slot); // Pinned above, cannot fail
+                strncpy(entry->name, changes[i].name, RFID_CARD_NAME_LEN - 1);
+                entry->name[RFID_CARD_NAME_LEN - 1] = '\0';
+                updated++;
+            }
+            continue;
+        }
+        if (slot < 0)
+        {
+            free_slot = rfid_store_find_free_slot(free_slot);
+            if (free_slot >= RFID_MAX_CARDS)
+            {
+                break; // Not reached, the slots were counted above
+            }
+            slot = free_slot;
+        }
+        ret = rfid_store_put_card(slot, changes[i].card_id, changes[i].name, (uint32_t)now_add);
+        added += ret == ESP_OK;
+    }
+
+    ESP_LOGI(TAG, "Applied card changes: %u added, %u updated, %u removed.", added, updated, removed);
+    if (added + updated + removed > 0)
+    {
+        esp_err_t write_ret = rfid_schedule_write();
+        ret = (ret == ESP_OK) ? write_ret : ret;
+    }
+    rfid_write_unlock();
+    return ret;
+}
+
 esp_err_t rfid_manager_remove_card(uint32_t card_id)
 {
     // Check if mutex is initialized
@@ -329,44 +2752,26 @@ esp_err_t rfid_manager_remove_card(uint32_t card_id)
         return ESP_FAIL;
     }
     
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE)
+    if (rfid_write_lock(pdMS_TO_TICKS(2000)))
     {
-        for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i)
-        { // Iterate all possible slots
-            if (rfid_database[i].card_id == card_id && rfid_database[i].active)
-            {
-                rfid_database[i].active = 0; // Mark as inactive
-                // Optionally clear name and timestamp
-                // memset(rfid_database[i].name, 0, RFID_CARD_NAME_LEN);
-                // rfid_database[i].timestamp = 0;
-
-                ESP_LOGI(TAG, "Removed card %lu.", (unsigned long)card_id);
-                
-                // Mark as dirty and start/reset the timer for delayed write
-                is_dirty = true;
-                
-                // Reset the timer if it's running
-                if (rfid_write_timer != NULL) {
-                    esp_timer_stop(rfid_write_timer);
-                    
-                    // Only start the timer if caching is enabled (timeout > 0)
-                    if (rfid_write_timeout_ms > 0) {
-                        esp_timer_start_once(rfid_write_timer, rfid_write_timeout_ms * 1000);
-                        ESP_LOGD(TAG, "Started RFID write timer for %lu ms", (unsigned long)rfid_write_timeout_ms);
-                    } else {
-                    // If caching is disabled, write immediately
-                    esp_err_t save_ret = rfid_manager_write_into_memory();
-                    xSemaphoreGive(rfid_mutex);
-                    return save_ret;
-                    }
-                }
-                
-                xSemaphoreGive(rfid_mutex);
-                return ESP_OK;
-            }
+        int32_t i = rfid_index_find(card_id);
+        if (i >= 0 && rfid_store_slot_active(i))
+        {
+            // Mark as inactive (stays indexed, see add_card). The paged part of the
+            // slot is unchanged, so its block need not be in RAM.
+            rfid_store_set_active(i, false);
+            rfid_store_mark_dirty(i);
+            rfid_filter_remove(card_id);
+
+            ESP_LOGI(TAG, "Removed card %lu.", (unsigned long)card_id);
+
+            // Mark as dirty and start/reset the timer for delayed write
+            esp_err_t save_ret = rfid_schedule_write();
+            rfid_write_unlock();
+            return save_ret;
         }
         ESP_LOGW(TAG, "Card 0x%08lx not found or already inactive.", (unsigned long)card_id);
-        xSemaphoreGive(rfid_mutex);
+        rfid_write_unlock();
         return ESP_ERR_NOT_FOUND;
     }
     ESP_LOGE(TAG, "Failed to take RFID mutex in remove_card");
@@ -374,34 +2779,49 @@ esp_err_t rfid_manager_remove_card(uint32_t card_id)
 }
 
 bool rfid_manager_check_card(uint32_t card_id)
+{
+    return rfid_manager_check_card_at(card_id, RFID_READER_ID_API);
+}
+
+bool rfid_manager_check_card_at(uint32_t card_id, uint8_t reader_id)
 {
     // Check if mutex is initialized
     if (rfid_mutex == NULL) {
         ESP_LOGE(TAG, "RFID mutex not initialized in check_card, returning false");
         return false;
     }
-    
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE)
+
+    // Unknown and removed cards are turned away here without waiting for the lock
+    if (rfid_filter_rejects(card_id))
     {
-        for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i)
-        { // Iterate all slots
-            if (rfid_database[i].card_id == card_id && rfid_database[i].active)
-            {
-                // Update timestamp on successful check
-                time_t now;
-                time(&now);
-                rfid_database[i].timestamp = (uint32_t)now;
-                ESP_LOGI(TAG, "Card %lu checked successfully. Timestamp updated to %lu.", (unsigned long)card_id, (unsigned long)rfid_database[i].timestamp);
-
-               // NOTE: Removed rfid_manager_save_to_file() here to reduce flash wear and improve performance.
-                // The timestamp update will only be in RAM until the next explicit save operation (e.g., add/remove card).
-                // If persistent timestamps on every check are critical, a different strategy is needed.
-
-                xSemaphoreGive(rfid_mutex);
-                return true;
-            }
+        app_metrics_count(rfid_metric_filter_rejected, 1);
+        rfid_access_log_record(card_id, false, reader_id);
+        return false;
+    }
+    
+    if (rfid_read_lock(pdMS_TO_TICKS(2000)))
+    {
+        int32_t i = rfid_index_find(card_id);
+        if (i >= 0 && rfid_store_slot_active(i))
+        {
+            // Update timestamp on successful check. Only the read lock is held; a single
+            // aligned 32-bit store is atomic, so concurrent checks of the same card are safe.
+            // Everything here is resident, a check never waits for a block read.
+            time_t now;
+            time(&now);
+            __atomic_store_n(&rfid_slot_timestamps[i], (uint32_t)now, __ATOMIC_RELAXED);
+            rfid_store_mark_seen(i); // Written back by rfid_seen_timer or with the next save
+            rfid_read_unlock();
+            rfid_access_log_record(card_id, true, reader_id);
+
+            ESP_LOGD(TAG, "Card %lu checked successfully. Timestamp updated to %lu.", (unsigned long)card_id, (unsigned long)now);
+
+            // No flash write here: the timestamps of all cards seen in an interval are
+            // appended to the journal together, see rfid_manager_set_last_seen_interval().
+            return true;
         }
-        xSemaphoreGive(rfid_mutex);
+        rfid_read_unlock();
+        rfid_access_log_record(card_id, false, reader_id);
         return false;
     }
     ESP_LOGE(TAG, "Failed to take RFID mutex in check_card");
@@ -419,17 +2839,11 @@ uint16_t rfid_manager_get_card_count(void)
         return 0;
     }
     
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE)
+    if (rfid_read_lock(pdMS_TO_TICKS(2000)))
     {
         // Recalculate on demand to ensure accuracy
-        for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i)
-        {
-            if (rfid_database[i].active && rfid_database[i].card_id != 0)
-            {
-                active_count++;
-            }
-        }
-        xSemaphoreGive(rfid_mutex);
+        active_count = rfid_store_active_count();
+        rfid_read_unlock();
     }
     else
     {
@@ -455,20 +2869,20 @@ esp_err_t rfid_manager_list_cards(rfid_card_t *cards_buffer, uint16_t buffer_siz
         return ESP_FAIL;
     }
     
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE)
+    if (rfid_read_lock(pdMS_TO_TICKS(2000)))
     {
         uint16_t active_cards_found = 0;
-        for (uint16_t i = 0; i < RFID_MAX_CARDS && active_cards_found < buffer_size; ++i)
+        for (uint16_t i = 0; i < RFID_MAX_CARDS && active_cards_found < buffer_size && ret == ESP_OK; ++i)
         {
-            if (rfid_database[i].active && rfid_database[i].card_id != 0)
+            if (rfid_store_slot_active(i))
             {
-                cards_buffer[active_cards_found] = rfid_database[i];
-                active_cards_found++;
+                ret = rfid_store_get_slot(i, &cards_buffer[active_cards_found]);
+                active_cards_found += ret == ESP_OK;
             }
         }
         *num_cards_copied = active_cards_found;
         // Give back the mutex
-        xSemaphoreGive(rfid_mutex);
+        rfid_read_unlock();
         ESP_LOGD(TAG, "Listed %u cards", active_cards_found);
     }
     else
@@ -480,6 +2894,175 @@ esp_err_t rfid_manager_list_cards(rfid_card_t *cards_buffer, uint16_t buffer_siz
     return ret;
 }
 
+/**
+ * @brief Returns true if an active card passes the given filter.
+ */
+static bool rfid_card_matches(const rfid_card_t *card, const rfid_card_filter_t *filter)
+{
+    if (!card->active)
+    {
+        return false;
+    }
+    if (card->timestamp < filter->since_ts)
+    {
+        return false;
+    }
+    size_t prefix_len = strnlen(filter->name_prefix, RFID_CARD_NAME_LEN);
+    return prefix_len == 0 || strncasecmp(card->name, filter->name_prefix, prefix_len) == 0;
+}
+
+/**
+ * @brief Moves an iterator forward over up to max_cards matching cards.
+ *
+ * Copies them to cards_buffer unless it is NULL. Must be called with the read
+ * or write lock held.
+ *
+ * @param passed Set to the number of matching cards passed.
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if a card's block cannot be read
+ *         (the iterator stops before that card).
+ */
+static esp_err_t rfid_card_iter_advance(rfid_card_iter_t *iter, rfid_card_t *cards_buffer, uint32_t max_cards, uint32_t *passed)
+{
+    // The cursor is a card_id rather than a position, so it stays valid across
+    // index inserts and erases between batches
+    esp_err_t ret = ESP_OK;
+    *passed = 0;
+    uint16_t pos = rfid_index_lower_bound(iter->next_card_id);
+    for (; pos < rfid_index_count && *passed < max_cards; ++pos)
+    {
+        // The resident fields go first, so only candidates have their block paged in
+        uint16_t slot = rfid_index[pos].slot;
+        if (!rfid_store_slot_active(slot) ||
+            __atomic_load_n(&rfid_slot_timestamps[slot], __ATOMIC_RELAXED) < iter->filter.since_ts)
+        {
+            continue;
+        }
+        if (cards_buffer == NULL && iter->filter.name_prefix[0] == '\0')
+        {
+            (*passed)++;
+            continue;
+        }
+        rfid_card_t card;
+        ret = rfid_store_get_slot(slot, &card);
+        if (ret != ESP_OK)
+        {
+            break;
+        }
+        if (rfid_card_matches(&card, &iter->filter))
+        {
+            if (cards_buffer != NULL)
+            {
+                cards_buffer[*passed] = card;
+            }
+            (*passed)++;
+        }
+    }
+
+    if (pos >= rfid_index_count)
+    {
+        iter->done = true;
+    }
+    else
+    {
+        // More cards remain, and rfid_index[pos].card_id > every card passed so far
+        iter->next_card_id = rfid_index[pos].card_id;
+    }
+    return ret;
+}
+
+void rfid_manager_card_iter_init(rfid_card_iter_t *iter)
+{
+    rfid_manager_card_iter_init_filtered(iter, NULL);
+}
+
+void rfid_manager_card_iter_init_filtered(rfid_card_iter_t *iter, const rfid_card_filter_t *filter)
+{
+    if (iter != NULL)
+    {
+        iter->next_card_id = 1; // card_id 0 marks an unused slot
+        iter->done = false;
+        memset(&iter->filter, 0, sizeof(iter->filter));
+        if (filter != NULL)
+        {
+            iter->filter = *filter;
+            iter->filter.name_prefix[RFID_CARD_NAME_LEN - 1] = '\0';
+        }
+    }
+}
+
+esp_err_t rfid_manager_card_iter_next(rfid_card_iter_t *iter, rfid_card_t *cards_buffer, uint16_t buffer_size, uint16_t *num_cards_copied)
+{
+    if (iter == NULL || cards_buffer == NULL || num_cards_copied == NULL || buffer_size == 0)
+    {
+        ESP_LOGE(TAG, "card_iter_next: Invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+    *num_cards_copied = 0;
+    if (iter->done)
+    {
+        return ESP_OK;
+    }
+
+    if (rfid_mutex == NULL) {
+        ESP_LOGE(TAG, "RFID mutex not initialized in card_iter_next");
+        return ESP_FAIL;
+    }
+
+    if (!rfid_read_lock(pdMS_TO_TICKS(2000)))
+    {
+        ESP_LOGE(TAG, "Failed to take RFID mutex in card_iter_next");
+        return ESP_FAIL;
+    }
+    uint32_t copied = 0;
+    esp_err_t ret = rfid_card_iter_advance(iter, cards_buffer, buffer_size, &copied);
+    *num_cards_copied = (uint16_t)copied;
+    rfid_read_unlock();
+
+    return ret;
+}
+
+esp_err_t rfid_manager_card_iter_skip(rfid_card_iter_t *iter, uint32_t count, uint32_t *num_cards_skipped)
+{
+    if (iter == NULL)
+    {
+        ESP_LOGE(TAG, "card_iter_skip: Invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t skipped = 0;
+    esp_err_t ret = ESP_OK;
+    if (!iter->done && count > 0)
+    {
+        if (rfid_mutex == NULL) {
+            ESP_LOGE(TAG, "RFID mutex not initialized in card_iter_skip");
+            return ESP_FAIL;
+        }
+        if (!rfid_read_lock(pdMS_TO_TICKS(2000)))
+        {
+            ESP_LOGE(TAG, "Failed to take RFID mutex in card_iter_skip");
+            return ESP_FAIL;
+        }
+        ret = rfid_card_iter_advance(iter, NULL, count, &skipped);
+        rfid_read_unlock();
+    }
+    if (num_cards_skipped != NULL)
+    {
+        *num_cards_skipped = skipped;
+    }
+    return ret;
+}
+
+esp_err_t rfid_manager_count_cards(const rfid_card_filter_t *filter, uint32_t *count)
+{
+    if (count == NULL)
+    {
+        ESP_LOGE(TAG, "count_cards: Invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+    rfid_card_iter_t iter;
+    rfid_manager_card_iter_init_filtered(&iter, filter);
+    return rfid_manager_card_iter_skip(&iter, UINT32_MAX, count);
+}
+
 esp_err_t rfid_manager_format_database(void)
 {
     esp_err_t ret = ESP_FAIL;
@@ -490,57 +3073,41 @@ esp_err_t rfid_manager_format_database(void)
         return ESP_FAIL;
     }
     
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(5000)) == pdTRUE) // Longer timeout for format
+    if (rfid_write_lock(pdMS_TO_TICKS(5000))) // Longer timeout for format
     {
         ESP_LOGW(TAG, "Formatting RFID database. All existing cards will be erased and defaults loaded.");
         
-        // Clear the database in memory first
-        memset(rfid_database, 0, sizeof(rfid_database));
+        // Clear the database in memory first, blocks are no longer read from the old image
+        rfid_store_reset();
         
         // Copy default cards directly (don't call another function that might take the mutex)
         uint16_t index = 0;
-        for (uint16_t i = 0; i < num_default_cards && index < RFID_MAX_CARDS; ++i, ++index)
+        if (rfid_store_put_defaults(&index) != ESP_OK)
         {
-            rfid_database[index] = default_cards[i]; // Copy default card
-            rfid_database[index].name[RFID_CARD_NAME_LEN - 1] = '\0'; // Ensure null-termination
+            ESP_LOGE(TAG, "Failed to store the default cards during format");
+            rfid_write_unlock();
+            return ESP_FAIL;
         }
         
         // Format is a special operation that always writes immediately to disk
         // Reset any pending cache operation
         if (rfid_write_timer != NULL) {
-            esp_timer_stop(rfid_write_timer);
+            rfid_port_timer_stop(rfid_write_timer);
         }
         is_dirty = false;
         
-        // Save to file directly
-        FILE *f = fopen(RFID_DATABASE_FILE, "wb");
-        if (f == NULL)
-        {
-            ESP_LOGE(TAG, "Failed to open RFID database file for writing during format");
-            xSemaphoreGive(rfid_mutex);
-            return ESP_FAIL;
-        }
-        
-        size_t cards_written = fwrite(rfid_database, sizeof(rfid_card_t), RFID_MAX_CARDS, f);
-        if (cards_written != RFID_MAX_CARDS)
-        {
-            ESP_LOGE(TAG, "Failed to write all RFID card data during format. Wrote %d of %d.", 
-                    cards_written, RFID_MAX_CARDS);
-            fclose(f);
-            xSemaphoreGive(rfid_mutex);
-            return ESP_FAIL;
-        }
-        
-        if (fclose(f) != 0)
+        // Save to file directly, rewriting every block
+        rfid_store_needs_rewrite = true;
+        if (rfid_store_save() != ESP_OK)
         {
-            ESP_LOGE(TAG, "Failed to close RFID database file after format.");
-            xSemaphoreGive(rfid_mutex);
+            ESP_LOGE(TAG, "Failed to write RFID database file during format");
+            rfid_write_unlock();
             return ESP_FAIL;
         }
         
         ESP_LOGI(TAG, "%d default cards loaded and saved during format.", index);
         ret = ESP_OK;
-        xSemaphoreGive(rfid_mutex);
+        rfid_write_unlock();
     }
     else
     {
@@ -552,7 +3119,7 @@ esp_err_t rfid_manager_format_database(void)
 esp_err_t rfid_manager_get_card_list_json(char *buffer, size_t bufferMaxLength)
 {
     esp_err_t ret = ESP_OK;
-    uint16_t _length = 0;
+    size_t _length = 0;
     bool isComma = false;
 
     // validate the params
@@ -570,9 +3137,8 @@ esp_err_t rfid_manager_get_card_list_json(char *buffer, size_t bufferMaxLength)
         return ESP_FAIL;
     }
 
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(500)) == pdTRUE) // Longer timeout for format
+    if (rfid_read_lock(pdMS_TO_TICKS(500))) // Longer timeout for format
     {
-        ESP_LOGI(TAG, "Getting the Lock");
 
         // clear the buffer
         memset(buffer, 0, bufferMaxLength);
@@ -581,39 +3147,50 @@ esp_err_t rfid_manager_get_card_list_json(char *buffer, size_t bufferMaxLength)
         _length = snprintf(buffer, bufferMaxLength, "{\"cards\":[");
 
         // loop over all possible card slots and add active ones to the JSON string
-        for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i) // Iterate up to RFID_MAX_CARDS
+        for (uint16_t i = 0; i < RFID_MAX_CARDS && ret == ESP_OK; ++i) // Iterate up to RFID_MAX_CARDS
         {
-            // only do for active cards that have a valid card_id
-            if (rfid_database[i].active && rfid_database[i].card_id != 0)
+            // only do for active cards
+            rfid_card_t card;
+            if (rfid_store_slot_active(i) && (ret = rfid_store_get_slot(i, &card)) == ESP_OK)
             {
-                if (_length + 80U >= bufferMaxLength)
+                int written = snprintf(buffer + _length, bufferMaxLength - _length,
+                                       "%s{\"id\":\"0x%lX\",\"nm\":\"%s\",\"ts\":%lu}",
+                                       isComma ? "," : "", (unsigned long)card.card_id,
+                                       card.name, (unsigned long)card.timestamp);
+                // A truncated entry would leave half an object in the buffer
+                if (written < 0 || (size_t)written >= bufferMaxLength - _length)
                 {
-                    ESP_LOGE(TAG, "Buffer too small for the JSON string");
-                    xSemaphoreGive(rfid_mutex);
-                    return ESP_FAIL;
+                    ret = ESP_FAIL;
+                }
+                else
+                {
+                    _length += (size_t)written;
                 }
-
-                _length += snprintf(buffer + _length, bufferMaxLength - _length,
-                                    "%s{\"id\":\"0x%lX\",\"nm\":\"%s\",\"ts\":%lu}",
-                                    isComma ? "," : "", rfid_database[i].card_id, rfid_database[i].name, rfid_database[i].timestamp);
 
                 isComma = true;//whenever a new item is printed a comma is palced i.e obj, obj, ...
-                // debug print statement
-                ESP_LOGI(TAG, "Adding Card %d to JSON", i + 1);
             }
         }
 
         // Add the closing bracket and null terminator to complete the JSON string
-        if (_length + 3U >= bufferMaxLength)
+        if (ret == ESP_OK)
         {
-            ESP_LOGE(TAG, "Buffer too small for the JSON string");
-            xSemaphoreGive(rfid_mutex);
-            return ESP_FAIL;
+            int written = snprintf(buffer + _length, bufferMaxLength - _length, "]}");
+            if (written < 0 || (size_t)written >= bufferMaxLength - _length)
+            {
+                ret = ESP_FAIL;
+            }
         }
 
-        _length += snprintf(buffer + _length, bufferMaxLength - _length, "]}");
-
-        xSemaphoreGive(rfid_mutex);
+        rfid_read_unlock();
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Buffer too small for the JSON string, or a card could not be read");
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to take RFID mutex in get_card_list_json");
+        ret = ESP_FAIL;
     }
     /*whenever you're gonna call this function and pass the buffer pointer and length,
      you're gonna get back the complete Jason string which is ready to send.*/
@@ -621,20 +3198,30 @@ esp_err_t rfid_manager_get_card_list_json(char *buffer, size_t bufferMaxLength)
     return ret;
 }
 
+static esp_err_t rfid_store_put_defaults(uint16_t *count)
+{
+    esp_err_t ret = ESP_OK;
+    *count = 0;
+    for (uint16_t i = 0; i < num_default_cards && *count < RFID_MAX_CARDS && ret == ESP_OK; ++i)
+    {
+        ret = rfid_store_put_card(*count, default_cards[i].card_id, default_cards[i].name, default_cards[i].timestamp);
+        *count += ret == ESP_OK;
+    }
+    return ret;
+}
+
 static esp_err_t rfid_manager_load_defaults(void)
 {
     ESP_LOGI(TAG, "Loading default RFID cards...");
-    memset(rfid_database, 0, sizeof(rfid_database)); // Clear existing in-memory db
+    rfid_store_reset(); // Clear existing in-memory db
     uint16_t index = 0;
 
-    for (uint16_t i = 0; i < num_default_cards && index < RFID_MAX_CARDS; ++i, ++index)
+    esp_err_t ret = rfid_store_put_defaults(&index);
+    rfid_store_needs_rewrite = true;
+    if (ret == ESP_OK)
     {
-        rfid_database[index] = default_cards[i]; // Copy default card
-        // Ensure name is null-terminated if it's shorter than RFID_CARD_NAME_LEN
-        rfid_database[index].name[RFID_CARD_NAME_LEN - 1] = '\0';
+        ret = rfid_manager_save_to_file();
     }
-
-    esp_err_t ret = rfid_manager_save_to_file();
     if (ret == ESP_OK)
     {
         ESP_LOGI(TAG, "%d default cards loaded and saved.", index);
@@ -649,61 +3236,15 @@ static esp_err_t rfid_manager_load_defaults(void)
 
 static esp_err_t rfid_manager_save_to_file(void)
 {
-    bool mutex_taken_locally = false;
-    
     // Check if mutex is valid first
     if (rfid_mutex == NULL) {
         ESP_LOGE(TAG, "RFID mutex not initialized in save_to_file");
         return ESP_FAIL;
     }
-    
-    // Only take the mutex if not already held by this task
-    if (xSemaphoreTakeRecursive(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE)
-    {
-        mutex_taken_locally = true;
-    }
-    else
-    {
-        // If we can't get the mutex, it's either held by another task or there's a timeout
-        ESP_LOGE(TAG, "Failed to take RFID mutex in save_to_file");
-        return ESP_FAIL;
-    }
-    
-    FILE *f = fopen(RFID_DATABASE_FILE, "wb"); // Open for writing in binary mode
-    if (f == NULL)
-    {
-        ESP_LOGE(TAG, "Failed to open RFID database file for writing: %s", RFID_DATABASE_FILE);
-        if (mutex_taken_locally) {
-            xSemaphoreGive(rfid_mutex);
-        }
-        return ESP_FAIL;
-    }
-
-    // Write card data (all RFID_MAX_CARDS slots)
-    size_t cards_written = fwrite(rfid_database, sizeof(rfid_card_t), RFID_MAX_CARDS, f);
-    if (cards_written != RFID_MAX_CARDS)
-    {
-        ESP_LOGE(TAG, "Failed to write all RFID card data to file. Wrote %d of %d.", cards_written, RFID_MAX_CARDS);
-        fclose(f);
-        if (mutex_taken_locally) {
-            xSemaphoreGive(rfid_mutex);
-        }
-        return ESP_FAIL;
-    }
-
-    if (fclose(f) != 0)
-    {
-        ESP_LOGE(TAG, "Failed to close RFID database file after writing.");
-        if (mutex_taken_locally) {
-            xSemaphoreGive(rfid_mutex);
-        }
-        return ESP_FAIL;
-    }
 
-    if (mutex_taken_locally) {
-        xSemaphoreGive(rfid_mutex);
-    }
-    return ESP_OK;
+    // Journal only the slots that changed since the last save.
+    // Every caller already holds the write lock.
+    return rfid_store_save();
 }
 
 /**
@@ -715,17 +3256,30 @@ static esp_err_t rfid_manager_save_to_file(void)
  * 
  * @param arg Timer argument (unused)
  */
+static void rfid_seen_timeout_handler(void* arg)
+{
+    is_seen_due = true;
+    if (rfid_work_cb != NULL)
+    {
+        rfid_work_cb();
+    }
+}
+
 static void rfid_cache_write_timeout_handler(void* arg)
 {
     ESP_LOGI(TAG, "RFID write timer expired. Setting is_ready_to_write flag.");
     is_ready_to_write = true;
+    if (rfid_work_cb != NULL)
+    {
+        rfid_work_cb();
+    }
 }
 
 /**
  * @brief Internal function to perform the actual write of cached RFID data to NVS.
  * 
  * This function is called by rfid_manager_process() or directly when caching is disabled.
- * It handles mutex acquisition and error logging for the NVS write operation.
+ * The caller must hold the write lock.
  * 
  * @return esp_err_t ESP_OK on success, or an error code on failure.
  */
@@ -734,29 +3288,19 @@ static esp_err_t rfid_manager_write_into_memory(void)
     esp_err_t write_into_mem_ret = ESP_OK;
 
     ESP_LOGI(TAG, "Attempting to write cached RFID data to NVS.");
-    // Attempt to take the mutex before accessing shared resources
-    // Use xSemaphoreTakeRecursive as this function might be called from contexts
-    // that already hold the mutex (e.g., add_card, remove_card).
-    if (rfid_mutex != NULL && xSemaphoreTakeRecursive(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE) { // Use a reasonable timeout
-        if (is_dirty) {
-            ESP_LOGI(TAG, "is_dirty is true, writing cached RFID data to NVS...");
-            esp_err_t err = rfid_manager_save_to_file();
-            if (err == ESP_OK) {
-                is_dirty = false;
-                ESP_LOGI(TAG, "Successfully wrote RFID data to NVS.");
-            } else {
-                ESP_LOGE(TAG, "Failed to write RFID data to NVS from timer: %s", esp_err_to_name(err));
-                // Consider: What to do if save fails? Retry? For now, is_dirty remains true.
-                write_into_mem_ret = ESP_FAIL;
-            }
+    if (is_dirty) {
+        ESP_LOGI(TAG, "is_dirty is true, writing cached RFID data to NVS...");
+        esp_err_t err = rfid_manager_save_to_file();
+        if (err == ESP_OK) {
+            is_dirty = false;
+            ESP_LOGI(TAG, "Successfully wrote RFID data to NVS.");
         } else {
-            ESP_LOGI(TAG, "is_dirty is false, no NVS write needed from timer.");
+            ESP_LOGE(TAG, "Failed to write RFID data to NVS from timer: %s", esp_err_to_name(err));
+            // Consider: What to do if save fails? Retry? For now, is_dirty remains true.
+            write_into_mem_ret = ESP_FAIL;
         }
-        xSemaphoreGiveRecursive(rfid_mutex); // Use GiveRecursive to match TakeRecursive
     } else {
-        ESP_LOGE(TAG, "Failed to take RFID mutex for NVS write. NVS write deferred.");
-        // If this happens, data remains dirty and will attempt to save on next timer expiry or deinit.
-        write_into_mem_ret = ESP_FAIL;
+        ESP_LOGI(TAG, "is_dirty is false, no NVS write needed from timer.");
     }
 
     return write_into_mem_ret;
@@ -772,14 +3316,14 @@ esp_err_t rfid_manager_set_cache_timeout(uint32_t timeout_ms)
         return ESP_FAIL;
     }
     
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
+    if (rfid_write_lock(pdMS_TO_TICKS(1000))) {
         // If decreasing timeout and we have pending changes, 
         // adjust the current timer if it's running
         if (timeout_ms < rfid_write_timeout_ms && is_dirty && rfid_write_timer != NULL) {
-            esp_timer_stop(rfid_write_timer);
+            rfid_port_timer_stop(rfid_write_timer);
             if (timeout_ms > 0) {
                 // Start with new timeout
-                esp_timer_start_once(rfid_write_timer, timeout_ms * 1000);
+                rfid_port_timer_start_once(rfid_write_timer, timeout_ms * 1000);
             } else {
                 // If setting timeout to 0, write immediately
                 rfid_manager_save_to_file();
@@ -791,7 +3335,7 @@ esp_err_t rfid_manager_set_cache_timeout(uint32_t timeout_ms)
         rfid_write_timeout_ms = timeout_ms;
         ESP_LOGI(TAG, "RFID cache timeout set to %lu ms", (unsigned long)timeout_ms);
         
-        xSemaphoreGive(rfid_mutex);
+        rfid_write_unlock();
         return ESP_OK;
     }
     
@@ -799,6 +3343,29 @@ esp_err_t rfid_manager_set_cache_timeout(uint32_t timeout_ms)
     return ESP_FAIL;
 }
 
+esp_err_t rfid_manager_set_last_seen_interval(uint32_t interval_ms)
+{
+    if (rfid_mutex == NULL || rfid_seen_timer == NULL) {
+        ESP_LOGE(TAG, "RFID manager not initialized in set_last_seen_interval");
+        return ESP_FAIL;
+    }
+
+    if (rfid_write_lock(pdMS_TO_TICKS(1000))) {
+        rfid_seen_interval_ms = interval_ms;
+        // Re-arm for the new interval if timestamps are waiting
+        rfid_port_timer_stop(rfid_seen_timer);
+        if (rfid_seen_pending && interval_ms > 0) {
+            rfid_port_timer_start_once(rfid_seen_timer, (uint64_t)interval_ms * 1000);
+        }
+        ESP_LOGI(TAG, "RFID last-seen write interval set to %lu ms", (unsigned long)interval_ms);
+        rfid_write_unlock();
+        return ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "Failed to take RFID mutex in set_last_seen_interval");
+    return ESP_FAIL;
+}
+
 /**
  * Force an immediate write of any cached changes.
  */
@@ -809,14 +3376,14 @@ esp_err_t rfid_manager_flush_cache(void)
         return ESP_FAIL;
     }
     
-    if (xSemaphoreTake(rfid_mutex, pdMS_TO_TICKS(2000)) == pdTRUE) {
+    if (rfid_write_lock(pdMS_TO_TICKS(2000))) {
         // Stop any pending timer
         if (rfid_write_timer != NULL) {
-            esp_timer_stop(rfid_write_timer);
+            rfid_port_timer_stop(rfid_write_timer);
         }
         
         // Only write if there are pending changes
-        if (is_dirty) {
+        if (is_dirty || rfid_seen_pending) {
             ESP_LOGI(TAG, "Flushing RFID cache to flash");
             esp_err_t err = rfid_manager_save_to_file();
             if (err == ESP_OK) {
@@ -824,14 +3391,14 @@ esp_err_t rfid_manager_flush_cache(void)
                 ESP_LOGI(TAG, "RFID cache successfully flushed to flash");
             } else {
                 ESP_LOGE(TAG, "Failed to flush RFID cache to flash: %s", esp_err_to_name(err));
-                xSemaphoreGive(rfid_mutex);
+                rfid_write_unlock();
                 return err;
             }
         } else {
             ESP_LOGD(TAG, "No pending changes to flush to flash");
         }
         
-        xSemaphoreGive(rfid_mutex);
+        rfid_write_unlock();
         return ESP_OK;
     }
     
@@ -839,51 +3406,129 @@ esp_err_t rfid_manager_flush_cache(void)
     return ESP_FAIL;
 }
 
-static esp_err_t rfid_manager_load_from_file(void)
+static esp_err_t rfid_store_load_legacy(void)
 {
-
-    FILE *f = fopen(RFID_DATABASE_FILE, "rb"); // Open for reading in binary mode
-
+    FILE *f = fopen(RFID_DATABASE_FILE, "rb");
     if (f == NULL)
     {
-        ESP_LOGW(TAG, "RFID database file not found: %s. This may be the first boot.", RFID_DATABASE_FILE);
-        return ESP_ERR_NOT_FOUND; // File not found is a common case on first boot
+        return ESP_ERR_NOT_FOUND;
     }
 
-    // Check file size to determine if it's a new format or old format with header
-    long file_size;
     fseek(f, 0, SEEK_END);
-    file_size = ftell(f);
+    long file_size = ftell(f);
     fseek(f, 0, SEEK_SET);
-    
-    // Initialize database to clean state
-    memset(rfid_database, 0, sizeof(rfid_database));
-    
-    // Expected size for database without header
-    size_t expected_size = sizeof(rfid_card_t) * RFID_MAX_CARDS;
-    
-    if (file_size == expected_size) {
-        // New format - just read the card data directly
-        size_t cards_read = fread(rfid_database, sizeof(rfid_card_t), RFID_MAX_CARDS, f);
-        if (cards_read != RFID_MAX_CARDS) {
-            ESP_LOGE(TAG, "Failed to read all RFID card data. Read %d of %d slots.", cards_read, RFID_MAX_CARDS);
+    if (file_size <= 0 || (file_size % sizeof(rfid_card_t)) != 0)
+    {
+        ESP_LOGW(TAG, "Old RFID database file has an unexpected size (%ld), ignoring it.", file_size);
+        fclose(f);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint32_t slots_in_file = (uint32_t)(file_size / sizeof(rfid_card_t));
+    uint32_t slots_to_read = (slots_in_file < RFID_MAX_CARDS) ? slots_in_file : RFID_MAX_CARDS;
+    for (uint32_t i = 0; i < slots_to_read; ++i)
+    {
+        rfid_card_t card;
+        if (fread(&card, sizeof(card), 1, f) != 1)
+        {
+            ESP_LOGE(TAG, "Failed to read old RFID database file.");
             fclose(f);
             return ESP_FAIL;
         }
-        ESP_LOGI(TAG, "Successfully read RFID database in new format");
-    } else {
-        // Old format with header or corrupted file - reset to defaults
-        ESP_LOGW(TAG, "File size mismatch (got %ld, expected %d). Resetting to defaults.", file_size, expected_size);
-        fclose(f);
-        return ESP_ERR_INVALID_SIZE; // Return error to trigger loading defaults
+        rfid_store_load_slot((uint16_t)i, card.card_id, card.active != 0, card.timestamp);
     }
+    fclose(f);
+
+    // Names are paged from the old file until the first image replaces it
+    rfid_store_backing.kind = RFID_BACKING_SLOTS;
+    rfid_store_backing.path = RFID_DATABASE_FILE;
+    rfid_store_backing.base = 0;
+    rfid_store_backing.slots = slots_to_read;
+    rfid_index_sort();
+    ESP_LOGI(TAG, "Migrating %lu slots from %s", (unsigned long)slots_to_read, RFID_DATABASE_FILE);
+    return ESP_OK;
+}
 
-    if (fclose(f) != 0)
+static esp_err_t rfid_manager_load_from_file(void)
+{
+    rfid_store_newest = -1;
+    rfid_store_sequence = 0;
+    rfid_store_needs_rewrite = true;
+    rfid_journal_has_base = false;
+
+    // Headers first, so the newest copy is read first
+    rfid_store_header_t headers[2];
+    bool header_ok[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        header_ok[i] = rfid_store_read_image(rfid_store_files[i], &headers[i], false, NULL) == ESP_OK;
+        if (header_ok[i] && headers[i].sequence > rfid_store_sequence)
+        {
+            rfid_store_sequence = headers[i].sequence; // New images must outrank even a copy with damaged slots
+        }
+    }
+    int first = (header_ok[1] && (!header_ok[0] || headers[1].sequence > headers[0].sequence)) ? 1 : 0;
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    for (int attempt = 0; attempt < 2 && rfid_store_newest < 0; ++attempt)
+    {
+        int copy = attempt == 0 ? first : !first;
+        if (!header_ok[copy])
+        {
+            continue;
+        }
+        bool rewrite = false;
+        rfid_store_reset();
+        ret = rfid_store_read_image(rfid_store_files[copy], &headers[copy], true, &rewrite);
+        if (ret == ESP_OK)
+        {
+            rfid_store_newest = copy;
+            rfid_store_needs_rewrite = rewrite || attempt > 0;
+            if (headers[copy].version != RFID_STORE_VERSION)
+            {
+                ESP_LOGI(TAG, "Migrating RFID database image %s from version %u.", rfid_store_files[copy],
+                         (unsigned)headers[copy].version);
+            }
+            if (attempt > 0)
+            {
+                // The journal may miss changes that were only in the newer image
+                ESP_LOGW(TAG, "Newest RFID database copy is damaged, recovered from %s (image %lu).",
+                         rfid_store_files[copy], (unsigned long)headers[copy].sequence);
+            }
+        }
+        else
+        {
+            ESP_LOGW(TAG, "RFID database copy %s is damaged (%s).", rfid_store_files[copy], esp_err_to_name(ret));
+        }
+    }
+
+    if (rfid_store_newest < 0)
     {
-        ESP_LOGE(TAG, "Failed to close RFID database file after reading.");
-        // Data might be loaded, but this is still an issue.
+        // Without its image a journal is meaningless, and a new image must not pick it up
+        remove(RFID_JOURNAL_FILE);
+        rfid_store_reset();
+        ret = rfid_store_load_legacy();
+        if (ret == ESP_ERR_NOT_FOUND)
+        {
+            ESP_LOGW(TAG, "No RFID database file found. This may be the first boot.");
+        }
+        if (ret != ESP_OK)
+        {
+            rfid_store_reset();
+            return ret; // The caller loads the defaults
+        }
     }
 
+    // Bring the table up to date with changes saved after the last compaction
+    bool journal_clean = rfid_store_replay_journal(rfid_store_newest < 0 ? 0 : headers[rfid_store_newest].sequence);
+    rfid_filter_rebuild();
+
+    // New records must not be appended behind a damaged tail, so fold the journal in now
+    rfid_store_needs_rewrite = rfid_store_needs_rewrite || !journal_clean;
+    if (rfid_store_needs_rewrite && rfid_store_compact() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to compact RFID journal after load.");
+    }
     return ESP_OK;
 }
 
@@ -899,14 +3544,26 @@ esp_err_t rfid_manager_deinit(void)
         // Decide if this is a critical error. For deinit, we might proceed with cleanup anyway.
     }
 
+    esp_err_t log_ret = rfid_access_log_deinit();
+    if (log_ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to write staged access records during deinitialization: %s", esp_err_to_name(log_ret));
+    }
+
     // 2. Stop and delete the timer
     if (rfid_write_timer != NULL)
     {
-        esp_timer_stop(rfid_write_timer);
-        esp_timer_delete(rfid_write_timer);
+        rfid_port_timer_stop(rfid_write_timer);
+        rfid_port_timer_delete(rfid_write_timer);
         rfid_write_timer = NULL;
         ESP_LOGD(TAG, "RFID write timer deleted.");
     }
+    if (rfid_seen_timer != NULL)
+    {
+        rfid_port_timer_stop(rfid_seen_timer);
+        rfid_port_timer_delete(rfid_seen_timer);
+        rfid_seen_timer = NULL;
+    }
+    is_seen_due = false;
 
     // 3. Delete the mutex
     if (rfid_mutex != NULL) { // Check if mutex is still valid after flush_cache (it should be)
@@ -914,6 +3571,17 @@ esp_err_t rfid_manager_deinit(void)
         rfid_mutex = NULL;
         ESP_LOGD(TAG, "RFID mutex deleted.");
     }
+    if (rfid_readers_drained != NULL) {
+        vSemaphoreDelete(rfid_readers_drained);
+        rfid_readers_drained = NULL;
+    }
+
+    // 4. Release the card table and its cached blocks
+    rfid_store_free();
+    if (rfid_page_mutex != NULL) {
+        vSemaphoreDelete(rfid_page_mutex);
+        rfid_page_mutex = NULL;
+    }
 
     ESP_LOGI(TAG, "RFID manager deinitialized successfully.");
     return ESP_OK;
@@ -930,10 +3598,35 @@ esp_err_t rfid_manager_deinit(void)
  */
 bool rfid_manager_process(void)
 {
+    bool log_written = rfid_access_log_process();
+
+    if (is_seen_due && rfid_mutex != NULL)
+    {
+        if (rfid_write_lock(pdMS_TO_TICKS(2000)))
+        {
+            rfid_seen_write_due();
+            rfid_write_unlock();
+            log_written = true;
+        }
+        else
+        {
+            // is_seen_due stays set, the next call tries again
+            ESP_LOGW(TAG, "Failed to take RFID mutex for last-seen write.");
+        }
+    }
+
     if (is_ready_to_write)
     {
         ESP_LOGI(TAG, "rfid_manager_process: is_ready_to_write is true. Attempting NVS write.");
+        if (rfid_mutex == NULL || !rfid_write_lock(pdMS_TO_TICKS(2000)))
+        {
+            // Data remains dirty, the timer brings rfid_manager_process() back for another try
+            ESP_LOGE(TAG, "Failed to take RFID mutex for NVS write. NVS write deferred.");
+            rfid_retry_write_later();
+            return true;
+        }
         esp_err_t write_into_ret = rfid_manager_write_into_memory();
+        rfid_write_unlock();
 
         if(write_into_ret == ESP_OK)
         {
@@ -941,9 +3634,16 @@ bool rfid_manager_process(void)
             ESP_LOGI(TAG, "rfid_manager_process: NVS write successful, is_ready_to_write cleared.");
         } else {
             ESP_LOGE(TAG, "rfid_manager_process: NVS write failed.");
+            rfid_retry_write_later();
         }
         return true; // Indicate that processing occurred
     } 
 
-    return false; // No processing needed
+    return log_written; // No NVS write needed
+}
+
+void rfid_manager_set_work_callback(rfid_manager_work_cb_t callback)
+{
+    rfid_work_cb = callback;
+    rfid_access_log_set_work_callback(callback);
 }
@@ -0,0 +1,206 @@
+#include "rfid_port.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+
+static const char *TAG = "RFID_PORT";
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+// --- Chip: SPIFFS, esp_timer and heap_caps ---
+
+#include "esp_spiffs.h"
+#include "esp_heap_caps.h"
+#include "spi_ffs_storage.h"
+
+esp_err_t rfid_port_timer_create(rfid_port_timer_cb_t callback, void *arg, const char *name, rfid_port_timer_t *timer)
+{
+    esp_timer_create_args_t timer_args = {
+        .callback = callback,
+        .arg = arg,
+        .name = name
+    };
+    return esp_timer_create(&timer_args, timer);
+}
+
+esp_err_t rfid_port_timer_start_once(rfid_port_timer_t timer, uint64_t timeout_us)
+{
+    return esp_timer_start_once(timer, timeout_us);
+}
+
+void rfid_port_timer_stop(rfid_port_timer_t timer)
+{
+    esp_timer_stop(timer);
+}
+
+void rfid_port_timer_delete(rfid_port_timer_t timer)
+{
+    esp_timer_delete(timer);
+}
+
+int64_t rfid_port_time_us(void)
+{
+    return esp_timer_get_time();
+}
+
+void *rfid_port_calloc(size_t n, size_t size, bool prefer_psram)
+{
+    if (prefer_psram)
+    {
+        void *ptr = heap_caps_calloc(n, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (ptr != NULL)
+        {
+            return ptr;
+        }
+        ESP_LOGW(TAG, "PSRAM allocation of %u bytes failed, using internal RAM", (unsigned)(n * size));
+    }
+    return heap_caps_calloc(n, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+void rfid_port_free(void *ptr)
+{
+    heap_caps_free(ptr);
+}
+
+esp_err_t rfid_port_storage_info(size_t *total_bytes, size_t *used_bytes)
+{
+    return esp_spiffs_info(NULL, total_bytes, used_bytes); // Default partition label
+}
+
+bool rfid_port_rename(const char *old_path, const char *new_path)
+{
+    return spiffs_storage_rename_file(old_path, new_path);
+}
+
+#else
+
+// --- ESP-IDF Linux target: host directory, FreeRTOS timers and malloc ---
+
+#include <time.h>
+#include <errno.h>
+#include <sys/statvfs.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+struct rfid_port_timer
+{
+    TimerHandle_t handle;
+    rfid_port_timer_cb_t callback;
+    void *arg;
+};
+
+static void rfid_port_timer_expired(TimerHandle_t handle)
+{
+    struct rfid_port_timer *timer = pvTimerGetTimerID(handle);
+    timer->callback(timer->arg);
+}
+
+/**
+ * @brief Block time for timer commands, the timer task must not wait on its own queue
+ */
+static TickType_t rfid_port_timer_block_time(void)
+{
+    return (xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle()) ? 0 : portMAX_DELAY;
+}
+
+esp_err_t rfid_port_timer_create(rfid_port_timer_cb_t callback, void *arg, const char *name, rfid_port_timer_t *timer)
+{
+    struct rfid_port_timer *t = calloc(1, sizeof(*t));
+    if (t == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = callback;
+    t->arg = arg;
+    t->handle = xTimerCreate(name, 1, pdFALSE, t, rfid_port_timer_expired);
+    if (t->handle == NULL)
+    {
+        free(t);
+        return ESP_ERR_NO_MEM;
+    }
+    *timer = t;
+    return ESP_OK;
+}
+
+esp_err_t rfid_port_timer_start_once(rfid_port_timer_t timer, uint64_t timeout_us)
+{
+    // Same contract as esp_timer_start_once(): an armed timer keeps its deadline
+    if (xTimerIsTimerActive(timer->handle))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint64_t tick_us = (uint64_t)portTICK_PERIOD_MS * 1000;
+    uint64_t ticks = (timeout_us + tick_us - 1) / tick_us;
+    if (ticks == 0)
+    {
+        ticks = 1;
+    }
+    else if (ticks > portMAX_DELAY - 1)
+    {
+        ticks = portMAX_DELAY - 1;
+    }
+    return (xTimerChangePeriod(timer->handle, (TickType_t)ticks, rfid_port_timer_block_time()) == pdPASS) ? ESP_OK : ESP_FAIL;
+}
+
+void rfid_port_timer_stop(rfid_port_timer_t timer)
+{
+    xTimerStop(timer->handle, rfid_port_timer_block_time());
+}
+
+void rfid_port_timer_delete(rfid_port_timer_t timer)
+{
+    xTimerDelete(timer->handle, rfid_port_timer_block_time());
+    free(timer);
+}
+
+int64_t rfid_port_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void *rfid_port_calloc(size_t n, size_t size, bool prefer_psram)
+{
+    return calloc(n, size);
+}
+
+void rfid_port_free(void *ptr)
+{
+    free(ptr);
+}
+
+esp_err_t rfid_port_storage_info(size_t *total_bytes, size_t *used_bytes)
+{
+    // The directory stands in for the mounted partition, so it is created here
+    struct statvfs fs;
+    if ((mkdir(CONFIG_RFID_STORAGE_BASE_PATH, 0755) != 0 && errno != EEXIST) ||
+        statvfs(CONFIG_RFID_STORAGE_BASE_PATH, &fs) != 0)
+    {
+        ESP_LOGE(TAG, "Card directory %s is not usable: errno %d", CONFIG_RFID_STORAGE_BASE_PATH, errno);
+        return ESP_ERR_NOT_FOUND;
+    }
+    *total_bytes = (size_t)(fs.f_blocks * fs.f_frsize);
+    *used_bytes = (size_t)((fs.f_blocks - fs.f_bfree) * fs.f_frsize);
+    return ESP_OK;
+}
+
+bool rfid_port_rename(const char *old_path, const char *new_path)
+{
+    struct stat st;
+    if (stat(new_path, &st) == 0)
+    {
+        ESP_LOGE(TAG, "New file already exists: %s", new_path);
+        return false;
+    }
+    if (rename(old_path, new_path) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to rename file: %s", old_path);
+        return false;
+    }
+    return true;
+}
+
+#endif // CONFIG_IDF_TARGET_LINUX
@@ -7,11 +7,16 @@
 #include <limits.h>
 #include <string.h>
 #include <stdio.h> // For snprintf and remove
+#include <stddef.h>
 #include "unity.h"
 #include "rfid_manager.h"
+#include "app_metrics.h"
+#include "rfid_reader.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h" // For hand-made card images
 #include "nvs_flash.h" // For file corruption test
 
 static const char *TAG_TEST = "RFID_TESTS";
@@ -20,6 +25,14 @@ static const char *TAG_TEST = "RFID_TESTS";
 #define RFID_WRITE_TIMEOUT_MS_TEST 100 // 100ms for tests
 #define NUM_DEFAULT_CARDS 3 // Assuming 3 default cards as per rfid_manager.c
 
+#ifndef CONFIG_RFID_LAST_SEEN_FLUSH_S
+#define CONFIG_RFID_LAST_SEEN_FLUSH_S 600
+#endif
+
+#ifndef CONFIG_RFID_ACCESS_LOG_STAGING
+#define CONFIG_RFID_ACCESS_LOG_STAGING 32
+#endif
+
 // Static buffer to avoid stack overflow for list_cards test
 static rfid_card_t static_cards_buffer[10]; // Use a smaller buffer size for testing list_cards
 
@@ -171,6 +184,151 @@ TEST_CASE("RFID Manager: JSON Card List", "[rfid_manager]")
     TEST_ASSERT_NOT_NULL(strstr(json_buffer, test_card_name));
     TEST_ASSERT_NOT_NULL(strstr(json_buffer, "Admin Card")); // Check for default card too
     TEST_ASSERT_NOT_NULL(strstr(json_buffer, "0x12345678")); // Check for default admin card in hex
+
+    // A list that does not fit is an error, not a truncated object
+    size_t full_len = strlen(json_buffer);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card_list_json(json_buffer, full_len + 1));
+    TEST_ASSERT_EQUAL(ESP_FAIL, rfid_manager_get_card_list_json(json_buffer, full_len));
+    TEST_ASSERT_EQUAL(ESP_FAIL, rfid_manager_get_card_list_json(json_buffer, 40));
+}
+
+TEST_CASE("RFID Manager: Card Iterator Batches", "[rfid_manager]")
+{
+    esp_err_t ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x40000000 - i * 0x100, "Iter Card"));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_remove_card(0x40000000 - 3 * 0x100));
+
+    // Walk with a batch smaller than the list so the cursor has to carry over
+    rfid_card_iter_t iter;
+    rfid_card_t batch[3];
+    uint16_t copied = 0;
+    uint16_t total = 0;
+    uint32_t last_id = 0;
+    rfid_manager_card_iter_init(&iter);
+    while (!iter.done)
+    {
+        ret = rfid_manager_card_iter_next(&iter, batch, 3, &copied);
+        TEST_ASSERT_EQUAL(ESP_OK, ret);
+        for (uint16_t i = 0; i < copied; ++i)
+        {
+            TEST_ASSERT_TRUE(batch[i].card_id > last_id); // Ascending, no repeats
+            TEST_ASSERT_EQUAL_UINT8(1, batch[i].active);
+            last_id = batch[i].card_id;
+            total++;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT16(rfid_manager_get_card_count(), total);
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 9, total);
+
+    // A finished iterator keeps returning nothing
+    ret = rfid_manager_card_iter_next(&iter, batch, 3, &copied);
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_EQUAL_UINT16(0, copied);
+}
+
+TEST_CASE("RFID Manager: Filtered Iteration And Paging", "[rfid_manager]")
+{
+    esp_err_t ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    for (uint32_t i = 0; i < 6; ++i)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x50000000 + i, (i % 2) ? "Guest Card" : "Staff Card"));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_remove_card(0x50000002)); // One staff card gone
+
+    // Name prefix is case-insensitive
+    rfid_card_filter_t filter = {0};
+    strcpy(filter.name_prefix, "staff");
+    uint32_t count = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_count_cards(&filter, &count));
+    TEST_ASSERT_EQUAL_UINT32(2, count);
+
+    // Default cards carry timestamp 0, added cards the current time
+    rfid_card_filter_t since = {.since_ts = 1};
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_count_cards(&since, &count));
+    TEST_ASSERT_EQUAL_UINT32(5, count);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_count_cards(NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(NUM_DEFAULT_CARDS + 5, count);
+
+    // Page 2 of size 2 over the "Guest" cards: skip one page, then read the rest
+    rfid_card_iter_t iter;
+    rfid_card_t batch[2];
+    uint16_t copied = 0;
+    uint32_t skipped = 0;
+    strcpy(filter.name_prefix, "Guest");
+    rfid_manager_card_iter_init_filtered(&iter, &filter);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_card_iter_skip(&iter, 2, &skipped));
+    TEST_ASSERT_EQUAL_UINT32(2, skipped);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_card_iter_next(&iter, batch, 2, &copied));
+    TEST_ASSERT_EQUAL_UINT16(1, copied);
+    TEST_ASSERT_EQUAL_HEX32(0x50000005, batch[0].card_id);
+    TEST_ASSERT_TRUE(iter.done);
+
+    // Skipping past the end stops at the number of matches
+    rfid_manager_card_iter_init_filtered(&iter, &filter);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_card_iter_skip(&iter, 100, &skipped));
+    TEST_ASSERT_EQUAL_UINT32(3, skipped);
+    TEST_ASSERT_TRUE(iter.done);
+}
+
+TEST_CASE("RFID Manager: Batch Add", "[rfid_manager]")
+{
+    esp_err_t ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x60000001, "Existing Card"));
+
+    rfid_card_t cards[5] = {
+        {0x60000002, 0, "Batch Card A", 0},
+        {0x60000001, 1, "Duplicate", 0},      // Already in the database
+        {0, 1, "Zero ID", 0},                 // Never valid
+        {0x60000003, 1, "Batch Card B", 1234},
+        {0x60000002, 1, "Duplicate In Batch", 0},
+    };
+    uint16_t added = 0;
+    ret = rfid_manager_add_cards_batch(cards, 5, &added);
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_EQUAL_UINT16(2, added);
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 3, rfid_manager_get_card_count());
+
+    rfid_card_t card;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x60000002, &card));
+    TEST_ASSERT_EQUAL_STRING("Batch Card A", card.name);
+    TEST_ASSERT_EQUAL_UINT8(1, card.active);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x60000003, &card));
+    TEST_ASSERT_EQUAL_UINT32(1234, card.timestamp); // Imported timestamps are kept
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x60000001, &card));
+    TEST_ASSERT_EQUAL_STRING("Existing Card", card.name);
+
+    // The batch survives a restart
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x60000003));
+
+    // A batch that does not fit adds nothing, one that just fits fills the database
+    static rfid_card_t many[RFID_MAX_CARDS];
+    for (uint16_t i = 0; i < RFID_MAX_CARDS; ++i)
+    {
+        many[i] = (rfid_card_t){.card_id = 0x61000000 + i, .name = "Bulk"};
+    }
+    ret = rfid_manager_add_cards_batch(many, RFID_MAX_CARDS, &added);
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, ret);
+    TEST_ASSERT_EQUAL_UINT16(0, added);
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 3, rfid_manager_get_card_count());
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x61000000));
+
+    ret = rfid_manager_add_cards_batch(many, RFID_MAX_CARDS - (NUM_DEFAULT_CARDS + 3), &added);
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_EQUAL_UINT16(RFID_MAX_CARDS - (NUM_DEFAULT_CARDS + 3), added);
+    TEST_ASSERT_EQUAL_UINT16(RFID_MAX_CARDS, rfid_manager_get_card_count());
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, rfid_manager_add_cards_batch(NULL, 1, &added));
 }
 
 TEST_CASE("RFID Manager: Fill Database (Performance/Stress)", "[rfid_manager]")
@@ -202,39 +360,282 @@ TEST_CASE("RFID Manager: Fill Database (Performance/Stress)", "[rfid_manager]")
     TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, ret);
 }
 
-TEST_CASE("RFID Manager: File Corruption and Recovery", "[rfid_manager]")
+TEST_CASE("RFID Manager: Index Lookup After Unordered Adds", "[rfid_manager]")
 {
-    esp_err_t ret;
+    esp_err_t ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
 
-    ret = rfid_manager_format_database();
+    // Insert IDs out of order so the sorted index has to shift entries
+    const uint32_t ids[] = { 0x90000000, 0x00000005, 0x7FFFFFFF, 0x00000001, 0xFFFFFFF0 };
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i)
+    {
+        ret = rfid_manager_add_card(ids[i], "Index Card");
+        TEST_ASSERT_EQUAL(ESP_OK, ret);
+    }
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i)
+    {
+        TEST_ASSERT_TRUE(rfid_manager_check_card(ids[i]));
+    }
+
+    // Removed cards stay indexed, so re-adding the same ID is still rejected
+    ret = rfid_manager_remove_card(0x7FFFFFFF);
     TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x7FFFFFFF));
+    ret = rfid_manager_add_card(0x7FFFFFFF, "Index Card");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ret);
 
-    uint32_t custom_card_id = 0xDDCCBBAA;
-    const char *custom_card_name = "CustomCorruptTest";
-    ret = rfid_manager_add_card(custom_card_id, custom_card_name);
+    // Index must be rebuilt from the file on re-init
+    ret = rfid_manager_flush_cache();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_deinit();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_init();
     TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0xFFFFFFF0));
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x00000001));
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x00000002));
+}
 
-    rfid_card_t temp_card;
-    ret = rfid_manager_get_card(custom_card_id, &temp_card);
+TEST_CASE("RFID Manager: Removed ID Stays Taken After Compaction", "[rfid_manager]")
+{
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x34000001, "Removed Card"));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_remove_card(0x34000001));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+
+    // A torn journal tail makes the next load fold the journal into a new image
+    const char *journal_path = "/spiffs/rfid_cards.jnl";
+    FILE *f = fopen(journal_path, "ab");
+    TEST_ASSERT_NOT_NULL(f);
+    const uint8_t torn_record[3] = { 0x52, 0x4A, 0x01 };
+    TEST_ASSERT_EQUAL(sizeof(torn_record), fwrite(torn_record, 1, sizeof(torn_record), f));
+    fclose(f);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    f = fopen(journal_path, "rb");
+    TEST_ASSERT_NULL(f);
+
+    // Loaded from the image alone, the removed ID is still rejected
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x34000001));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, rfid_manager_add_card(0x34000001, "Removed Card"));
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS, rfid_manager_get_card_count());
+}
+
+TEST_CASE("RFID Manager: Dirty Block Saves Persist", "[rfid_manager]")
+{
+    esp_err_t ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    // First save after format rewrites the file, the following ones only patch changed blocks
+    ret = rfid_manager_add_card(0x31000001, "Block Card A");
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_flush_cache();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    ret = rfid_manager_remove_card(0x87654321); // User Card 1
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_add_card(0x31000002, "Block Card B");
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_flush_cache();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    ret = rfid_manager_deinit();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_init();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    rfid_card_t card;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x31000001, &card));
+    TEST_ASSERT_EQUAL_STRING("Block Card A", card.name);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x31000002, &card));
+    TEST_ASSERT_EQUAL_STRING("Block Card B", card.name);
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x87654321));
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 1, rfid_manager_get_card_count());
+}
+
+TEST_CASE("RFID Manager: Journal Replay and Torn Tail", "[rfid_manager]")
+{
+    esp_err_t ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    ret = rfid_manager_add_card(0x32000001, "Journal Card A");
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_flush_cache();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    // The change is in the journal, not yet compacted into the card file
+    const char *journal_path = "/spiffs/rfid_cards.jnl";
+    FILE *f = fopen(journal_path, "ab");
+    TEST_ASSERT_NOT_NULL(f);
+    // Simulate a power loss halfway through appending the next record
+    const uint8_t torn_record[7] = { 0x52, 0x4A, 0x01, 0x00, 0xEF, 0xBE, 0xAD };
+    TEST_ASSERT_EQUAL(sizeof(torn_record), fwrite(torn_record, 1, sizeof(torn_record), f));
+    fclose(f);
+
+    // Re-init replays the intact record and drops the torn one
+    ret = rfid_manager_init();
     TEST_ASSERT_EQUAL(ESP_OK, ret);
-    TEST_ASSERT_EQUAL_STRING(custom_card_name, temp_card.name);
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x32000001));
     TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 1, rfid_manager_get_card_count());
 
-    const char *filepath = "/spiffs/rfid_cards.dat";
-    FILE *f_check = fopen(filepath, "rb");
-    if (f_check)
+    // Changes saved after the recovery must survive another reload
+    ret = rfid_manager_add_card(0x32000002, "Journal Card B");
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_flush_cache();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    ret = rfid_manager_init();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x32000001));
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x32000002));
+}
+
+TEST_CASE("RFID Manager: Format Survives A Leftover Journal", "[rfid_manager]")
+{
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x33000001, "Erased Card"));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+
+    // Keep the journal that holds the card
+    const char *journal_path = "/spiffs/rfid_cards.jnl";
+    static uint8_t journal[512];
+    FILE *f = fopen(journal_path, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    size_t journal_len = fread(journal, 1, sizeof(journal), f);
+    fclose(f);
+    TEST_ASSERT_GREATER_THAN(0, journal_len);
+
+    // Power loss after the format published its image, before it deleted the journal
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+    f = fopen(journal_path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(journal_len, fwrite(journal, 1, journal_len, f));
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x33000001));
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS, rfid_manager_get_card_count());
+
+    // The stale journal is gone, so later changes start a journal of their own
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x33000002, "New Card"));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x33000001));
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x33000002));
+}
+
+static SemaphoreHandle_t concurrent_readers_done;
+static volatile uint32_t concurrent_read_failures;
+
+static void concurrent_reader_task(void *arg)
+{
+    uint32_t card_id = (uint32_t)(uintptr_t)arg;
+    for (int i = 0; i < 200; ++i)
+    {
+        rfid_card_t card;
+        if (!rfid_manager_check_card(card_id) || rfid_manager_get_card(card_id, &card) != ESP_OK)
+        {
+            concurrent_read_failures++;
+        }
+    }
+    xSemaphoreGive(concurrent_readers_done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("RFID Manager: Concurrent Readers And Writer", "[rfid_manager]")
+{
+    esp_err_t ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    concurrent_readers_done = xSemaphoreCreateCounting(2, 0);
+    TEST_ASSERT_NOT_NULL(concurrent_readers_done);
+    concurrent_read_failures = 0;
+
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(concurrent_reader_task, "rfid_rd1", 4096, (void *)(uintptr_t)0x12345678, 5, NULL));
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(concurrent_reader_task, "rfid_rd2", 4096, (void *)(uintptr_t)0x87654321, 5, NULL));
+
+    // Writers interleave with the readers and must neither fail nor disturb them
+    static char json_buffer[2048];
+    for (uint32_t i = 0; i < 20; ++i)
     {
-        fclose(f_check);
-        ESP_LOGI(TAG_TEST, "Corrupting file by removing: %s", filepath);
-        int remove_ret = remove(filepath);
-        TEST_ASSERT_EQUAL_INT(0, remove_ret);
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x33000000 + i, "Concurrent Card"));
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card_list_json(json_buffer, sizeof(json_buffer)));
     }
-    else
+
+    for (int i = 0; i < 2; ++i)
     {
-        ESP_LOGW(TAG_TEST, "File %s did not exist before attempting removal for corruption test. This might be unexpected.", filepath);
+        TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(concurrent_readers_done, pdMS_TO_TICKS(10000)));
+    }
+    vSemaphoreDelete(concurrent_readers_done);
+
+    TEST_ASSERT_EQUAL_UINT32(0, concurrent_read_failures);
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 20, rfid_manager_get_card_count());
+}
+
+/**
+ * @brief Inverts one byte of a file
+ */
+static void corrupt_file(const char *path, long offset)
+{
+    FILE *f = fopen(path, "r+b");
+    TEST_ASSERT_NOT_NULL(f);
+    uint8_t byte = 0;
+    TEST_ASSERT_EQUAL_INT(0, fseek(f, offset, SEEK_SET));
+    TEST_ASSERT_EQUAL(1, fread(&byte, 1, 1, f));
+    byte ^= 0xFF;
+    TEST_ASSERT_EQUAL_INT(0, fseek(f, offset, SEEK_SET));
+    TEST_ASSERT_EQUAL(1, fwrite(&byte, 1, 1, f));
+    fclose(f);
+}
+
+TEST_CASE("RFID Manager: File Corruption and Recovery", "[rfid_manager]")
+{
+    esp_err_t ret;
+    uint32_t custom_card_id = 0xDDCCBBAA;
+    const char *custom_card_name = "CustomCorruptTest";
+    uint32_t default_admin_card_id = 0x12345678;
+    rfid_card_t temp_card;
+    const char *copies[2] = { "/spiffs/rfid_cards.a", "/spiffs/rfid_cards.b" };
+    const long admin_name_offset = 24 + 11 + 5; // Header, then the record head of the admin card
+
+    for (int i = 0; i < 2; i++)
+    {
+        // Two images of the defaults on flash, the custom card in the journal
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(custom_card_id, custom_card_name));
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+
+        // Whichever copy is damaged, the CRC rejects it and the other one is loaded
+        ESP_LOGI(TAG_TEST, "Corrupting %s", copies[i]);
+        corrupt_file(copies[i], admin_name_offset);
+        ret = rfid_manager_init();
+        TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(default_admin_card_id, &temp_card));
+        TEST_ASSERT_EQUAL_STRING("Admin Card", temp_card.name);
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(custom_card_id, &temp_card));
+        TEST_ASSERT_EQUAL_STRING(custom_card_name, temp_card.name);
+        TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 1, rfid_manager_get_card_count());
     }
 
-    // Re-initialize RFID manager - should trigger loading defaults due to missing file
+    // A compaction cut short only leaves the temp file behind, which is ignored
+    FILE *f = fopen("/spiffs/rfid_cards.tmp", "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    const uint8_t torn_image[10] = { 0x52, 0x46, 0x44, 0x42, 0x01 };
+    TEST_ASSERT_EQUAL(sizeof(torn_image), fwrite(torn_image, 1, sizeof(torn_image), f));
+    fclose(f);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_TRUE(rfid_manager_check_card(custom_card_id));
+
+    // With both copies gone the defaults are loaded
+    for (int i = 0; i < 2; i++)
+    {
+        remove(copies[i]);
+    }
     ret = rfid_manager_init();
     TEST_ASSERT_EQUAL(ESP_OK, ret);
 
@@ -243,7 +644,6 @@ TEST_CASE("RFID Manager: File Corruption and Recovery", "[rfid_manager]")
     TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ret);
 
     // Default cards should be present
-    uint32_t default_admin_card_id = 0x12345678;
     ret = rfid_manager_get_card(default_admin_card_id, &temp_card);
     TEST_ASSERT_EQUAL(ESP_OK, ret);
     TEST_ASSERT_EQUAL_STRING("Admin Card", temp_card.name);
@@ -251,6 +651,208 @@ TEST_CASE("RFID Manager: File Corruption and Recovery", "[rfid_manager]")
     TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS, rfid_manager_get_card_count());
 }
 
+TEST_CASE("RFID Manager: Migrates Headerless Card File", "[rfid_manager]")
+{
+    // The flat slot array written by older firmware, shorter than the current capacity
+    rfid_card_t old_cards[4] = {
+        { .card_id = 0x01D00001, .active = 1, .name = "Old Card A" },
+        { .card_id = 0x01D00002, .active = 0, .name = "Old Card B" },
+        { .card_id = 0x01D00003, .active = 1, .name = "Old Card C" },
+    };
+    remove("/spiffs/rfid_cards.a");
+    remove("/spiffs/rfid_cards.b");
+    remove("/spiffs/rfid_cards.jnl");
+    FILE *f = fopen("/spiffs/rfid_cards.dat", "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(4, fwrite(old_cards, sizeof(rfid_card_t), 4, f));
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x01D00001));
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x01D00002));
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x01D00003));
+    TEST_ASSERT_EQUAL_UINT16(2, rfid_manager_get_card_count());
+
+    // Rewritten as an A/B image right away, the old file is gone
+    f = fopen("/spiffs/rfid_cards.dat", "rb");
+    TEST_ASSERT_NULL(f);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x01D00003));
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+}
+
+TEST_CASE("RFID Manager: Migrates Version 1 Card Image", "[rfid_manager]")
+{
+    // Same layout as the image header in rfid_manager.c
+    struct store_header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t card_size;
+        uint32_t count;
+        uint32_t sequence;
+        uint32_t data_crc;
+        uint32_t header_crc;
+    } header = { .magic = 0x42444652, .version = 1, .card_size = sizeof(rfid_card_t), .count = 4, .sequence = 7 };
+    rfid_card_t old_cards[4] = {
+        { .card_id = 0x01E00001, .active = 1, .name = "V1 Card A" },
+        { .card_id = 0x01E00002, .active = 0, .name = "V1 Card B" },
+        { .card_id = 0x01E00003, .active = 1, .name = "V1 Card C", .timestamp = 1700000000 },
+    };
+    header.data_crc = esp_rom_crc32_le(0, (const uint8_t *)old_cards, sizeof(old_cards));
+    header.header_crc = esp_rom_crc32_le(0, (const uint8_t *)&header, offsetof(struct store_header, header_crc));
+
+    remove("/spiffs/rfid_cards.a");
+    remove("/spiffs/rfid_cards.b");
+    remove("/spiffs/rfid_cards.jnl");
+    FILE *f = fopen("/spiffs/rfid_cards.a", "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(1, fwrite(&header, sizeof(header), 1, f));
+    TEST_ASSERT_EQUAL(4, fwrite(old_cards, sizeof(rfid_card_t), 4, f));
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    rfid_card_t card;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x01E00003, &card));
+    TEST_ASSERT_EQUAL_STRING("V1 Card C", card.name);
+    TEST_ASSERT_EQUAL_UINT32(1700000000, card.timestamp);
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x01E00002));
+    TEST_ASSERT_EQUAL_UINT16(2, rfid_manager_get_card_count());
+
+    // Rewritten into the other copy as packed records, the removed card without its name
+    f = fopen("/spiffs/rfid_cards.b", "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(1, fread(&header, sizeof(header), 1, f));
+    TEST_ASSERT_EQUAL_INT(0, fseek(f, 0, SEEK_END));
+    long size = ftell(f);
+    fclose(f);
+    TEST_ASSERT_EQUAL_UINT16(2, header.version);
+    TEST_ASSERT_EQUAL_UINT32(3, header.count);
+    TEST_ASSERT_EQUAL_UINT32(8, header.sequence);
+    TEST_ASSERT_EQUAL_INT32(sizeof(header) + 3 * 11 + strlen("V1 Card A") + strlen("V1 Card C"), size);
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x01E00001));
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x01E00003));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, rfid_manager_add_card(0x01E00002, "V1 Card B"));
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+}
+
+static rfid_card_change_t s_changes[RFID_MAX_CARDS + 1];
+
+TEST_CASE("RFID Manager: Apply Changes Is All Or Nothing", "[rfid_manager]")
+{
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+    rfid_card_t card;
+
+    rfid_card_change_t first[3] = {
+        { .card_id = 0x02A00001, .name = "Sync A" },
+        { .card_id = 0x02A00002, .name = "Sync B" },
+        { .card_id = 0x12345678, .remove = true },
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_apply_changes(first, 3));
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x02A00001));
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x02A00002));
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x12345678));
+
+    // Adding again renames an active card and brings back a removed one
+    rfid_card_change_t second[3] = {
+        { .card_id = 0x02A00001, .name = "Sync A2" },
+        { .card_id = 0x12345678, .name = "Admin Again" },
+        { .card_id = 0x02A00003, .remove = true }, // Unknown, ignored
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_apply_changes(second, 3));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x02A00001, &card));
+    TEST_ASSERT_EQUAL_STRING("Sync A2", card.name);
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x12345678));
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 2, rfid_manager_get_card_count());
+
+    // One card more than fits: nothing is applied
+    uint16_t free_slots = RFID_MAX_CARDS - rfid_manager_get_card_count();
+    for (uint16_t i = 0; i <= free_slots; i++)
+    {
+        s_changes[i] = (rfid_card_change_t){ .card_id = 0x02B00000 + i };
+        snprintf(s_changes[i].name, RFID_CARD_NAME_LEN, "Fill %u", i);
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, rfid_manager_apply_changes(s_changes, free_slots + 1));
+    TEST_ASSERT_EQUAL_UINT16(NUM_DEFAULT_CARDS + 2, rfid_manager_get_card_count());
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x02B00000));
+
+    // A removal in the same batch makes room
+    s_changes[free_slots + 1] = (rfid_card_change_t){ .card_id = 0x02A00002, .remove = true };
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_apply_changes(s_changes, free_slots + 2));
+    TEST_ASSERT_EQUAL_UINT16(RFID_MAX_CARDS, rfid_manager_get_card_count());
+    TEST_ASSERT_TRUE(rfid_manager_check_card(0x02B00000 + free_slots));
+    TEST_ASSERT_FALSE(rfid_manager_check_card(0x02A00002));
+
+    rfid_card_change_t zero = { .card_id = 0 };
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, rfid_manager_apply_changes(&zero, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+}
+
+/**
+ * @brief Checks every card added by the paging test, newest ID first.
+ *
+ * Every third card carries its new name once renamed is set, card 1 is gone after a removal.
+ */
+static void check_paged_cards(uint16_t count, bool renamed)
+{
+    char expected[RFID_CARD_NAME_LEN];
+    rfid_card_t card;
+    for (int32_t i = count - 1; i >= 0; i--)
+    {
+        if (renamed && i == 1)
+        {
+            TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, rfid_manager_get_card(0x02C00000 + i, &card));
+            continue;
+        }
+        snprintf(expected, sizeof(expected), (renamed && i % 3 == 0) ? "Renamed %ld" : "Paged %ld", (long)i);
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(0x02C00000 + i, &card));
+        TEST_ASSERT_EQUAL_STRING(expected, card.name);
+    }
+}
+
+TEST_CASE("RFID Manager: Card Blocks Paged From Image And Journal", "[rfid_manager]")
+{
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+
+    // Names are read back block by block; walking the IDs backwards evicts
+    // blocks whenever the table has more of them than the cache holds
+    uint16_t count = RFID_MAX_CARDS - NUM_DEFAULT_CARDS;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        s_changes[i] = (rfid_card_change_t){ .card_id = 0x02C00000 + i };
+        snprintf(s_changes[i].name, RFID_CARD_NAME_LEN, "Paged %u", i);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_apply_changes(s_changes, count));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_EQUAL_UINT16(RFID_MAX_CARDS, rfid_manager_get_card_count());
+    check_paged_cards(count, false);
+
+    // Changes spread over every block, read back before the save, from the
+    // journal after a reload, and from the image once compacted
+    uint16_t changes = 0;
+    for (uint16_t i = 0; i < count; i += 3)
+    {
+        s_changes[changes] = (rfid_card_change_t){ .card_id = 0x02C00000 + i };
+        snprintf(s_changes[changes].name, RFID_CARD_NAME_LEN, "Renamed %u", i);
+        changes++;
+    }
+    s_changes[changes++] = (rfid_card_change_t){ .card_id = 0x02C00001, .remove = true };
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_apply_changes(s_changes, changes));
+    check_paged_cards(count, true);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    check_paged_cards(count, true);
+    TEST_ASSERT_EQUAL_UINT16(RFID_MAX_CARDS - 1, rfid_manager_get_card_count());
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+}
+
 TEST_CASE("RFID Manager Cache: Add Card - No Immediate NVS Write (In-Memory Check)", "[rfid_manager_caching]")
 {
     // setUp() initializes the manager
@@ -302,6 +904,50 @@ TEST_CASE("RFID Manager Cache: Timer Expiry Triggers NVS Write", "[rfid_manager_
     TEST_ASSERT_EQUAL_STRING(card_name, fetched_card.name);
 }
 
+static long journal_size(void)
+{
+    FILE *f = fopen("/spiffs/rfid_cards.jnl", "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+TEST_CASE("RFID Manager Cache: Last-Seen Timestamps Written Back", "[rfid_manager_caching]")
+{
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+    uint32_t card_id = 0x5EE40001;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(card_id, "Last Seen"));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+    long before = journal_size();
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_set_last_seen_interval(RFID_WRITE_TIMEOUT_MS_TEST));
+    for (int i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_TRUE(rfid_manager_check_card(card_id));
+    }
+    rfid_card_t seen;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(card_id, &seen));
+    TEST_ASSERT_EQUAL_INT32(before, journal_size()); // Nothing written by the checks themselves
+
+    vTaskDelay(pdMS_TO_TICKS(RFID_WRITE_TIMEOUT_MS_TEST + 50));
+    rfid_manager_process();
+    TEST_ASSERT_EQUAL_INT32(before + 12, journal_size()); // One small timestamp record for five checks
+
+    // The timestamp survives a reload through the journal replay
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_set_last_seen_interval(CONFIG_RFID_LAST_SEEN_FLUSH_S * 1000));
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    rfid_card_t reloaded;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_get_card(card_id, &reloaded));
+    TEST_ASSERT_EQUAL_UINT32(seen.timestamp, reloaded.timestamp);
+    TEST_ASSERT_EQUAL_STRING("Last Seen", reloaded.name);
+}
+
 TEST_CASE("RFID Manager Cache: Multiple Operations Coalesced", "[rfid_manager_caching]")
 {
     esp_err_t format_ret = rfid_manager_format_database();
@@ -338,6 +984,36 @@ TEST_CASE("RFID Manager Cache: Multiple Operations Coalesced", "[rfid_manager_ca
     TEST_ASSERT_TRUE(rfid_manager_check_card(card3_id));
 }
 
+static volatile int work_cb_calls = 0;
+
+static void test_work_cb(void)
+{
+    work_cb_calls++;
+}
+
+TEST_CASE("RFID Manager Cache: Work Callback Signals Due Write", "[rfid_manager_caching]")
+{
+    esp_err_t format_ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, format_ret);
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_set_cache_timeout(RFID_WRITE_TIMEOUT_MS_TEST));
+    rfid_manager_set_work_callback(test_work_cb);
+    work_cb_calls = 0;
+
+    uint32_t test_card_id = 0xCA401;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(test_card_id, "Work Callback Test"));
+    TEST_ASSERT_EQUAL(0, work_cb_calls); // Nothing due before the cache timeout
+
+    vTaskDelay(pdMS_TO_TICKS(RFID_WRITE_TIMEOUT_MS_TEST + 50));
+    TEST_ASSERT_TRUE(work_cb_calls > 0);
+    TEST_ASSERT_TRUE(rfid_manager_process());
+
+    rfid_manager_set_work_callback(NULL);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    TEST_ASSERT_TRUE(rfid_manager_check_card(test_card_id));
+}
+
 TEST_CASE("RFID Manager Cache: Flush Cache", "[rfid_manager_caching]")
 {
     esp_err_t format_ret = rfid_manager_format_database();
@@ -377,6 +1053,212 @@ TEST_CASE("RFID Manager Cache: Disable Caching (Immediate Write)", "[rfid_manage
     TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_set_cache_timeout(RFID_DEFAULT_CACHE_TIMEOUT_MS));
 }
 
+TEST_CASE("RFID Manager: Access Log Records Checks", "[rfid_manager]")
+{
+    esp_err_t format_ret = rfid_manager_format_database();
+    TEST_ASSERT_EQUAL(ESP_OK, format_ret);
+
+    uint32_t known_card = 0xACC501;
+    uint32_t unknown_card = 0xACC502;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(known_card, "Access Log Test"));
+
+    // More checks than the staging buffer holds, written by the main loop as they come
+    const int checks = 40;
+    for (int i = 0; i < checks; i++) {
+        TEST_ASSERT_TRUE(rfid_manager_check_card_at(known_card, 2));
+        rfid_manager_process();
+    }
+    TEST_ASSERT_FALSE(rfid_manager_check_card(unknown_card));
+
+    // Staged records must survive a deinit/init cycle
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+
+    rfid_access_filter_t filter = { .card_id = known_card };
+    uint32_t count = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_access_log_count(&filter, &count));
+    TEST_ASSERT_EQUAL_UINT32(checks, count);
+
+    // Page through with a small batch size and an offset
+    rfid_access_record_t records[8];
+    rfid_access_iter_t iter;
+    rfid_access_log_iter_init(&iter, &filter);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_access_log_iter_skip(&iter, 5));
+    uint32_t seen = 0;
+    uint16_t num = 0;
+    do {
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_access_log_iter_next(&iter, records, 8, &num));
+        for (uint16_t i = 0; i < num; i++) {
+            TEST_ASSERT_EQUAL_UINT32(known_card, records[i].card_id);
+            TEST_ASSERT_EQUAL_UINT8(1, records[i].granted);
+            TEST_ASSERT_EQUAL_UINT8(2, records[i].reader_id);
+        }
+        seen += num;
+    } while (!iter.done);
+    TEST_ASSERT_EQUAL_UINT32(checks - 5, seen);
+
+    // The denied check is logged against the API reader
+    filter.card_id = unknown_card;
+    rfid_access_log_iter_init(&iter, &filter);
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_access_log_iter_next(&iter, records, 8, &num));
+    TEST_ASSERT_EQUAL_UINT16(1, num);
+    TEST_ASSERT_EQUAL_UINT8(0, records[0].granted);
+    TEST_ASSERT_EQUAL_UINT8(RFID_READER_ID_API, records[0].reader_id);
+
+    // A time range that ends before the checks matches nothing
+    filter.card_id = known_card;
+    filter.from_ts = 1;
+    filter.to_ts = records[0].timestamp - 1;
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_access_log_count(&filter, &count));
+    TEST_ASSERT_EQUAL_UINT32(0, count);
+
+    // Without the main loop the checks still answer, but never write the log themselves
+    for (int i = 0; i < CONFIG_RFID_ACCESS_LOG_STAGING + 8; i++) {
+        TEST_ASSERT_FALSE(rfid_manager_check_card(unknown_card));
+    }
+    filter = (rfid_access_filter_t){ .card_id = unknown_card };
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_access_log_count(&filter, &count));
+    TEST_ASSERT_EQUAL_UINT32(1 + CONFIG_RFID_ACCESS_LOG_STAGING, count);
+}
+
+#ifdef CONFIG_APP_METRICS_ENABLE
+static char metrics_buffer[4096];
+static size_t metrics_length;
+
+static bool metrics_capture(const char *data, size_t len, void *ctx)
+{
+    if (metrics_length + len >= sizeof(metrics_buffer))
+    {
+        return false;
+    }
+    memcpy(metrics_buffer + metrics_length, data, len);
+    metrics_length += len;
+    metrics_buffer[metrics_length] = '\0';
+    return true;
+}
+
+/**
+ * @brief Sample count of a series in the JSON summary, 0 if it is not listed
+ */
+static unsigned long metrics_summary_count(const char *series)
+{
+    metrics_length = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, app_metrics_write(APP_METRICS_FORMAT_JSON_SUMMARY, metrics_capture, NULL));
+    const char *found = strstr(metrics_buffer, series);
+    unsigned long count = 0;
+    if (found != NULL)
+    {
+        sscanf(found + strlen(series), ",\"count\":%lu", &count);
+    }
+    return count;
+}
+
+TEST_CASE("RFID Manager: Lock And Flash Metrics", "[rfid_manager]")
+{
+    app_metrics_set_sampling(true);
+    app_metrics_reset();
+
+    // Checks of a known card, unknown ones are turned away before the lock
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(0x3E7A1C5, "Metrics Test"));
+    for (int i = 0; i < 10; i++)
+    {
+        rfid_manager_check_card(0x3E7A1C5);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(10, metrics_summary_count("\"rfid_lock_wait_us\",\"mode\":\"read\""));
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(2, metrics_summary_count("\"rfid_lock_hold_us\",\"mode\":\"write\""));
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, metrics_summary_count("\"flash_write_us\",\"file\":\"cards\""));
+
+    // Sampling off: the probes record nothing
+    app_metrics_reset();
+    app_metrics_set_sampling(false);
+    rfid_manager_check_card(0x3E7A1C5);
+    app_metrics_set_sampling(true);
+    TEST_ASSERT_EQUAL_UINT32(0, metrics_summary_count("\"rfid_lock_wait_us\",\"mode\":\"read\""));
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_remove_card(0x3E7A1C5));
+}
+#endif
+
+TEST_CASE("RFID Manager: Negative Filter Never Rejects Active Cards", "[rfid_manager]")
+{
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+#ifdef CONFIG_APP_METRICS_ENABLE
+    app_metrics_set_sampling(true);
+    app_metrics_reset();
+#endif
+
+    const uint32_t base = 0xF1170000;
+    const int num_cards = 64;
+    for (int i = 0; i < num_cards; i++)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_add_card(base + i, "Filter Test"));
+    }
+    for (int i = 0; i < num_cards; i++)
+    {
+        TEST_ASSERT_TRUE(rfid_manager_check_card(base + i));
+    }
+
+    // Removing cards must not clear counters the remaining cards still use
+    for (int i = 0; i < num_cards; i += 2)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_remove_card(base + i));
+    }
+    for (int i = 0; i < num_cards; i++)
+    {
+        TEST_ASSERT_EQUAL(i % 2 == 1, rfid_manager_check_card(base + i));
+    }
+
+    // The filter is rebuilt with the table on load
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_flush_cache());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_deinit());
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_init());
+    for (int i = 0; i < num_cards; i++)
+    {
+        TEST_ASSERT_EQUAL(i % 2 == 1, rfid_manager_check_card(base + i));
+    }
+
+    const int num_unknown = 500;
+    for (int i = 0; i < num_unknown; i++)
+    {
+        TEST_ASSERT_FALSE(rfid_manager_check_card(0xBAD00000 + i * 7919));
+    }
+#ifdef CONFIG_APP_METRICS_ENABLE
+    // Unknown cards almost all stop at the filter
+    metrics_length = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, app_metrics_write(APP_METRICS_FORMAT_JSON_SUMMARY, metrics_capture, NULL));
+    const char *found = strstr(metrics_buffer, "\"rfid_filter_rejected_total\"");
+    TEST_ASSERT_NOT_NULL(found);
+    unsigned long rejected = 0;
+    sscanf(found + strlen("\"rfid_filter_rejected_total\""), ",\"value\":%lu", &rejected);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(num_unknown * 9 / 10, rejected);
+#endif
+
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_manager_format_database());
+}
+
+TEST_CASE("RFID Reader: Wiegand Decode", "[rfid_reader]")
+{
+    uint32_t card_id = 0;
+
+    // 26 bit: facility 0x12, card 0x3456
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_reader_wiegand_decode(0x2468AC, 26, &card_id));
+    TEST_ASSERT_EQUAL_UINT32(0x123456, card_id);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, rfid_reader_wiegand_decode(0x2468AC ^ (1u << 25), 26, &card_id));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, rfid_reader_wiegand_decode(0x2468AC ^ 1u, 26, &card_id));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, rfid_reader_wiegand_decode(0x2468AC ^ (1u << 4), 26, &card_id));
+
+    // 34 bit
+    TEST_ASSERT_EQUAL(ESP_OK, rfid_reader_wiegand_decode(0x3BD5B7DDEULL, 34, &card_id));
+    TEST_ASSERT_EQUAL_UINT32(0xDEADBEEF, card_id);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, rfid_reader_wiegand_decode(0x3BD5B7DDEULL ^ (1ULL << 20), 34, &card_id));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, rfid_reader_wiegand_decode(0x2468AC, 25, &card_id));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, rfid_reader_wiegand_decode(0, 0, &card_id));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, rfid_reader_wiegand_decode(0x2468AC, 26, NULL));
+}
+
 TEST_CASE("RFID Manager: Invalid Parameters", "[rfid_manager]")
 {
     // Test adding a card with NULL name
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Wiegand card reader on two GPIOs (D0, D1), see "RFID Reader" in Kconfig.
+ *
+ * The GPIO ISR only timestamps each pulse into a lock-free single producer,
+ * single consumer ring. A reader task pinned to CONFIG_RFID_READER_TASK_CORE
+ * assembles the pulses into frames, closes a frame once the lines have been
+ * quiet for CONFIG_RFID_READER_FRAME_GAP_US, checks parity, drops repeated
+ * reads of the same card within CONFIG_RFID_READER_DEBOUNCE_MS, calls
+ * rfid_manager_check_card_at() and pulses the door relay. Card checks from
+ * the reader never touch HTTP, JSON or flash on the authorization path.
+ *
+ * Supported frames: 26 bit (8 bit facility + 16 bit card, reported as
+ * facility << 16 | card) and 34 bit (32 bit card).
+ */
+
+/**
+ * @brief Called by the reader task after the relay was driven for a read
+ *
+ * Runs on the reader task, so keep it short: queue work elsewhere.
+ *
+ * @param card_id Card that was presented
+ * @param granted Result of the check
+ */
+typedef void (*rfid_reader_event_cb_t)(uint32_t card_id, bool granted);
+
+/**
+ * @brief Configure the GPIOs and start the reader task
+ *
+ * Does nothing unless CONFIG_RFID_READER_ENABLE is set. Pulses arriving
+ * before APP_BOOT_STORAGE_READY are kept in the ring and checked once the
+ * card database is loaded.
+ *
+ * @return esp_err_t ESP_OK on success or when the reader is disabled,
+ *         ESP_ERR_NO_MEM if the task or timers could not be created,
+ *         or the error of the GPIO setup
+ */
+esp_err_t rfid_reader_start(void);
+
+/**
+ * @brief Register the callback told about every read, e.g. for telemetry
+ * @param callback Callback to register, or NULL
+ */
+void rfid_reader_set_event_callback(rfid_reader_event_cb_t callback);
+
+/**
+ * @brief Decode a Wiegand frame
+ *
+ * @param bits Received bits, first bit in the most significant position used (bit num_bits - 1)
+ * @param num_bits Number of bits received
+ * @param card_id Filled with the card id on success
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_SIZE for an unsupported length,
+ *         ESP_ERR_INVALID_CRC on a parity error
+ */
+esp_err_t rfid_reader_wiegand_decode(uint64_t bits, uint8_t num_bits, uint32_t *card_id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,364 @@
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rfid_manager.h"
+#include "app_boot.h"
+#include "app_metrics.h"
+#include "rfid_reader.h"
+
+#ifndef CONFIG_RFID_READER_D0_GPIO
+#define CONFIG_RFID_READER_D0_GPIO 25
+#endif
+#ifndef CONFIG_RFID_READER_D1_GPIO
+#define CONFIG_RFID_READER_D1_GPIO 26
+#endif
+#ifndef CONFIG_RFID_READER_RELAY_GPIO
+#define CONFIG_RFID_READER_RELAY_GPIO 27
+#endif
+#ifndef CONFIG_RFID_READER_RELAY_PULSE_MS
+#define CONFIG_RFID_READER_RELAY_PULSE_MS 3000
+#endif
+#ifndef CONFIG_RFID_READER_FRAME_GAP_US
+#define CONFIG_RFID_READER_FRAME_GAP_US 5000
+#endif
+#ifndef CONFIG_RFID_READER_DEBOUNCE_MS
+#define CONFIG_RFID_READER_DEBOUNCE_MS 1500
+#endif
+#ifndef CONFIG_RFID_READER_ID
+#define CONFIG_RFID_READER_ID 1
+#endif
+#ifndef CONFIG_RFID_READER_TASK_PRIORITY
+#define CONFIG_RFID_READER_TASK_PRIORITY 10
+#endif
+#ifndef CONFIG_RFID_READER_TASK_CORE
+#define CONFIG_RFID_READER_TASK_CORE 1
+#endif
+
+#ifdef CONFIG_RFID_READER_RELAY_ACTIVE_LOW
+#define RFID_READER_RELAY_ON 0
+#else
+#define RFID_READER_RELAY_ON 1
+#endif
+
+#define RFID_READER_MAX_BITS    64
+#define RFID_READER_EDGE_RING   128          // Pulses buffered between ISR and task, a power of 2
+#define RFID_READER_TS_MASK     0x7FFFFFFFu  // Pulse timestamps keep 31 bits of esp_timer_get_time()
+#define RFID_READER_STACK_SIZE  3072
+
+esp_err_t rfid_reader_wiegand_decode(uint64_t bits, uint8_t num_bits, uint32_t *card_id)
+{
+    if (card_id == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (num_bits != 26 && num_bits != 34) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Leading even parity over the first half, trailing odd parity over the second half
+    uint8_t half = (num_bits - 2) / 2;
+    uint64_t half_mask = (1ULL << (half + 1)) - 1;
+    bool even_ok = (__builtin_popcountll((bits >> (num_bits - 1 - half)) & half_mask) % 2) == 0;
+    bool odd_ok = (__builtin_popcountll(bits & half_mask) % 2) == 1;
+    if (!even_ok || !odd_ok) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    *card_id = (uint32_t)((bits >> 1) & ((1ULL << (num_bits - 2)) - 1));
+    return ESP_OK;
+}
+
+#ifdef CONFIG_RFID_READER_ENABLE
+
+static const char *TAG = "rfid_reader";
+
+// Pulse ring, written only by the ISR (s_edge_head) and read only by the
+// reader task (s_edge_tail). Each entry is the 31 bit pulse time << 1 | bit.
+// The ISR is installed from the reader task, so both run on the same core.
+static uint32_t s_edges[RFID_READER_EDGE_RING];
+static volatile uint32_t s_edge_head = 0;
+static volatile uint32_t s_edge_tail = 0;
+static volatile bool s_edge_overflow = false;
+
+static TaskHandle_t s_task = NULL;
+static esp_timer_handle_t s_gap_timer = NULL;   // Closes a frame once the lines are quiet
+static esp_timer_handle_t s_relay_timer = NULL; // Releases the relay after CONFIG_RFID_READER_RELAY_PULSE_MS
+static rfid_reader_event_cb_t s_event_cb = NULL;
+static SemaphoreHandle_t s_setup_done = NULL;   // Given by the task once the GPIO setup finished
+static esp_err_t s_setup_err = ESP_OK;
+
+static app_metrics_histogram_t *s_metric_auth = NULL; // Last pulse to relay drive
+static app_metrics_counter_t *s_metric_parity = NULL;
+static app_metrics_counter_t *s_metric_length = NULL;
+static app_metrics_counter_t *s_metric_overflow = NULL;
+
+// Frame being received, only touched by the reader task
+typedef struct {
+    uint64_t bits;
+    uint8_t num_bits;
+    bool too_long;
+    uint32_t last_ts; // Timestamp of the last pulse
+} rfid_reader_frame_t;
+
+static uint32_t s_last_card = 0;
+static int64_t s_last_card_us = 0;
+
+/**
+ * @brief D0 / D1 falling edge: queue the bit, arg is its value
+ */
+static void IRAM_ATTR rfid_reader_isr(void *arg)
+{
+    uint32_t head = s_edge_head;
+    if (head - s_edge_tail >= RFID_READER_EDGE_RING) {
+        s_edge_overflow = true;
+        return;
+    }
+
+    uint32_t ts = (uint32_t)esp_timer_get_time() & RFID_READER_TS_MASK;
+    s_edges[head % RFID_READER_EDGE_RING] = (ts << 1) | (uint32_t)(uintptr_t)arg;
+    __atomic_store_n(&s_edge_head, head + 1, __ATOMIC_RELEASE);
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(s_task, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void rfid_reader_gap_timer_cb(void *arg)
+{
+    xTaskNotifyGive(s_task);
+}
+
+static void rfid_reader_relay_timer_cb(void *arg)
+{
+#if CONFIG_RFID_READER_RELAY_GPIO >= 0
+    gpio_set_level(CONFIG_RFID_READER_RELAY_GPIO, !RFID_READER_RELAY_ON);
+#endif
+}
+
+static uint32_t rfid_reader_ts_since(uint32_t now, uint32_t then)
+{
+    return (now - then) & RFID_READER_TS_MASK;
+}
+
+static bool rfid_reader_debounced(uint32_t card_id)
+{
+    int64_t now = esp_timer_get_time();
+    bool repeat = card_id == s_last_card && now - s_last_card_us < (int64_t)CONFIG_RFID_READER_DEBOUNCE_MS * 1000;
+    // A card held in front of the reader keeps extending the window
+    s_last_card = card_id;
+    s_last_card_us = now;
+    return repeat;
+}
+
+/**
+ * @brief Decodes a complete frame, checks the card and drives the relay
+ */
+static void rfid_reader_finish_frame(rfid_reader_frame_t *frame)
+{
+    uint32_t card_id = 0;
+    esp_err_t err = frame->too_long ? ESP_ERR_INVALID_SIZE
+                                    : rfid_reader_wiegand_decode(frame->bits, frame->num_bits, &card_id);
+    uint8_t num_bits = frame->num_bits;
+    uint32_t last_ts = frame->last_ts;
+    memset(frame, 0, sizeof(*frame));
+
+    if (err != ESP_OK) {
+        app_metrics_count(err == ESP_ERR_INVALID_CRC ? s_metric_parity : s_metric_length, 1);
+        ESP_LOGW(TAG, "Dropped %u bit frame: %s", num_bits, esp_err_to_name(err));
+        return;
+    }
+    if (rfid_reader_debounced(card_id)) {
+        return;
+    }
+
+    bool granted = rfid_manager_check_card_at(card_id, CONFIG_RFID_READER_ID);
+#if CONFIG_RFID_READER_RELAY_GPIO >= 0
+    if (granted) {
+        gpio_set_level(CONFIG_RFID_READER_RELAY_GPIO, RFID_READER_RELAY_ON);
+        esp_timer_stop(s_relay_timer); // Not running is fine, a new grant restarts the pulse
+        esp_timer_start_once(s_relay_timer, (uint64_t)CONFIG_RFID_READER_RELAY_PULSE_MS * 1000);
+    }
+#endif
+    uint32_t now = (uint32_t)esp_timer_get_time() & RFID_READER_TS_MASK;
+    app_metrics_observe(s_metric_auth, rfid_reader_ts_since(now, last_ts));
+
+    // Everything below is off the authorization path
+    ESP_LOGI(TAG, "Card 0x%08" PRIx32 " %s", card_id, granted ? "granted" : "denied");
+    if (s_event_cb != NULL) {
+        s_event_cb(card_id, granted);
+    }
+}
+
+/**
+ * @brief Configures the reader GPIOs and the ISR on the calling core
+ */
+static esp_err_t rfid_reader_setup_gpio(void)
+{
+    gpio_config_t input = {
+        .pin_bit_mask = (1ULL << CONFIG_RFID_READER_D0_GPIO) | (1ULL << CONFIG_RFID_READER_D1_GPIO),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE, // Wiegand lines idle high and pulse low
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    esp_err_t err = gpio_config(&input);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+#if CONFIG_RFID_READER_RELAY_GPIO >= 0
+    {
+        gpio_config_t relay = {
+            .pin_bit_mask = 1ULL << CONFIG_RFID_READER_RELAY_GPIO,
+            .mode = GPIO_MODE_OUTPUT,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        gpio_set_level(CONFIG_RFID_READER_RELAY_GPIO, !RFID_READER_RELAY_ON);
+        if ((err = gpio_config(&relay)) != ESP_OK) {
+            return err;
+        }
+    }
+#endif
+
+    // Another component may have installed the service already
+    err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
+    if ((err = gpio_isr_handler_add(CONFIG_RFID_READER_D0_GPIO, rfid_reader_isr, (void *)0)) != ESP_OK) {
+        return err;
+    }
+    return gpio_isr_handler_add(CONFIG_RFID_READER_D1_GPIO, rfid_reader_isr, (void *)1);
+}
+
+static void rfid_reader_task(void *pvParameters)
+{
+    rfid_reader_frame_t frame = {0};
+
+    s_setup_err = rfid_reader_setup_gpio();
+    xSemaphoreGive(s_setup_done);
+    if (s_setup_err != ESP_OK) {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    while (!app_boot_wait_ready(APP_BOOT_STORAGE_READY, 1000)) {
+        vTaskDelay(pdMS_TO_TICKS(100)); // Also keeps us from spinning if app_boot was never initialized
+    }
+    ESP_LOGI(TAG, "Reader %d ready on D0=%d D1=%d", CONFIG_RFID_READER_ID,
+             CONFIG_RFID_READER_D0_GPIO, CONFIG_RFID_READER_D1_GPIO);
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t head = __atomic_load_n(&s_edge_head, __ATOMIC_ACQUIRE);
+        uint32_t tail = s_edge_tail;
+        while (tail != head) {
+            uint32_t edge = s_edges[tail % RFID_READER_EDGE_RING];
+            tail++;
+            uint32_t ts = edge >> 1;
+
+            // The gap timer may fire late under load, the next frame's first pulse closes this one
+            if (frame.num_bits > 0 && rfid_reader_ts_since(ts, frame.last_ts) >= CONFIG_RFID_READER_FRAME_GAP_US) {
+                rfid_reader_finish_frame(&frame);
+            }
+            if (frame.num_bits < RFID_READER_MAX_BITS) {
+                frame.bits = (frame.bits << 1) | (edge & 1);
+            } else {
+                frame.too_long = true;
+            }
+            frame.num_bits += frame.num_bits < UINT8_MAX;
+            frame.last_ts = ts;
+        }
+        __atomic_store_n(&s_edge_tail, tail, __ATOMIC_RELEASE);
+
+        if (s_edge_overflow) {
+            s_edge_overflow = false;
+            app_metrics_count(s_metric_overflow, 1);
+            ESP_LOGW(TAG, "Pulse ring overflow, frame dropped");
+            memset(&frame, 0, sizeof(frame));
+            continue;
+        }
+        if (frame.num_bits == 0) {
+            continue;
+        }
+
+        uint32_t now = (uint32_t)esp_timer_get_time() & RFID_READER_TS_MASK;
+        uint32_t quiet = rfid_reader_ts_since(now, frame.last_ts);
+        if (quiet >= CONFIG_RFID_READER_FRAME_GAP_US) {
+            rfid_reader_finish_frame(&frame);
+        } else {
+            esp_timer_stop(s_gap_timer);
+            esp_timer_start_once(s_gap_timer, CONFIG_RFID_READER_FRAME_GAP_US - quiet);
+        }
+    }
+}
+
+esp_err_t rfid_reader_start(void)
+{
+    if (s_task != NULL) {
+        return ESP_OK;
+    }
+
+    s_metric_auth = app_metrics_histogram("rfid_reader_auth_us", "reader", "wiegand");
+    s_metric_parity = app_metrics_counter("rfid_reader_errors_total", "kind", "parity");
+    s_metric_length = app_metrics_counter("rfid_reader_errors_total", "kind", "length");
+    s_metric_overflow = app_metrics_counter("rfid_reader_errors_total", "kind", "overflow");
+
+    const esp_timer_create_args_t gap_args = {
+        .callback = rfid_reader_gap_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "rfid_reader_gap",
+    };
+    const esp_timer_create_args_t relay_args = {
+        .callback = rfid_reader_relay_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "rfid_relay",
+    };
+    s_setup_done = xSemaphoreCreateBinary();
+    if (s_setup_done == NULL ||
+        esp_timer_create(&gap_args, &s_gap_timer) != ESP_OK ||
+        esp_timer_create(&relay_args, &s_relay_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create reader timers");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreatePinnedToCore(rfid_reader_task, "rfid_reader", RFID_READER_STACK_SIZE, NULL,
+                                CONFIG_RFID_READER_TASK_PRIORITY, &s_task, CONFIG_RFID_READER_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create reader task");
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(s_setup_done, portMAX_DELAY);
+    if (s_setup_err != ESP_OK) {
+        ESP_LOGE(TAG, "Reader GPIO setup failed: %s", esp_err_to_name(s_setup_err));
+        s_task = NULL; // The task deleted itself
+    }
+    return s_setup_err;
+}
+
+void rfid_reader_set_event_callback(rfid_reader_event_cb_t callback)
+{
+    s_event_cb = callback;
+}
+
+#else // CONFIG_RFID_READER_ENABLE
+
+esp_err_t rfid_reader_start(void)
+{
+    return ESP_OK;
+}
+
+void rfid_reader_set_event_callback(rfid_reader_event_cb_t callback)
+{
+}
+
+#endif // CONFIG_RFID_READER_ENABLE
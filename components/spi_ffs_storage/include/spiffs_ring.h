@@ -0,0 +1,90 @@
+#ifndef SPIFFS_RING_H
+#define SPIFFS_RING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Bounded FIFO of fixed size records in one SPIFFS file. The file holds a
+ * small header (head, count, CRC) followed by the record slots. The file is
+ * preallocated, so it never grows, and once the ring is full a push
+ * overwrites the oldest records.
+ *
+ * A push writes the records first and the header last, so a power loss in
+ * between loses only the records of that push. A header with a bad CRC, or
+ * one created for another record size or capacity, resets the ring.
+ *
+ * A ring keeps its file open between calls and is not thread safe, callers
+ * serialize access themselves.
+ */
+typedef struct
+{
+    FILE *file;
+    uint16_t record_size;
+    uint32_t capacity;
+    uint32_t head;   // Slot of the oldest record
+    uint32_t count;  // Records stored
+} spiffs_ring_t;
+
+/**
+ * @brief Opens a ring file, creating or resetting it if needed
+ *
+ * @param ring Ring to initialize
+ * @param path File path, e.g. "/spiffs/telemetry.q"
+ * @param record_size Size of one record in bytes
+ * @param capacity Number of record slots
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on bad arguments,
+ *         ESP_FAIL if the file can not be opened or preallocated
+ */
+esp_err_t spiffs_ring_open(spiffs_ring_t *ring, const char *path, uint16_t record_size, uint32_t capacity);
+
+/**
+ * @brief Closes the ring file, the records stay on flash
+ */
+void spiffs_ring_close(spiffs_ring_t *ring);
+
+/**
+ * @brief Appends records, overwriting the oldest ones once the ring is full
+ *
+ * @param ring An open ring
+ * @param records Array of n records of ring->record_size bytes
+ * @param n Number of records
+ * @param num_overwritten Optional, filled with the number of old records lost
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on I/O errors
+ */
+esp_err_t spiffs_ring_push(spiffs_ring_t *ring, const void *records, uint32_t n, uint32_t *num_overwritten);
+
+/**
+ * @brief Copies records without removing them
+ *
+ * @param ring An open ring
+ * @param index Position to start at, 0 is the oldest record
+ * @param records Buffer for up to n records
+ * @param n Maximum number of records to copy
+ * @param num_read Filled with the number of records copied
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on I/O errors
+ */
+esp_err_t spiffs_ring_read(spiffs_ring_t *ring, uint32_t index, void *records, uint32_t n, uint32_t *num_read);
+
+/**
+ * @brief Removes the n oldest records
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on I/O errors
+ */
+esp_err_t spiffs_ring_pop(spiffs_ring_t *ring, uint32_t n);
+
+/**
+ * @brief Removes all records
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on I/O errors
+ */
+esp_err_t spiffs_ring_clear(spiffs_ring_t *ring);
+
+/**
+ * @brief Number of records stored
+ */
+static inline uint32_t spiffs_ring_count(const spiffs_ring_t *ring)
+{
+    return ring->file != NULL ? ring->count : 0;
+}
+
+#endif // SPIFFS_RING_H
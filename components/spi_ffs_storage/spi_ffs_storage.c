@@ -33,6 +33,9 @@ void spiffs_storage_init(void)
         return;
     }
 
+#ifdef CONFIG_SPIFFS_STORAGE_CHECK_ON_BOOT
+    // A full check reads the whole partition and can take seconds; by default
+    // it only runs when the partition info below looks inconsistent
     ESP_LOGI(TAG, "Performing SPIFFS_check().");
     ret = esp_spiffs_check(conf.partition_label);
     if (ret != ESP_OK)
@@ -44,6 +47,7 @@ void spiffs_storage_init(void)
     {
         ESP_LOGI(TAG, "SPIFFS_check() successful");
     }
+#endif
 
     size_t total = 0, used = 0;
     ret = esp_spiffs_info(conf.partition_label, &total, &used);
@@ -0,0 +1,265 @@
+#include "spiffs_ring.h"
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "SPIFFS_RING";
+
+#define SPIFFS_RING_MAGIC 0x31474E52  // "RNG1"
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t record_size;
+    uint16_t reserved;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    uint32_t crc;  // CRC32 of all preceding bytes of the header
+} spiffs_ring_header_t;
+
+static uint32_t spiffs_ring_header_crc(const spiffs_ring_header_t *header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(spiffs_ring_header_t, crc));
+}
+
+static long spiffs_ring_slot_offset(const spiffs_ring_t *ring, uint32_t slot)
+{
+    return (long)sizeof(spiffs_ring_header_t) + (long)slot * ring->record_size;
+}
+
+static esp_err_t spiffs_ring_write_header(spiffs_ring_t *ring)
+{
+    spiffs_ring_header_t header = {
+        .magic = SPIFFS_RING_MAGIC,
+        .record_size = ring->record_size,
+        .capacity = ring->capacity,
+        .head = ring->head,
+        .count = ring->count,
+    };
+    header.crc = spiffs_ring_header_crc(&header);
+
+    if (fseek(ring->file, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, ring->file) != 1 ||
+        fflush(ring->file) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to write ring header");
+        return ESP_FAIL;
+    }
+    fsync(fileno(ring->file));
+    return ESP_OK;
+}
+
+/**
+ * @brief Creates the file with every slot allocated, so it never grows later
+ */
+static esp_err_t spiffs_ring_create(spiffs_ring_t *ring, const char *path)
+{
+    ring->file = fopen(path, "w+b");
+    if (ring->file == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        return ESP_FAIL;
+    }
+
+    ring->head = 0;
+    ring->count = 0;
+    if (spiffs_ring_write_header(ring) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    uint8_t zeros[64] = {0};
+    size_t remaining = (size_t)ring->capacity * ring->record_size;
+    while (remaining > 0)
+    {
+        size_t chunk = remaining < sizeof(zeros) ? remaining : sizeof(zeros);
+        if (fwrite(zeros, 1, chunk, ring->file) != chunk)
+        {
+            ESP_LOGE(TAG, "Failed to preallocate %s, filesystem full?", path);
+            return ESP_FAIL;
+        }
+        remaining -= chunk;
+    }
+    fflush(ring->file);
+
+    ESP_LOGI(TAG, "Created %s, %lu slots of %u bytes", path, (unsigned long)ring->capacity, ring->record_size);
+    return ESP_OK;
+}
+
+esp_err_t spiffs_ring_open(spiffs_ring_t *ring, const char *path, uint16_t record_size, uint32_t capacity)
+{
+    if (ring == NULL || path == NULL || record_size == 0 || capacity == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->record_size = record_size;
+    ring->capacity = capacity;
+
+    ring->file = fopen(path, "r+b");
+    if (ring->file != NULL)
+    {
+        spiffs_ring_header_t header;
+        if (fread(&header, sizeof(header), 1, ring->file) == 1 &&
+            header.magic == SPIFFS_RING_MAGIC && header.crc == spiffs_ring_header_crc(&header) &&
+            header.record_size == record_size && header.capacity == capacity &&
+            header.head < capacity && header.count <= capacity)
+        {
+            ring->head = header.head;
+            ring->count = header.count;
+            ESP_LOGI(TAG, "Opened %s with %lu records", path, (unsigned long)ring->count);
+            return ESP_OK;
+        }
+
+        ESP_LOGW(TAG, "%s has an invalid or different header, resetting it", path);
+        fclose(ring->file);
+        ring->file = NULL;
+    }
+
+    esp_err_t err = spiffs_ring_create(ring, path);
+    if (err != ESP_OK)
+    {
+        spiffs_ring_close(ring);
+        unlink(path);
+    }
+    return err;
+}
+
+void spiffs_ring_close(spiffs_ring_t *ring)
+{
+    if (ring != NULL && ring->file != NULL)
+    {
+        fclose(ring->file);
+        ring->file = NULL;
+    }
+}
+
+esp_err_t spiffs_ring_push(spiffs_ring_t *ring, const void *records, uint32_t n, uint32_t *num_overwritten)
+{
+    if (ring == NULL || ring->file == NULL || (records == NULL && n > 0))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint8_t *src = records;
+    uint32_t overwritten = 0;
+
+    // Only the last 'capacity' records of a huge push can survive
+    if (n > ring->capacity)
+    {
+        overwritten += n - ring->capacity;
+        src += (size_t)(n - ring->capacity) * ring->record_size;
+        n = ring->capacity;
+    }
+
+    uint32_t written = 0;
+    while (written < n)
+    {
+        // Write up to the end of the slot area in one go
+        uint32_t slot = (ring->head + ring->count + written) % ring->capacity;
+        uint32_t run = ring->capacity - slot;
+        if (run > n - written)
+        {
+            run = n - written;
+        }
+        if (fseek(ring->file, spiffs_ring_slot_offset(ring, slot), SEEK_SET) != 0 ||
+            fwrite(src + (size_t)written * ring->record_size, ring->record_size, run, ring->file) != run)
+        {
+            ESP_LOGE(TAG, "Failed to write records");
+            return ESP_FAIL;
+        }
+        written += run;
+    }
+
+    uint32_t total = ring->count + n;
+    if (total > ring->capacity)
+    {
+        uint32_t lost = total - ring->capacity;
+        ring->head = (ring->head + lost) % ring->capacity;
+        overwritten += lost;
+        total = ring->capacity;
+    }
+    ring->count = total;
+
+    if (num_overwritten != NULL)
+    {
+        *num_overwritten = overwritten;
+    }
+    return spiffs_ring_write_header(ring);
+}
+
+esp_err_t spiffs_ring_read(spiffs_ring_t *ring, uint32_t index, void *records, uint32_t n, uint32_t *num_read)
+{
+    if (ring == NULL || ring->file == NULL || records == NULL || num_read == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *num_read = 0;
+    if (index >= ring->count)
+    {
+        return ESP_OK;
+    }
+    if (n > ring->count - index)
+    {
+        n = ring->count - index;
+    }
+
+    uint8_t *dst = records;
+    uint32_t done = 0;
+    while (done < n)
+    {
+        uint32_t slot = (ring->head + index + done) % ring->capacity;
+        uint32_t run = ring->capacity - slot;
+        if (run > n - done)
+        {
+            run = n - done;
+        }
+        if (fseek(ring->file, spiffs_ring_slot_offset(ring, slot), SEEK_SET) != 0 ||
+            fread(dst + (size_t)done * ring->record_size, ring->record_size, run, ring->file) != run)
+        {
+            ESP_LOGE(TAG, "Failed to read records");
+            return ESP_FAIL;
+        }
+        done += run;
+    }
+
+    *num_read = done;
+    return ESP_OK;
+}
+
+esp_err_t spiffs_ring_pop(spiffs_ring_t *ring, uint32_t n)
+{
+    if (ring == NULL || ring->file == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (n > ring->count)
+    {
+        n = ring->count;
+    }
+    if (n == 0)
+    {
+        return ESP_OK;
+    }
+    ring->head = (ring->head + n) % ring->capacity;
+    ring->count -= n;
+    return spiffs_ring_write_header(ring);
+}
+
+esp_err_t spiffs_ring_clear(spiffs_ring_t *ring)
+{
+    if (ring == NULL || ring->file == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ring->head = 0;
+    ring->count = 0;
+    return spiffs_ring_write_header(ring);
+}
@@ -0,0 +1,362 @@
+/* RFID Manager host benchmark
+ *
+ * The card database and the DNS reply builder on the ESP-IDF Linux target:
+ * the same code as on the chip, with the card files in a host directory
+ * (CONFIG_RFID_STORAGE_BASE_PATH). Runs the operations far more often than
+ * the on-device benchmark in bench/ can, so algorithm changes show up in
+ * seconds. Output uses the BENCH line format of bench/, so
+ * bench/compare_bench.py diffs two host runs as well:
+ *
+ *   BENCH {"bench":"check_card_hit","cards":20000,"n":200000,"p50_us":0.071,...}
+ *
+ * Timings are wall clock and include the FreeRTOS simulator, compare runs
+ * on the same machine only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_idf_version.h"
+#include "rfid_manager.h"
+#include "dns_packet.h"
+
+static const char *TAG = "RFID_HOST_BENCH";
+
+#define BENCH_LOOKUPS      200000     // check_card calls per percentile run
+#define BENCH_DNS_QUERIES  200000     // dns_build_reply calls per percentile run
+#define BENCH_DNS_NAMES    64         // Distinct names of the uncached run, more than the reply cache holds
+#define BENCH_CARD_ID_BASE 0xBE000000 // Benchmark cards, away from the default cards
+#define BENCH_MISS_ID_BASE 0xDE000000 // Never added
+#define BENCH_NUM_LEVELS   3
+#define BENCH_LOG_FLUSH_EVERY (CONFIG_RFID_ACCESS_LOG_STAGING / 2) // Like the main loop, so checks are logged rather than dropped
+
+static uint32_t s_samples[BENCH_LOOKUPS > BENCH_DNS_QUERIES ? BENCH_LOOKUPS : BENCH_DNS_QUERIES];
+static uint32_t s_lcg_state;
+static int s_failures;
+
+// Live bench cards are bench_card_id(s_first_live) .. bench_card_id(s_next_card - 1),
+// as in bench/main/bench_main.c
+static uint32_t s_first_live;
+static uint32_t s_next_card;
+
+/**
+ * @brief Deterministic pseudo random numbers, so every run does the same lookups
+ */
+static uint32_t bench_rand(void)
+{
+    s_lcg_state = s_lcg_state * 1664525u + 1013904223u;
+    return s_lcg_state;
+}
+
+static uint32_t bench_card_id(uint32_t i)
+{
+    return BENCH_CARD_ID_BASE + i * 7u + 1u;
+}
+
+static int64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double bench_elapsed_ms(int64_t start_ns)
+{
+    return (double)(bench_now_ns() - start_ns) / 1e6;
+}
+
+static int bench_compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Sorts s_samples[0..n), in ns, and prints their percentiles
+ */
+static void bench_report_percentiles(const char *bench, uint16_t cards, uint32_t n)
+{
+    qsort(s_samples, n, sizeof(s_samples[0]), bench_compare_u32);
+    printf("BENCH {\"bench\":\"%s\",\"cards\":%u,\"n\":%" PRIu32 ",\"p50_us\":%.3f,\"p90_us\":%.3f,"
+           "\"p99_us\":%.3f,\"max_us\":%.3f}\n",
+           bench, cards, n,
+           s_samples[n / 2] / 1000.0,
+           s_samples[(n * 90) / 100] / 1000.0,
+           s_samples[(n * 99) / 100] / 1000.0,
+           s_samples[n - 1] / 1000.0);
+}
+
+/**
+ * @brief Adds n new bench cards
+ * @return true if all were added
+ */
+static bool bench_add_cards(uint32_t n)
+{
+    char name[RFID_CARD_NAME_LEN];
+    for (uint32_t i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "Bench %" PRIu32, s_next_card);
+        if (rfid_manager_add_card(bench_card_id(s_next_card), name) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to add bench card %" PRIu32, s_next_card);
+            s_failures++;
+            return false;
+        }
+        s_next_card++;
+    }
+    return true;
+}
+
+/**
+ * @brief Removes the n oldest bench cards
+ */
+static void bench_remove_cards(uint32_t n)
+{
+    for (uint32_t i = 0; i < n && s_first_live < s_next_card; i++) {
+        rfid_manager_remove_card(bench_card_id(s_first_live++));
+    }
+}
+
+/**
+ * @brief Times rfid_manager_check_card() for cards that are, or are not, in the database
+ */
+static void bench_check_card(uint16_t cards)
+{
+    uint32_t live = s_next_card - s_first_live;
+    s_lcg_state = 12345;
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint32_t id = bench_card_id(s_first_live + bench_rand() % live);
+        int64_t start = bench_now_ns();
+        bool found = rfid_manager_check_card(id);
+        s_samples[i] = (uint32_t)(bench_now_ns() - start);
+        if (!found) {
+            ESP_LOGE(TAG, "Card 0x%08" PRIx32 " missing", id);
+            s_failures++;
+        }
+        if ((i + 1) % BENCH_LOG_FLUSH_EVERY == 0) {
+            // Staged access log records go to the file outside the timed calls
+            rfid_access_log_flush();
+        }
+    }
+    bench_report_percentiles("check_card_hit", cards, BENCH_LOOKUPS);
+
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint32_t id = BENCH_MISS_ID_BASE + (bench_rand() & 0xFFFFF);
+        int64_t start = bench_now_ns();
+        rfid_manager_check_card(id);
+        s_samples[i] = (uint32_t)(bench_now_ns() - start);
+        if ((i + 1) % BENCH_LOG_FLUSH_EVERY == 0) {
+            rfid_access_log_flush();
+        }
+    }
+    bench_report_percentiles("check_card_miss", cards, BENCH_LOOKUPS);
+    rfid_access_log_flush();
+}
+
+/**
+ * @brief Times rfid_manager_get_card_list_json() over the whole database
+ */
+static void bench_json(uint16_t cards)
+{
+    size_t len = (size_t)cards * 96 + 64;
+    char *buffer = malloc(len);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "No memory for a %u byte JSON buffer", (unsigned)len);
+        s_failures++;
+        return;
+    }
+
+    const uint32_t runs = 50;
+    for (uint32_t i = 0; i < runs; i++) {
+        int64_t start = bench_now_ns();
+        if (rfid_manager_get_card_list_json(buffer, len) != ESP_OK) {
+            ESP_LOGE(TAG, "Card list JSON does not fit in %u bytes", (unsigned)len);
+            s_failures++;
+            free(buffer);
+            return;
+        }
+        s_samples[i] = (uint32_t)(bench_now_ns() - start);
+    }
+    size_t out_len = strlen(buffer);
+    free(buffer);
+
+    qsort(s_samples, runs, sizeof(s_samples[0]), bench_compare_u32);
+    printf("BENCH {\"bench\":\"card_list_json\",\"cards\":%u,\"n\":%" PRIu32 ",\"p50_us\":%.3f,"
+           "\"max_us\":%.3f,\"bytes\":%u}\n",
+           cards, runs, s_samples[runs / 2] / 1000.0, s_samples[runs - 1] / 1000.0, (unsigned)out_len);
+}
+
+/**
+ * @brief Fills the database up to target cards and runs every benchmark at that size
+ *
+ * @param target Total card count for this level
+ */
+static void bench_level(uint16_t target)
+{
+    uint16_t before = rfid_manager_get_card_count();
+    if (target <= before) {
+        return;
+    }
+    uint16_t to_add = target - before;
+
+    // Adds only touch RAM while the cache timer is far away
+    int64_t start = bench_now_ns();
+    if (!bench_add_cards(to_add)) {
+        return;
+    }
+    double add_ms = bench_elapsed_ms(start);
+    printf("BENCH {\"bench\":\"add_card\",\"cards\":%u,\"n\":%u,\"total_ms\":%.3f,\"per_s\":%.1f}\n",
+           target, to_add, add_ms, add_ms > 0 ? to_add * 1000.0 / add_ms : 0.0);
+
+    start = bench_now_ns();
+    rfid_manager_flush_cache();
+    printf("BENCH {\"bench\":\"save_batch\",\"cards\":%u,\"n\":%u,\"total_ms\":%.3f}\n",
+           target, to_add, bench_elapsed_ms(start));
+
+    // One card replaced, the common case once the database is set up
+    bench_remove_cards(1);
+    bench_add_cards(1);
+    start = bench_now_ns();
+    rfid_manager_flush_cache();
+    printf("BENCH {\"bench\":\"save_one\",\"cards\":%u,\"total_ms\":%.3f}\n", target, bench_elapsed_ms(start));
+
+    // Deinit writes nothing here (cache flushed), init reads the card file and journal
+    rfid_manager_deinit();
+    start = bench_now_ns();
+    esp_err_t ret = rfid_manager_init();
+    printf("BENCH {\"bench\":\"load\",\"cards\":%u,\"total_ms\":%.3f}\n", target, bench_elapsed_ms(start));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Reload failed: %s", esp_err_to_name(ret));
+        s_failures++;
+        return;
+    }
+    if (rfid_manager_get_card_count() != target) {
+        ESP_LOGE(TAG, "Reloaded %u cards, expected %u", rfid_manager_get_card_count(), target);
+        s_failures++;
+    }
+    rfid_manager_set_cache_timeout(60 * 1000);
+
+    bench_check_card(target);
+    bench_json(target);
+
+    // Replace half of the bench cards, restoring the level
+    uint32_t to_remove = (s_next_card - s_first_live) / 2;
+    start = bench_now_ns();
+    bench_remove_cards(to_remove);
+    double remove_ms = bench_elapsed_ms(start);
+    printf("BENCH {\"bench\":\"remove_card\",\"cards\":%u,\"n\":%" PRIu32 ",\"total_ms\":%.3f,\"per_s\":%.1f}\n",
+           target, to_remove, remove_ms, remove_ms > 0 ? to_remove * 1000.0 / remove_ms : 0.0);
+    bench_add_cards(to_remove);
+    rfid_manager_flush_cache();
+}
+
+/**
+ * @brief Writes a one question query for name into packet
+ * @return Length of the query
+ */
+static int bench_dns_query(uint8_t *packet, const char *name, uint16_t type)
+{
+    static const uint8_t header[12] = { 0x12, 0x34, 0x01, 0x00, 0x00, 0x01 }; // RD, one question
+    memcpy(packet, header, sizeof(header));
+    int len = sizeof(header);
+    while (*name != '\0') {
+        const char *dot = strchr(name, '.');
+        int label_len = (dot != NULL) ? (int)(dot - name) : (int)strlen(name);
+        packet[len++] = (uint8_t)label_len;
+        memcpy(packet + len, name, label_len);
+        len += label_len;
+        name += label_len + (dot != NULL ? 1 : 0);
+    }
+    packet[len++] = 0;
+    packet[len++] = type >> 8;
+    packet[len++] = type & 0xFF;
+    packet[len++] = 0x00;
+    packet[len++] = 0x01; // Class IN
+    return len;
+}
+
+/**
+ * @brief Times dns_build_reply() for repeated (cached), rotating and non-A questions
+ */
+static void bench_dns(void)
+{
+    static uint8_t queries[BENCH_DNS_NAMES][512];
+    static int query_lens[BENCH_DNS_NAMES];
+    uint8_t packet[512];
+    char name[64];
+
+    dns_set_answer_ip(0x0104A8C0); // 192.168.4.1 in network order
+    for (int i = 0; i < BENCH_DNS_NAMES; i++) {
+        snprintf(name, sizeof(name), "host%d.connectivitycheck.gstatic.com", i);
+        query_lens[i] = bench_dns_query(queries[i], name, 0x0001);
+    }
+
+    const struct {
+        const char *bench;
+        int names;     // Queries rotated through
+        uint16_t type; // Question type of the queries
+    } runs[] = {
+        { "dns_a_cached", 1, 0x0001 },
+        { "dns_a_uncached", BENCH_DNS_NAMES, 0x0001 },
+        { "dns_aaaa_cached", 1, 0x001C },
+    };
+    for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+        if (runs[r].type != 0x0001) {
+            query_lens[0] = bench_dns_query(queries[0], "host0.connectivitycheck.gstatic.com", runs[r].type);
+        }
+        for (uint32_t i = 0; i < BENCH_DNS_QUERIES; i++) {
+            int q = i % runs[r].names;
+            memcpy(packet, queries[q], query_lens[q]);
+            int64_t start = bench_now_ns();
+            int reply_len = dns_build_reply(packet, query_lens[q], sizeof(packet));
+            s_samples[i] = (uint32_t)(bench_now_ns() - start);
+            if (reply_len <= query_lens[q]) {
+                ESP_LOGE(TAG, "No reply to query %d of %s", q, runs[r].bench);
+                s_failures++;
+                break;
+            }
+        }
+        bench_report_percentiles(runs[r].bench, 0, BENCH_DNS_QUERIES);
+    }
+}
+
+void app_main(void)
+{
+    printf("BENCH {\"bench\":\"meta\",\"version\":\"host\",\"idf\":\"%s\",\"cpu_mhz\":0,\"max_cards\":%u}\n",
+           esp_get_idf_version(), RFID_MAX_CARDS);
+
+    int64_t start = bench_now_ns();
+    if (rfid_manager_init() != ESP_OK) {
+        ESP_LOGE(TAG, "rfid_manager_init() failed, is %s writable?", CONFIG_RFID_STORAGE_BASE_PATH);
+        exit(1);
+    }
+    printf("BENCH {\"bench\":\"init\",\"cards\":%u,\"total_ms\":%.3f}\n",
+           rfid_manager_get_card_count(), bench_elapsed_ms(start));
+
+    start = bench_now_ns();
+    rfid_manager_format_database();
+    printf("BENCH {\"bench\":\"format\",\"cards\":%u,\"total_ms\":%.3f}\n",
+           rfid_manager_get_card_count(), bench_elapsed_ms(start));
+    rfid_manager_set_cache_timeout(60 * 1000);
+
+    const uint16_t levels[BENCH_NUM_LEVELS] = {
+        RFID_MAX_CARDS / 4, RFID_MAX_CARDS / 2, RFID_MAX_CARDS
+    };
+    for (int i = 0; i < BENCH_NUM_LEVELS; i++) {
+        bench_level(levels[i]);
+    }
+
+    rfid_manager_format_database();
+    rfid_manager_set_cache_timeout(RFID_DEFAULT_CACHE_TIMEOUT_MS);
+    rfid_manager_deinit();
+
+    bench_dns();
+
+    printf("BENCH_DONE\n");
+    // The simulator keeps running after app_main() returns, the exit code tells CI how it went
+    exit(s_failures == 0 ? 0 : 1);
+}
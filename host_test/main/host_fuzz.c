@@ -0,0 +1,268 @@
+/* RFID Manager and DNS fuzz target
+ *
+ * libFuzzer target for the parsers that read untrusted bytes: the DNS reply
+ * builder, and the card images and journal that rfid_manager_init() reads
+ * back from flash. The first input byte picks the target, the rest is the
+ * packet or file:
+ *
+ *   0  DNS query given to dns_build_reply()
+ *   1  Card image in rfid_cards.a
+ *   2  Headerless card file of older firmware (rfid_cards.dat)
+ *   3  Journal replayed over a valid image of the default cards
+ *
+ * Besides crashes and sanitizer reports, a card file must always load, and
+ * whatever was loaded must come back unchanged after a save and a reload.
+ * The build ignores file checksums (RFID_PORT_CRC_OK()), so inputs get past
+ * them into the record parsers.
+ *
+ *   CC=clang idf.py -B build_fuzz -DHOST_TEST_FUZZ=ON --preview set-target linux build
+ *   mkdir -p corpus && build_fuzz/rfid_host_test.elf -max_total_time=60 corpus
+ *
+ * The FreeRTOS simulator owns main(), so libFuzzer is started from a task
+ * with LLVMFuzzerRunDriver() and the command line of the process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "rfid_manager.h"
+#include "rfid_port.h"
+#include "dns_packet.h"
+
+static const char *TAG = "RFID_HOST_FUZZ";
+
+// File names of rfid_manager.c
+#define FUZZ_STORE_FILE_A   RFID_PORT_PATH("rfid_cards.a")
+#define FUZZ_STORE_FILE_B   RFID_PORT_PATH("rfid_cards.b")
+#define FUZZ_STORE_TEMP     RFID_PORT_PATH("rfid_cards.tmp")
+#define FUZZ_JOURNAL_FILE   RFID_PORT_PATH("rfid_cards.jnl")
+#define FUZZ_LEGACY_FILE    RFID_PORT_PATH("rfid_cards.dat")
+
+#define FUZZ_DNS_MAX_LEN    512        // DNS_MAX_LEN of dns_server.c
+#define FUZZ_CARD_ID        0xF0221234 // Added between the two loads
+#define FUZZ_TASK_STACK     (1024 * 1024)
+#define FUZZ_MAX_ARGS       64
+
+enum {
+    FUZZ_TARGET_DNS,
+    FUZZ_TARGET_CARD_IMAGE,
+    FUZZ_TARGET_LEGACY_FILE,
+    FUZZ_TARGET_JOURNAL,
+    FUZZ_TARGETS
+};
+
+int LLVMFuzzerRunDriver(int *argc, char ***argv, int (*callback)(const uint8_t *data, size_t size));
+
+// Image of the default cards, the base the journal target replays onto
+static uint8_t *s_base_image;
+static size_t s_base_image_len;
+static const char *s_base_image_path;
+
+static rfid_card_t s_before[RFID_MAX_CARDS + 1];
+static rfid_card_t s_after[RFID_MAX_CARDS + 1];
+
+static void fuzz_remove_files(void)
+{
+    remove(FUZZ_STORE_FILE_A);
+    remove(FUZZ_STORE_FILE_B);
+    remove(FUZZ_STORE_TEMP);
+    remove(FUZZ_JOURNAL_FILE);
+    remove(FUZZ_LEGACY_FILE);
+}
+
+static void fuzz_write_file(const char *path, const uint8_t *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(data, 1, size, f) != size || fclose(f) != 0) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        abort();
+    }
+}
+
+static uint8_t *fuzz_read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(len > 0 ? len : 1);
+    if (data == NULL || fread(data, 1, len, f) != (size_t)len) {
+        abort();
+    }
+    fclose(f);
+    *size = len;
+    return data;
+}
+
+static int fuzz_compare_cards(const void *a, const void *b)
+{
+    uint32_t x = ((const rfid_card_t *)a)->card_id;
+    uint32_t y = ((const rfid_card_t *)b)->card_id;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Lists the active cards sorted by id, checking what every card must satisfy
+ * @return Number of cards in cards
+ */
+static uint16_t fuzz_list_cards(rfid_card_t *cards)
+{
+    uint16_t count = 0;
+    if (rfid_manager_list_cards(cards, RFID_MAX_CARDS + 1, &count) != ESP_OK || count > RFID_MAX_CARDS ||
+        count != rfid_manager_get_card_count()) {
+        abort();
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        rfid_card_t card;
+        if (cards[i].card_id == 0 || strnlen(cards[i].name, RFID_CARD_NAME_LEN) == RFID_CARD_NAME_LEN ||
+            rfid_manager_get_card(cards[i].card_id, &card) != ESP_OK || !card.active) {
+            abort();
+        }
+    }
+    qsort(cards, count, sizeof(cards[0]), fuzz_compare_cards);
+    return count;
+}
+
+/**
+ * @brief Loads the card files in place, then checks that a save and reload keep the cards
+ */
+static void fuzz_load_cards(void)
+{
+    if (rfid_manager_init() != ESP_OK) {
+        abort(); // Damaged files must fall back to the other copy or the defaults
+    }
+    rfid_manager_set_cache_timeout(60 * 1000);
+    uint16_t count = fuzz_list_cards(s_before);
+
+    // One change on top makes the save go through the journal as well
+    if (rfid_manager_add_card(FUZZ_CARD_ID, "Fuzz") == ESP_OK) {
+        s_before[count] = (rfid_card_t){ .card_id = FUZZ_CARD_ID, .active = 1, .name = "Fuzz" };
+        count++;
+        qsort(s_before, count, sizeof(s_before[0]), fuzz_compare_cards);
+    }
+    rfid_manager_deinit();
+
+    if (rfid_manager_init() != ESP_OK || fuzz_list_cards(s_after) != count) {
+        abort();
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        if (s_before[i].card_id != s_after[i].card_id || strcmp(s_before[i].name, s_after[i].name) != 0) {
+            ESP_LOGE(TAG, "Card 0x%08" PRIx32 " changed across a reload", s_before[i].card_id);
+            abort();
+        }
+    }
+    rfid_manager_deinit();
+}
+
+static void fuzz_dns(const uint8_t *data, size_t size)
+{
+    uint8_t packet[FUZZ_DNS_MAX_LEN];
+    int len = size < sizeof(packet) ? (int)size : (int)sizeof(packet);
+    memcpy(packet, data, len);
+    int reply_len = dns_build_reply(packet, len, sizeof(packet));
+    if (reply_len > (int)sizeof(packet) || (reply_len > 0 && !(packet[2] & 0x80))) {
+        abort(); // Longer than the buffer, or not marked as a response
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    uint8_t target = data[0] % FUZZ_TARGETS;
+    data++;
+    size--;
+
+    switch (target) {
+    case FUZZ_TARGET_DNS:
+        fuzz_dns(data, size);
+        break;
+    case FUZZ_TARGET_CARD_IMAGE:
+        fuzz_remove_files();
+        fuzz_write_file(FUZZ_STORE_FILE_A, data, size);
+        fuzz_load_cards();
+        break;
+    case FUZZ_TARGET_LEGACY_FILE:
+        fuzz_remove_files();
+        fuzz_write_file(FUZZ_LEGACY_FILE, data, size);
+        fuzz_load_cards();
+        break;
+    case FUZZ_TARGET_JOURNAL:
+        fuzz_remove_files();
+        fuzz_write_file(s_base_image_path, s_base_image, s_base_image_len);
+        fuzz_write_file(FUZZ_JOURNAL_FILE, data, size);
+        fuzz_load_cards();
+        break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the default cards once and keeps their image for the journal target
+ */
+static void fuzz_prepare_base_image(void)
+{
+    fuzz_remove_files();
+    if (rfid_manager_init() != ESP_OK) {
+        ESP_LOGE(TAG, "rfid_manager_init() failed, is %s writable?", CONFIG_RFID_STORAGE_BASE_PATH);
+        exit(1);
+    }
+    rfid_manager_deinit();
+
+    s_base_image_path = FUZZ_STORE_FILE_A;
+    s_base_image = fuzz_read_file(s_base_image_path, &s_base_image_len);
+    if (s_base_image == NULL) {
+        s_base_image_path = FUZZ_STORE_FILE_B;
+        s_base_image = fuzz_read_file(s_base_image_path, &s_base_image_len);
+    }
+    if (s_base_image == NULL) {
+        ESP_LOGE(TAG, "No card image written");
+        exit(1);
+    }
+}
+
+static void fuzz_task(void *arg)
+{
+    fuzz_prepare_base_image();
+    dns_set_answer_ip(0x0104A8C0); // 192.168.4.1 in network order
+
+    // The simulator keeps the ticks on SIGALRM and libFuzzer would use it for
+    // -timeout, so that is off; the caller's arguments follow and can add more
+    static char *args[FUZZ_MAX_ARGS];
+    static char cmdline[4096];
+    int argc = 0;
+    args[argc++] = "rfid_host_test";
+    args[argc++] = "-timeout=0";
+    args[argc++] = "-handle_usr1=0";
+    args[argc++] = "-handle_usr2=0";
+
+    FILE *f = fopen("/proc/self/cmdline", "rb");
+    size_t len = (f != NULL) ? fread(cmdline, 1, sizeof(cmdline) - 1, f) : 0;
+    if (f != NULL) {
+        fclose(f);
+    }
+    cmdline[len] = '\0';
+    char *next = cmdline + strlen(cmdline) + 1; // Skip the program name
+    while (next < cmdline + len && argc < FUZZ_MAX_ARGS - 1) {
+        args[argc++] = next;
+        next += strlen(next) + 1;
+    }
+    args[argc] = NULL;
+
+    char **argv = args;
+    exit(LLVMFuzzerRunDriver(&argc, &argv, LLVMFuzzerTestOneInput));
+}
+
+void app_main(void)
+{
+    // libFuzzer and the sanitizers need far more stack than the main task has
+    xTaskCreate(fuzz_task, "fuzz", FUZZ_TASK_STACK, NULL, 5, NULL);
+}
@@ -5,6 +5,12 @@
 #include "spi_ffs_storage.h"
 #include "rfid_manager.h" // Added for RFID Management
 #include "aws_iot.h"
+#include "aws_iot_commands.h"
+#include "app_ota.h"
+#include "app_boot.h"
+#include "app_metrics.h"
+#include "rfid_reader.h"
+#include "aws_iot_telemetry.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
@@ -12,111 +18,236 @@
 
 static const char *TAG = "MAIN";
 
+#ifndef CONFIG_APP_BOOT_STORAGE_TASK_STACK_SIZE
+#define CONFIG_APP_BOOT_STORAGE_TASK_STACK_SIZE 6144
+#endif
+
+#ifndef CONFIG_APP_BOOT_STORAGE_TASK_PRIORITY
+#define CONFIG_APP_BOOT_STORAGE_TASK_PRIORITY 5
+#endif
+
+// Work items posted to the main task as task notification bits
+#define MAIN_EVENT_HTTP_MONITOR (1u << 0) // Monitor messages queued, incl. the OTA success that arms the reset timer
+#define MAIN_EVENT_RFID_WORK    (1u << 1) // Cached card writes or staged access records are due
+#define MAIN_EVENT_TIME_SYNC    (1u << 2) // An SNTP attempt completed
+
+static TaskHandle_t main_task_handle = NULL;
+
 /**
- * @brief Handler for messages received from AWS IoT
+ * @brief Posts work items to the main loop, safe to call from any task
+ */
+static void main_post_event(uint32_t events)
+{
+    if (main_task_handle != NULL) {
+        xTaskNotify(main_task_handle, events, eSetBits);
+    }
+}
+
+static void main_http_monitor_work_cb(void)
+{
+    main_post_event(MAIN_EVENT_HTTP_MONITOR);
+}
+
+static void main_rfid_work_cb(void)
+{
+    main_post_event(MAIN_EVENT_RFID_WORK);
+}
+
+static void main_time_sync_cb(void)
+{
+    main_post_event(MAIN_EVENT_TIME_SYNC);
+}
+
+/**
+ * @brief Reports reads from the hardware reader, runs on the reader task after the relay was driven
+ */
+static void main_reader_event_cb(uint32_t card_id, bool granted)
+{
+    aws_iot_telemetry_add_card_access(card_id, granted);
+}
+
+static void main_cmd_reboot(const aws_iot_command_t *command, void *arg)
+{
+    // Only this worker waits, MQTT keeps running until the restart
+    ESP_LOGW(TAG, "Reboot command received. Rebooting in 5 seconds...");
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    esp_restart();
+}
+
+static void main_cmd_status(const aws_iot_command_t *command, void *arg)
+{
+    ESP_LOGI(TAG, "Status request received");
+    // You could publish status back to AWS IoT here
+}
+
+static void main_cmd_ota(const aws_iot_command_t *command, void *arg)
+{
+    // {"command": "ota", "url": "https://host/firmware.bin"}
+    const cJSON *url = cJSON_GetObjectItem(command->json, "url");
+    if (!cJSON_IsString(url)) {
+        ESP_LOGW(TAG, "OTA command without url");
+        return;
+    }
+    esp_err_t ota_ret = app_ota_start(url->valuestring);
+    if (ota_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start OTA: %s", esp_err_to_name(ota_ret));
+    }
+}
+
+static void main_cmd_led(const aws_iot_command_t *command, void *arg)
+{
+    ESP_LOGI(TAG, "LED %s command received", (const char *)arg);
+    // Control LED if you have one connected
+}
+
+/**
+ * @brief Messages without a registered command, mostly the echo of our own telemetry
  */
 static void aws_iot_message_handler(const char *topic, int topic_len, const char *data, int data_len)
 {
-    ESP_LOGI(TAG, "Received message from AWS IoT");
-    ESP_LOGI(TAG, "Topic: %.*s", topic_len, topic);
-    ESP_LOGI(TAG, "Data: %.*s", data_len, data);
-    
-    // Create null-terminated strings for easier processing
-    char topic_str[256] = {0};
-    char data_str[1024] = {0};
-    
-    int topic_copy_len = (topic_len < sizeof(topic_str) - 1) ? topic_len : sizeof(topic_str) - 1;
-    int data_copy_len = (data_len < sizeof(data_str) - 1) ? data_len : sizeof(data_str) - 1;
-    
-    strncpy(topic_str, topic, topic_copy_len);
-    strncpy(data_str, data, data_copy_len);
-    
-    // Try to parse as JSON
-    cJSON *json = cJSON_Parse(data_str);
-    if (json != NULL) {
-        // Check for message field
-        cJSON *message = cJSON_GetObjectItem(json, "message");
-        if (cJSON_IsString(message)) {
-            ESP_LOGI(TAG, "Message field: %s", message->valuestring);
-        }
-        
-        // Handle different commands if present
-        cJSON *command = cJSON_GetObjectItem(json, "command");
-        if (cJSON_IsString(command)) {
-            const char *cmd = command->valuestring;
-            ESP_LOGI(TAG, "Command: %s", cmd);
-            
-            // Example command handlers
-            if (strcmp(cmd, "reboot") == 0) {
-                ESP_LOGW(TAG, "Reboot command received. Rebooting in 5 seconds...");
-                vTaskDelay(5000 / portTICK_PERIOD_MS);
-                esp_restart();
-            } else if (strcmp(cmd, "status") == 0) {
-                ESP_LOGI(TAG, "Status request received");
-                // You could publish status back to AWS IoT here
-            } else if (strcmp(cmd, "led_on") == 0) {
-                ESP_LOGI(TAG, "LED ON command received");
-                // Control LED if you have one connected
-            } else if (strcmp(cmd, "led_off") == 0) {
-                ESP_LOGI(TAG, "LED OFF command received");
-                // Control LED if you have one connected
-            } else {
-                ESP_LOGW(TAG, "Unknown command: %s", cmd);
-            }
-        }
-        
-        // You can check for other fields like temperature/humidity
-        // but ignore them since they're from your own published messages
-        cJSON *temperature = cJSON_GetObjectItem(json, "temperature");
-        cJSON *humidity = cJSON_GetObjectItem(json, "humidity");
-        if (temperature || humidity) {
-            ESP_LOGD(TAG, "Ignoring sensor data echo (from our own publish)");
+    ESP_LOGD(TAG, "Ignoring message on %.*s: %.*s", topic_len, topic, data_len, data);
+}
+
+/**
+ * @brief Registers the AWS IoT commands, before time sync can start AWS IoT
+ */
+static void main_register_commands(void)
+{
+    static const struct {
+        const char *name;
+        aws_iot_command_handler_t handler;
+        void *arg;
+    } commands[] = {
+        { "reboot", main_cmd_reboot, NULL },
+        { "status", main_cmd_status, NULL },
+        { "ota", main_cmd_ota, NULL },
+        { "led_on", main_cmd_led, "ON" },
+        { "led_off", main_cmd_led, "OFF" },
+    };
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        esp_err_t err = aws_iot_commands_register(commands[i].name, commands[i].handler, commands[i].arg);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register command %s: %s", commands[i].name, esp_err_to_name(err));
         }
-        
-        cJSON_Delete(json);
+    }
+}
+
+/**
+ * @brief Mounts SPIFFS and loads the card database, then signals APP_BOOT_STORAGE_READY
+ *
+ * The bit is set even if loading failed, the RFID API then reports the error;
+ * waiting longer would not help.
+ */
+static void boot_storage_task(void *arg)
+{
+    int64_t stage = app_boot_stage_begin();
+    spiffs_storage_init();
+    app_boot_stage_end("spiffs", stage);
+
+    // Initialize RFID manager with error checking
+    stage = app_boot_stage_begin();
+    esp_err_t rfid_init_ret = rfid_manager_init();
+    if (rfid_init_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize RFID manager: %s", esp_err_to_name(rfid_init_ret));
     } else {
-        ESP_LOGW(TAG, "Failed to parse message as JSON. Raw message: %s", data_str);
+        ESP_LOGI(TAG, "RFID manager initialized successfully");
+    }
+    app_boot_stage_end("rfid_db", stage);
+
+    app_boot_set_ready(APP_BOOT_STORAGE_READY);
+    if (xTaskGetCurrentTaskHandle() != main_task_handle) {
+        vTaskDelete(NULL); // Not when called inline from app_main()
     }
 }
 
 void app_main(void)
 {
+    // Callbacks first, so work signalled during init is not lost
+    main_task_handle = xTaskGetCurrentTaskHandle();
+    app_local_server_set_work_callback(main_http_monitor_work_cb);
+    rfid_manager_set_work_callback(main_rfid_work_cb);
+    app_time_sync_set_callback(main_time_sync_cb);
+    rfid_reader_set_event_callback(main_reader_event_cb);
+
+    esp_err_t boot_ret = app_boot_init();
+    if (boot_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize boot tracking: %s", esp_err_to_name(boot_ret));
+    }
+    if (app_metrics_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Metrics counters will have no per second rates");
+    }
+
+    // NVS is needed by WiFi, OTA and the AWS IoT settings, so it comes first
+    int64_t stage = app_boot_stage_begin();
     nvs_storage_init();
+    app_boot_stage_end("nvs", stage);
+
+    // SPIFFS and the card database don't depend on the network: load them on
+    // their own task while WiFi associates. Card endpoints wait for
+    // APP_BOOT_STORAGE_READY.
+    if (xTaskCreate(boot_storage_task, "boot_storage", CONFIG_APP_BOOT_STORAGE_TASK_STACK_SIZE,
+                    NULL, CONFIG_APP_BOOT_STORAGE_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create storage task, loading storage inline");
+        boot_storage_task(NULL);
+    }
+
+    // The reader task holds its reads until APP_BOOT_STORAGE_READY
+    esp_err_t reader_ret = rfid_reader_start();
+    if (reader_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start RFID reader: %s", esp_err_to_name(reader_ret));
+    }
+
+    // Register AWS IoT commands and the handler for other messages before
+    // time sync can start AWS IoT
+    main_register_commands();
+    esp_err_t aws_cb_ret = aws_iot_set_message_callback(aws_iot_message_handler);
+    if (aws_cb_ret == ESP_OK) {
+        ESP_LOGI(TAG, "AWS IoT message handler registered successfully");
+    } else {
+        ESP_LOGE(TAG, "Failed to register AWS IoT message handler: %s", esp_err_to_name(aws_cb_ret));
+    }
+
     // Initialize WiFi first (this sets up the network stack)
+    stage = app_boot_stage_begin();
     app_wifi_init();
+    app_boot_stage_end("wifi", stage);
     
     // Now that network is up, start the local server
+    stage = app_boot_stage_begin();
     app_local_server_init();
     app_local_server_start();
+    app_boot_stage_end("http_server", stage);
     
     // Initialize time sync in non-blocking mode (requires network)
     ESP_LOGI(TAG, "Starting time synchronization in background");
+    stage = app_boot_stage_begin();
     app_time_sync_init();
-    
-    // Initialize SPIFFS storage
-    spiffs_storage_init();
-    
-    // Initialize RFID manager with error checking
-    esp_err_t rfid_init_ret = rfid_manager_init();
-    if (rfid_init_ret != ESP_OK) {
-        ESP_LOGE("MAIN", "Failed to initialize RFID manager: %s", esp_err_to_name(rfid_init_ret));
-    } else {
-        ESP_LOGI("MAIN", "RFID manager initialized successfully");
-    }
-    
-    // Register AWS IoT message handler
-    // This will be called when messages are received on subscribed topics
-    esp_err_t aws_cb_ret = aws_iot_set_message_callback(aws_iot_message_handler);
-    if (aws_cb_ret == ESP_OK) {
-        ESP_LOGI(TAG, "AWS IoT message handler registered successfully");
-    } else {
-        ESP_LOGE(TAG, "Failed to register AWS IoT message handler: %s", esp_err_to_name(aws_cb_ret));
+    app_boot_stage_end("time_sync", stage);
+
+    // Resumes an OTA download interrupted by a reset, once the network is up
+    stage = app_boot_stage_begin();
+    esp_err_t ota_init_ret = app_ota_init();
+    if (ota_init_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize OTA client: %s", esp_err_to_name(ota_init_ret));
     }
+    app_boot_stage_end("ota", stage);
+    app_boot_set_ready(APP_BOOT_NETWORK_READY);
     
-    // Main loop
+    // Main loop: sleeps until a component posts work, the idle task can use
+    // tickless idle / light sleep in between when power management is enabled
+    uint32_t events = MAIN_EVENT_HTTP_MONITOR | MAIN_EVENT_RFID_WORK; // Whatever became due during init
     while (1) {
-        app_local_server_process();
-        rfid_manager_process();
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        if (events & MAIN_EVENT_TIME_SYNC) {
+            app_local_server_post_msg(HTTP_MSG_TIME_SERVICE_INITIALIZED);
+        }
+        if (events & (MAIN_EVENT_HTTP_MONITOR | MAIN_EVENT_TIME_SYNC)) {
+            app_local_server_process();
+        }
+        if (events & MAIN_EVENT_RFID_WORK) {
+            rfid_manager_process();
+        }
+
+        events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
     }
 }